@@ -11,11 +11,13 @@
 /* ------ Value-based config variables -------- */
 
 #define USER_STACK_PAGES       @USER_STACK_PAGES@
+#define ZERO_PAGE_POOL_SIZE    @ZERO_PAGE_POOL_SIZE@
 
 /* --------- Boolean config variables --------- */
 
 #cmakedefine01 FORK_NO_COW
 #cmakedefine01 MMAP_NO_COW
+#cmakedefine01 MMAP_BIG_PAGES
 
 
 /*
@@ -35,12 +37,13 @@
 
 
 #define USER_VDSO_VADDR  (LINEAR_MAPPING_END)
+#define USER_VVAR_VADDR  (USER_VDSO_VADDR + 4096)  /* right after the vDSO */
 
 #define USERMODE_VADDR_END   (KERNEL_BASE_VA) /* biggest user vaddr + 1 */
 #define MAX_BRK                  (0x40000000) /* +1 GB (virtual memory) */
 #define USER_MMAP_BEGIN               MAX_BRK /* +1 GB (virtual memory) */
-#define USER_MMAP_MIN_SZ            (16 * MB)
 #define USER_MMAP_MAX_SZ          (1024 * MB)
+#define USER_MMAP_END   (USER_MMAP_BEGIN + USER_MMAP_MAX_SZ)
 #define USERMODE_STACK_ALIGN              16u
 
 #define USERMODE_STACK_MAX \
@@ -12,6 +12,9 @@
 
 /* --------- Boolean config variables --------- */
 #cmakedefine01 KRN_RESCHED_ENABLE_PREEMPT
+#cmakedefine01 KRN_NO_HZ_IDLE
+#cmakedefine01 KRN_HRTIMERS
+#cmakedefine01 KRN_SMP
 
 /*
  * --------------------------------------------------------------------------
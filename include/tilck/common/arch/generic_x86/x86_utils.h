@@ -184,6 +184,16 @@ static ALWAYS_INLINE void halt(void)
    asmVolatile("hlt");
 }
 
+/*
+ * Enable the interrupts and halt the CPU. Because `sti` takes effect only after
+ * the next instruction, no IRQ can be served between the two: that allows to
+ * check for pending work with interrupts disabled and then to halt safely.
+ */
+static ALWAYS_INLINE void enable_interrupts_and_halt(void)
+{
+   asmVolatile("sti\n\thlt");
+}
+
 static ALWAYS_INLINE void wrmsr(u32 msr_id, u64 msr_value)
 {
    asmVolatile( "wrmsr" : : "c" (msr_id), "A" (msr_value) );
@@ -53,6 +53,18 @@ round_down_at64(u64 n, u64 unit)
    return (n / unit) * unit;
 }
 
+/*
+ * Compute (val * mult) >> shift, with 0 < shift <= 32, without overflowing
+ * for big values of `val`. Used for fixed-point conversions.
+ */
+CONSTEXPR static ALWAYS_INLINE u64
+mul_u64_u32_shr(u64 val, u32 mult, u32 shift)
+{
+   const u64 hi = (val >> 32) * mult;
+   const u64 lo = (val & 0xffffffff) * mult;
+   return (hi << (32 - shift)) + (lo >> shift);
+}
+
 CONSTEXPR static ALWAYS_INLINE ulong
 make_bitmask(ulong width)
 {
@@ -77,14 +89,8 @@ get_first_zero_bit_index32(u32 num)
 CONSTEXPR static inline u32
 get_first_set_bit_index32(u32 num)
 {
-   u32 i;
    ASSERT(num != 0);
-
-   for (i = 0; i < 32; i++)
-      if (num & (1U << i))
-         break;
-
-   return i;
+   return (u32)__builtin_ctz(num);
 }
 
 CONSTEXPR static inline u32
@@ -104,14 +110,8 @@ get_first_zero_bit_index64(u64 num)
 CONSTEXPR static inline u32
 get_first_set_bit_index64(u64 num)
 {
-   u32 i;
    ASSERT(num != 0);
-
-   for (i = 0; i < 64; i++)
-      if (num & (1ull << i))
-         break;
-
-   return i;
+   return (u32)__builtin_ctzll(num);
 }
 
 CONSTEXPR static inline u32
@@ -130,12 +130,13 @@ get_first_zero_bit_index_l(ulong num)
 CONSTEXPR static inline u32
 get_first_set_bit_index_l(ulong num)
 {
-   u32 i;
    ASSERT(num != 0);
+   return (u32)__builtin_ctzl(num);
+}
 
-   for (i = 0; i < NBITS; i++)
-      if (num & (1UL << i))
-         break;
-
-   return i;
+CONSTEXPR static inline u32
+get_last_set_bit_index32(u32 num)
+{
+   ASSERT(num != 0);
+   return 31u - (u32)__builtin_clz(num);
 }
@@ -28,6 +28,7 @@ STATIC_ASSERT(X86_KERNEL_CODE_SEL == X86_SELECTOR(1, TABLE_GDT, 0));
 STATIC_ASSERT(X86_KERNEL_DATA_SEL == X86_SELECTOR(2, TABLE_GDT, 0));
 STATIC_ASSERT(X86_USER_CODE_SEL == X86_SELECTOR(3, TABLE_GDT, 3));
 STATIC_ASSERT(X86_USER_DATA_SEL == X86_SELECTOR(4, TABLE_GDT, 3));
+STATIC_ASSERT(X86_KERNEL_PERCPU_SEL == X86_SELECTOR(6, TABLE_GDT, 0));
 
 struct x86_arch_proc_members {
    void *ldt;
@@ -38,10 +39,14 @@ struct x86_arch_proc_members {
 
 struct x86_arch_task_members {
    u16 fpu_regs_size;
+   u16 tls_gdt_index; /* GDT entry of the thread's TLS segment, if > 0 */
    void *aligned_fpu_regs;
+   u32 tls_desc[2];   /* The TLS segment's descriptor (struct gdt_entry) */
 };
 
 NORETURN void context_switch(regs_t *r);
+NORETURN void context_switch_unlock_bkl(regs_t *r); /* KRN_SMP only */
+void setup_sysenter_interface(void);
 
 static ALWAYS_INLINE int regs_intnum(regs_t *r)
 {
@@ -53,6 +58,11 @@ static ALWAYS_INLINE void set_return_register(regs_t *r, ulong value)
    r->eax = value;
 }
 
+static ALWAYS_INLINE void set_user_stack_ptr(regs_t *r, ulong value)
+{
+   r->useresp = value;
+}
+
 static ALWAYS_INLINE ulong get_rem_stack(void)
 {
    return (get_stack_ptr() & ((ulong)KERNEL_STACK_SIZE - 1));
@@ -2,6 +2,7 @@
 
 #pragma once
 #include <tilck_gen_headers/config_global.h>
+#include <tilck_gen_headers/config_sched.h>
 #include <tilck/common/arch/generic_x86/asm_consts.h>
 
 #if KERNEL_STACK_PAGES == 1
@@ -17,6 +18,16 @@
 #define TI_F_RESUME_RS_OFF     20 /* offset of: fault_resume_regs */
 #define TI_FAULTS_MASK_OFF     24 /* offset of: faults_resume_mask */
 
+#define CPU_CURRENT_OFF         4 /* offset of: cpu.current */
+#define CPU_PREEMPT_OFF         8 /* offset of: cpu.disable_preempt */
+
+#define VVAR_SEQ_OFF            0 /* offset of: vdso_data.seq */
+#define VVAR_TICK_MULT_OFF      4 /* offset of: vdso_data.tick_mult */
+#define VVAR_TIME_NS_OFF        8 /* offset of: vdso_data.time_ns */
+#define VVAR_TICK_CYCLES_OFF   16 /* offset of: vdso_data.tick_cycles */
+#define VVAR_TICK_NS_OFF       24 /* offset of: vdso_data.tick_ns */
+#define VVAR_BOOT_TS_OFF       28 /* offset of: vdso_data.boot_ts */
+
 #define SIZEOF_REGS            84
 #define REGS_EIP_OFF           64
 #define REGS_USERESP_OFF       76
@@ -28,6 +39,17 @@
 #define X86_KERNEL_DATA_SEL  0x10
 #define X86_USER_CODE_SEL    0x1b
 #define X86_USER_DATA_SEL    0x23
+#define X86_KERNEL_PERCPU_SEL 0x30 /* KRN_SMP only: see struct cpu */
+
+/* The kernel's FS: with KRN_SMP, it points to the per-CPU data */
+#if KRN_SMP
+   #define X86_KERNEL_FS_SEL  X86_KERNEL_PERCPU_SEL
+#else
+   #define X86_KERNEL_FS_SEL  X86_KERNEL_DATA_SEL
+#endif
+
+/* Where the APs start executing in real mode (see smp.c): must be < 64 KB */
+#define AP_TRAMPOLINE_PADDR  0x8000
 
 /* Some useful asm macros */
 #ifdef ASM_FILE
@@ -41,6 +63,12 @@
 #define EBP_OFFSET_ARG2 12
 #define EBP_OFFSET_ARG3 16
 
+#if KRN_SMP
+   #define CURR_TASK_REF  dword ptr fs:[CPU_CURRENT_OFF]
+#else
+   #define CURR_TASK_REF  [__current]
+#endif
+
 .macro asm_disable_cr0_ts
    mov eax, CR0
    and eax, ~8
@@ -102,8 +130,9 @@
    mov ax, X86_KERNEL_DATA_SEL
    mov ds, ax
    mov es, ax
-   mov fs, ax
    mov gs, ax
+   mov ax, X86_KERNEL_FS_SEL
+   mov fs, ax
 
 .endm
 
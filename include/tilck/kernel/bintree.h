@@ -34,6 +34,16 @@ struct bintree_walk_ctx {
 #undef STACK_VAR
 #undef STACK_SIZE_VAR
 
+/*
+ * Augmented trees: `aug(obj)` is called every time the children of `obj`
+ * might have changed, bottom-up, during insert, remove and the rotations.
+ * That allows each object to keep data about its whole subtree (e.g. the max
+ * value of a field in the subtree), computed only from its own fields and the
+ * ones of its children. The callback has to be passed to all the insert and
+ * remove calls for a given tree.
+ */
+typedef void (*bintree_aug_cb)(void *obj);
+
 /*
  * bintree_find_internal() returns true it was actually able to insert the
  * object and false it case an object with the same 'value' (cmp(a,b) == 0) was
@@ -74,6 +84,21 @@ bintree_remove_internal(void **root_obj_ref,
                         cmpfun_ptr objval_cmpfun, //cmp(*root_obj_ref,value_ptr)
                         long bintree_offset);
 
+/* Versions of insert and remove for augmented trees (see bintree_aug_cb) */
+bool
+bintree_insert_aug_internal(void **root_obj_ref,
+                            void *obj,
+                            cmpfun_ptr cmp,
+                            long bintree_offset,
+                            bintree_aug_cb aug);
+
+void *
+bintree_remove_aug_internal(void **root_obj_ref,
+                            void *value_ptr,
+                            cmpfun_ptr objval_cmpfun,
+                            long bintree_offset,
+                            bintree_aug_cb aug);
+
 
 typedef int (*bintree_visit_cb) (void *obj, void *arg);
 
@@ -156,6 +181,15 @@ bintree_remove_ptr_internal(void **root_obj_ref,
                            (value), (objval_cmpfun),                          \
                            OFFSET_OF(struct_type, elem_name))
 
+#define bintree_insert_aug(rootref, obj, cmpfun, aug, struct_type, elem_name)  \
+   bintree_insert_aug_internal((void **)(rootref), (void*)obj, cmpfun,        \
+                               OFFSET_OF(struct_type, elem_name), (aug))
+
+#define bintree_remove_aug(rootref, value, cmpfun, aug, struct_type, elem_name)\
+   bintree_remove_aug_internal((void**)(rootref),                             \
+                               (value), (cmpfun),                             \
+                               OFFSET_OF(struct_type, elem_name), (aug))
+
 #define bintree_remove_ptr(rootref, value, struct_type, elem_name, field_name) \
    bintree_remove_ptr_internal((void**)(rootref),                              \
                            (value),                                            \
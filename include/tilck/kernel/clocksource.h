@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck/common/basic_defs.h>
+
+/*
+ * Clock sources
+ * ---------------
+ *
+ * The system time (__time_ns) advances by one tick duration on every timer
+ * IRQ. When a free-running counter is available (e.g. the TSC), get_sys_time()
+ * interpolates between the ticks by reading it. Its frequency is measured at
+ * boot, against the timer IRQ, the same way the bogoMips are. Until then, or
+ * when no such counter exists, the "jiffies" clock source is used: the system
+ * time has just the resolution of a tick.
+ */
+
+struct clocksource {
+
+   const char *name;
+   u64 (*read)(void);      /* NULL means: no interpolation between ticks */
+   u64 freq;               /* Hz, measured at boot */
+   bool vdso;              /* the vDSO can read it too (see vdso.h) */
+};
+
+const struct clocksource *get_clocksource(void);
+void clocksource_select(struct clocksource *cs, u64 cycles, u32 ticks);
+void clocksource_tick(void);
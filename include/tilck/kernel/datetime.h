@@ -39,6 +39,7 @@ u64 timespec_to_ticks(const struct k_timespec64 *tp);
 void real_time_get_timespec(struct k_timespec64 *tp);
 void monotonic_time_get_timespec(struct k_timespec64 *tp);
 void clock_get_resync_stats(struct clock_resync_stats *s);
+int do_clock_gettime(clockid_t clk_id, struct k_timespec64 *tp);
 
 static ALWAYS_INLINE struct k_timespec32
 to_k_timespec32(struct k_timespec64 tp)
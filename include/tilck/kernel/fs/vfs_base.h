@@ -116,6 +116,16 @@ struct fs_handle_base {
 #define VFS_SPFL_NO_USER_COPY                  (1 << 0)
 #define VFS_SPFL_MMAP_SUPPORTED                (1 << 1)
 #define VFS_SPFL_NO_LF                         (1 << 2)
+#define VFS_SPFL_USER_BUF                      (1 << 3)
+
+/*
+ * With VFS_SPFL_NO_USER_COPY, the read/write file_ops always get user buffers
+ * and take care of them by themselves. With VFS_SPFL_USER_BUF instead, they
+ * get either user or kernel buffers and access them only through the
+ * vfs_copy_to_buf() and vfs_copy_from_buf() helpers: that allows the syscalls
+ * to pass them the user buffer, without bouncing the data through the task's
+ * `io_copybuf` and without limiting each call to IO_COPYBUF_SIZE bytes.
+ */
 
 /*
  * vfs_mmap()'s flags
@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck/common/basic_defs.h>
+
+#ifndef FUTEX_WAIT
+   #define FUTEX_WAIT                   0
+   #define FUTEX_WAKE                   1
+   #define FUTEX_REQUEUE                3
+   #define FUTEX_CMP_REQUEUE            4
+   #define FUTEX_WAIT_BITSET            9
+   #define FUTEX_WAKE_BITSET           10
+   #define FUTEX_PRIVATE_FLAG         128
+   #define FUTEX_CLOCK_REALTIME       256
+   #define FUTEX_BITSET_MATCH_ANY     0xffffffff
+#endif
+
+#define FUTEX_CMD_MASK     (~(FUTEX_PRIVATE_FLAG | FUTEX_CLOCK_REALTIME))
+
+void init_futexes(void);
+int futex_wake(u32 *uaddr, int count);
@@ -45,6 +45,7 @@ STATIC_ASSERT(ARCH_PROC_MEMBERS_ALIGN == alignof(arch_proc_members_t));
 NORETURN void reboot(void);
 NORETURN void poweroff(void);
 void init_segmentation(void);
+void init_segmentation_early(void); /* KRN_SMP only */
 void init_cpu_exception_handling(void);
 void init_syscall_interfaces(void);
 void set_kernel_stack(ulong stack);
@@ -59,6 +60,13 @@ int get_int_num(regs_t *context);
 void on_first_pdir_update(void);
 void hw_read_clock(struct datetime *out);
 u32 hw_timer_setup(u32 hz);
+u32 hw_timer_oneshot_max_ticks(void);
+u32 hw_timer_setup_oneshot(u32 ticks);
+bool hw_timer_oneshot_rearm(u32 *ticks);
+struct clocksource *hw_get_clocksource(void);
+bool hw_hrtimer_init(void);
+u64 hw_hrtimer_now(void);
+void hw_hrtimer_program(u64 expire);
 
 bool allocate_fpu_regs(arch_task_members_t *arch_fields);
 void copy_main_tss_on_regs(regs_t *ctx);
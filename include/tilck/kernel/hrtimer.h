@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck_gen_headers/config_sched.h>
+#include <tilck/common/basic_defs.h>
+#include <tilck/kernel/bintree.h>
+
+/*
+ * High-resolution timers
+ * ------------------------
+ *
+ * One-shot timers with nanosecond expiration time, backed by a per-CPU
+ * hardware timer (on x86, the local APIC timer, in TSC-deadline mode when
+ * available) programmed to fire exactly on the first expiring timer. Armed
+ * timers are kept in a tree sorted by expiration time. The callbacks are run
+ * in IRQ context, with interrupts disabled: they must be short and they must
+ * not sleep.
+ *
+ * When the hardware doesn't support them (or KRN_HRTIMERS is disabled),
+ * hrtimers_available() returns false and the users are expected to fall back
+ * to the regular (tick-based) timers.
+ */
+
+struct hrtimer;
+typedef void (*hrtimer_func)(struct hrtimer *);
+
+struct hrtimer {
+
+   struct bintree_node node;
+   u64 expire;                   /* absolute time, in ns (see hrtimer_now) */
+   hrtimer_func func;
+   bool armed;
+};
+
+void init_hrtimers(void);
+bool hrtimers_available(void);
+u64 hrtimer_now(void);           /* ns since the hrtimers have been started */
+
+void hrtimer_init(struct hrtimer *t, hrtimer_func func);
+void hrtimer_start(struct hrtimer *t, u64 delay_ns);
+u64 hrtimer_cancel(struct hrtimer *t);
+void hrtimer_irq_handler(void);
+
+static ALWAYS_INLINE bool hrtimer_is_armed(struct hrtimer *t)
+{
+   return t->armed;
+}
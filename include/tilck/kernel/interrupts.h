@@ -6,13 +6,18 @@
 #include <tilck/common/atomics.h>
 #include <tilck/kernel/list.h>
 #include <tilck/kernel/hal_types.h>
+#include <tilck/kernel/smp.h>
 
 void set_fault_handler(int fault, void *ptr);
 
 static ALWAYS_INLINE bool in_irq(void)
 {
+#if SMP_ENABLED
+   return this_cpu_read(in_irq_count) > 0;
+#else
    extern ATOMIC(int) __in_irq_count;
    return atomic_load_explicit(&__in_irq_count, mo_relaxed) > 0;
+#endif
 }
 
 #if KRN_TRACK_NESTED_INTERR
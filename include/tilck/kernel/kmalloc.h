@@ -6,6 +6,7 @@
 
 #define KMALLOC_METADATA_BLOCK_NODE_SIZE      1
 #define KMALLOC_HEAPS_COUNT                  32
+#define KMALLOC_MAX_HEAP_LEVELS              32
 
 #define SMALL_HEAP_MBS                       32
 #define SMALL_HEAP_SIZE               (32 * KB)
@@ -27,11 +28,19 @@
 typedef bool (*virtual_alloc_and_map_func)(ulong vaddr, size_t page_count);
 typedef void (*virtual_free_and_unmap_func)(ulong vaddr, size_t page_count);
 
-#define calculate_heap_metadata_size(heap_size, min_block_size) \
+/*
+ * A heap's metadata is made by its tree of block nodes (one byte per node)
+ * followed by the bitmap of its free nodes (one bit per node, see kmalloc.c).
+ */
+#define calculate_heap_nodes_size(heap_size, min_block_size) \
    (2 * (heap_size) / (min_block_size))
 
-#define calculate_heap_min_block_size(heap_size, metadata_size) \
-   (2 * (heap_size) / (metadata_size))
+#define calculate_heap_free_bm_size(heap_size, min_block_size) \
+   UNSAFE_MAX(calculate_heap_nodes_size(heap_size, min_block_size) / 8, 4)
+
+#define calculate_heap_metadata_size(heap_size, min_block_size)        \
+   (calculate_heap_nodes_size(heap_size, min_block_size) +             \
+    calculate_heap_free_bm_size(heap_size, min_block_size))
 
 struct kmalloc_heap;
 
@@ -0,0 +1,105 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck/common/basic_defs.h>
+#include <tilck/kernel/list.h>
+
+/*
+ * Object caches (slab allocator) for fixed-size kernel objects.
+ *
+ * Each cache hands out objects of the same size from "slabs": power-of-2
+ * sized and aligned blocks of memory (at least one page) obtained from
+ * kmalloc, containing a small header followed by the objects themselves.
+ * The free objects of a slab are linked in a free list, making both
+ * kmem_cache_alloc() and kmem_cache_free() O(1) operations.
+ *
+ * When a constructor is specified, it's called only once per object, when
+ * its slab is created: objects are expected to be freed in their constructed
+ * state, exactly as in the original slab allocator design.
+ */
+
+typedef void (*kmem_cache_ctor)(void *obj);
+
+struct kmem_cache {
+
+   struct list_node node;     /* node in the global list of caches */
+   const char *name;
+
+   size_t size;               /* object size, as requested by the user */
+   size_t align;              /* object alignment, as requested by the user */
+   kmem_cache_ctor ctor;      /* optional */
+   bool dynamic;              /* allocated by kmem_cache_create() */
+
+   /* Pre-calculated values */
+   size_t obj_size;           /* actual size of each object in a slab */
+   size_t slab_size;          /* power of 2, at least PAGE_SIZE */
+   size_t objs_offset;        /* offset of the first object in a slab */
+   size_t objs_per_slab;
+   size_t free_link_off;      /* offset of the free-list link in a object */
+
+   struct list partial_slabs; /* slabs having both used and free objects */
+   struct list full_slabs;    /* slabs without any free objects */
+   struct kmem_slab *empty;   /* at most one completely free slab is kept */
+
+   /* Stats */
+   ulong hits;                /* allocations served by an existing slab */
+   ulong misses;              /* allocations that required a new slab */
+   ulong slabs;               /* slabs currently owned by the cache */
+   ulong objs_in_use;
+};
+
+struct kmem_slab {
+
+   struct list_node node;     /* node in cache's partial or full list */
+   struct kmem_cache *cache;
+   void *free_list;
+   size_t in_use;
+};
+
+void
+kmem_cache_init(struct kmem_cache *c,
+                const char *name,
+                size_t size,
+                size_t align,
+                kmem_cache_ctor ctor);
+
+struct kmem_cache *
+kmem_cache_create(const char *name,
+                  size_t size,
+                  size_t align,
+                  kmem_cache_ctor ctor);
+
+void
+kmem_cache_destroy(struct kmem_cache *c);
+
+void *
+kmem_cache_alloc(struct kmem_cache *c);
+
+void *
+kmem_cache_zalloc(struct kmem_cache *c);
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj);
+
+int
+iterate_over_kmem_caches(int (*func)(struct kmem_cache *, void *), void *arg);
+
+void
+init_kmem_caches(void);
+
+/*
+ * Define a statically-allocated object cache, registered at startup. It can
+ * be used as soon as kmalloc has been initialized.
+ */
+#define DEF_KMEM_CACHE(var, _name, _size, _align, _ctor)                  \
+                                                                          \
+   static struct kmem_cache var;                                          \
+                                                                          \
+   __attribute__((constructor))                                           \
+   static void __init_kmem_cache_##var(void)                              \
+   {                                                                      \
+      kmem_cache_init(&var, _name, _size, _align, _ctor);                 \
+   }
+
+#define DEF_KMEM_CACHE_FOR_TYPE(var, _name, type)                         \
+   DEF_KMEM_CACHE(var, _name, sizeof(type), alignof(type), NULL)
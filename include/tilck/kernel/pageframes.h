@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck/common/basic_defs.h>
+
+/*
+ * Page-frame allocator, used for user pages and page tables.
+ *
+ * Pageframes are handed out one at a time, in O(1), from a free list. The
+ * allocator gets its memory from kmalloc in naturally-aligned chunks of
+ * PF_CHUNK_SIZE bytes and returns them back once they become completely free
+ * (keeping a few free pages around). That way, kmalloc's heaps see only a few
+ * big allocations instead of lots of 4 KB ones.
+ *
+ * The returned pointers are kernel virtual addresses in the linear mapping,
+ * exactly like kmalloc's ones: use KERNEL_VA_TO_PA() to get the pageframe.
+ *
+ * pf_zalloc() takes its pages from a small pool of pre-zeroed pages, filled
+ * by the idle task through pf_zpool_refill(), before falling back to zeroing
+ * the page synchronously. See ZERO_PAGE_POOL_SIZE.
+ *
+ * pf_alloc_big() returns physically contiguous memory, aligned at its size,
+ * for big pages. Its pages are regular used pages and they're freed one by
+ * one with pf_free(), which allows big pages to be split.
+ *
+ * When kmalloc has no more memory to give, pf_alloc() calls the reclaim
+ * callback (if any), which can free pages that are not strictly needed (e.g.
+ * the ones released by user space with MADV_FREE), before failing.
+ */
+
+#define PF_CHUNK_SIZE                              (64 * KB)
+
+struct pf_stats {
+
+   ulong chunks;              /* chunks currently owned by the allocator */
+   ulong free_pages;
+   ulong used_pages;
+
+   /* Pre-zeroed pages pool */
+   ulong zpool_pages;         /* pages currently in the pool */
+   ulong zpool_hits;          /* pf_zalloc() calls served by the pool */
+   ulong zpool_misses;        /* pf_zalloc() calls that had to zero a page */
+   ulong zpool_refills;       /* pages zeroed and added to the pool */
+   u64 zpool_refill_cycles;   /* total cycles spent by pf_zpool_refill() */
+
+   ulong reclaimed_pages;     /* pages freed by the reclaim callback */
+};
+
+/* Returns the number of pages freed. It must not allocate memory. */
+typedef size_t (*pf_reclaim_cb)(void);
+
+void init_pageframes(void);
+
+void *pf_alloc(void);
+void *pf_zalloc(void);
+void *pf_alloc_big(size_t size);
+void pf_free(void *va);
+void pf_get_stats(struct pf_stats *stats);
+const struct pf_stats *pf_get_live_stats(void);
+void pf_set_reclaim_cb(pf_reclaim_cb cb);
+void pf_zpool_refill(void);
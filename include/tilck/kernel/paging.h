@@ -8,6 +8,9 @@
 
 #ifdef __i386__
    #define PAGE_DIR_SIZE (PAGE_SIZE)
+   #define BIG_PAGE_SIZE (4 * MB)
+#else
+   #define BIG_PAGE_SIZE (2 * MB)
 #endif
 
 #define OFFSET_IN_PAGE_MASK                        (PAGE_SIZE - 1)
@@ -77,6 +80,66 @@ map_zero_pages(pdir_t *pdir,
                size_t page_count,
                u32 pg_flags);
 
+/*
+ * Map the BIG_PAGE_SIZE-aligned pageframes at `paddr` as a single big page at
+ * the user address `vaddr`. Any 4 KB mappings in that range are replaced and
+ * their pageframes released. User big pages are split back to 4 KB pages when
+ * they get partially unmapped or on copy-on-write.
+ */
+NODISCARD int
+map_big_page(pdir_t *pdir, void *vaddr, ulong paddr, u32 pg_flags);
+
+/*
+ * Check if the whole user big page range at `vaddr` (aligned) is mapped, in a
+ * private page table, copy-on-write to the zero page.
+ */
+bool is_zero_big_page_range(pdir_t *pdir, void *vaddr);
+
+/* Number of big pages mapped in the user part of `pdir` */
+size_t get_user_big_pages_count(pdir_t *pdir);
+
+/*
+ * Batch of TLB invalidations, used by the range unmap functions. The ranges
+ * are collected with tlb_batch_add() and invalidated by tlb_batch_flush(),
+ * page by page with `invlpg` or, when they contain more than
+ * TLB_BATCH_MAX_INVLPG pages, by flushing the whole TLB, which is cheaper.
+ *
+ * The TLB entries are invalidated on all the CPUs using `pdir` (all the CPUs,
+ * if `pdir` is NULL or the batch contains kernel pages): with SMP, that's done
+ * with an IPI to the other CPUs (TLB shootdown).
+ *
+ * The pageframes unmapped in the ranges are not freed immediately: other CPUs
+ * might still access them through their stale TLB entries. They're added to
+ * the batch with tlb_batch_free_frame(), after their range, and freed by
+ * tlb_batch_flush() after the invalidation, like Linux's mmu_gather does.
+ */
+
+#define TLB_BATCH_MAX_RANGES                                  8
+#define TLB_BATCH_MAX_INVLPG                                 32
+#define TLB_BATCH_MAX_FRAMES                                 32
+
+struct tlb_range {
+   ulong vaddr;
+   size_t page_count;
+};
+
+struct tlb_batch {
+   pdir_t *pdir;              /* the page directory of the ranges */
+   size_t page_count;         /* total pages in the ranges */
+   u32 ranges_count;
+   bool full_flush;           /* too many pages or ranges: flush everything */
+   bool global;               /* there are kernel (global) pages */
+   struct tlb_range ranges[TLB_BATCH_MAX_RANGES];
+   u32 frames_count;
+   void *frames[TLB_BATCH_MAX_FRAMES];    /* to free after the invalidation */
+};
+
+void tlb_batch_init(struct tlb_batch *b, pdir_t *pdir);
+void tlb_batch_add(struct tlb_batch *b, ulong vaddr, size_t page_count);
+void tlb_batch_free_frame(struct tlb_batch *b, void *frame);
+void tlb_batch_flush(struct tlb_batch *b);
+void tlb_invalidate(pdir_t *pdir, ulong vaddr, size_t page_count);
+
 void init_paging(void);
 bool is_mapped(pdir_t *pdir, void *vaddr);
 bool is_rw_mapped(pdir_t *pdir, void *vaddrp);
@@ -84,6 +147,11 @@ void unmap_page(pdir_t *pdir, void *vaddr, bool do_free);
 int unmap_page_permissive(pdir_t *pdir, void *vaddrp, bool do_free);
 void unmap_pages(pdir_t *pdir, void *vaddr, size_t count, bool do_free);
 size_t unmap_pages_permissive(pdir_t *pd, void *va, size_t count, bool do_free);
+int prepare_to_unmap_user_pages(pdir_t *pdir, void *vaddr, size_t count);
+size_t move_pages(pdir_t *pdir, void *src, void *dst, size_t page_count);
+int discard_user_pages(pdir_t *pdir, void *vaddr, size_t page_count);
+void lazy_free_user_pages(pdir_t *pdir, void *vaddr, size_t page_count);
+size_t reclaim_lazy_free_pages(pdir_t *pdir, void *vaddr, size_t page_count);
 ulong get_mapping(pdir_t *pdir, void *vaddr);
 int get_mapping2(pdir_t *pdir, void *vaddrp, ulong *pa_ref);
 pdir_t *pdir_clone(pdir_t *pdir);
@@ -3,10 +3,24 @@
 #pragma once
 #include <tilck/common/basic_defs.h>
 #include <tilck/kernel/hal.h>
+#include <tilck/kernel/smp.h>
 
 static ALWAYS_INLINE void set_curr_pdir(pdir_t *pdir)
 {
+#if SMP_ENABLED
+
+   /* Track the pdir in use by each CPU, for the TLB shootdown */
+   ulong var;
+   disable_interrupts(&var);
+   {
+      atomic_store_explicit(&get_this_cpu()->pdir, pdir, mo_relaxed);
+      __set_curr_pdir(KERNEL_VA_TO_PA(pdir));
+   }
+   enable_interrupts(&var);
+
+#else
    __set_curr_pdir(KERNEL_VA_TO_PA(pdir));
+#endif
 }
 
 static ALWAYS_INLINE pdir_t *get_curr_pdir()
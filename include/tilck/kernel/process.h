@@ -28,11 +28,35 @@ struct kernel_alloc {
 
 struct mappings_info {
 
-   struct kmalloc_heap *mmap_heap;
-   size_t mmap_heap_size;
-   struct list mappings;
+   struct user_mapping *mappings;    /* root of the tree of user mappings */
 };
 
+/* A process group or a session: see pgroups.c */
+struct pgroup {
+
+   struct bintree_node node;
+   long id;                          /* pgid or sid (key: long-sized) */
+   int sid;                          /* process groups only: their session */
+   struct list members;              /* struct process objects */
+};
+
+/* clone() flags: the same values as Linux */
+#ifndef CLONE_VM
+   #define CSIGNAL                       0x000000ff
+   #define CLONE_VM                      0x00000100
+   #define CLONE_FS                      0x00000200
+   #define CLONE_FILES                   0x00000400
+   #define CLONE_SIGHAND                 0x00000800
+   #define CLONE_VFORK                   0x00004000
+   #define CLONE_THREAD                  0x00010000
+   #define CLONE_SYSVSEM                 0x00040000
+   #define CLONE_SETTLS                  0x00080000
+   #define CLONE_PARENT_SETTID           0x00100000
+   #define CLONE_CHILD_CLEARTID          0x00200000
+   #define CLONE_DETACHED                0x00400000
+   #define CLONE_CHILD_SETTID            0x01000000
+#endif
+
 struct process {
 
    REF_COUNTED_OBJECT;
@@ -48,15 +72,22 @@ struct process {
    struct mappings_info *mi;
 
    struct list children;
+   struct list threads;                   /* the live threads (tasks) */
+
+   struct pgroup *pgrp;                   /* NULL for the kernel process */
+   struct pgroup *session;                /* NULL for the kernel process */
+   struct list_node pgrp_node;            /* node in pgrp->members */
+   struct list_node session_node;         /* node in session->members */
 
    void *proc_tty;
    bool did_call_execve;
    bool automatic_reaping;       /* the parent explicitly ignored SIGCHLD */
    bool vforked;                 /* after vfork(), before execve() */
-   bool inherited_mmap_heap;
+   bool inherited_mappings_info;
    bool did_set_tty_medium_raw;
+   bool exiting;                 /* all the threads are being killed */
 
-   int *set_child_tid;                    /* NOTE: this is an user pointer */
+   s32 exit_status;              /* wstatus of exit_group() or fatal signal */
 
    struct kmutex fslock;                  /* protects `handles` and `cwd` */
    mode_t umask;
@@ -117,7 +148,22 @@ task_is_parent(struct task *parent, struct task *child)
    return child->pi->parent_pid == parent->pi->pid;
 }
 
-int do_fork(bool vfork);
+/* True if `ti` is the only live thread of its process */
+static ALWAYS_INLINE bool
+is_only_live_thread(struct task *ti)
+{
+   struct list *threads = &ti->pi->threads;
+
+   return threads->first == &ti->thread_node &&
+          threads->last == &ti->thread_node;
+}
+
+int do_fork(bool vfork, void *newsp);
+int do_clone_thread(ulong flags,
+                    void *newsp,
+                    int *parent_tid,
+                    void *tls,
+                    int *child_tid);
 void handle_vforked_child_move_on(struct process *pi);
 int first_execve(const char *abs_path, const char *const *argv);
 
@@ -142,12 +188,19 @@ bool arch_specific_new_task_setup(struct task *ti, struct task *parent);
 void arch_specific_free_task(struct task *ti);
 void arch_specific_new_proc_setup(struct process *pi, struct process *parent);
 void arch_specific_free_proc(struct process *pi);
+int arch_specific_clone_settls(struct task *ti, void *tls);
 void wake_up_tasks_waiting_on(struct task *ti, enum wakeup_reason r);
 void init_process_lists(struct process *pi);
+int process_set_groups(struct process *pi, int pgid, int sid);
+void process_join_groups_of(struct process *pi, struct process *other);
+void process_leave_groups(struct process *pi);
+int iterate_over_group(int pgid, bintree_visit_cb func, void *arg);
 
 void process_set_cwd2_nolock(struct vfs_path *tp);
 void process_set_cwd2_nolock_raw(struct process *pi, struct vfs_path *tp);
 void terminate_process(int exit_code, int term_sig);
+void terminate_thread(int exit_code, int term_sig);
+int terminate_other_threads(void);
 void close_cloexec_handles(struct process *pi);
 int setup_sig_handler(struct task *ti,
                       enum sig_state sig_state,
@@ -13,12 +13,15 @@ void process_free_mappings_info(struct process *pi);
 
 static ALWAYS_INLINE void set_curr_task(struct task *ti)
 {
-   extern struct task *__current;
-
 #ifndef UNIT_TEST_ENVIRONMENT
    DEBUG_ONLY(check_not_in_irq_handler());
    ASSERT(!are_interrupts_enabled());
 #endif
 
+#if SMP_ENABLED
+   this_cpu_write(current, ti);
+#else
+   extern struct task *__current;
    __current = ti;
+#endif
 }
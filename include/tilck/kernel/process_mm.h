@@ -5,10 +5,11 @@
 #include <tilck/kernel/fs/vfs_base.h>
 #include <tilck/kernel/paging.h>
 #include <tilck/kernel/list.h>
+#include <tilck/kernel/bintree.h>
 
 struct user_mapping {
 
-   struct list_node pi_node;
+   struct bintree_node node;        /* node in pi->mi->mappings (by vaddr) */
    struct list_node inode_node;
    struct process *pi;
 
@@ -22,7 +23,16 @@ struct user_mapping {
    };
 
    int prot;
+   bool lazy_free;                  /* has pages released with MADV_FREE */
 
+   /*
+    * Augmented data about the subtree rooted here, kept up-to-date by the
+    * tree's insert and remove operations: it allows finding a free range of
+    * a given size in O(log n).
+    */
+   ulong sub_start;                 /* lowest vaddr in the subtree */
+   ulong sub_end;                   /* highest (vaddr + len) in the subtree */
+   ulong sub_max_gap;               /* biggest free gap between its mappings */
 };
 
 struct user_mapping *
@@ -32,9 +42,15 @@ void full_remove_user_mapping(struct process *pi, struct user_mapping *um);
 void remove_all_mappings_of_handle(struct process *pi, fs_handle h);
 void remove_all_user_zero_mem_mappings(struct process *pi);
 struct user_mapping *process_get_user_mapping(void *vaddr);
+struct user_mapping *process_get_user_mapping_from(void *vaddr);
+void process_set_user_mapping_range(struct user_mapping *um,
+                                    void *vaddr, size_t len);
+void *process_find_free_user_range(size_t len);
 void remove_all_file_mappings(struct process *pi);
 struct mappings_info *
 duplicate_mappings_info(struct process *new_pi, struct mappings_info *mi);
+void destroy_mappings_info(struct mappings_info *mi);
+void init_process_mm(void);
 
 
 /* Internal functions */
@@ -42,6 +58,7 @@ bool user_valloc_and_map(ulong user_vaddr, size_t page_count);
 void user_vfree_and_unmap(ulong user_vaddr, size_t page_count);
 void user_unmap_zero_page(ulong user_vaddr, size_t page_count);
 bool user_map_zero_page(ulong user_vaddr, size_t page_count);
+bool user_map_big_page_on_cow(ulong vaddr);
 int generic_fs_munmap(struct user_mapping *um, void *vaddrp, size_t len);
 
 /* Special one-time funcs */
@@ -7,14 +7,29 @@
 #include <tilck/kernel/hal_types.h>
 #include <tilck/kernel/list.h>
 #include <tilck/kernel/bintree.h>
+#include <tilck/kernel/hrtimer.h>
 #include <tilck/kernel/sync.h>
 #include <tilck/kernel/worker_thread.h>
 #include <tilck/kernel/signal.h>
+#include <tilck/kernel/smp.h>
 
 #include <tilck_gen_headers/config_sched.h>
 
 #define TIME_SLICE_TICKS (TIMER_HZ / 25)
 
+/* Scheduling policies: the same values as Linux */
+#ifndef SCHED_OTHER
+   #define SCHED_OTHER                 0
+   #define SCHED_FIFO                  1
+   #define SCHED_RR                    2
+   #define SCHED_BATCH                 3
+   #define SCHED_IDLE                  5
+#endif
+
+#define MAX_RT_PRIO                   99
+#define MIN_NICE                     -20
+#define MAX_NICE                      19
+
 enum task_state {
    TASK_STATE_INVALID   = 0,
    TASK_STATE_RUNNABLE  = 1,
@@ -42,6 +57,7 @@ struct sched_ticks {
    u64 total;           /* total life-time ticks */
    u64 total_kernel;    /* total life-time ticks spent in kernel */
    u64 vruntime;        /* a brutal approx. of Linux's vruntime */
+   u64 rt_seq;          /* FIFO order among the RT tasks with the same prio */
 };
 
 STATIC_ASSERT(sizeof(enum sig_state) == 1);
@@ -77,14 +93,19 @@ struct task {
    void *worker_thread;                      /* only for worker threads */
 
    struct bintree_node tree_by_tid_node;
-   struct list_node runnable_node;
+   struct bintree_node runnable_node;
    struct list_node wakeup_timer_node;
    struct list_node siblings_node;    /* nodes in parent's pi's children list */
+   struct list_node thread_node;      /* node in pi->threads, while alive */
 
    struct list tasks_waiting_list;    /* tasks waiting this task to end */
 
    s32 wstatus;                       /* waitpid's wstatus  */
    struct sched_ticks ticks;          /* scheduler counters */
+   u8 sched_policy;                   /* SCHED_OTHER, SCHED_FIFO, etc. */
+   u8 rt_prio;                        /* base_rt_prio + inherited (PI) */
+   s8 nice;                           /* MIN_NICE..MAX_NICE */
+   u8 base_rt_prio;                   /* 1..MAX_RT_PRIO if RT, 0 otherwise */
 
    void *kernel_stack;
    void *args_copybuf;
@@ -95,7 +116,10 @@ struct task {
    };
 
    struct wait_obj wobj;
-   u32 ticks_before_wake_up;
+   struct kmutex *blocked_on;         /* the kmutex we're waiting for */
+   struct kmutex *held_kmutexes;      /* stack of the kmutexes held (for PI) */
+   u32 wakeup_timer_expire;           /* see the timing wheel in timer.c */
+   struct hrtimer wakeup_hrtimer;     /* used instead, by the *_ns() funcs */
 
    /* List of callbacks to call on exit */
    struct list on_exit;
@@ -115,12 +139,21 @@ struct task {
    /* The current sa_mask has been altered by sigsuspend() */
    bool in_sigsuspend;
 
+   /* The buffer passed to the file_ops is an user one (VFS_SPFL_USER_BUF) */
+   bool io_user_buf;
+
    /* Number of nested custom signal handlers (at most 1, at the moment). */
-   int nested_sig_handlers;
+   s8 nested_sig_handlers;
+
+   /* The CPU of the runqueue the task belongs to (see sched.c) */
+   u8 cpu;
 
    /* Kernel thread name, NULL for user tasks */
    const char *kthread_name;
 
+   /* User pointer set by set_tid_address() or CLONE_CHILD_CLEARTID */
+   int *clear_child_tid;
+
    /* Pending signals bitset */
    ulong sa_pending[K_SIGACTION_MASK_WORDS];
 
@@ -139,9 +172,7 @@ struct task {
 
 extern struct task *kernel_process;
 extern struct process *kernel_process_pi;
-extern struct task *idle_task;
 
-extern struct list runnable_tasks_list;
 extern const char *const task_state_str[5];
 
 #define KTH_ALLOC_BUFS                       (1 << 0)
@@ -153,12 +184,50 @@ extern const char *const task_state_str[5];
 STATIC_ASSERT(MAX_PID < KERNEL_TID_START);
 
 void init_sched(void);
+struct task *sched_create_idle_task(u32 cpu);
 struct task *get_task(int tid);
 struct process *get_process(int pid);
 void task_change_state(struct task *ti, enum task_state new_state);
 void task_change_state_idempotent(struct task *ti, enum task_state new_state);
+void task_set_timer_ready(struct task *ti, bool value);
+void task_set_sched_policy(struct task *ti, int policy, int rt_prio);
+void task_set_rt_prio(struct task *ti, int rt_prio);
+void task_requeue(struct task *ti);
 bool save_regs_and_schedule(bool skip_disable_preempt);
 
+#if SMP_ENABLED
+
+static ALWAYS_INLINE void sched_set_need_resched(void)
+{
+   this_cpu_write(need_resched, 1);
+}
+
+static ALWAYS_INLINE void sched_clear_need_resched(void)
+{
+   this_cpu_write(need_resched, 0);
+}
+
+static ALWAYS_INLINE bool need_reschedule(void)
+{
+   return this_cpu_read(need_resched) != 0;
+}
+
+/* With SMP, they take and release the big kernel lock: see sched.c */
+void disable_preemption(void);
+void enable_preemption_nosched(void);
+void sched_restore_preempt_count(int count);
+void sched_release_bkl(void);
+
+/* WARNING: only for special self-test code paths, see below */
+void force_enable_preemption(void);
+
+static ALWAYS_INLINE int get_preempt_disable_count(void)
+{
+   return this_cpu_read(disable_preempt);
+}
+
+#else
+
 static ALWAYS_INLINE void sched_set_need_resched(void)
 {
    extern ATOMIC(int) __need_resched; /* see docs/atomics.md */
@@ -189,8 +258,6 @@ static ALWAYS_INLINE void enable_preemption_nosched(void)
    atomic_fetch_sub_explicit(&__disable_preempt, 1, mo_relaxed);
 }
 
-void enable_preemption(void);
-
 /*
  * WARNING: this function is dangerous and should NEVER be used it for anything
  * other than special self-test code paths. See selftest_kmutex_ord_med().
@@ -207,6 +274,10 @@ static ALWAYS_INLINE int get_preempt_disable_count(void)
    return atomic_load_explicit(&__disable_preempt, mo_relaxed);
 }
 
+#endif
+
+void enable_preemption(void);
+
 static ALWAYS_INLINE bool is_preemption_enabled(void)
 {
    return !get_preempt_disable_count();
@@ -281,6 +352,13 @@ static ALWAYS_INLINE bool schedule_preempt_disabled(void)
 
 static ALWAYS_INLINE struct task *get_curr_task(void)
 {
+#if SMP_ENABLED
+
+   /* See the comment above struct cpu */
+   return this_cpu_read(current);
+
+#else
+
    extern struct task *__current;
 
    /*
@@ -300,6 +378,18 @@ static ALWAYS_INLINE struct task *get_curr_task(void)
     *       - in kthread_exit() [with interrupts disabled]
     */
    return __current;
+
+#endif
+}
+
+/* True if `ti` is the current task of its CPU (always false for others) */
+static ALWAYS_INLINE bool is_task_on_cpu(struct task *ti)
+{
+#if SMP_ENABLED
+   return get_cpu(ti->cpu)->current == ti;
+#else
+   return ti == get_curr_task();
+#endif
 }
 
 /* Hack: it works only if the C file includes process.h, but that's fine. */
@@ -387,7 +477,10 @@ int get_curr_pid(void);
 void save_current_task_state(regs_t *);
 void sched_account_ticks(void);
 int create_new_pid(void);
+void retain_pid(int pid);
+void release_pid(int pid);
 int create_new_kernel_tid(void);
+void release_kernel_tid(int tid);
 void task_info_reset_kernel_stack(struct task *ti);
 void add_task(struct task *ti);
 void remove_task(struct task *ti);
@@ -399,9 +492,12 @@ void kthread_exit(void);
 int kthread_join(int tid, bool ignore_signals);
 int kthread_join_all(const int *tids, size_t n, bool ignore_signals);
 
+void task_init_wakeup_timer(struct task *ti);
 void task_set_wakeup_timer(struct task *task, u32 ticks);
 void task_update_wakeup_timer_if_any(struct task *ti, u32 new_ticks);
 u32 task_cancel_wakeup_timer(struct task *ti);
+void task_set_wakeup_timer_ns(struct task *ti, u64 ns);
+u64 task_cancel_wakeup_timer_ns(struct task *ti);
 
 typedef void (*kthread_func_ptr)();
 
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck_gen_headers/config_sched.h>
+#include <tilck_gen_headers/config_debug.h>
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/atomics.h>
+
+/*
+ * The unit tests run on the host, as a single CPU: they use the same code paths
+ * of a kernel built without KRN_SMP.
+ */
+#if KRN_SMP && defined(__i386__) && !defined(UNIT_TEST_ENVIRONMENT)
+   #define SMP_ENABLED                                     1
+   #define MAX_CPUS                                        8
+#else
+   #define SMP_ENABLED                                     0
+   #define MAX_CPUS                                        1
+#endif
+
+typedef void (*smp_call_func)(void *arg);
+
+#if SMP_ENABLED
+
+struct task;
+struct tss_entry;
+
+/*
+ * Per-CPU data
+ * --------------
+ *
+ * Each CPU has its own `struct cpu`, reachable through the FS segment (see
+ * X86_KERNEL_PERCPU_SEL), which is set up for that in the GDT of each CPU.
+ * Because of that, the fields accessed by the this_cpu_*() macros are read or
+ * written with a single instruction: a task can be moved to another CPU at any
+ * time when the preemption is enabled, but it will never mix the fields of two
+ * different CPUs.
+ *
+ * The offsets of `current` and `disable_preempt` are used by the assembly code
+ * as well: keep them in sync with CPU_CURRENT_OFF and CPU_PREEMPT_OFF.
+ */
+struct cpu {
+
+   struct cpu *self;                   /* see get_this_cpu() */
+   struct task *current;               /* see get_curr_task() */
+   ATOMIC(int) disable_preempt;        /* see disable_preemption() */
+   ATOMIC(int) need_resched;           /* see sched_set_need_resched() */
+   ATOMIC(int) in_irq_count;           /* see in_irq() */
+
+   u32 id;                             /* index in __cpus[] */
+   u32 apic_id;
+   ATOMIC(bool) online;
+   ATOMIC(void *) pdir;                /* page directory in use (CR3) */
+   void *stack;                        /* the initial stack of an AP */
+
+#if KRN_TRACK_NESTED_INTERR
+   int nested_interrupts_count;
+   int nested_interrupts[MAX_NESTED_INTERRUPTS];
+#endif
+};
+
+extern struct cpu __cpus[MAX_CPUS];
+
+#define this_cpu_read(field)                                              \
+   ({                                                                     \
+      __typeof__(((struct cpu *)0)->field + 0) __val;                     \
+      STATIC_ASSERT(sizeof(__val) == 4);                                  \
+      asmVolatile("movl %%fs:%c1, %0"                                     \
+                  : "=r" (__val)                                          \
+                  : "i" (OFFSET_OF(struct cpu, field)));                  \
+      __val;                                                              \
+   })
+
+#define this_cpu_write(field, val)                                        \
+   do {                                                                   \
+      __typeof__(((struct cpu *)0)->field + 0) __val = (val);             \
+      STATIC_ASSERT(sizeof(__val) == 4);                                  \
+      asmVolatile("movl %0, %%fs:%c1"                                     \
+                  : /* no output */                                       \
+                  : "r" (__val), "i" (OFFSET_OF(struct cpu, field))       \
+                  : "memory");                                            \
+   } while (0)
+
+#define this_cpu_inc(field)                                               \
+   do {                                                                   \
+      STATIC_ASSERT(sizeof(((struct cpu *)0)->field) == 4);               \
+      asmVolatile("incl %%fs:%c0"                                         \
+                  : /* no output */                                       \
+                  : "i" (OFFSET_OF(struct cpu, field))                    \
+                  : "memory", "cc");                                      \
+   } while (0)
+
+#define this_cpu_dec(field)                                               \
+   do {                                                                   \
+      STATIC_ASSERT(sizeof(((struct cpu *)0)->field) == 4);               \
+      asmVolatile("decl %%fs:%c0"                                         \
+                  : /* no output */                                       \
+                  : "i" (OFFSET_OF(struct cpu, field))                    \
+                  : "memory", "cc");                                      \
+   } while (0)
+
+static ALWAYS_INLINE struct cpu *get_this_cpu(void)
+{
+   return this_cpu_read(self);
+}
+
+static ALWAYS_INLINE u32 get_cpu_id(void)
+{
+   return this_cpu_read(id);
+}
+
+static ALWAYS_INLINE struct cpu *get_cpu(u32 id)
+{
+   return &__cpus[id];
+}
+
+static ALWAYS_INLINE bool is_cpu_online(struct cpu *c)
+{
+   return atomic_load_explicit(&c->online, mo_acquire);
+}
+
+void smp_register_cpu(u32 apic_id);
+void init_smp(void);
+void smp_call(u32 cpu_mask, smp_call_func func, void *arg);
+void smp_send_resched(u32 cpu);
+bool smp_handle_call_ipi(int int_num);
+void smp_stop_other_cpus(void);
+void smp_pdir_release(void *pdir);
+u32 smp_get_pdir_users(void *pdir);
+
+#else
+
+static ALWAYS_INLINE u32 get_cpu_id(void) { return 0; }
+static ALWAYS_INLINE void smp_register_cpu(u32 apic_id) { }
+static ALWAYS_INLINE void init_smp(void) { }
+static ALWAYS_INLINE void smp_send_resched(u32 cpu) { }
+static ALWAYS_INLINE void smp_call(u32 mask, smp_call_func f, void *arg) { }
+static ALWAYS_INLINE bool smp_handle_call_ipi(int int_num) { return false; }
+static ALWAYS_INLINE void smp_stop_other_cpus(void) { }
+static ALWAYS_INLINE void smp_pdir_release(void *pdir) { }
+static ALWAYS_INLINE u32 smp_get_pdir_users(void *pdir) { return 0; }
+
+#endif
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#pragma once
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/atomics.h>
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/smp.h>
+
+/*
+ * Spinlocks protect the few data structures which are used with the interrupts
+ * disabled, instead of the preemption (e.g. the runqueues, the timers): on a
+ * single CPU, that's enough and spin_lock() and spin_unlock() do nothing.
+ *
+ * The preemption must never be disabled while holding a spinlock, because with
+ * SMP that might require to wait for the big kernel lock (see sched.c), held by
+ * a CPU which, in turn, might be waiting for our spinlock.
+ */
+
+struct spinlock {
+   ATOMIC(bool) locked;
+};
+
+#if SMP_ENABLED
+
+void spin_lock(struct spinlock *l);
+void spin_wait_unlocked(struct spinlock *l);
+
+static ALWAYS_INLINE bool spin_trylock(struct spinlock *l)
+{
+   return !atomic_exchange_explicit(&l->locked, true, mo_acquire);
+}
+
+static ALWAYS_INLINE void spin_unlock(struct spinlock *l)
+{
+   atomic_store_explicit(&l->locked, false, mo_release);
+}
+
+#else
+
+static ALWAYS_INLINE void spin_lock(struct spinlock *l) { }
+static ALWAYS_INLINE bool spin_trylock(struct spinlock *l) { return true; }
+static ALWAYS_INLINE void spin_unlock(struct spinlock *l) { }
+
+#endif
+
+static ALWAYS_INLINE void spin_lock_irqsave(struct spinlock *l, ulong *var)
+{
+   disable_interrupts(var);
+   spin_lock(l);
+}
+
+static ALWAYS_INLINE void
+spin_unlock_irqrestore(struct spinlock *l, const ulong *var)
+{
+   spin_unlock(l);
+   enable_interrupts(var);
+}
+
+static ALWAYS_INLINE void spin_lock_irq(struct spinlock *l)
+{
+   disable_interrupts_forced();
+   spin_lock(l);
+}
+
+static ALWAYS_INLINE void spin_unlock_irq(struct spinlock *l)
+{
+   spin_unlock(l);
+   enable_interrupts_forced();
+}
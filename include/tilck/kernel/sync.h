@@ -15,6 +15,7 @@ enum wo_type {
    WOBJ_KCOND,
    WOBJ_TASK,
    WOBJ_SEM,
+   WOBJ_FUTEX,
 
    /* Special "meta-object" types */
 
@@ -143,6 +144,7 @@ int ksem_signal(struct ksem *s, int units);
 struct kmutex {
 
    struct task *owner_task;
+   struct kmutex *next_held;  // Next in owner_task->held_kmutexes
    u32 flags;
    u32 lock_count; // Valid when the mutex is recursive
    struct list wait_list;
@@ -156,6 +158,7 @@ struct kmutex {
 #define STATIC_KMUTEX_INIT(m, fl)                 \
    {                                              \
       .owner_task = NULL,                         \
+      .next_held = NULL,                          \
       .flags = 0,                                 \
       .lock_count = 0,                            \
       .wait_list = STATIC_LIST_INIT(m.wait_list), \
@@ -178,6 +181,7 @@ void kmutex_lock(struct kmutex *m);
 bool kmutex_trylock(struct kmutex *m);
 void kmutex_unlock(struct kmutex *m);
 void kmutex_destroy(struct kmutex *m);
+void kmutex_pi_update(struct task *ti);
 
 #if DEBUG_CHECKS
 bool kmutex_is_curr_task_holding_lock(struct kmutex *m);
@@ -204,4 +208,5 @@ void kcond_destory(struct kcond *c);
 void kcond_signal_one(struct kcond *c);
 void kcond_signal_all(struct kcond *c);
 bool kcond_wait(struct kcond *c, struct kmutex *m, u32 timeout_ticks);
+bool kcond_wait_ns(struct kcond *c, struct kmutex *m, u64 timeout_ns);
 bool kcond_is_anyone_waiting(struct kcond *c);
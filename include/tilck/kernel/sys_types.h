@@ -115,6 +115,11 @@ struct k_timespec64 {
    long tv_nsec;
 };
 
+struct k_sched_param {
+
+   int sched_priority;
+};
+
 #ifdef BITS32
 
 /*
@@ -81,7 +81,7 @@ int sys_pause(void);
 int sys_utime32(const char *u_path, const struct k_utimbuf *u_times);
 int sys_access(const char *u_path, mode_t mode);
 
-CREATE_STUB_SYSCALL_IMPL(sys_nice)
+int sys_nice(int inc);
 
 int sys_sync(void);
 int sys_kill(int pid, int sig);
@@ -165,8 +165,10 @@ CREATE_STUB_SYSCALL_IMPL(sys_ftruncate)
 int sys_fchmod(int fd, mode_t mode);
 
 CREATE_STUB_SYSCALL_IMPL(sys_fchown16)
-CREATE_STUB_SYSCALL_IMPL(sys_getpriority)
-CREATE_STUB_SYSCALL_IMPL(sys_setpriority)
+
+int sys_getpriority(int which, int who);
+int sys_setpriority(int which, int who, int prio);
+
 CREATE_STUB_SYSCALL_IMPL(sys_statfs)
 CREATE_STUB_SYSCALL_IMPL(sys_fstatfs)
 CREATE_STUB_SYSCALL_IMPL(sys_ioperm)
@@ -193,7 +195,12 @@ CREATE_STUB_SYSCALL_IMPL(sys_ipc)
 int sys_fsync(int fd);
 CREATE_STUB_SYSCALL_IMPL(sys_sigreturn);
 
-CREATE_STUB_SYSCALL_IMPL(sys_clone)
+int sys_clone(ulong flags,
+              void *newsp,
+              int *parent_tid,
+              void *tls,
+              int *child_tid);
+
 CREATE_STUB_SYSCALL_IMPL(sys_setdomainname)
 
 int sys_newuname(struct utsname *buf);
@@ -237,21 +244,26 @@ CREATE_STUB_SYSCALL_IMPL(sys_mlock)
 CREATE_STUB_SYSCALL_IMPL(sys_munlock)
 CREATE_STUB_SYSCALL_IMPL(sys_mlockall)
 CREATE_STUB_SYSCALL_IMPL(sys_munlockall)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_setparam)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_getparam)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_setscheduler)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_getscheduler)
 
-int sys_sched_yield(void);
+int sys_sched_setparam(int pid, const struct k_sched_param *u_param);
+int sys_sched_getparam(int pid, struct k_sched_param *u_param);
 
-CREATE_STUB_SYSCALL_IMPL(sys_sched_get_priority_max)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_set_priority_min)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_rr_get_interval_time32)
+int sys_sched_setscheduler(int pid,
+                           int policy,
+                           const struct k_sched_param *u_param);
+
+int sys_sched_getscheduler(int pid);
+int sys_sched_yield(void);
+int sys_sched_get_priority_max(int policy);
+int sys_sched_get_priority_min(int policy);
+int sys_sched_rr_get_interval_time32(int pid, struct k_timespec32 *u_tp);
 
 int sys_nanosleep_time32(const struct k_timespec32 *req,
                          struct k_timespec32 *rem);
 
-CREATE_STUB_SYSCALL_IMPL(sys_mremap)
+long sys_mremap(void *old_addr, size_t old_len, size_t new_len,
+                int flags, void *new_addr);
+
 CREATE_STUB_SYSCALL_IMPL(sys_setresuid16)
 CREATE_STUB_SYSCALL_IMPL(sys_getresuid16)
 CREATE_STUB_SYSCALL_IMPL(sys_vm86)
@@ -356,7 +368,14 @@ CREATE_STUB_SYSCALL_IMPL(sys_fremovexattr)
 int sys_tkill(int tid, int sig);
 
 CREATE_STUB_SYSCALL_IMPL(sys_sendfile64)
-CREATE_STUB_SYSCALL_IMPL(sys_futex_time32)
+
+int sys_futex_time32(u32 *uaddr,
+                     int op,
+                     u32 val,
+                     const struct k_timespec32 *timeout,
+                     u32 *uaddr2,
+                     u32 val3);
+
 CREATE_STUB_SYSCALL_IMPL(sys_sched_setaffinity)
 CREATE_STUB_SYSCALL_IMPL(sys_sched_getaffinity)
 
@@ -391,7 +410,11 @@ CREATE_STUB_SYSCALL_IMPL(sys_clock_settime32)
 int sys_clock_gettime32(clockid_t clk_id, struct k_timespec32 *tp);
 int sys_clock_getres_time32(clockid_t clk_id, struct k_timespec32 *res);
 
-CREATE_STUB_SYSCALL_IMPL(sys_clock_nanosleep_time32)
+int sys_clock_nanosleep_time32(clockid_t clk_id,
+                               int flags,
+                               const struct k_timespec32 *req,
+                               struct k_timespec32 *rem);
+
 CREATE_STUB_SYSCALL_IMPL(sys_statfs64)
 CREATE_STUB_SYSCALL_IMPL(sys_fstatfs64)
 
@@ -541,7 +564,11 @@ CREATE_STUB_SYSCALL_IMPL(sys_clock_adjtime)
 
 int sys_clock_getres(clockid_t clk_id, struct k_timespec64 *user_res);
 
-CREATE_STUB_SYSCALL_IMPL(sys_clock_nanosleep)
+int sys_clock_nanosleep(clockid_t clk_id,
+                        int flags,
+                        const struct k_timespec64 *req,
+                        struct k_timespec64 *rem);
+
 CREATE_STUB_SYSCALL_IMPL(sys_timer_gettime)
 CREATE_STUB_SYSCALL_IMPL(sys_timer_settime)
 CREATE_STUB_SYSCALL_IMPL(sys_timerfd_gettime)
@@ -555,8 +582,16 @@ CREATE_STUB_SYSCALL_IMPL(sys_mq_timedsend)
 CREATE_STUB_SYSCALL_IMPL(sys_mq_timedreceive)
 CREATE_STUB_SYSCALL_IMPL(sys_semtimedop)
 CREATE_STUB_SYSCALL_IMPL(sys_rt_sigtimedwait)
-CREATE_STUB_SYSCALL_IMPL(sys_futex)
-CREATE_STUB_SYSCALL_IMPL(sys_sched_rr_get_interval)
+
+int sys_futex(u32 *uaddr,
+              int op,
+              u32 val,
+              const struct k_timespec64 *timeout,
+              u32 *uaddr2,
+              u32 val3);
+
+int sys_sched_rr_get_interval(int pid, struct k_timespec64 *u_tp);
+
 CREATE_STUB_SYSCALL_IMPL(sys_pidfd_send_signal)
 CREATE_STUB_SYSCALL_IMPL(sys_io_uring_setup)
 CREATE_STUB_SYSCALL_IMPL(sys_io_uring_enter)
@@ -10,5 +10,12 @@ STATIC void sort_mem_regions(void);
 STATIC void merge_adj_mem_regions(void);
 STATIC void handle_overlapping_regions(void);
 
+/*
+ * Fake physical memory in the unit tests: a reserved region for the "kernel
+ * image", containing kmalloc's first heap, followed by a usable region.
+ */
+#define TEST_MEM_SIZE                         (256 * MB)
+#define TEST_KERNEL_IMG_SIZE                  (1 * MB)
+
 extern struct mem_region mem_regions[MAX_MEM_REGIONS];
 extern int mem_regions_count;
@@ -6,6 +6,7 @@
 
 void kernel_sleep(u64 ticks);  /* sleep for `ticks` timer ticks (jiffies) */
 void kernel_sleep_ms(u64 ms);  /* sleep for `ms` milliseconds */
+void kernel_sleep_ns(u64 ns);  /* sleep for `ns` nanoseconds */
 void delay_us(u32 us);         /* busy-wait for `us` microseconds */
 
 static ALWAYS_INLINE u64
@@ -16,3 +17,5 @@ ms_to_ticks(u64 ms)
 
 u64 get_ticks(void);
 void init_timer(void);
+void timer_nohz_enter(void);
+void timer_nohz_exit(void);
@@ -2,9 +2,36 @@
 
 #pragma once
 #include <tilck/common/basic_defs.h>
+#include <tilck/common/page_size.h>
 
 extern const ulong vdso_begin;
 extern const ulong vdso_end;
 extern const ulong sysexit_user_code_user_vaddr;
 extern const ulong post_sig_handler_user_vaddr;
 extern const ulong pause_trampoline_user_vaddr;
+
+/*
+ * The vvar page, mapped read-only in userspace at USER_VVAR_VADDR, right after
+ * the vDSO. It contains the time base used by __vdso_clock_gettime() & co.
+ * to compute the system time exactly like get_sys_time() does, without any
+ * syscall. The kernel updates it on every tick: `seq` is odd while that's
+ * happening and the readers retry if it changed in the meanwhile.
+ *
+ * NOTE: the layout is known by vdso.S (see the VVAR_* offsets).
+ */
+struct vdso_data {
+
+   u32 seq;
+   u32 tick_mult;          /* cs_tick_mult, 0 if there's no clocksource */
+   u64 time_ns;            /* __time_ns */
+   u64 tick_cycles;        /* clocksource's value at the last tick */
+   u32 tick_ns;            /* duration of the current tick */
+   u32 boot_ts;            /* boot_timestamp, as a 32-bit time_t */
+};
+
+union vvar_page {
+   struct vdso_data data;
+   char raw[PAGE_SIZE];
+};
+
+extern union vvar_page vvar_page;
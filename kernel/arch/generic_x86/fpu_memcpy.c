@@ -132,6 +132,13 @@ void fpu_memset256_sse2(void *dest, u32 val32, u32 n)
 
    for (register u32 i = 0; i < n; i++, dest += 32)
       fpu_cpy_single_256_nt_sse2(dest, val256);
+
+   /*
+    * The non-temporal stores are weakly ordered: without this, another CPU
+    * might still see the old data after seeing the stores that follow (e.g.
+    * the ones making the memory available to it, see pf_zpool_refill()).
+    */
+   asmVolatile("sfence" ::: "memory");
 }
 
 void fpu_memset256_avx2(void *dest, u32 val32, u32 n)
@@ -141,6 +148,8 @@ void fpu_memset256_avx2(void *dest, u32 val32, u32 n)
 
    for (register u32 i = 0; i < n; i++, dest += 32)
       fpu_cpy_single_256_nt_avx2(dest, val256);
+
+   asmVolatile("sfence" ::: "memory");   /* See fpu_memset256_sse2() */
 }
 
 static void
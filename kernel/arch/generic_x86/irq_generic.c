@@ -13,6 +13,7 @@
 #include <tilck/kernel/timer.h>
 
 #include "pic.h"
+#include "lapic.h"
 
 struct list irq_handlers_lists[16] = {
    STATIC_LIST_INIT(irq_handlers_lists[ 0]),
@@ -38,15 +39,23 @@ u32 spur_irq_count;
 
 void idt_set_entry(u8 num, void *handler, u16 sel, u8 flags);
 
+/*
+ * The lists of handlers are walked by arch_irq_handling() with the interrupts
+ * enabled, but never with the preemption enabled: with SMP, disabling the
+ * preemption is what keeps the other CPUs from walking them meanwhile.
+ */
+
 /* This installs a custom IRQ handler for the given IRQ */
 void irq_install_handler(u8 irq, struct irq_handler_node *n)
 {
    ulong var;
+   disable_preemption();
    disable_interrupts(&var);
    {
       list_add_tail(&irq_handlers_lists[irq], &n->node);
    }
    enable_interrupts(&var);
+   enable_preemption();
    irq_clear_mask(irq);
 }
 
@@ -54,6 +63,7 @@ void irq_install_handler(u8 irq, struct irq_handler_node *n)
 void irq_uninstall_handler(u8 irq, struct irq_handler_node *n)
 {
    ulong var;
+   disable_preemption();
    disable_interrupts(&var);
    {
       list_remove(&n->node);
@@ -62,6 +72,7 @@ void irq_uninstall_handler(u8 irq, struct irq_handler_node *n)
          irq_set_mask(irq);
    }
    enable_interrupts(&var);
+   enable_preemption();
 }
 
 static inline void handle_irq_set_mask_and_eoi(int irq)
@@ -105,6 +116,27 @@ void arch_irq_handling(regs_t *r)
    ASSERT(!are_interrupts_enabled());
    ASSERT(!is_preemption_enabled());
 
+   if (irq >= LAPIC_FIRST_IRQ) {
+
+      /* Local APIC interrupts: they don't go through the PIC */
+      if (irq == LAPIC_SPURIOUS_IRQ) {
+         spur_irq_count++;    /* No EOI must be sent in this case */
+         return;
+      }
+
+      push_nested_interrupt(r->int_num);
+      {
+         if (irq == LAPIC_TIMER_IRQ)
+            lapic_handle_timer_irq();
+         else if (SMP_ENABLED && irq == LAPIC_RESCHED_IRQ)
+            lapic_handle_resched_irq();
+         else
+            unhandled_irq_count[irq]++;
+      }
+      pop_nested_interrupt();
+      return;
+   }
+
    if (pic_is_spur_irq(irq)) {
       spur_irq_count++;
       return;
@@ -0,0 +1,361 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+#include <tilck/common/utils.h>
+
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/paging.h>
+#include <tilck/kernel/hrtimer.h>
+#include <tilck/kernel/datetime.h>
+#include <tilck/kernel/sched.h>
+
+#include "lapic.h"
+#include "pit.h"
+
+/*
+ * Local APIC timer, used as hardware for the high-resolution timers.
+ *
+ * The external IRQs are still handled by the 8259 PIC: the local APIC is
+ * configured in "virtual wire" mode (the PIC's output goes through LINT0) and
+ * only its timer is used. The timer works in TSC-deadline mode when the CPU
+ * supports it, in one-shot mode otherwise (e.g. QEMU without KVM). In both
+ * cases, the TSC is used as clock source for hw_hrtimer_now(). Both the TSC
+ * and the local APIC timer are calibrated at boot against the PIT.
+ *
+ * With KRN_SMP, the local APIC is also used to send the INIT and STARTUP IPIs
+ * to the application processors (see smp.c) and, later, the IPIs used by the
+ * scheduler and by the TLB shootdown. The timer of the APs is used for their
+ * periodic scheduler tick, instead: only the BSP handles the hrtimers.
+ */
+
+#define APIC_BASE_X2APIC_MODE               (1u << 10)
+#define APIC_BASE_ENABLE                    (1u << 11)
+#define APIC_BASE_ADDR_MASK                 0xfffff000u
+
+/* Registers */
+#define LAPIC_ID                            0x020
+#define LAPIC_EOI                           0x0b0
+#define LAPIC_SVR                           0x0f0
+#define LAPIC_ICR_LOW                       0x300
+#define LAPIC_ICR_HIGH                      0x310
+#define LAPIC_LVT_TIMER                     0x320
+#define LAPIC_LVT_LINT0                     0x350
+#define LAPIC_LVT_LINT1                     0x360
+#define LAPIC_TIMER_INIT_CNT                0x380
+#define LAPIC_TIMER_CURR_CNT                0x390
+#define LAPIC_TIMER_DIV                     0x3e0
+
+#define LAPIC_SVR_ENABLE                    (1u << 8)
+#define LAPIC_LVT_MASKED                    (1u << 16)
+#define LAPIC_LVT_DM_NMI                    (4u << 8)
+#define LAPIC_LVT_DM_EXTINT                 (7u << 8)
+#define LAPIC_TIMER_ONESHOT                 (0u << 17)
+#define LAPIC_TIMER_PERIODIC                (1u << 17)
+#define LAPIC_TIMER_TSC_DEADLINE            (2u << 17)
+#define LAPIC_TIMER_DIV_16                  0x3
+
+#define LAPIC_ICR_DM_FIXED                  (0u << 8)
+#define LAPIC_ICR_DM_INIT                   (5u << 8)
+#define LAPIC_ICR_DM_STARTUP                (6u << 8)
+#define LAPIC_ICR_PENDING                   (1u << 12)
+#define LAPIC_ICR_ASSERT                    (1u << 14)
+#define LAPIC_ICR_LEVEL                     (1u << 15)
+
+#define LAPIC_CALIBRATION_MS                20
+#define LAPIC_MAX_DELTA_NS                  ((u64)TS_SCALE)
+#define FP_SHIFT                            24
+
+static volatile u32 *lapic;
+static bool use_tsc_deadline;
+static u64 tsc_start;
+static u32 tsc_to_ns_mult;          /* ns per TSC cycle, << FP_SHIFT */
+static u32 ns_to_tsc_mult;          /* TSC cycles per ns, << FP_SHIFT */
+static u32 ns_to_lapic_mult;        /* LAPIC timer counts per ns, << FP_SHIFT */
+static u64 lapic_timer_hz;          /* with LAPIC_TIMER_DIV_16 */
+static u32 ap_tick_counts;          /* LAPIC timer counts per AP tick */
+
+static ALWAYS_INLINE u32 lapic_read(u32 reg)
+{
+   return lapic[reg / 4];
+}
+
+static ALWAYS_INLINE void lapic_write(u32 reg, u32 val)
+{
+   lapic[reg / 4] = val;
+}
+
+static ALWAYS_INLINE u64 fp_mul(u64 val, u32 mult)
+{
+   return mul_u64_u32_shr(val, mult, FP_SHIFT);
+}
+
+u64 hw_hrtimer_now(void)
+{
+   return fp_mul(RDTSC() - tsc_start, tsc_to_ns_mult);
+}
+
+#if SMP_ENABLED
+
+static void hw_hrtimer_program_on_bsp(void *arg)
+{
+   hw_hrtimer_program(*(u64 *)arg);
+}
+
+#endif
+
+/*
+ * Program the timer to fire at `expire` (ns, as returned by hw_hrtimer_now()),
+ * or as soon as possible if that's in the past. Far deadlines are clamped:
+ * in that case, the timer fires earlier and hrtimer_irq_handler() just
+ * programs it again.
+ */
+void hw_hrtimer_program(u64 expire)
+{
+   u64 now, delta;
+
+#if SMP_ENABLED
+   if (get_cpu_id()) {
+      /* The hrtimers use the BSP's timer: the ones of the APs run their tick */
+      smp_call(1u << 0, &hw_hrtimer_program_on_bsp, &expire);
+      return;
+   }
+#endif
+
+   now = hw_hrtimer_now();
+   delta = expire > now ? expire - now : 0;
+
+   delta = MIN(delta, LAPIC_MAX_DELTA_NS);
+
+   if (use_tsc_deadline) {
+      wrmsr(MSR_IA32_TSC_DEADLINE,
+            RDTSC() + fp_mul(delta, ns_to_tsc_mult) + 1);
+      return;
+   }
+
+   lapic_write(LAPIC_TIMER_INIT_CNT,
+               (u32)CLAMP(fp_mul(delta, ns_to_lapic_mult), 1u, UINT32_MAX));
+}
+
+void lapic_handle_timer_irq(void)
+{
+   ASSERT(!are_interrupts_enabled());
+
+   lapic_write(LAPIC_EOI, 0);
+
+   if (get_cpu_id()) {
+      /* The periodic tick of an AP: see lapic_start_ap_tick() */
+      sched_account_ticks();
+      return;
+   }
+
+   hrtimer_irq_handler();
+}
+
+void lapic_eoi(void)
+{
+   lapic_write(LAPIC_EOI, 0);
+}
+
+/* Sent by another CPU with SMP: see sched_resched_cpu() */
+void lapic_handle_resched_irq(void)
+{
+   lapic_write(LAPIC_EOI, 0);
+   sched_set_need_resched();
+}
+
+static bool lapic_calibrate(void)
+{
+   u64 start, cycles, tsc_hz, lapic_hz;
+   u32 counts;
+
+   lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+   lapic_write(LAPIC_LVT_TIMER,
+               LAPIC_LVT_MASKED | LAPIC_TIMER_ONESHOT | (32 + LAPIC_TIMER_IRQ));
+
+   lapic_write(LAPIC_TIMER_INIT_CNT, 0xffffffff);
+   start = RDTSC();
+   pit_busy_wait_ms(LAPIC_CALIBRATION_MS);
+   cycles = RDTSC() - start;
+   counts = 0xffffffff - lapic_read(LAPIC_TIMER_CURR_CNT);
+   lapic_write(LAPIC_TIMER_INIT_CNT, 0);
+
+   tsc_hz = cycles * 1000 / LAPIC_CALIBRATION_MS;
+   lapic_hz = (u64)counts * 1000 / LAPIC_CALIBRATION_MS;
+   lapic_timer_hz = lapic_hz;
+
+   /* With slower TSCs, tsc_to_ns_mult would not fit in 32 bits */
+   if (tsc_hz < 10 * MILLION) {
+      printk("hrtimers: TSC too slow (%u Hz)\n", (u32)tsc_hz);
+      return false;
+   }
+
+   tsc_to_ns_mult = (u32)(((u64)TS_SCALE << FP_SHIFT) / tsc_hz);
+   ns_to_tsc_mult = (u32)((tsc_hz << FP_SHIFT) / TS_SCALE);
+   ns_to_lapic_mult = (u32)((lapic_hz << FP_SHIFT) / TS_SCALE);
+
+   if (!use_tsc_deadline && !ns_to_lapic_mult) {
+      printk("hrtimers: LAPIC timer too slow (%u Hz)\n", (u32)lapic_hz);
+      return false;
+   }
+
+   printk("hrtimers: TSC: %u kHz, LAPIC timer: %u kHz, mode: %s\n",
+          (u32)(tsc_hz / 1000),
+          (u32)(lapic_hz / 1000),
+          use_tsc_deadline ? "TSC-deadline" : "one-shot");
+
+   return true;
+}
+
+/*
+ * Map and enable the local APIC of the BSP, in virtual wire mode. Used by both
+ * the hrtimers and the SMP code: only the first call does the actual work.
+ */
+bool lapic_init(void)
+{
+   ulong paddr;
+   u64 base;
+   void *va;
+
+   ASSERT(!are_interrupts_enabled());
+
+   if (lapic)
+      return true;
+
+   if (!x86_cpu_features.edx1.apic || !x86_cpu_features.edx1.msr)
+      return false;
+
+   base = rdmsr(MSR_IA32_APIC_BASE);
+
+   if (base & APIC_BASE_X2APIC_MODE) {
+      printk("LAPIC: x2APIC mode not supported\n");
+      return false;
+   }
+
+   paddr = (ulong)(base & APIC_BASE_ADDR_MASK);
+
+   if (!(va = hi_vmem_reserve(PAGE_SIZE)))
+      return false;
+
+   if (map_kernel_pages(va, paddr, 1, PAGING_FL_RW) != 1) {
+      hi_vmem_release(va, PAGE_SIZE);
+      return false;
+   }
+
+   lapic = va;
+   wrmsr(MSR_IA32_APIC_BASE, base | APIC_BASE_ENABLE);
+
+   /* Virtual wire mode: the PIC's INTR on LINT0 and the NMIs on LINT1 */
+   lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_DM_EXTINT);
+   lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_DM_NMI);
+   lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | (32 + LAPIC_SPURIOUS_IRQ));
+   return true;
+}
+
+/*
+ * Enable the local APIC of the current AP. All the local APICs are mapped at
+ * the same physical address, so `lapic` works here too. Only the BSP gets the
+ * PIC's IRQs: LINT0 and the timer are masked.
+ */
+void lapic_init_ap(void)
+{
+   ASSERT(!are_interrupts_enabled());
+   ASSERT(lapic != NULL);
+
+   wrmsr(MSR_IA32_APIC_BASE, rdmsr(MSR_IA32_APIC_BASE) | APIC_BASE_ENABLE);
+   lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+   lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+   lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_DM_NMI);
+   lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | (32 + LAPIC_SPURIOUS_IRQ));
+}
+
+u32 lapic_get_id(void)
+{
+   return lapic_read(LAPIC_ID) >> 24;
+}
+
+static void lapic_send_ipi(u32 apic_id, u32 icr)
+{
+   lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+   lapic_write(LAPIC_ICR_LOW, icr);
+
+   while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) { }
+}
+
+/* Send the interrupt `32 + irq` to the CPU `apic_id` */
+void lapic_send_fixed_ipi(u32 apic_id, int irq)
+{
+   ulong var;
+   disable_interrupts(&var);
+   {
+      lapic_send_ipi(apic_id,
+                     LAPIC_ICR_DM_FIXED | LAPIC_ICR_ASSERT | (u32)(32 + irq));
+   }
+   enable_interrupts(&var);
+}
+
+void lapic_send_init_ipi(u32 apic_id)
+{
+   /* Assert and de-assert INIT: the latter is required by the older CPUs */
+   lapic_send_ipi(apic_id,
+                  LAPIC_ICR_DM_INIT | LAPIC_ICR_LEVEL | LAPIC_ICR_ASSERT);
+   lapic_send_ipi(apic_id, LAPIC_ICR_DM_INIT | LAPIC_ICR_LEVEL);
+}
+
+/* Make the AP `apic_id` start in real mode at `paddr` (4 KB aligned, < 1 MB) */
+void lapic_send_startup_ipi(u32 apic_id, ulong paddr)
+{
+   ASSERT(!(paddr & (PAGE_SIZE - 1)));
+   ASSERT(paddr < 1 * MB);
+
+   lapic_send_ipi(apic_id,
+                  LAPIC_ICR_DM_STARTUP | LAPIC_ICR_ASSERT | (u32)(paddr >> 12));
+}
+
+bool hw_hrtimer_init(void)
+{
+   ASSERT(!are_interrupts_enabled());
+
+   if (!x86_cpu_features.edx1.tsc || !lapic_init())
+      return false;
+
+   use_tsc_deadline = x86_cpu_features.ecx1.tsc_deadline;
+
+   if (!lapic_calibrate())
+      return false;
+
+   lapic_write(LAPIC_LVT_TIMER,
+               (use_tsc_deadline
+                  ? LAPIC_TIMER_TSC_DEADLINE
+                  : LAPIC_TIMER_ONESHOT) | (32 + LAPIC_TIMER_IRQ));
+
+   tsc_start = RDTSC();
+   return true;
+}
+
+/*
+ * Compute the period of the timer tick of the APs, calibrating the timer of
+ * the local APIC if hw_hrtimer_init() didn't. Called by the BSP before starting
+ * the APs, with the interrupts disabled.
+ */
+bool lapic_setup_ap_tick(void)
+{
+   ASSERT(!are_interrupts_enabled());
+
+   if (!lapic_timer_hz && x86_cpu_features.edx1.tsc)
+      lapic_calibrate();
+
+   ap_tick_counts = (u32)(lapic_timer_hz / TIMER_HZ);
+   return ap_tick_counts > 0;
+}
+
+/* Start the periodic timer tick of the current AP */
+void lapic_start_ap_tick(void)
+{
+   ASSERT(!are_interrupts_enabled());
+   ASSERT(ap_tick_counts > 0);
+
+   lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+   lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | (32 + LAPIC_TIMER_IRQ));
+   lapic_write(LAPIC_TIMER_INIT_CNT, ap_tick_counts);
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+
+/*
+ * IRQ numbers (vector - 32) of the local APIC interrupts. They're above the
+ * ones of the PIC, which is still used for all the external IRQs.
+ */
+#define LAPIC_TIMER_IRQ            16
+#define LAPIC_RESCHED_IRQ          17      /* KRN_SMP only: see smp.c */
+#define LAPIC_CALL_IRQ             18      /* KRN_SMP only: see smp.c */
+#define LAPIC_SPURIOUS_IRQ         31
+
+#define LAPIC_FIRST_IRQ            LAPIC_TIMER_IRQ
+
+void lapic_handle_timer_irq(void);
+void lapic_handle_resched_irq(void);
+void lapic_eoi(void);
+
+bool lapic_init(void);
+void lapic_init_ap(void);
+u32 lapic_get_id(void);
+void lapic_send_init_ipi(u32 apic_id);
+void lapic_send_startup_ipi(u32 apic_id, ulong paddr);
+void lapic_send_fixed_ipi(u32 apic_id, int irq);
+bool lapic_setup_ap_tick(void);
+void lapic_start_ap_tick(void);
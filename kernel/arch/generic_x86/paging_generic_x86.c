@@ -9,6 +9,7 @@
 
 #include <tilck/kernel/paging.h>
 #include <tilck/kernel/paging_hw.h>
+#include <tilck/kernel/pageframes.h>
 #include <tilck/kernel/kmalloc.h>
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/system_mmap.h>
@@ -62,6 +63,137 @@ void invalidate_page(ulong vaddr)
    invalidate_page_hw(vaddr);
 }
 
+void tlb_batch_init(struct tlb_batch *b, pdir_t *pdir)
+{
+   b->pdir = pdir;
+   b->page_count = 0;
+   b->ranges_count = 0;
+   b->full_flush = false;
+   b->global = false;
+   b->frames_count = 0;
+}
+
+void tlb_batch_add(struct tlb_batch *b, ulong vaddr, size_t page_count)
+{
+   struct tlb_range *last;
+
+   if (vaddr >= KERNEL_BASE_VA)
+      b->global = true;
+
+   if (b->full_flush)
+      return;
+
+   b->page_count += page_count;
+
+   if (b->page_count > TLB_BATCH_MAX_INVLPG) {
+      b->full_flush = true;
+      return;
+   }
+
+   if (b->ranges_count > 0) {
+
+      last = &b->ranges[b->ranges_count - 1];
+
+      if (last->vaddr + (last->page_count << PAGE_SHIFT) == vaddr) {
+         last->page_count += page_count;
+         return;
+      }
+   }
+
+   if (b->ranges_count == TLB_BATCH_MAX_RANGES) {
+      b->full_flush = true;
+      return;
+   }
+
+   b->ranges[b->ranges_count++] = (struct tlb_range) {
+      .vaddr = vaddr,
+      .page_count = page_count,
+   };
+}
+
+/* Invalidate the TLB entries of the batch on the current CPU */
+static void tlb_batch_flush_local(void *arg)
+{
+   struct tlb_batch *b = arg;
+   ulong cr4;
+
+   /* Without PCIDs, the TLB has only the entries of the current pdir */
+   if (!b->global && b->pdir && b->pdir != get_curr_pdir())
+      return;
+
+   if (b->full_flush) {
+
+      if (b->global) {
+
+         /* Reloading CR3 does not flush the global pages: toggle PGE */
+         cr4 = read_cr4();
+         write_cr4(cr4 & ~CR4_PGE);
+         write_cr4(cr4);
+
+      } else {
+
+         set_curr_pdir(get_curr_pdir());
+      }
+
+   } else {
+
+      for (u32 i = 0; i < b->ranges_count; i++) {
+
+         ulong va = b->ranges[i].vaddr;
+
+         for (size_t j = 0; j < b->ranges[i].page_count; j++, va += PAGE_SIZE)
+            invalidate_page_hw(va);
+      }
+   }
+}
+
+/*
+ * Free `frame` once the TLB entries of the ranges added so far are gone. The
+ * range mapping `frame` must have been already added to the batch.
+ */
+void tlb_batch_free_frame(struct tlb_batch *b, void *frame)
+{
+   if (b->frames_count == TLB_BATCH_MAX_FRAMES)
+      tlb_batch_flush(b);
+
+   b->frames[b->frames_count++] = frame;
+}
+
+void tlb_batch_flush(struct tlb_batch *b)
+{
+   u32 other_cpus;
+   ulong var;
+
+   if (b->page_count || b->full_flush) {
+
+      /* Stay on this CPU: it's not among the `other_cpus` */
+      disable_interrupts(&var);
+      {
+         tlb_batch_flush_local(b);
+         other_cpus = smp_get_pdir_users(b->global ? NULL : b->pdir);
+
+         if (other_cpus)
+            smp_call(other_cpus, &tlb_batch_flush_local, b);
+      }
+      enable_interrupts(&var);
+   }
+
+   /* Now no CPU can access the unmapped pageframes anymore */
+   for (u32 i = 0; i < b->frames_count; i++)
+      pf_free(b->frames[i]);
+
+   tlb_batch_init(b, b->pdir);
+}
+
+void tlb_invalidate(pdir_t *pdir, ulong vaddr, size_t page_count)
+{
+   struct tlb_batch b;
+
+   tlb_batch_init(&b, pdir);
+   tlb_batch_add(&b, vaddr, page_count);
+   tlb_batch_flush(&b);
+}
+
 void init_paging(void)
 {
    int rc;
@@ -95,10 +227,11 @@ void init_paging(void)
    init_hi_vmem_heap();
 
    /*
-    * Now use the just-created hi vmem heap to reserve a page for the user
-    * vdso-like page and expect it to be == USER_VDSO_VADDR.
+    * Now use the just-created hi vmem heap to reserve two pages for the user
+    * vdso-like page and its vvar page and expect them to be at
+    * USER_VDSO_VADDR.
     */
-   user_vdso_vaddr = hi_vmem_reserve(PAGE_SIZE);
+   user_vdso_vaddr = hi_vmem_reserve(2 * PAGE_SIZE);
 
    if (user_vdso_vaddr != (void *)USER_VDSO_VADDR)
       panic("user_vdso_vaddr != USER_VDSO_VADDR");
@@ -114,6 +247,18 @@ void init_paging(void)
 
    if (rc < 0)
       panic("Unable to map the vdso-like page");
+
+   /*
+    * Map the vvar page, read-only for userspace. The kernel updates it
+    * through its regular (linear) mapping.
+    */
+   rc = map_page(get_kernel_pdir(),
+                 (void *)USER_VVAR_VADDR,
+                 KERNEL_VA_TO_PA(&vvar_page),
+                 PAGING_FL_US);
+
+   if (rc < 0)
+      panic("Unable to map the vvar page");
 }
 
 void *
@@ -133,6 +278,7 @@ map_framebuffer(pdir_t *pdir,
    const size_t page_count = pow2_round_up_at(size, PAGE_SIZE) / PAGE_SIZE;
    const u32 pg_flags = PAGING_FL_RW                     |
                         PAGING_FL_SHARED                 |
+                        PAGING_FL_BIG_PAGES_ALLOWED      |
                         (user_mmap ? PAGING_FL_US : 0);
 
    if (!vaddr) {
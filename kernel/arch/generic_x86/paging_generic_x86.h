@@ -23,6 +23,22 @@
  */
 #define PAGE_SHARED                            (1 << 1)
 
+/*
+ * When this flag is set in the 'avail' bits in page_dir_entry_t, it means that
+ * the page table is shared with other page directories after fork() and that
+ * it has been made read-only for that reason. On the first write attempt, the
+ * page table is copied. See pdir_clone().
+ */
+#define PAGE_PT_SHARED                         (1 << 2)
+
+/*
+ * When this flag is set in the 'avail' bits in page_t, it means that the page
+ * has been released with madvise(MADV_FREE): if it's still clean (not written
+ * since then) when we run out of memory, its pageframe can be reclaimed by
+ * mapping the zero page there. See reclaim_lazy_free_pages().
+ */
+#define PAGE_LAZY_FREE                         (1 << 2)
+
 
 /* ---------------------------------------------- */
 
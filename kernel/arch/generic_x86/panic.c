@@ -117,6 +117,9 @@ NORETURN void panic(const char *fmt, ...)
    struct task *curr;
    bool panic_triggered_df = false;
 
+   /* Halt all the other CPUs: from now on, we're the only one running */
+   smp_stop_other_cpus();
+
    if (!kopt_panic_kb) {
 
       /* No interrupts: we're in a panic state */
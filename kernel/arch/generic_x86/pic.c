@@ -3,6 +3,7 @@
 #include <tilck_gen_headers/config_debug.h>
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/timer.h>
+#include <tilck/kernel/spinlock.h>
 
 #include "pic.h"
 
@@ -31,6 +32,13 @@
 #define ICW4_BUF_MASTER     0x0C     /* Buffered mode/master */
 #define ICW4_SFNM           0x10     /* Special fully nested (not) */
 
+/*
+ * With SMP, the IRQ handlers run only on the BSP, but the IRQs can be masked
+ * and unmasked by any CPU: the read-modify-write sequences on the PIC's
+ * registers must be atomic across the CPUs.
+ */
+static struct spinlock pic_lock;
+
 static NO_INLINE void pic_io_wait(void)
 {
    if (in_hypervisor())
@@ -105,7 +113,7 @@ void pic_send_eoi(int __irq)
    u8 irq = (u8)__irq;
    ASSERT(IN_RANGE_INC(__irq, 0, 16));
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&pic_lock, &var);
    {
       if (irq < 8) {
 
@@ -117,7 +125,7 @@ void pic_send_eoi(int __irq)
          outb(PIC1_COMMAND, PIC_SPEC_EOI | PIC_CASCADE);
       }
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&pic_lock, &var);
 }
 
 void pic_mask_and_send_eoi(int __irq)
@@ -127,7 +135,7 @@ void pic_mask_and_send_eoi(int __irq)
    u8 irq_mask;
    ASSERT(IN_RANGE_INC(__irq, 0, 16));
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&pic_lock, &var);
    {
       if (irq < 8) {
 
@@ -146,7 +154,7 @@ void pic_mask_and_send_eoi(int __irq)
          outb(PIC1_COMMAND, PIC_SPEC_EOI | PIC_CASCADE);
       }
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&pic_lock, &var);
 }
 
 void irq_set_mask(int irq)
@@ -173,13 +181,13 @@ void irq_set_mask(int irq)
       irq -= 8;
    }
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&pic_lock, &var);
    {
       irq_mask = inb(port);
       irq_mask |= (1 << irq);
       outb(port, irq_mask);
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&pic_lock, &var);
 }
 
 void irq_clear_mask(int irq)
@@ -196,13 +204,13 @@ void irq_clear_mask(int irq)
       irq -= 8;
    }
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&pic_lock, &var);
    {
       irq_mask = inb(port);
       irq_mask &= ~(1 << irq);
       outb(port, irq_mask);
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&pic_lock, &var);
 }
 
 bool irq_is_masked(int irq)
@@ -211,14 +219,14 @@ bool irq_is_masked(int irq)
    bool res;
    ASSERT(IN_RANGE_INC(irq, 0, 16));
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&pic_lock, &var);
    {
       if (irq < 8)
          res = inb(PIC1_IMR) & (1 << irq);
       else
          res = inb(PIC2_IMR) & (1 << (irq - 8));
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&pic_lock, &var);
    return res;
 }
 
@@ -258,14 +266,18 @@ bool pic_is_spur_irq(int irq)
 
    if (irq == 7) {
 
+      spin_lock(&pic_lock);
       outb(PIC1_COMMAND, PIC_READ_ISR);
       u8 isr = inb(PIC1_COMMAND);
+      spin_unlock(&pic_lock);
       return !(isr & (1 << 7));
 
    } else if (irq == 15) {
 
+      spin_lock(&pic_lock);
       outb(PIC2_COMMAND, PIC_READ_ISR);
       u8 isr = inb(PIC2_COMMAND);
+      spin_unlock(&pic_lock);
 
       if (!(isr & (1 << 7))) {
          pic_send_eoi(PIC_CASCADE);
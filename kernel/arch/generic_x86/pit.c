@@ -5,12 +5,19 @@
 #include <tilck/kernel/timer.h>
 #include <tilck/kernel/datetime.h>
 
+#include "pit.h"
+
 #define PIT_FREQ           1193182
 
 #define PIT_CMD_PORT          0x43
 #define PIT_CH0_PORT          0x40
 #define PIT_CH1_PORT          0x41
 #define PIT_CH2_PORT          0x42
+#define PIT_CH2_CTRL_PORT     0x61   // NMI status and control register
+
+#define PIT_CH2_GATE    0b00000001   // ctrl: channel 2 gate
+#define PIT_CH2_SPKR    0b00000010   // ctrl: speaker data enable
+#define PIT_CH2_OUT     0b00100000   // ctrl: state of the channel 2 OUT pin
 
 #define PIT_MODE_BIN    0b00000000
 #define PIT_MODE_BCD    0b00000001
@@ -31,6 +38,14 @@
 #define PIT_CH2         0b10000000   // select channel 2
 
 #define PIT_READ_BACK   0b11000000   // read-back command (8254 only)
+#define PIT_RB_CH0      0b00000010   // read-back: select channel 0
+
+#define PIT_ST_OUT      0b10000000   // status: state of the OUT pin
+#define PIT_ST_NULL     0b01000000   // status: count not loaded yet
+
+static u32 pit_divisor;              /* PIT counts per regular tick */
+static u32 pit_oneshot_count;        /* PIT counts of the one-shot timer */
+static u32 pit_oneshot_phase;        /* counts of the tick elapsed before it */
 
 /*
  * Set the time between ticks to be `interval`, where 1 means 1/TS_SCALE sec.
@@ -82,5 +97,100 @@ u32 hw_timer_setup(u32 interval)
    outb(PIT_CH0_PORT, divisor & 0xff);            /* Set low byte of divisor */
    outb(PIT_CH0_PORT, (divisor >> 8) & 0xff);     /* Set high byte of divisor */
 
+   pit_divisor = divisor;
    return (u32)actual_interval;
 }
+
+/*
+ * Max number of regular ticks that a one-shot timer can cover: the PIT has a
+ * 16-bit counter, which means ~55 ms at most.
+ */
+u32 hw_timer_oneshot_max_ticks(void)
+{
+   return 0xffff / pit_divisor;
+}
+
+/*
+ * Make the timer to fire just once, after `ticks` regular ticks, instead of
+ * periodically. Returns the number of ticks actually programmed. Call
+ * hw_timer_setup() to go back to the periodic mode.
+ */
+u32 hw_timer_setup_oneshot(u32 ticks)
+{
+   ticks = MIN(ticks, hw_timer_oneshot_max_ticks());
+   pit_oneshot_count = ticks * pit_divisor;
+   pit_oneshot_phase = 0;
+
+   outb(PIT_CMD_PORT, PIT_MODE_BIN | PIT_MODE_0 | PIT_ACC_LOHI | PIT_CH0);
+   outb(PIT_CH0_PORT, pit_oneshot_count & 0xff);
+   outb(PIT_CH0_PORT, (pit_oneshot_count >> 8) & 0xff);
+   return ticks;
+}
+
+/*
+ * Called when the CPU woke up before the one-shot timer fired. Gets the number
+ * of whole regular ticks elapsed since the one-shot timer has been programmed
+ * and re-arms it to fire exactly on the next tick boundary: the partial tick is
+ * carried forward and the periodic ticks keep their phase. Returns false when
+ * the timer has already fired or it's just about to: in that case, its IRQ will
+ * follow and nothing is changed.
+ */
+bool hw_timer_oneshot_rearm(u32 *ticks)
+{
+   u32 status, count, elapsed;
+
+   /* Latch both the status and the count of channel 0 */
+   outb(PIT_CMD_PORT, PIT_READ_BACK | PIT_RB_CH0);
+   status = inb(PIT_CH0_PORT);
+   count = inb(PIT_CH0_PORT);
+   count |= (u32)inb(PIT_CH0_PORT) << 8;
+
+   if (status & PIT_ST_NULL)
+      count = pit_oneshot_count;    /* The counter didn't even start */
+   else if ((status & PIT_ST_OUT) || count < pit_divisor / 8)
+      return false;
+
+   elapsed = pit_oneshot_phase + pit_oneshot_count - count;
+   *ticks = elapsed / pit_divisor;
+
+   /*
+    * Mode 0 restarts counting when a new count is loaded. The few counts
+    * elapsed while reprogramming the PIT are not compensated: they're way less
+    * than the IRQ latency anyway.
+    */
+   pit_oneshot_phase = elapsed % pit_divisor;
+   pit_oneshot_count = pit_divisor - pit_oneshot_phase;
+
+   outb(PIT_CMD_PORT, PIT_MODE_BIN | PIT_MODE_0 | PIT_ACC_LOHI | PIT_CH0);
+   outb(PIT_CH0_PORT, pit_oneshot_count & 0xff);
+   outb(PIT_CH0_PORT, (pit_oneshot_count >> 8) & 0xff);
+   return true;
+}
+
+/*
+ * Busy-wait for `ms` milliseconds using the PIT's channel 2, which is not
+ * connected to any IRQ and, therefore, works with the interrupts disabled as
+ * well. Used to calibrate the other timers. The max supported value is ~54 ms.
+ */
+void pit_busy_wait_ms(u32 ms)
+{
+   const u32 count = PIT_FREQ * ms / 1000;
+   u8 ctrl;
+
+   ASSERT(count <= 0xffff);
+
+   /* Keep the speaker off and the gate low, while programming the counter */
+   ctrl = inb(PIT_CH2_CTRL_PORT) & ~(PIT_CH2_GATE | PIT_CH2_SPKR);
+   outb(PIT_CH2_CTRL_PORT, ctrl);
+
+   outb(PIT_CMD_PORT, PIT_MODE_BIN | PIT_MODE_0 | PIT_ACC_LOHI | PIT_CH2);
+   outb(PIT_CH2_PORT, count & 0xff);
+   outb(PIT_CH2_PORT, (count >> 8) & 0xff);
+
+   /* Start counting: in mode 0, OUT goes high on terminal count */
+   outb(PIT_CH2_CTRL_PORT, ctrl | PIT_CH2_GATE);
+
+   while (!(inb(PIT_CH2_CTRL_PORT) & PIT_CH2_OUT)) { }
+
+   outb(PIT_CH2_CTRL_PORT, ctrl);
+}
@@ -0,0 +1,5 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+
+void pit_busy_wait_ms(u32 ms);
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/clocksource.h>
+
+static u64 tsc_read(void)
+{
+   return RDTSC();
+}
+
+static struct clocksource tsc_clocksource = {
+   .name = "tsc",
+   .read = &tsc_read,
+   .vdso = true,
+};
+
+/*
+ * Returns the best clock source available on this machine, which is still
+ * to be calibrated, or NULL if there's none.
+ */
+struct clocksource *hw_get_clocksource(void)
+{
+   if (!x86_cpu_features.edx1.tsc)
+      return NULL;
+
+   return &tsc_clocksource;
+}
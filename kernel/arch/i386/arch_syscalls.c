@@ -227,7 +227,7 @@ static struct syscall syscalls[MAX_SYSCALLS] =
    [157] = DECL_SYS(sys_sched_getscheduler, 0),
    [158] = DECL_SYS(sys_sched_yield, 0),
    [159] = DECL_SYS(sys_sched_get_priority_max, 0),
-   [160] = DECL_SYS(sys_sched_set_priority_min, 0),
+   [160] = DECL_SYS(sys_sched_get_priority_min, 0),
    [161] = DECL_SYS(sys_sched_rr_get_interval_time32, 0),
    [162] = DECL_SYS(sys_nanosleep_time32, 0),
    [163] = DECL_SYS(sys_mremap, 0),
@@ -614,6 +614,13 @@ void handle_syscall(regs_t *r)
    set_current_task_in_user_mode();
 }
 
+/* The MSRs are per-CPU: with SMP, the APs call this function as well */
+void setup_sysenter_interface(void)
+{
+   wrmsr(MSR_IA32_SYSENTER_CS, X86_KERNEL_CODE_SEL);
+   wrmsr(MSR_IA32_SYSENTER_EIP, (ulong) &sysenter_entry);
+}
+
 void init_syscall_interfaces(void)
 {
    /* Set the entry for the int 0x80 syscall interface */
@@ -623,7 +630,6 @@ void init_syscall_interfaces(void)
                  IDT_FLAG_PRESENT | IDT_FLAG_INT_GATE | IDT_FLAG_DPL3);
 
    /* Setup the sysenter interface */
-   wrmsr(MSR_IA32_SYSENTER_CS, X86_KERNEL_CODE_SEL);
-   wrmsr(MSR_IA32_SYSENTER_EIP, (ulong) &sysenter_entry);
+   setup_sysenter_interface();
 }
 
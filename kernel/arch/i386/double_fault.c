@@ -25,7 +25,7 @@ static const struct tss_entry df_tss_data = {
    .es = X86_KERNEL_DATA_SEL,
    .ss = X86_KERNEL_DATA_SEL,
    .ds = X86_KERNEL_DATA_SEL,
-   .fs = X86_KERNEL_DATA_SEL,
+   .fs = X86_KERNEL_FS_SEL,
    .gs = X86_KERNEL_DATA_SEL,
    .esp = ((ulong)kernel_initial_stack + PAGE_SIZE - 4),
 };
@@ -10,6 +10,7 @@
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/user.h>
 #include <tilck/kernel/syscalls.h>
+#include <tilck/kernel/spinlock.h>
 
 #include "gdt_int.h"
 #include "double_fault.h"
@@ -43,8 +44,55 @@ static s32 *gdt_refcount = initial_gdt_refcount_in_bss;
  */
 
 struct tss_entry tss_array[2] ALIGNED_AT(PAGE_SIZE);
+static struct spinlock gdt_lock;
 
-static void load_gdt(struct gdt_entry *gdt, u32 entries_count);
+#if SMP_ENABLED
+
+/*
+ * With SMP, each AP has its own copy of the GDT and its own TSS (the BSP uses
+ * `gdt` and `tss_array[TSS_MAIN]`): the entries of the TSS (5) and of the
+ * per-CPU data (6) differ between CPUs, as well as the TLS entries loaded by
+ * gdt_load_task_tls(). All the other entries are the same in every copy and
+ * they are changed holding `gdt_lock`.
+ */
+static struct gdt_entry *ap_gdt[MAX_CPUS];
+static struct tss_entry ap_tss[MAX_CPUS] ALIGNED_AT(PAGE_SIZE);
+
+static ALWAYS_INLINE struct gdt_entry *this_cpu_gdt(void)
+{
+   const u32 id = get_cpu_id();
+   return id ? ap_gdt[id] : gdt;
+}
+
+static ALWAYS_INLINE struct tss_entry *this_cpu_tss(void)
+{
+   const u32 id = get_cpu_id();
+   return id ? &ap_tss[id] : &tss_array[TSS_MAIN];
+}
+
+#else
+
+static ALWAYS_INLINE struct gdt_entry *this_cpu_gdt(void)
+{
+   return gdt;
+}
+
+static ALWAYS_INLINE struct tss_entry *this_cpu_tss(void)
+{
+   return &tss_array[TSS_MAIN];
+}
+
+#endif
+
+static void load_gdt(struct gdt_entry *g, u32 entries_count);
+
+static ALWAYS_INLINE void load_percpu_seg(void)
+{
+   asmVolatile("mov %w0, %%fs"
+               : /* no output */
+               : "q" (X86_KERNEL_FS_SEL)
+               : "memory");
+}
 
 
 void
@@ -76,40 +124,54 @@ gdt_set_entry(struct gdt_entry *e,
    e->flags = flags & 0xf;
 }
 
+/* Write the entry `n` in all the copies of the GDT. Call with gdt_lock held */
+static void write_entry_num(u32 n, const struct gdt_entry *e)
+{
+   gdt[n] = *e;
+
+#if SMP_ENABLED
+   for (u32 i = 1; i < MAX_CPUS; i++)
+      if (ap_gdt[i])
+         ap_gdt[i][n] = *e;
+#endif
+}
+
 static void
 set_entry_num(u32 n, struct gdt_entry *e)
 {
    ulong var;
-   disable_interrupts(&var);
+   spin_lock_irqsave(&gdt_lock, &var);
    {
       ASSERT(n < gdt_size);
       ASSERT(gdt_refcount[n] >= 0);
 
-      gdt[n] = *e;
+      write_entry_num(n, e);
       gdt_refcount[n]++;
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&gdt_lock, &var);
 }
 
 void gdt_clear_entry(u32 n)
 {
+   static const struct gdt_entry null_entry;
    ulong var;
-   disable_interrupts(&var);
+
+   spin_lock_irqsave(&gdt_lock, &var);
    {
       ASSERT(n < gdt_size);
       ASSERT(gdt_refcount[n] > 0);
 
       if (--gdt_refcount[n] == 0) {
-         bzero(&gdt[n], sizeof(struct gdt_entry));
+         write_entry_num(n, &null_entry);
       }
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&gdt_lock, &var);
 }
 
 void gdt_entry_inc_ref_count(u32 n)
 {
    ulong var;
-   disable_interrupts(&var);
+   spin_lock_irqsave(&gdt_lock, &var);
    {
       ASSERT(n < gdt_size);
       ASSERT(gdt_refcount[n] > 0);
@@ -117,7 +179,7 @@ void gdt_entry_inc_ref_count(u32 n)
 
       gdt_refcount[n]++;
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&gdt_lock, &var);
 }
 
 static void
@@ -132,17 +194,42 @@ set_entry_num2(u32 n,
    set_entry_num(n, &e);
 }
 
+/* The pointer to the copy of the GDT used by `cpu` */
+static ALWAYS_INLINE struct gdt_entry **gdt_copy_ref(u32 cpu)
+{
+#if SMP_ENABLED
+   return cpu ? &ap_gdt[cpu] : &gdt;
+#else
+   return &gdt;
+#endif
+}
+
+static void gdt_reload(void *arg)
+{
+   load_gdt(this_cpu_gdt(), gdt_size);
+}
+
+static void
+gdt_free_copies(struct gdt_entry **copies, u32 size)
+{
+   for (u32 i = 0; i < MAX_CPUS; i++)
+      if (copies[i] && copies[i] != initial_gdt_in_bss)
+         kfree_array_obj(copies[i], struct gdt_entry, size);
+}
+
 static NODISCARD int gdt_expand(void)
 {
-   void *old_gdt_ptr;
+   struct gdt_entry *new_copies[MAX_CPUS] = {0};
+   struct gdt_entry *old_copies[MAX_CPUS] = {0};
    void *old_gdt_refcount_ptr;
+   void *new_gdt_refcount;
    u32 old_gdt_size;
    u32 new_size;
+   u32 mask = 0;
 
    ASSERT(are_interrupts_enabled());
    disable_preemption();
    {
-      old_gdt_ptr = gdt;
       old_gdt_refcount_ptr = gdt_refcount;
       old_gdt_size = gdt_size;
       new_size = gdt_size * 2;
@@ -152,43 +239,64 @@ static NODISCARD int gdt_expand(void)
          return -ENOMEM;
       }
 
-      void *new_gdt = kzalloc_array_obj(struct gdt_entry, new_size);
-      void *new_gdt_refcount;
+      /* With SMP, each CPU has its copy of the GDT: see `ap_gdt` */
+      for (u32 i = 0; i < MAX_CPUS; i++) {
 
-      if (!new_gdt) {
-         enable_preemption();
-         return -ENOMEM;
+         if (!*gdt_copy_ref(i))
+            continue;
+
+         new_copies[i] = kzalloc_array_obj(struct gdt_entry, new_size);
+
+         if (!new_copies[i]) {
+            gdt_free_copies(new_copies, new_size);
+            enable_preemption();
+            return -ENOMEM;
+         }
       }
 
       new_gdt_refcount = kzalloc_array_obj(s32, new_size);
 
       if (!new_gdt_refcount) {
-         kfree2(new_gdt, new_size);
+         gdt_free_copies(new_copies, new_size);
          enable_preemption();
          return -1;
       }
 
-      memcpy(new_gdt, gdt, sizeof(struct gdt_entry) * gdt_size);
-      memcpy(new_gdt_refcount, gdt_refcount, sizeof(s32) * gdt_size);
-
-      disable_interrupts_forced();
+      spin_lock_irq(&gdt_lock);
       {
-         gdt = new_gdt;
+         memcpy(new_gdt_refcount, gdt_refcount, sizeof(s32) * gdt_size);
+
+         for (u32 i = 0; i < MAX_CPUS; i++) {
+
+            struct gdt_entry **ref = gdt_copy_ref(i);
+
+            if (!new_copies[i])
+               continue;
+
+            memcpy(new_copies[i], *ref, sizeof(struct gdt_entry) * gdt_size);
+            old_copies[i] = *ref;
+            *ref = new_copies[i];
+
+            if (i != get_cpu_id())
+               mask |= (1u << i);
+         }
+
          gdt_size = new_size;
          gdt_refcount = new_gdt_refcount;
-         load_gdt(new_gdt, new_size);
+         gdt_reload(NULL);
+
+         /* The other CPUs must stop using their old copy before we free it */
+         if (mask)
+            smp_call(mask, &gdt_reload, NULL);
       }
-      enable_interrupts_forced();
+      spin_unlock_irq(&gdt_lock);
    }
    enable_preemption();
 
-   if (old_gdt_ptr != initial_gdt_in_bss) {
+   gdt_free_copies(old_copies, old_gdt_size);
 
-      ASSERT(old_gdt_refcount_ptr != initial_gdt_refcount_in_bss);
-
-      kfree_array_obj(old_gdt_ptr, struct gdt_entry, old_gdt_size);
+   if (old_gdt_refcount_ptr != initial_gdt_refcount_in_bss)
       kfree_array_obj(old_gdt_refcount_ptr, s32, old_gdt_size);
-   }
 
    return 0;
 }
@@ -229,9 +337,11 @@ void set_kernel_stack(ulong stack)
    ulong var;
    disable_interrupts(&var);
    {
+      struct tss_entry *tss = this_cpu_tss();
+
       /* Kernel stack segment = data seg */
-      tss_array[TSS_MAIN].ss0 = X86_KERNEL_DATA_SEL;
-      tss_array[TSS_MAIN].esp0 = stack;
+      tss->ss0 = X86_KERNEL_DATA_SEL;
+      tss->esp0 = stack;
       wrmsr(MSR_IA32_SYSENTER_ESP, stack);
    }
    enable_interrupts(&var);
@@ -318,6 +428,17 @@ void init_segmentation(void)
                   GDT_DESC_TYPE_TSS | GDT_ACCESS_PL0,
                   GDT_GRAN_BYTE | GDT_32BIT);
 
+#if SMP_ENABLED
+
+   /* Per-CPU data segment: see struct cpu */
+   set_entry_num2(6,
+                  (ulong)get_cpu(0),
+                  sizeof(struct cpu) - 1,
+                  GDT_ACC_REG | GDT_ACCESS_PL0 | GDT_ACCESS_RW,
+                  GDT_GRAN_BYTE | GDT_32BIT);
+
+#endif
+
    /* Register other special GDT entires */
    register_double_fault_tss_entry();
 
@@ -326,8 +447,103 @@ void init_segmentation(void)
 
    /* Load the TSS */
    load_tss(5 /* TSS index in GDT */, 0 /* priv. level */);
+
+   if (SMP_ENABLED)
+      load_percpu_seg();
 }
 
+#if SMP_ENABLED
+
+/*
+ * Before init_segmentation(), the per-CPU data is already needed (e.g. by
+ * get_curr_task()): use a minimal GDT, just with the kernel segments, in the
+ * meanwhile. The code and data segment registers keep the values set by the
+ * bootloader, exactly like after init_segmentation(), until the first
+ * interrupt or fault.
+ */
+void init_segmentation_early(void)
+{
+   static struct gdt_entry early_gdt[7];
+
+   gdt_set_entry(&early_gdt[1],
+                 0,
+                 GDT_LIMIT_MAX,
+                 GDT_ACC_REG | GDT_ACCESS_PL0 | GDT_ACCESS_RW | GDT_ACCESS_EX,
+                 GDT_GRAN_4KB | GDT_32BIT);
+
+   gdt_set_entry(&early_gdt[2],
+                 0,
+                 GDT_LIMIT_MAX,
+                 GDT_ACC_REG | GDT_ACCESS_PL0 | GDT_ACCESS_RW,
+                 GDT_GRAN_4KB | GDT_32BIT);
+
+   gdt_set_entry(&early_gdt[6],
+                 (ulong)get_cpu(0),
+                 sizeof(struct cpu) - 1,
+                 GDT_ACC_REG | GDT_ACCESS_PL0 | GDT_ACCESS_RW,
+                 GDT_GRAN_BYTE | GDT_32BIT);
+
+   load_gdt(early_gdt, ARRAY_SIZE(early_gdt));
+   load_percpu_seg();
+}
+
+/*
+ * Prepare the copy of the GDT and the TSS of the AP `cpu`, before starting it.
+ * Called by the BSP with the preemption disabled.
+ */
+bool gdt_setup_ap(u32 cpu)
+{
+   struct gdt_entry *copy;
+   struct gdt_entry e;
+
+   ASSERT(cpu > 0 && cpu < MAX_CPUS);
+   ASSERT(!is_preemption_enabled());
+
+   if (!(copy = kzalloc_array_obj(struct gdt_entry, gdt_size)))
+      return false;
+
+   ap_tss[cpu].ss0 = X86_KERNEL_DATA_SEL;
+
+   spin_lock_irq(&gdt_lock);
+   {
+      memcpy(copy, gdt, sizeof(struct gdt_entry) * gdt_size);
+
+      gdt_set_entry(&e,
+                    (ulong)&ap_tss[cpu],
+                    sizeof(ap_tss[cpu]),
+                    GDT_DESC_TYPE_TSS | GDT_ACCESS_PL0,
+                    GDT_GRAN_BYTE | GDT_32BIT);
+
+      copy[5] = e;
+
+      gdt_set_entry(&e,
+                    (ulong)get_cpu(cpu),
+                    sizeof(struct cpu) - 1,
+                    GDT_ACC_REG | GDT_ACCESS_PL0 | GDT_ACCESS_RW,
+                    GDT_GRAN_BYTE | GDT_32BIT);
+
+      copy[6] = e;
+      ap_gdt[cpu] = copy;
+   }
+   spin_unlock_irq(&gdt_lock);
+   return true;
+}
+
+/* Called by the AP `cpu` itself, with the interrupts disabled */
+void gdt_load_ap(u32 cpu)
+{
+   /*
+    * No gdt_lock here: without FS, we couldn't wait for it (see smp.c).
+    * Nothing can expand the GDT now anyway, because the BSP holds the big
+    * kernel lock while starting the APs.
+    */
+   load_gdt(ap_gdt[cpu], gdt_size);
+   load_tss(5 /* TSS index in GDT */, 0 /* priv. level */);
+   load_percpu_seg();
+}
+
+#endif
+
 static void DEBUG_set_thread_area(struct user_desc *d)
 {
    printk(NO_PREFIX "set_thread_area(e: %i,\n"
@@ -352,9 +568,8 @@ static void DEBUG_set_thread_area(struct user_desc *d)
                     d->useable);
 }
 
-static int find_available_slot_in_user_task(void)
+static int find_available_slot_in_user_task(struct process *pi)
 {
-   struct process *pi = get_curr_proc();
    arch_proc_members_t *arch = get_proc_arch_fields(pi);
 
    for (int i = 0; i < ARRAY_SIZE(arch->gdt_entries); i++)
@@ -364,9 +579,9 @@ static int find_available_slot_in_user_task(void)
    return -1;
 }
 
-static int get_user_task_slot_for_gdt_entry(u32 gdt_entry_num)
+static int
+get_user_task_slot_for_gdt_entry(struct process *pi, u32 gdt_entry_num)
 {
-   struct process *pi = get_curr_proc();
    arch_proc_members_t *arch = get_proc_arch_fields(pi);
 
    for (int i = 0; i < ARRAY_SIZE(arch->gdt_entries); i++)
@@ -381,101 +596,137 @@ static void gdt_set_slot(struct process *pi, u16 slot, u16 gdt_index)
    get_proc_arch_fields(pi)->gdt_entries[slot] = gdt_index;
 }
 
-int sys_set_thread_area(void *arg)
+static void
+set_task_tls_desc(struct task *ti, u32 gdt_index, struct gdt_entry *e)
 {
-   int rc = 0;
-   struct gdt_entry e = {0};
-   struct user_desc dc;
-   struct user_desc *ud = arg;
+   arch_task_members_t *arch = get_task_arch_fields(ti);
+   STATIC_ASSERT(sizeof(arch->tls_desc) == sizeof(*e));
 
-   rc = copy_from_user(&dc, ud, sizeof(struct user_desc));
+   arch->tls_gdt_index = (u16)gdt_index;
+   memcpy(arch->tls_desc, e, sizeof(*e));
+}
 
-   if (rc != 0)
-      return -EFAULT;
+/*
+ * The GDT entries are per-process, but the threads of a process share them
+ * with different base addresses (e.g. libmusl's pthread_create() passes to
+ * clone() the entry number used by the main thread). Therefore, each task
+ * keeps its own copy of its TLS descriptor, loaded in the GDT by
+ * switch_to_task() through this function.
+ */
+void gdt_load_task_tls(struct task *ti)
+{
+   arch_task_members_t *arch = get_task_arch_fields(ti);
 
-   disable_preemption();
+   ASSERT(!is_preemption_enabled());
+   ASSERT(arch->tls_gdt_index < gdt_size);
+
+   memcpy(&this_cpu_gdt()[arch->tls_gdt_index],
+          arch->tls_desc,
+          sizeof(struct gdt_entry));
+}
+
+/*
+ * Set the TLS segment of `ti`, which can be the current task or one of its
+ * threads just created by clone(). In the latter case, the GDT is not touched
+ * here: the new descriptor will be loaded when switching to the new task.
+ */
+int set_task_thread_area(struct task *ti, struct user_desc *dc)
+{
+   struct process *pi = ti->pi;
+   struct gdt_entry e = {0};
+   int slot;
 
-   if (!(dc.flags == USER_DESC_FLAGS_EMPTY && !dc.base_addr && !dc.limit)) {
-      gdt_set_entry(&e, dc.base_addr, dc.limit, 0, 0);
+   ASSERT(!is_preemption_enabled());
+
+   if (!(dc->flags == USER_DESC_FLAGS_EMPTY && !dc->base_addr && !dc->limit)) {
+      gdt_set_entry(&e, dc->base_addr, dc->limit, 0, 0);
       e.s = 1;
       e.dpl = 3;
-      e.d = dc.seg_32bit;
-      e.type |= (dc.contents << 2);
-      e.type |= !dc.read_exec_only ? GDT_ACCESS_RW : 0;
-      e.g = dc.limit_in_pages;
-      e.avl = dc.useable;
-      e.p = !dc.seg_not_present;
+      e.d = dc->seg_32bit;
+      e.type |= (dc->contents << 2);
+      e.type |= !dc->read_exec_only ? GDT_ACCESS_RW : 0;
+      e.g = dc->limit_in_pages;
+      e.avl = dc->useable;
+      e.p = !dc->seg_not_present;
    } else {
       /* The user passed an empty descriptor: entry_number cannot be -1 */
-      if (dc.entry_number == INVALID_ENTRY_NUM) {
-         rc = -EINVAL;
-         goto out;
-      }
+      if (dc->entry_number == INVALID_ENTRY_NUM)
+         return -EINVAL;
    }
 
-   if (dc.entry_number == INVALID_ENTRY_NUM) {
-
-      int slot = find_available_slot_in_user_task();
+   if (dc->entry_number == INVALID_ENTRY_NUM) {
 
-      if (slot < 0) {
-         rc = -ESRCH;
-         goto out;
-      }
+      if ((slot = find_available_slot_in_user_task(pi)) < 0)
+         return -ESRCH;
 
-      dc.entry_number = (u32)gdt_add_entry(&e);
+      dc->entry_number = (u32)gdt_add_entry(&e);
 
-      if (dc.entry_number == INVALID_ENTRY_NUM) {
+      if (dc->entry_number == INVALID_ENTRY_NUM) {
 
-         rc = gdt_expand();
+         if (gdt_expand() < 0)
+            return -ESRCH;
 
-         if (rc < 0) {
-            rc = -ESRCH;
-            goto out;
-         }
-
-         dc.entry_number = (u32)gdt_add_entry(&e);
-         ASSERT(dc.entry_number != INVALID_ENTRY_NUM);
+         dc->entry_number = (u32)gdt_add_entry(&e);
+         ASSERT(dc->entry_number != INVALID_ENTRY_NUM);
       }
 
-      gdt_set_slot(get_curr_proc(), (u16)slot, (u16)dc.entry_number);
-      goto out;
+      gdt_set_slot(pi, (u16)slot, (u16)dc->entry_number);
+      set_task_tls_desc(ti, dc->entry_number, &e);
+      return 0;
    }
 
    /* Handling the case where the user specified a GDT entry number */
 
-   int slot = get_user_task_slot_for_gdt_entry(dc.entry_number);
+   slot = get_user_task_slot_for_gdt_entry(pi, dc->entry_number);
 
    if (slot < 0) {
       /* A GDT entry with that index has never been allocated by this task */
 
-      if (dc.entry_number >= gdt_size || gdt[dc.entry_number].access) {
+      if (dc->entry_number >= gdt_size || gdt[dc->entry_number].access) {
          /* The entry is out-of-bounds or it's used by another task */
-         rc = -EINVAL;
-         goto out;
+         return -EINVAL;
       }
 
       /* The entry is available, now find a slot */
-      slot = find_available_slot_in_user_task();
+      slot = find_available_slot_in_user_task(pi);
 
       if (slot < 0) {
          /* Unable to find a free slot in this struct task struct */
-         rc = -ESRCH;
-         goto out;
+         return -ESRCH;
       }
 
-      gdt_set_slot(get_curr_proc(), (u16)slot, (u16)dc.entry_number);
+      gdt_set_slot(pi, (u16)slot, (u16)dc->entry_number);
+      set_entry_num(dc->entry_number, &e);
+
+   } else if (ti == get_curr_task()) {
+
+      /*
+       * We found a slot already containing this index (therefore it must be
+       * valid): just update the entry, without taking another reference.
+       */
+      ASSERT(dc->entry_number < gdt_size);
+      this_cpu_gdt()[dc->entry_number] = e;
    }
 
-   ASSERT(dc.entry_number < gdt_size);
+   set_task_tls_desc(ti, dc->entry_number, &e);
+   return 0;
+}
 
-   set_entry_num(dc.entry_number, &e);
+int sys_set_thread_area(void *arg)
+{
+   int rc;
+   struct user_desc dc;
+   struct user_desc *ud = arg;
 
-   /*
-    * We're here because either we found a slot already containing this index
-    * (therefore it must be valid) or the index is in-bounds and it is free.
-    */
+   rc = copy_from_user(&dc, ud, sizeof(struct user_desc));
+
+   if (rc != 0)
+      return -EFAULT;
 
-out:
+   disable_preemption();
+   {
+      rc = set_task_thread_area(get_curr_task(), &dc);
+   }
    enable_preemption();
 
    if (!rc) {
@@ -495,27 +746,29 @@ out:
 
 void copy_main_tss_on_regs(regs_t *ctx)
 {
+   const struct tss_entry *tss = this_cpu_tss();
+
    *ctx = (regs_t) {
       .kernel_resume_eip   = 0,
       .custom_flags        = 0,
-      .gs                  = tss_array[TSS_MAIN].gs,
-      .fs                  = tss_array[TSS_MAIN].fs,
-      .es                  = tss_array[TSS_MAIN].es,
-      .ds                  = tss_array[TSS_MAIN].ds,
-      .edi                 = tss_array[TSS_MAIN].edi,
-      .esi                 = tss_array[TSS_MAIN].esi,
-      .ebp                 = tss_array[TSS_MAIN].ebp,
-      .esp                 = tss_array[TSS_MAIN].esp,
-      .ebx                 = tss_array[TSS_MAIN].ebx,
-      .edx                 = tss_array[TSS_MAIN].edx,
-      .ecx                 = tss_array[TSS_MAIN].ecx,
-      .eax                 = tss_array[TSS_MAIN].eax,
+      .gs                  = tss->gs,
+      .fs                  = tss->fs,
+      .es                  = tss->es,
+      .ds                  = tss->ds,
+      .edi                 = tss->edi,
+      .esi                 = tss->esi,
+      .ebp                 = tss->ebp,
+      .esp                 = tss->esp,
+      .ebx                 = tss->ebx,
+      .edx                 = tss->edx,
+      .ecx                 = tss->ecx,
+      .eax                 = tss->eax,
       .int_num             = 0,
       .err_code            = 0,
-      .eip                 = tss_array[TSS_MAIN].eip,
-      .cs                  = tss_array[TSS_MAIN].cs,
-      .eflags              = tss_array[TSS_MAIN].eflags,
-      .useresp             = tss_array[TSS_MAIN].esp,
-      .ss                  = tss_array[TSS_MAIN].ss0,
+      .eip                 = tss->eip,
+      .cs                  = tss->cs,
+      .eflags              = tss->eflags,
+      .useresp             = tss->esp,
+      .ss                  = tss->ss0,
    };
 }
@@ -133,11 +133,17 @@ struct user_desc {
    };
 };
 
+struct task;
+
 void load_ldt(u32 entry_index_in_gdt, u32 dpl);
 void gdt_set_entry(struct gdt_entry *e, ulong base, ulong lim, u8 accs, u8 fl);
 int gdt_add_entry(struct gdt_entry *e);
 void gdt_clear_entry(u32 index);
 void gdt_entry_inc_ref_count(u32 n);
+void gdt_load_task_tls(struct task *ti);
+int set_task_thread_area(struct task *ti, struct user_desc *dc);
+bool gdt_setup_ap(u32 cpu);    /* KRN_SMP only */
+void gdt_load_ap(u32 cpu);     /* KRN_SMP only */
 
 #define TSS_MAIN                   0
 #define TSS_DOUBLE_FAULT           1
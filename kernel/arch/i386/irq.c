@@ -23,13 +23,15 @@ void init_irq_handling(void)
    ASSERT(!are_interrupts_enabled());
    init_pic_8259(32, 40);
 
-   for (int i = 0; i < ARRAY_SIZE(irq_handlers_lists); i++) {
+   /* The entries above the PIC's IRQs are for the local APIC interrupts */
+   for (int i = 0; i < ARRAY_SIZE(irq_entry_points); i++) {
 
       idt_set_entry(32 + (u8)i,
                     irq_entry_points[i],
                     X86_KERNEL_CODE_SEL,
                     IDT_FLAG_PRESENT | IDT_FLAG_INT_GATE | IDT_FLAG_DPL0);
 
-      irq_set_mask(i);
+      if (i < ARRAY_SIZE(irq_handlers_lists))
+         irq_set_mask(i);
    }
 }
@@ -11,6 +11,7 @@
 #include <tilck/kernel/paging_hw.h>
 #include <tilck/kernel/irq.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/pageframes.h>
 #include <tilck/kernel/debug_utils.h>
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/hal.h>
@@ -34,12 +35,304 @@
 pdir_t *__kernel_pdir;
 static char kpdir_buf[sizeof(pdir_t)] ALIGNED_AT(PAGE_SIZE);
 
+STATIC_ASSERT(BIG_PAGE_SIZE == (1 << BIG_PAGE_SHIFT));
+
 static ALWAYS_INLINE page_table_t *
 pdir_get_page_table(pdir_t *pdir, u32 i)
 {
    return KERNEL_PA_TO_VA(pdir->entries[i].ptaddr << PAGE_SHIFT);
 }
 
+/*
+ * User big pages are ref-counted per 4 KB pageframe, exactly like the regular
+ * pages. That costs a bit more when mapping and unmapping them, but it makes
+ * splitting a big page into a page table trivial: the ref-counts don't change.
+ */
+
+static ALWAYS_INLINE ulong big_page_paddr(page_dir_entry_t e)
+{
+   return (ulong)e.big_4mb_page.paddr << BIG_PAGE_SHIFT;
+}
+
+static void big_page_ref_count_inc(ulong paddr)
+{
+   for (u32 i = 0; i < 1024; i++, paddr += PAGE_SIZE)
+      pf_ref_count_inc(paddr);
+}
+
+/*
+ * Drop a reference to each pageframe of the big page at `paddr`. The ones not
+ * used anymore are freed through the batch `b`, when not NULL.
+ */
+static void
+big_page_release(ulong paddr, bool free_pageframes, struct tlb_batch *b)
+{
+   for (u32 i = 0; i < 1024; i++, paddr += PAGE_SIZE) {
+
+      if (pf_ref_count_dec(paddr) || !free_pageframes)
+         continue;
+
+      if (b)
+         tlb_batch_free_frame(b, KERNEL_PA_TO_VA(paddr));
+      else
+         pf_free(KERNEL_PA_TO_VA(paddr));
+   }
+}
+
+static bool big_page_is_shared(ulong paddr)
+{
+   for (u32 i = 0; i < 1024; i++, paddr += PAGE_SIZE) {
+      if (pf_ref_count_get(paddr) > 1)
+         return true;
+   }
+
+   return false;
+}
+
+/* Page table entry flags equivalent to the ones of the big page `e` */
+static u32 big_page_to_pt_flags(page_dir_entry_t e)
+{
+   u32 flags = e.raw & (PG_PRESENT_BIT |
+                        PG_RW_BIT      |
+                        PG_US_BIT      |
+                        PG_WT_BIT      |
+                        PG_CD_BIT      |
+                        PG_ACC_BIT     |
+                        PG_DIRTY_BIT   |
+                        PG_CUSTOM_BITS);
+
+   if (e.raw & PG_4MB_PAT_BIT)
+      flags |= PG_PAGE_PAT_BIT;
+
+   return flags;
+}
+
+/*
+ * Replace the user big page at `pd_index` with a page table mapping the same
+ * pageframes, with the same flags.
+ */
+static int split_big_page(pdir_t *pdir, u32 pd_index)
+{
+   const page_dir_entry_t e = pdir->entries[pd_index];
+   page_table_t *pt;
+   ulong paddr;
+   u32 flags;
+
+   ASSERT(e.present && e.psize);
+   ASSERT(pd_index < KERNEL_BASE_PD_IDX);
+
+   if (!(pt = pf_alloc()))
+      return -ENOMEM;
+
+   paddr = big_page_paddr(e);
+   flags = big_page_to_pt_flags(e);
+
+   for (u32 j = 0; j < 1024; j++, paddr += PAGE_SIZE)
+      pt->pages[j].raw = flags | paddr;
+
+   pdir->entries[pd_index].raw =
+      PG_PRESENT_BIT | PG_RW_BIT | PG_US_BIT | KERNEL_VA_TO_PA(pt);
+
+   tlb_invalidate(pdir, pd_index << BIG_PAGE_SHIFT, 1);
+   return 0;
+}
+
+/*
+ * User page tables are shared, read-only, between the parent and the child
+ * by pdir_clone(), and copied only on the first write in their range. The
+ * number of page directories sharing a page table is kept in the ref-count of
+ * its pageframe, while the pages mapped by a shared page table have their
+ * ref-count incremented only once, no matter how many page directories use it.
+ */
+
+static ALWAYS_INLINE bool is_pt_shared(page_dir_entry_t e)
+{
+   return e.present && !e.psize && (e.avail & PAGE_PT_SHARED);
+}
+
+static void share_page_table(page_dir_entry_t *e)
+{
+   const ulong pt_paddr = (ulong)e->ptaddr << PAGE_SHIFT;
+
+   if (!(e->avail & PAGE_PT_SHARED)) {
+
+      /* Not shared yet: count the current page directory too */
+      ASSERT(pf_ref_count_get(pt_paddr) == 0);
+      pf_ref_count_inc(pt_paddr);
+
+      e->avail |= PAGE_PT_SHARED;
+      e->rw = false;
+   }
+
+   pf_ref_count_inc(pt_paddr);
+}
+
+/*
+ * Drop the reference to the page table of the user entry `e`. When that was
+ * the last one, release the pages mapped there and free the page table.
+ */
+static void put_page_table(page_dir_entry_t e, bool free_pageframes)
+{
+   page_table_t *pt = KERNEL_PA_TO_VA(e.ptaddr << PAGE_SHIFT);
+
+   if (e.avail & PAGE_PT_SHARED) {
+      if (pf_ref_count_dec(KERNEL_VA_TO_PA(pt)) > 0)
+         return; /* still used by other page directories */
+   }
+
+   for (u32 j = 0; j < 1024; j++) {
+
+      if (!pt->pages[j].present)
+         continue;
+
+      const ulong paddr = (ulong)pt->pages[j].pageAddr << PAGE_SHIFT;
+
+      if (!pf_ref_count_dec(paddr) && free_pageframes)
+         pf_free(KERNEL_PA_TO_VA(paddr));
+   }
+
+   pf_free(pt);
+}
+
+/*
+ * Give `pdir` its own writable copy of the shared page table at `pd_index`.
+ * The pages are copied-on-write later, one by one, as usual.
+ */
+static int unshare_page_table(pdir_t *pdir, u32 pd_index)
+{
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+   page_table_t *pt = pdir_get_page_table(pdir, pd_index);
+   const ulong pt_paddr = KERNEL_VA_TO_PA(pt);
+   page_table_t *new_pt;
+
+   ASSERT(is_pt_shared(*e));
+   ASSERT(pd_index < KERNEL_BASE_PD_IDX);
+
+   if (pf_ref_count_get(pt_paddr) > 1) {
+
+      if (!(new_pt = pf_alloc()))
+         return -ENOMEM;
+
+      /*
+       * Mark all the non-shared pages as COW. That's done in the original
+       * page table as well, because its pages now have one more user.
+       */
+      for (u32 j = 0; j < 1024; j++) {
+
+         page_t *const p = &pt->pages[j];
+
+         if (!p->present)
+            continue;
+
+         if (!(p->avail & PAGE_SHARED)) {
+
+            if (p->rw)
+               p->avail |= PAGE_COW_ORIG_RW;
+
+            p->rw = false;
+         }
+
+         pf_ref_count_inc((ulong)p->pageAddr << PAGE_SHIFT);
+      }
+
+      memcpy32(new_pt, pt, sizeof(page_table_t) / 4);
+      e->ptaddr = SHR_BITS(KERNEL_VA_TO_PA(new_pt), PAGE_SHIFT, u32);
+   }
+
+   /* If we were the last user of the page table, we just got it back */
+   pf_ref_count_dec(pt_paddr);
+   e->avail &= ~PAGE_PT_SHARED;
+   e->rw = true;
+
+   /*
+    * The original page table might be in use by other processes as well, on
+    * other CPUs: flush the TLB of all the address spaces. That's cheaper than
+    * invalidating all the pages in the range, one by one.
+    */
+   tlb_invalidate(NULL, pd_index << BIG_PAGE_SHIFT, 1024);
+
+   return 0;
+}
+
+/*
+ * Check if the user page directory entry at `pd_index` can become a big page.
+ * User page tables are not freed when they become empty, so free them here.
+ */
+static bool prepare_for_big_page(pdir_t *pdir, u32 pd_index)
+{
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+   const page_dir_entry_t orig_e = *e;
+   page_table_t *pt;
+
+   if (!e->present)
+      return true;
+
+   if (e->psize || pd_index >= KERNEL_BASE_PD_IDX)
+      return false;
+
+   pt = pdir_get_page_table(pdir, pd_index);
+
+   for (u32 j = 0; j < 1024; j++) {
+      if (pt->pages[j].present)
+         return false;
+   }
+
+   e->raw = 0;
+   tlb_invalidate(pdir, pd_index << BIG_PAGE_SHIFT, 1);
+   put_page_table(orig_e, true);
+   return true;
+}
+
+bool is_zero_big_page_range(pdir_t *pdir, void *vaddrp)
+{
+   const u32 pd_index = (u32)vaddrp >> BIG_PAGE_SHIFT;
+   const u32 zero_pg_addr = KERNEL_VA_TO_PA(&zero_page) >> PAGE_SHIFT;
+   const page_dir_entry_t e = pdir->entries[pd_index];
+   page_table_t *pt;
+
+   ASSERT(!((u32)vaddrp & (BIG_PAGE_SIZE - 1)));
+
+   if (!e.present || e.psize || is_pt_shared(e))
+      return false;
+
+   if (pd_index >= KERNEL_BASE_PD_IDX)
+      return false;
+
+   pt = pdir_get_page_table(pdir, pd_index);
+
+   for (u32 j = 0; j < 1024; j++) {
+
+      const page_t p = pt->pages[j];
+
+      if (!p.present || p.pageAddr != zero_pg_addr)
+         return false;
+
+      if (!(p.avail & PAGE_COW_ORIG_RW))
+         return false;
+   }
+
+   return true;
+}
+
+static void handle_cow_out_of_memory(void)
+{
+   struct task *curr = get_curr_task();
+
+   if (!curr->running_in_kernel) {
+
+      // The task was not running in kernel: we can safely kill it.
+      printk("Out-of-memory: killing pid %d\n", get_curr_pid());
+      send_signal(get_curr_pid(), SIGKILL, SIG_FL_PROCESS | SIG_FL_FAULT);
+
+   } else {
+
+      // We cannot kill a task running in kernel during a CoW page fault
+      // In this case (but in the one above too), Linux puts the process to
+      // sleep, while the OOM killer runs and frees some memory.
+      panic("Out-of-memory: can't copy a CoW page [pid %d]", get_curr_pid());
+   }
+}
+
 bool handle_potential_cow(void *context)
 {
    regs_t *r = context;
@@ -53,7 +346,49 @@ bool handle_potential_cow(void *context)
    const u32 pt_index = (vaddr >> PAGE_SHIFT) & 1023;
    const u32 pd_index = (vaddr >> BIG_PAGE_SHIFT);
    const void *const page_vaddr = (void *)(vaddr & PAGE_MASK);
-   page_table_t *pt = pdir_get_page_table(get_curr_pdir(), pd_index);
+   pdir_t *pdir = get_curr_pdir();
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+
+   if (e->psize) {
+
+      if (!(e->avail & PAGE_COW_ORIG_RW))
+         return false; /* Not a COW big page */
+
+      if (!big_page_is_shared(big_page_paddr(*e))) {
+
+         /* No pageframe is shared anymore: just make the big page writable */
+         e->rw = true;
+         e->avail = 0;
+         tlb_invalidate(pdir, vaddr, 1);
+         return true;
+      }
+
+      /* Split the big page and then copy only the 4 KB page being written */
+      if (split_big_page(pdir, pd_index) < 0) {
+         handle_cow_out_of_memory();
+         return true;
+      }
+   }
+
+   page_table_t *pt = pdir_get_page_table(pdir, pd_index);
+
+   if (is_pt_shared(*e)) {
+
+      const page_t p = pt->pages[pt_index];
+
+      if (!p.rw && !(p.avail & PAGE_COW_ORIG_RW))
+         return false; /* A read-only page: copying the page table is useless */
+
+      if (unshare_page_table(pdir, pd_index) < 0) {
+         handle_cow_out_of_memory();
+         return true;
+      }
+
+      pt = pdir_get_page_table(pdir, pd_index);
+
+      if (pt->pages[pt_index].rw)
+         return true; /* A shared page: it's writable now */
+   }
 
    if (!(pt->pages[pt_index].avail & PAGE_COW_ORIG_RW))
       return false; /* Not a COW page */
@@ -74,38 +409,32 @@ bool handle_potential_cow(void *context)
 
       pt->pages[pt_index].rw = true;
       pt->pages[pt_index].avail = 0;
-      invalidate_page_hw(vaddr);
+      tlb_invalidate(pdir, vaddr, 1);
       return true;
    }
 
-   // Allocate a new page.
-   void *new_page_vaddr = kmalloc(PAGE_SIZE);
-
-   if (!new_page_vaddr) {
-
-      // Out-of-memory case
-      struct task *curr = get_curr_task();
-
-      if (!curr->running_in_kernel) {
+   /*
+    * Allocate a new page. When the original page is the zero page, there's
+    * no need to copy anything: just get an already zeroed page, if possible.
+    */
+   const bool zero_pg = orig_page_paddr == KERNEL_VA_TO_PA(zero_page);
 
-         // The task was not running in kernel: we can safely kill it.
-         printk("Out-of-memory: killing pid %d\n", get_curr_pid());
-         send_signal(get_curr_pid(), SIGKILL, SIG_FL_PROCESS | SIG_FL_FAULT);
-         return true;
+   /* First write in a big page range of an anonymous mapping? */
+   if (zero_pg && user_map_big_page_on_cow(vaddr))
+      return true;
 
-      } else {
+   void *new_page_vaddr = zero_pg ? pf_zalloc() : pf_alloc();
 
-         // We cannot kill a task running in kernel during a CoW page fault
-         // In this case (but in the one above too), Linux puts the process to
-         // sleep, while the OOM killer runs and frees some memory.
-         panic("Out-of-memory: can't copy a CoW page [pid %d]", get_curr_pid());
-      }
+   if (!new_page_vaddr) {
+      handle_cow_out_of_memory();
+      return true;
    }
 
    ASSERT(IS_PAGE_ALIGNED(new_page_vaddr));
 
    // Copy page's contents
-   memcpy32(new_page_vaddr, page_vaddr, PAGE_SIZE / 4);
+   if (!zero_pg)
+      memcpy32(new_page_vaddr, page_vaddr, PAGE_SIZE / 4);
 
    // Get the paddr of the new page
    const ulong paddr = KERNEL_VA_TO_PA(new_page_vaddr);
@@ -124,7 +453,7 @@ bool handle_potential_cow(void *context)
    pt->pages[pt_index].rw = true;
    pt->pages[pt_index].avail = 0;
 
-   invalidate_page_hw(vaddr);
+   tlb_invalidate(pdir, vaddr, 1);
    return true;
 }
 
@@ -161,6 +490,14 @@ void handle_page_fault_int(regs_t *r)
       kernel_page_fault_panic(r, vaddr, rw, p);
    }
 
+   /*
+    * With SMP, another CPU might have made the page present while we were
+    * waiting to handle the fault (e.g. in reclaim_lazy_free_pages()): just
+    * retry the access.
+    */
+   if (!p && is_mapped(get_curr_pdir(), (void *)vaddr))
+      return;
+
    um = process_get_user_mapping((void *)vaddr);
 
    if (um) {
@@ -199,7 +536,7 @@ void handle_page_fault_int(regs_t *r)
       get_curr_proc()->debug_cmdline
    );
 
-   send_signal(get_curr_tid(), sig, SIG_FL_PROCESS | SIG_FL_FAULT);
+   send_signal2(get_curr_pid(), get_curr_tid(), sig, SIG_FL_FAULT);
 }
 
 bool is_mapped(pdir_t *pdir, void *vaddrp)
@@ -237,6 +574,10 @@ bool is_rw_mapped(pdir_t *pdir, void *vaddrp)
    if (e->psize) /* 4-MB page */
       return e->present && e->rw;
 
+   /* Shared page tables are mapped read-only: see share_page_table() */
+   if (!e->rw)
+      return false;
+
    pt = KERNEL_PA_TO_VA(pdir->entries[pd_index].ptaddr << PAGE_SHIFT);
    page = pt->pages[pt_index];
    return page.present && page.rw;
@@ -249,19 +590,37 @@ void set_page_rw(pdir_t *pdir, void *vaddrp, bool rw)
    const u32 pt_index = (vaddr >> PAGE_SHIFT) & 1023;
    const u32 pd_index = (vaddr >> BIG_PAGE_SHIFT);
 
+   ASSERT(!is_pt_shared(pdir->entries[pd_index]));
+
    pt = KERNEL_PA_TO_VA(pdir->entries[pd_index].ptaddr << PAGE_SHIFT);
    ASSERT(KERNEL_VA_TO_PA(pt) != 0);
    pt->pages[pt_index].rw = rw;
-   invalidate_page_hw(vaddr);
+   tlb_invalidate(pdir, vaddr, 1);
 }
 
 static inline int
-__unmap_page(pdir_t *pdir, void *vaddrp, bool free_pageframe, bool permissive)
+__unmap_page(pdir_t *pdir,
+             void *vaddrp,
+             bool free_pageframe,
+             bool permissive,
+             struct tlb_batch *b)
 {
    page_table_t *pt;
    const ulong vaddr = (ulong) vaddrp;
    const u32 pt_index = (vaddr >> PAGE_SHIFT) & 1023;
    const u32 pd_index = (vaddr >> BIG_PAGE_SHIFT);
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+
+   if (e->present && e->psize) {
+
+      /*
+       * Unmapping a single page of a big page: split it first. That might fail
+       * and leave the page mapped: the callers unmapping user memory split the
+       * big pages in advance, with prepare_to_unmap_user_pages().
+       */
+      if (split_big_page(pdir, pd_index) < 0)
+         return -ENOMEM;
+   }
 
    pt = KERNEL_PA_TO_VA(pdir->entries[pd_index].ptaddr << PAGE_SHIFT);
 
@@ -278,15 +637,33 @@ __unmap_page(pdir_t *pdir, void *vaddrp, bool free_pageframe, bool permissive)
       ASSERT(pt->pages[pt_index].present);
    }
 
+   if (is_pt_shared(*e)) {
+
+      /* Like above: see prepare_to_unmap_user_pages() */
+      if (unshare_page_table(pdir, pd_index) < 0)
+         return -ENOMEM;
+
+      pt = pdir_get_page_table(pdir, pd_index);
+   }
+
    const ulong paddr = (ulong)
       pt->pages[pt_index].pageAddr << PAGE_SHIFT;
 
    pt->pages[pt_index].raw = 0;
-   invalidate_page_hw(vaddr);
+
+   if (b)
+      tlb_batch_add(b, vaddr, 1);
+   else
+      tlb_invalidate(pdir, vaddr, 1);
 
    if (!pf_ref_count_dec(paddr) && free_pageframe) {
+
       ASSERT(paddr != KERNEL_VA_TO_PA(zero_page));
-      kfree2(KERNEL_PA_TO_VA(paddr), PAGE_SIZE);
+
+      if (b)
+         tlb_batch_free_frame(b, KERNEL_PA_TO_VA(paddr));
+      else
+         pf_free(KERNEL_PA_TO_VA(paddr));
    }
 
    return 0;
@@ -295,24 +672,129 @@ __unmap_page(pdir_t *pdir, void *vaddrp, bool free_pageframe, bool permissive)
 void
 unmap_page(pdir_t *pdir, void *vaddrp, bool free_pageframe)
 {
-   __unmap_page(pdir, vaddrp, free_pageframe, false);
+   DEBUG_ONLY_UNSAFE(int rc =)
+      __unmap_page(pdir, vaddrp, free_pageframe, false, NULL);
+
+   ASSERT(rc == 0);
 }
 
 int
 unmap_page_permissive(pdir_t *pdir, void *vaddrp, bool free_pageframe)
 {
-   return __unmap_page(pdir, vaddrp, free_pageframe, true);
+   return __unmap_page(pdir, vaddrp, free_pageframe, true, NULL);
+}
+
+/*
+ * If `vaddrp` is the beginning of a user big page and at least `page_count`
+ * pages have to be unmapped from there, unmap the whole big page at once.
+ */
+static bool
+unmap_whole_big_page(pdir_t *pdir,
+                     void *vaddrp,
+                     size_t page_count,
+                     bool free_pageframes,
+                     struct tlb_batch *b)
+{
+   const u32 vaddr = (u32) vaddrp;
+   const u32 pd_index = (vaddr >> BIG_PAGE_SHIFT);
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+   ulong paddr;
+
+   if (!e->present || !e->psize || pd_index >= KERNEL_BASE_PD_IDX)
+      return false;
+
+   if ((vaddr & (BIG_PAGE_SIZE - 1)) || page_count < 1024)
+      return false;
+
+   paddr = big_page_paddr(*e);
+   e->raw = 0;
+   tlb_batch_add(b, vaddr, 1);      /* a single TLB entry */
+   big_page_release(paddr, free_pageframes, b);
+   return true;
+}
+
+/*
+ * If `vaddrp` is the beginning of a user page table shared with other page
+ * directories and at least `page_count` pages have to be unmapped from there,
+ * just drop our reference to it, instead of copying it first. The pages it
+ * maps keep their ref-count, as it's held by the page table itself. Stores in
+ * `unmapped` the number of pages that were mapped there.
+ */
+static bool
+unmap_whole_shared_pt(pdir_t *pdir,
+                      void *vaddrp,
+                      size_t page_count,
+                      struct tlb_batch *b,
+                      size_t *unmapped)
+{
+   const u32 vaddr = (u32) vaddrp;
+   const u32 pd_index = (vaddr >> BIG_PAGE_SHIFT);
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+   page_table_t *pt;
+   ulong pt_paddr;
+
+   if (!is_pt_shared(*e) || pd_index >= KERNEL_BASE_PD_IDX)
+      return false;
+
+   if ((vaddr & (BIG_PAGE_SIZE - 1)) || page_count < 1024)
+      return false;
+
+   pt = pdir_get_page_table(pdir, pd_index);
+   pt_paddr = KERNEL_VA_TO_PA(pt);
+
+   /* The last user has to release its pages: see unshare_page_table() */
+   if (pf_ref_count_get(pt_paddr) == 1)
+      return false;
+
+   *unmapped = 0;
+
+   for (u32 j = 0; j < 1024; j++)
+      *unmapped += pt->pages[j].present;
+
+   e->raw = 0;
+   pf_ref_count_dec(pt_paddr);
+   tlb_batch_add(b, vaddr, 1024);
+   return true;
 }
 
+/*
+ * NOTE: the range unmap functions below invalidate the TLB entries all at once
+ * at the end, using a tlb_batch, which frees the unmapped pageframes only after
+ * that (see tlb_batch_free_frame()).
+ */
+
 void
 unmap_pages(pdir_t *pdir,
             void *vaddr,
             size_t page_count,
             bool do_free)
 {
-   for (size_t i = 0; i < page_count; i++) {
-      unmap_page(pdir, (char *)vaddr + (i << PAGE_SHIFT), do_free);
+   struct tlb_batch b;
+   size_t i = 0, cnt;
+
+   disable_preemption();
+   tlb_batch_init(&b, pdir);
+
+   while (i < page_count) {
+
+      void *va = (char *)vaddr + (i << PAGE_SHIFT);
+
+      if (unmap_whole_big_page(pdir, va, page_count - i, do_free, &b) ||
+          unmap_whole_shared_pt(pdir, va, page_count - i, &b, &cnt))
+      {
+         i += 1024;
+         continue;
+      }
+
+      DEBUG_ONLY_UNSAFE(int rc =)
+         __unmap_page(pdir, va, do_free, false, &b);
+
+      ASSERT(rc == 0);
+      i++;
    }
+
+   tlb_batch_flush(&b);
+   enable_preemption();
 }
 
 size_t
@@ -322,20 +804,366 @@ unmap_pages_permissive(pdir_t *pdir,
                        bool do_free)
 {
    size_t unmapped_pages = 0;
+   struct tlb_batch b;
+   size_t i = 0, cnt;
    int rc;
 
-   for (size_t i = 0; i < page_count; i++) {
-      rc = unmap_page_permissive(
-         pdir,
-         (char *)vaddr + (i << PAGE_SHIFT),
-         do_free
-      );
+   disable_preemption();
+   tlb_batch_init(&b, pdir);
+
+   while (i < page_count) {
+
+      void *va = (char *)vaddr + (i << PAGE_SHIFT);
+
+      if (unmap_whole_big_page(pdir, va, page_count - i, do_free, &b)) {
+         unmapped_pages += 1024;
+         i += 1024;
+         continue;
+      }
+
+      if (unmap_whole_shared_pt(pdir, va, page_count - i, &b, &cnt)) {
+         unmapped_pages += cnt;
+         i += 1024;
+         continue;
+      }
+
+      rc = __unmap_page(pdir, va, do_free, true, &b);
       unmapped_pages += (rc == 0);
+      i++;
    }
 
+   tlb_batch_flush(&b);
+   enable_preemption();
    return unmapped_pages;
 }
 
+/*
+ * Prepare the user range [vaddr, vaddr + page_count pages) to be unmapped by
+ * the functions above, which cannot fail: split the big pages covering it only
+ * in part and copy the shared page tables covering it only in part. Returns
+ * -ENOMEM when that's not possible, in which case the range is still mapped as
+ * before, just maybe with more page tables.
+ */
+int prepare_to_unmap_user_pages(pdir_t *pdir, void *vaddr, size_t page_count)
+{
+   const ulong start = (ulong)vaddr;
+   const ulong end = start + (page_count << PAGE_SHIFT);
+   const u32 end_pd_index = (end + BIG_PAGE_SIZE - 1) >> BIG_PAGE_SHIFT;
+   int rc = 0;
+
+   ASSERT(IS_PAGE_ALIGNED(start));
+   ASSERT(end <= KERNEL_BASE_VA);
+
+   disable_preemption();
+
+   for (u32 i = start >> BIG_PAGE_SHIFT; i < end_pd_index; i++) {
+
+      const ulong big_start = (ulong)i << BIG_PAGE_SHIFT;
+      page_dir_entry_t *e = &pdir->entries[i];
+
+      if (!e->present)
+         continue;
+
+      /* See unmap_whole_big_page() and unmap_whole_shared_pt() */
+      if (start <= big_start && big_start + BIG_PAGE_SIZE <= end)
+         continue;
+
+      if (e->psize && (rc = split_big_page(pdir, i)))
+         break;
+
+      if (is_pt_shared(*e) && (rc = unshare_page_table(pdir, i)))
+         break;
+   }
+
+   enable_preemption();
+   return rc;
+}
+
+/*
+ * Move the user pages mapped in [src, src + page_count pages) to `dst`, without
+ * touching their contents: only the page table entries move, along with the
+ * reference they hold on their pageframe. Big pages are moved as a whole when
+ * both the ranges allow that, otherwise they get split. The destination range
+ * must be free. Returns the number of pages processed: it's less than
+ * `page_count` only when we ran out of memory, in which case the caller can
+ * move them back.
+ */
+size_t
+move_pages(pdir_t *pdir, void *src, void *dst, size_t page_count)
+{
+   struct tlb_batch b;
+   size_t i = 0;
+
+   ASSERT(IS_PAGE_ALIGNED(src) && IS_PAGE_ALIGNED(dst));
+   ASSERT((ulong)src + (page_count << PAGE_SHIFT) <= KERNEL_BASE_VA);
+   ASSERT((ulong)dst + (page_count << PAGE_SHIFT) <= KERNEL_BASE_VA);
+
+   disable_preemption();
+   tlb_batch_init(&b, pdir);
+
+   while (i < page_count) {
+
+      const ulong sva = (ulong)src + (i << PAGE_SHIFT);
+      const ulong dva = (ulong)dst + (i << PAGE_SHIFT);
+      const u32 pd_index = sva >> BIG_PAGE_SHIFT;
+      page_dir_entry_t *se = &pdir->entries[pd_index];
+      page_dir_entry_t *de = &pdir->entries[dva >> BIG_PAGE_SHIFT];
+      page_table_t *pt;
+      page_t *pte;
+
+      if (se->present && se->psize) {
+
+         if (!(sva & (BIG_PAGE_SIZE - 1)) && !(dva & (BIG_PAGE_SIZE - 1)) &&
+             page_count - i >= 1024 && !de->present)
+         {
+            *de = *se;
+            se->raw = 0;
+            tlb_batch_add(&b, sva, 1);
+            i += 1024;
+            continue;
+         }
+
+         if (split_big_page(pdir, pd_index) < 0)
+            break;
+      }
+
+      if (!se->present) {
+         i++;
+         continue;
+      }
+
+      if (is_pt_shared(*se) && unshare_page_table(pdir, pd_index) < 0)
+         break;
+
+      pt = pdir_get_page_table(pdir, pd_index);
+      pte = &pt->pages[(sva >> PAGE_SHIFT) & 1023];
+
+      if (pte->present) {
+
+         const ulong paddr = (ulong)pte->pageAddr << PAGE_SHIFT;
+         const u32 flags = pte->raw & OFFSET_IN_PAGE_MASK;
+
+         /* NOTE: map_page_int() takes a reference that we drop below */
+         if (map_page_int(pdir, (void *)dva, paddr, flags))
+            break;
+
+         pte->raw = 0;
+         pf_ref_count_dec(paddr);
+         tlb_batch_add(&b, sva, 1);
+      }
+
+      i++;
+   }
+
+   tlb_batch_flush(&b);
+   enable_preemption();
+   return i;
+}
+
+/*
+ * Atomically replace the page table entry `pte` with `val`, returning its old
+ * value: with SMP, other CPUs might set its accessed and dirty bits meanwhile.
+ */
+static ALWAYS_INLINE page_t pte_xchg(page_t *pte, u32 val)
+{
+   ATOMIC(u32) *raw = (ATOMIC(u32) *)&pte->raw;
+   page_t old;
+
+   old.raw = atomic_exchange_explicit(raw, val, mo_relaxed);
+   return old;
+}
+
+/*
+ * Map the zero page at `vaddr`, in place of the private page `old` (the value
+ * of `pte` before) was mapping, and release the latter. The zero page is mapped
+ * read-only, as CoW if the page was writable.
+ */
+static void
+replace_with_zero_page(page_t *pte,
+                       page_t old,
+                       ulong vaddr,
+                       struct tlb_batch *b)
+{
+   const ulong zero_paddr = KERNEL_VA_TO_PA(&zero_page);
+   const ulong paddr = (ulong)old.pageAddr << PAGE_SHIFT;
+   const bool rw = old.rw || (old.avail & PAGE_COW_ORIG_RW);
+
+   ASSERT(!(old.avail & PAGE_SHARED));
+   ASSERT(paddr != zero_paddr);
+
+   pte->raw = PG_PRESENT_BIT | PG_US_BIT | zero_paddr;
+
+   if (rw)
+      pte->avail = PAGE_COW_ORIG_RW;
+
+   pf_ref_count_inc(zero_paddr);
+   tlb_batch_add(b, vaddr, 1);
+
+   if (!pf_ref_count_dec(paddr))
+      tlb_batch_free_frame(b, KERNEL_PA_TO_VA(paddr));
+}
+
+/*
+ * Get the page table entry mapping the user page at `vaddr`, if it's a private
+ * page other than the zero page. When `prepare` is true, split the big pages
+ * and copy the shared page tables, in order to allow changing the entry.
+ */
+static int
+get_private_pte(pdir_t *pdir, ulong vaddr, bool prepare, page_t **pte_ref)
+{
+   const u32 pd_index = vaddr >> BIG_PAGE_SHIFT;
+   const u32 pt_index = (vaddr >> PAGE_SHIFT) & 1023;
+   page_dir_entry_t *e = &pdir->entries[pd_index];
+   page_t *pte;
+   int rc;
+
+   *pte_ref = NULL;
+
+   if (!e->present)
+      return 0;
+
+   if (e->psize) {
+
+      if (!prepare)
+         return 0;
+
+      if ((rc = split_big_page(pdir, pd_index)))
+         return rc;
+   }
+
+   pte = &pdir_get_page_table(pdir, pd_index)->pages[pt_index];
+
+   if (!pte->present || (pte->avail & PAGE_SHARED))
+      return 0;
+
+   if (pte->pageAddr == KERNEL_VA_TO_PA(&zero_page) >> PAGE_SHIFT)
+      return 0;
+
+   if (is_pt_shared(*e)) {
+
+      if (!prepare)
+         return 0;
+
+      if ((rc = unshare_page_table(pdir, pd_index)))
+         return rc;
+
+      pte = &pdir_get_page_table(pdir, pd_index)->pages[pt_index];
+   }
+
+   *pte_ref = pte;
+   return 0;
+}
+
+/*
+ * Replace the private pages mapped in the given user range with the zero page,
+ * releasing their pageframes (madvise's MADV_DONTNEED).
+ */
+int discard_user_pages(pdir_t *pdir, void *vaddrp, size_t page_count)
+{
+   ulong vaddr = (ulong)vaddrp;
+   struct tlb_batch b;
+   page_t *pte;
+   int rc = 0;
+
+   ASSERT((ulong)vaddrp + (page_count << PAGE_SHIFT) <= KERNEL_BASE_VA);
+
+   disable_preemption();
+   tlb_batch_init(&b, pdir);
+
+   for (size_t i = 0; i < page_count; i++, vaddr += PAGE_SIZE) {
+
+      if ((rc = get_private_pte(pdir, vaddr, true, &pte)))
+         break;
+
+      if (pte)
+         replace_with_zero_page(pte, *pte, vaddr, &b);
+   }
+
+   tlb_batch_flush(&b);
+   enable_preemption();
+   return rc;
+}
+
+/*
+ * Mark the private pages in the given user range as lazily freeable
+ * (madvise's MADV_FREE): their dirty bit is cleared, in order to detect any
+ * write after this point. Pages in big pages or in shared page tables are
+ * skipped: they're unlikely to be freeable anyway.
+ */
+void lazy_free_user_pages(pdir_t *pdir, void *vaddrp, size_t page_count)
+{
+   ulong vaddr = (ulong)vaddrp;
+   struct tlb_batch b;
+   page_t *pte;
+
+   ASSERT((ulong)vaddrp + (page_count << PAGE_SHIFT) <= KERNEL_BASE_VA);
+
+   disable_preemption();
+   tlb_batch_init(&b, pdir);
+
+   for (size_t i = 0; i < page_count; i++, vaddr += PAGE_SIZE) {
+
+      get_private_pte(pdir, vaddr, false, &pte);
+
+      if (!pte)
+         continue;
+
+      pte->dirty = false;
+      pte->avail |= PAGE_LAZY_FREE;
+      tlb_batch_add(&b, vaddr, 1); /* the CPU has to set the dirty bit again */
+   }
+
+   tlb_batch_flush(&b);
+   enable_preemption();
+}
+
+/*
+ * Reclaim the pages in the given user range marked by lazy_free_user_pages()
+ * and not written since then. Returns the number of pageframes freed.
+ *
+ * NOTE: `pdir` might not be the current page directory, but it might be in use
+ * on other CPUs: tlb_batch_flush() takes care of that.
+ */
+size_t reclaim_lazy_free_pages(pdir_t *pdir, void *vaddrp, size_t page_count)
+{
+   ulong vaddr = (ulong)vaddrp;
+   size_t freed = 0;
+   struct tlb_batch b;
+   page_t *pte, old;
+
+   disable_preemption();
+   tlb_batch_init(&b, pdir);
+
+   for (size_t i = 0; i < page_count; i++, vaddr += PAGE_SIZE) {
+
+      get_private_pte(pdir, vaddr, false, &pte);
+
+      if (!pte || !(pte->avail & PAGE_LAZY_FREE))
+         continue;
+
+      /*
+       * Clear the entry before checking the dirty bit: a CPU writing the page
+       * through a clean TLB entry from now on has to set the dirty bit in the
+       * entry, and it gets a page fault instead, because it's not present. The
+       * fault handler waits for us (see handle_page_fault_int()).
+       */
+      old = pte_xchg(pte, 0);
+
+      if (old.dirty || pf_ref_count_get(old.pageAddr << PAGE_SHIFT) > 1) {
+         old.avail &= ~PAGE_LAZY_FREE;    /* the page is in use again */
+         pte->raw = old.raw;
+         continue;
+      }
+
+      replace_with_zero_page(pte, old, vaddr, &b);
+      freed++;
+   }
+
+   tlb_batch_flush(&b);
+   enable_preemption();
+   return freed;
+}
+
 ulong get_mapping(pdir_t *pdir, void *vaddrp)
 {
    page_table_t *pt;
@@ -353,8 +1181,11 @@ ulong get_mapping(pdir_t *pdir, void *vaddrp)
 
    e.raw = pdir->entries[pd_index].raw;
    ASSERT(e.present);
-   ASSERT(e.ptaddr != 0);
 
+   if (e.psize)
+      return big_page_paddr(e) | (vaddr & (BIG_PAGE_SIZE - 1));
+
+   ASSERT(e.ptaddr != 0);
    pt = KERNEL_PA_TO_VA(e.ptaddr << PAGE_SHIFT);
    p.raw = pt->pages[pt_index].raw;
    ASSERT(p.present);
@@ -417,13 +1248,29 @@ map_page_int(pdir_t *pdir, void *vaddrp, ulong paddr, u32 hw_flags)
    ASSERT(!(vaddr & OFFSET_IN_PAGE_MASK)); // the vaddr must be page-aligned
    ASSERT(!(paddr & OFFSET_IN_PAGE_MASK)); // the paddr must be page-aligned
 
+   if (pdir->entries[pd_index].psize)
+      return -EADDRINUSE; /* big page: the whole 4 MB are already in use */
+
+   if (is_pt_shared(pdir->entries[pd_index])) {
+      if (unshare_page_table(pdir, pd_index) < 0)
+         return -ENOMEM;
+   }
+
    pt = KERNEL_PA_TO_VA(pdir->entries[pd_index].ptaddr << PAGE_SHIFT);
    ASSERT(IS_PAGE_ALIGNED(pt));
 
    if (UNLIKELY(KERNEL_VA_TO_PA(pt) == 0)) {
 
-      // we have to create a page table for mapping 'vaddr'.
-      pt = kzalloc_obj(page_table_t);
+      /*
+       * We have to create a page table for mapping 'vaddr'. User page tables
+       * come from the pageframe allocator, as they get freed by
+       * pdir_destroy(), while kernel's ones are never freed and might be
+       * needed before the pageframe allocator is initialized.
+       */
+      if (pd_index < KERNEL_BASE_PD_IDX)
+         pt = pf_zalloc();
+      else
+         pt = kzalloc_obj(page_table_t);
 
       if (UNLIKELY(!pt))
          return -ENOMEM;
@@ -484,7 +1331,15 @@ map_pages_int(pdir_t *pdir,
       big_page_flags &= ~PG_GLOBAL_BIT;
 
       for (; big_pages < (rem_pages >> 10); big_pages++) {
+
+         if (!prepare_for_big_page(pdir, (ulong)vaddr >> BIG_PAGE_SHIFT))
+            break; /* map the rest using regular pages */
+
          map_4mb_page_int(pdir, vaddr, paddr, big_page_flags);
+
+         if (hw_flags & PG_US_BIT)
+            big_page_ref_count_inc(paddr);
+
          vaddr += (4 * MB);
          paddr += (4 * MB);
       }
@@ -523,7 +1378,7 @@ map_page(pdir_t *pdir, void *vaddrp, ulong paddr, u32 pg_flags)
       void *va;
       ASSERT(paddr == 0);
 
-      if (!(va = kmalloc(PAGE_SIZE)))
+      if (!(va = pf_alloc()))
          return -ENOMEM;
 
       if (pg_flags & PAGING_FL_ZERO_PG)
@@ -548,7 +1403,7 @@ map_page(pdir_t *pdir, void *vaddrp, ulong paddr, u32 pg_flags)
                    /* Kernel pages are global */
 
    if (UNLIKELY(rc != 0) && (pg_flags & PAGING_FL_DO_ALLOC)) {
-      kfree2(KERNEL_PA_TO_VA(paddr), PAGE_SIZE);
+      pf_free(KERNEL_PA_TO_VA(paddr));
    }
 
    return rc;
@@ -608,76 +1463,98 @@ map_pages(pdir_t *pdir,
 
 pdir_t *pdir_clone(pdir_t *pdir)
 {
-   pdir_t *new_pdir = kalloc_obj(pdir_t);
+   pdir_t *new_pdir = pf_alloc();
 
    if (!new_pdir)
       return NULL;
 
    ASSERT(IS_PAGE_ALIGNED(new_pdir));
-   memcpy32(new_pdir, pdir, sizeof(pdir_t) / 4);
 
    for (u32 i = 0; i < KERNEL_BASE_PD_IDX; i++) {
 
-      /* User-space cannot use 4-MB pages */
-      ASSERT(!pdir->entries[i].psize);
+      page_dir_entry_t *const e = &pdir->entries[i];
 
-      if (!pdir->entries[i].present)
+      if (!e->present)
          continue;
 
-      page_table_t *pt = kalloc_obj(page_table_t);
+      if (e->psize) {
+
+         /* Big page: mark it as COW as a whole, unless it's shared */
+         if (!(e->avail & PAGE_SHARED)) {
 
-      if (UNLIKELY(!pt)) {
+            if (e->rw)
+               e->avail |= PAGE_COW_ORIG_RW;
 
-         for (; i > 0; i--) {
-            if (pdir->entries[i - 1].present)
-               kfree_obj(pdir_get_page_table(pdir, i - 1), page_table_t);
+            e->rw = false;
          }
 
-         kfree_obj(new_pdir, pdir_t);
-         return NULL;
+         big_page_ref_count_inc(big_page_paddr(*e));
+         continue;
       }
 
-      ASSERT(IS_PAGE_ALIGNED(pt));
-      new_pdir->entries[i].ptaddr=SHR_BITS(KERNEL_VA_TO_PA(pt),PAGE_SHIFT,u32);
+      /*
+       * Don't copy the page table: share it, read-only. That makes fork()'s
+       * cost independent from the number of pages mapped, which matters a
+       * lot when the child is going to call execve() right away.
+       */
+      share_page_table(e);
    }
 
-   for (u32 i = 0; i < KERNEL_BASE_PD_IDX; i++) {
+   memcpy32(new_pdir, pdir, sizeof(pdir_t) / 4);
+   return new_pdir;
+}
 
-      if (!pdir->entries[i].present)
-         continue;
+/*
+ * Copy the big page at `pd_index` in `new_pdir`. If we cannot get a new big
+ * page, fall back to copying it page by page.
+ */
+static int
+deep_clone_big_page(pdir_t *pdir, pdir_t *new_pdir, u32 pd_index)
+{
+   const page_dir_entry_t e = pdir->entries[pd_index];
+   const ulong orig_paddr = big_page_paddr(e);
+   const u32 flags = big_page_to_pt_flags(e);
+   page_table_t *new_pt;
+   void *new_page;
+   ulong paddr;
 
-      page_table_t *orig_pt = pdir_get_page_table(pdir, i);
-      page_table_t *new_pt = pdir_get_page_table(new_pdir, i);
+   if ((new_page = pf_alloc_big(BIG_PAGE_SIZE))) {
 
-      /* Mark all the non-shared pages in that page-table as COW. */
-      for (u32 j = 0; j < 1024; j++) {
+      paddr = KERNEL_VA_TO_PA(new_page);
+      memcpy32(new_page, KERNEL_PA_TO_VA(orig_paddr), BIG_PAGE_SIZE / 4);
+      big_page_ref_count_inc(paddr);
 
-         page_t *const p = &orig_pt->pages[j];
+      new_pdir->entries[pd_index].raw = e.raw;
+      new_pdir->entries[pd_index].big_4mb_page.paddr =
+         SHR_BITS(paddr, BIG_PAGE_SHIFT, u32);
 
-         if (!p->present)
-            continue;
+      return 0;
+   }
 
-         const ulong orig_paddr = (ulong)p->pageAddr << PAGE_SHIFT;
+   if (!(new_pt = pf_zalloc()))
+      return -ENOMEM;
 
-         /* Sanity-check: a mapped page MUST have ref-count > 0 */
-         ASSERT(pf_ref_count_get(orig_paddr) > 0);
+   /* Make the page table reachable right away, as in pdir_deep_clone() */
+   new_pdir->entries[pd_index].raw =
+      PG_PRESENT_BIT | PG_RW_BIT | PG_US_BIT | KERNEL_VA_TO_PA(new_pt);
 
-         if (!(p->avail & PAGE_SHARED)) {
+   for (u32 j = 0; j < 1024; j++) {
 
-            if (p->rw)
-               p->avail |= PAGE_COW_ORIG_RW;
+      if (!(new_page = pf_alloc()))
+         return -ENOMEM;
 
-            p->rw = false;
-         }
+      paddr = KERNEL_VA_TO_PA(new_page);
+      ASSERT(pf_ref_count_get(paddr) == 0);
+      pf_ref_count_inc(paddr);
 
-         pf_ref_count_inc(orig_paddr);
-      }
+      memcpy32(new_page,
+               KERNEL_PA_TO_VA(orig_paddr + (j << PAGE_SHIFT)),
+               PAGE_SIZE / 4);
 
-      // copy the page table
-      memcpy(new_pt, orig_pt, sizeof(page_table_t));
+      new_pt->pages[j].raw = flags | paddr;
    }
 
-   return new_pdir;
+   return 0;
 }
 
 pdir_t *
@@ -686,10 +1563,7 @@ pdir_deep_clone(pdir_t *pdir)
    STATIC_ASSERT(sizeof(pdir_t) == PAGE_SIZE);
    STATIC_ASSERT(sizeof(page_table_t) == PAGE_SIZE);
 
-   struct kmalloc_acc acc;
-   kmalloc_create_accelerator(&acc, PAGE_SIZE, 4);
-
-   pdir_t *new_pdir = kmalloc_accelerator_get_elem(&acc);
+   pdir_t *new_pdir = pf_zalloc();
 
    if (UNLIKELY(!new_pdir))
       goto oom_exit;
@@ -698,30 +1572,43 @@ pdir_deep_clone(pdir_t *pdir)
 
    for (u32 i = 0; i < KERNEL_BASE_PD_IDX; i++) {
 
-      new_pdir->entries[i].raw = pdir->entries[i].raw;
+      if (!pdir->entries[i].present)
+         continue;
 
-      /* User-space cannot use 4-MB pages */
-      ASSERT(!pdir->entries[i].psize);
+      if (pdir->entries[i].psize) {
+
+         if (deep_clone_big_page(pdir, new_pdir, i) < 0)
+            goto oom_exit;
 
-      if (!pdir->entries[i].present)
          continue;
+      }
 
       page_table_t *orig_pt = pdir_get_page_table(pdir, i);
-      page_table_t *new_pt = kmalloc_accelerator_get_elem(&acc);
+      page_table_t *new_pt = pf_zalloc();
 
       if (UNLIKELY(!new_pt))
          goto oom_exit;
 
       ASSERT(IS_PAGE_ALIGNED(new_pt));
 
-      for (u32 j = 0; j < 1024; j++) {
+      /*
+       * Make the page table reachable right away, so that pdir_destroy() can
+       * free it, along with the pages already copied, in the OOM case.
+       */
+      new_pdir->entries[i].raw = pdir->entries[i].raw;
+      new_pdir->entries[i].ptaddr =
+         SHR_BITS(KERNEL_VA_TO_PA(new_pt), PAGE_SHIFT, u32);
 
-         new_pt->pages[j].raw = orig_pt->pages[j].raw;
+      /* The new page table is private, even if the original one isn't */
+      new_pdir->entries[i].avail &= ~PAGE_PT_SHARED;
+      new_pdir->entries[i].rw = true;
+
+      for (u32 j = 0; j < 1024; j++) {
 
          if (!orig_pt->pages[j].present)
             continue;
 
-         void *new_page = kmalloc_accelerator_get_elem(&acc);
+         void *new_page = pf_alloc();
 
          if (!new_page)
             goto oom_exit;
@@ -738,24 +1625,19 @@ pdir_deep_clone(pdir_t *pdir)
          pf_ref_count_inc(new_page_paddr);
 
          memcpy32(new_page, orig_page, PAGE_SIZE / 4);
+         new_pt->pages[j].raw = orig_pt->pages[j].raw;
          new_pt->pages[j].pageAddr = SHR_BITS(new_page_paddr, PAGE_SHIFT, u32);
       }
-
-      new_pdir->entries[i].ptaddr =
-         SHR_BITS(KERNEL_VA_TO_PA(new_pt), PAGE_SHIFT, u32);
    }
 
    for (u32 i = KERNEL_BASE_PD_IDX; i < 1024; i++) {
       new_pdir->entries[i].raw = pdir->entries[i].raw;
    }
 
-   kmalloc_destroy_accelerator(&acc);
    return new_pdir;
 
 oom_exit:
 
-   kmalloc_destroy_accelerator(&acc);
-
    if (new_pdir)
       pdir_destroy(new_pdir);
 
@@ -767,30 +1649,25 @@ void pdir_destroy(pdir_t *pdir)
    // Kernel's pdir cannot be destroyed!
    ASSERT(pdir != __kernel_pdir);
 
+   // With SMP, other CPUs running kernel threads might still have it loaded
+   smp_pdir_release(pdir);
+
    for (u32 i = 0; i < KERNEL_BASE_PD_IDX; i++) {
 
       if (!pdir->entries[i].present)
          continue;
 
-      page_table_t *pt = pdir_get_page_table(pdir, i);
-
-      for (u32 j = 0; j < 1024; j++) {
-
-         if (!pt->pages[j].present)
-            continue;
-
-         const ulong paddr = (ulong)pt->pages[j].pageAddr << PAGE_SHIFT;
-
-         if (pf_ref_count_dec(paddr) == 0)
-            kfree2(KERNEL_PA_TO_VA(paddr), PAGE_SIZE);
+      if (pdir->entries[i].psize) {
+         big_page_release(big_page_paddr(pdir->entries[i]), true, NULL);
+         continue;
       }
 
-      // We freed all the pages, now free the whole page-table.
-      kfree_obj(pt, page_table_t);
+      // Free all the pages and the page-table, unless it's still shared.
+      put_page_table(pdir->entries[i], true);
    }
 
    // We freed all pages and all the page-tables, now free pdir.
-   kfree_obj(pdir, pdir_t);
+   pf_free(pdir);
 }
 
 
@@ -814,6 +1691,58 @@ void map_4mb_page_int(pdir_t *pdir,
    pdir->entries[pd_index].raw = flags | paddr;
 }
 
+NODISCARD int
+map_big_page(pdir_t *pdir, void *vaddrp, ulong paddr, u32 pg_flags)
+{
+   const u32 vaddr = (u32) vaddrp;
+   const u32 pd_index = (vaddr >> BIG_PAGE_SHIFT);
+   const bool rw = !!(pg_flags & PAGING_FL_RW);
+   const bool us = !!(pg_flags & PAGING_FL_US);
+   u32 avail_bits = 0;
+
+   /* Only user big pages are ref-counted and can be split */
+   ASSERT(us);
+   ASSERT(pd_index < KERNEL_BASE_PD_IDX);
+
+   if (pg_flags & PAGING_FL_SHARED)
+      avail_bits |= PAGE_SHARED;
+
+   if (pdir->entries[pd_index].psize)
+      return -EADDRINUSE;
+
+   if (!prepare_for_big_page(pdir, pd_index)) {
+
+      /* Release the 4 KB mappings in the range and then the page table */
+      unmap_pages_permissive(pdir, vaddrp, 1024, true);
+      VERIFY(prepare_for_big_page(pdir, pd_index));
+   }
+
+   map_4mb_page_int(pdir,
+                    vaddrp,
+                    paddr,
+                    PG_PRESENT_BIT                        |
+                    PG_4MB_BIT                            |
+                    (u32)(avail_bits << PG_CUSTOM_B0_POS) |
+                    (u32)(us << PG_US_BIT_POS)            |
+                    (u32)(rw << PG_RW_BIT_POS));
+
+   big_page_ref_count_inc(paddr);
+   tlb_invalidate(pdir, vaddr, 1);
+   return 0;
+}
+
+size_t get_user_big_pages_count(pdir_t *pdir)
+{
+   size_t count = 0;
+
+   for (u32 i = 0; i < KERNEL_BASE_PD_IDX; i++) {
+      if (pdir->entries[i].present && pdir->entries[i].psize)
+         count++;
+   }
+
+   return count;
+}
+
 static inline bool in_big_4mb_page(pdir_t *pdir, void *vaddrp)
 {
    const u32 vaddr = (u32) vaddrp;
@@ -834,7 +1763,7 @@ static void set_big_4mb_page_pat_wc(pdir_t *pdir, void *vaddrp)
    e->big_4mb_page.cd = 1;
    e->big_4mb_page.wt = 1;
 
-   invalidate_page_hw(vaddr);
+   tlb_invalidate(pdir, vaddr, 1);
 }
 
 static void set_4kb_page_pat_wc(pdir_t *pdir, void *vaddrp)
@@ -855,7 +1784,7 @@ static void set_4kb_page_pat_wc(pdir_t *pdir, void *vaddrp)
    pt->pages[pt_index].cd = 1;
    pt->pages[pt_index].wt = 1;
 
-   invalidate_page_hw(vaddr);
+   tlb_invalidate(pdir, vaddr, 1);
 }
 
 void set_pages_pat_wc(pdir_t *pdir, void *vaddr, size_t size)
@@ -5,6 +5,7 @@
 
 #include <tilck/common/basic_defs.h>
 #include <tilck/common/utils.h>
+#include <tilck/common/elf_types.h>
 
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/process.h>
@@ -40,6 +41,19 @@ STATIC_ASSERT(
 
 STATIC_ASSERT(TOT_PROC_AND_TASK_SIZE <= 1024);
 
+/* The vDSO (vdso.S) reads the vvar page using these offsets */
+STATIC_ASSERT(OFFSET_OF(struct vdso_data, seq) == VVAR_SEQ_OFF);
+STATIC_ASSERT(OFFSET_OF(struct vdso_data, tick_mult) == VVAR_TICK_MULT_OFF);
+STATIC_ASSERT(OFFSET_OF(struct vdso_data, time_ns) == VVAR_TIME_NS_OFF);
+STATIC_ASSERT(
+   OFFSET_OF(struct vdso_data, tick_cycles) == VVAR_TICK_CYCLES_OFF
+);
+STATIC_ASSERT(OFFSET_OF(struct vdso_data, tick_ns) == VVAR_TICK_NS_OFF);
+STATIC_ASSERT(OFFSET_OF(struct vdso_data, boot_ts) == VVAR_BOOT_TS_OFF);
+
+/* The vDSO assumes the system time is in nanoseconds */
+STATIC_ASSERT(TS_SCALE == BILLION);
+
 void task_info_reset_kernel_stack(struct task *ti)
 {
    ulong bottom = (ulong)ti->kernel_stack + KERNEL_STACK_SIZE - 1;
@@ -112,15 +126,15 @@ push_args_on_user_stack(regs_t *r,
 
    // push the env array (in reverse order)
 
-   push_on_user_stack(r, 0); /*
-                              * 2nd mandatory NULL pointer: after the 'env'
-                              * pointers there could additional aux information
-                              * that some libc implementations check for.
-                              * Therefore, it is essential to add another NULL
-                              * after the env pointers to inform the libc impl
-                              * that no such information exist. For more info,
-                              * check __init_libc() in libmusl.
-                              */
+   /*
+    * The aux vector, after the 'env' pointers. Some libc implementations check
+    * for it: for more info, check __init_libc() in libmusl. The only entry is
+    * AT_SYSINFO_EHDR, which tells the libc where the vDSO is.
+    */
+   push_on_user_stack(r, 0);                 // AT_NULL's value
+   push_on_user_stack(r, AT_NULL);
+   push_on_user_stack(r, USER_VDSO_VADDR);   // AT_SYSINFO_EHDR's value
+   push_on_user_stack(r, AT_SYSINFO_EHDR);
 
    push_on_user_stack(r, 0); // mandatory final NULL pointer (end of 'env' ptrs)
 
@@ -299,7 +313,7 @@ kthread_create2(kthread_func_ptr func, const char *name, int fl, void *arg)
       .kernel_resume_eip = (ulong)&soft_interrupt_resume,
       .custom_flags = 0,
       .gs = X86_KERNEL_DATA_SEL,
-      .fs = X86_KERNEL_DATA_SEL,
+      .fs = X86_KERNEL_FS_SEL,
       .es = X86_KERNEL_DATA_SEL,
       .ds = X86_KERNEL_DATA_SEL,
       .edi = 0, .esi = 0, .ebp = 0, .esp = 0,
@@ -324,8 +338,10 @@ kthread_create2(kthread_func_ptr func, const char *name, int fl, void *arg)
 
    ti = allocate_new_thread(kernel_process->pi, tid, !!(fl & KTH_ALLOC_BUFS));
 
-   if (!ti)
+   if (!ti) {
+      release_kernel_tid(tid);
       goto end;
+   }
 
    ASSERT(is_kernel_thread(ti));
 
@@ -439,12 +455,21 @@ setup_first_process(pdir_t *pdir, struct task **ti_ref)
 
    VERIFY(create_new_pid() == 1);
 
-   if (!(ti = allocate_new_process(kernel_process, 1, pdir)))
+   if (!(ti = allocate_new_process(kernel_process, 1, pdir))) {
+      release_pid(1);
       return -ENOMEM;
+   }
 
    pi = ti->pi;
-   pi->pgid = 1;
-   pi->sid = 1;
+
+   if (process_set_groups(pi, 1, 1)) {
+      ti->state = TASK_STATE_ZOMBIE;
+      free_common_task_allocs(ti);
+      free_task(ti);
+      release_pid(1);
+      return -ENOMEM;
+   }
+
    pi->umask = 0022;
    ti->state = TASK_STATE_RUNNING;
    add_task(ti);
@@ -682,6 +707,9 @@ switch_to_task(struct task *ti)
             load_ldt(arch->ldt_index_in_gdt, arch->ldt_size);
       }
 
+      if (get_task_arch_fields(ti)->tls_gdt_index)
+         gdt_load_task_tls(ti);
+
       if (!ti->running_in_kernel)
          process_signals(ti, sig_in_usermode, state);
 
@@ -695,7 +723,14 @@ switch_to_task(struct task *ti)
    /* From here until the end, we have to be as fast as possible */
    disable_interrupts_forced();
    switch_to_task_pop_nested_interrupts();
+
+#if SMP_ENABLED
+   /* Keep the big kernel lock until we're off this stack: see sched.c */
+   this_cpu_dec(disable_preempt);
+#else
    enable_preemption_nosched();
+#endif
+
    ASSERT(is_preemption_enabled());
 
    if (!ti->running_in_kernel)
@@ -706,7 +741,12 @@ switch_to_task(struct task *ti)
    set_curr_task(ti);
    ti->timer_ready = false;
    set_kernel_stack((ulong)ti->state_regs);
+
+#if SMP_ENABLED
+   context_switch_unlock_bkl(state);
+#else
    context_switch(state);
+#endif
 }
 
 int
@@ -717,10 +757,39 @@ sys_set_tid_address(int *tidptr)
     * is not valid, we'll send SIGSEGV to the just created thread.
     */
 
-   get_curr_proc()->set_child_tid = tidptr;
+   get_curr_task()->clear_child_tid = tidptr;
    return get_curr_task()->tid;
 }
 
+int
+arch_specific_clone_settls(struct task *ti, void *tls)
+{
+   struct user_desc dc;
+
+   if (copy_from_user(&dc, tls, sizeof(dc)))
+      return -EFAULT;
+
+   return set_task_thread_area(ti, &dc);
+}
+
+/*
+ * A new task inherits the TLS segment of the task creating it: the forking
+ * task or, for threads, the one calling clone().
+ */
+static void
+reset_arch_task_fields(struct task *ti, struct task *parent)
+{
+   arch_task_members_t *arch = get_task_arch_fields(ti);
+   arch_task_members_t *parent_arch = get_task_arch_fields(parent);
+
+   bzero(arch, sizeof(*arch));
+
+   if (!is_kernel_thread(ti) && !is_kernel_thread(parent)) {
+      arch->tls_gdt_index = parent_arch->tls_gdt_index;
+      memcpy(arch->tls_desc, parent_arch->tls_desc, sizeof(arch->tls_desc));
+   }
+}
+
 bool
 arch_specific_new_task_setup(struct task *ti, struct task *parent)
 {
@@ -738,7 +807,12 @@ arch_specific_new_task_setup(struct task *ti, struct task *parent)
           * order to be sure we won't fail.
           */
 
-         bzero(arch, sizeof(arch_task_members_t));
+         reset_arch_task_fields(ti, parent);
+
+      } else {
+
+         /* The GDT entries of the process are going to be released */
+         arch->tls_gdt_index = 0;
       }
 
       if (arch->aligned_fpu_regs) {
@@ -766,7 +840,7 @@ arch_specific_new_task_setup(struct task *ti, struct task *parent)
        */
 
       if (parent) {
-         bzero(arch, sizeof(*arch));
+         reset_arch_task_fields(ti, parent);
       } else {
          arch_specific_free_task(ti);
       }
@@ -782,6 +856,7 @@ arch_specific_free_task(struct task *ti)
    aligned_kfree2(arch->aligned_fpu_regs, arch->fpu_regs_size);
    arch->aligned_fpu_regs = NULL;
    arch->fpu_regs_size = 0;
+   arch->tls_gdt_index = 0;
 }
 
 void
@@ -800,8 +875,6 @@ arch_specific_new_proc_setup(struct process *pi, struct process *parent)
    for (int i = 0; i < ARRAY_SIZE(arch->gdt_entries); i++)
       if (arch->gdt_entries[i])
          gdt_entry_inc_ref_count(arch->gdt_entries[i]);
-
-   pi->set_child_tid = NULL;
 }
 
 void
@@ -825,7 +898,8 @@ arch_specific_free_proc(struct process *pi)
 static void
 handle_fatal_error(regs_t *r, int signum)
 {
-   send_signal(get_curr_tid(), signum, SIG_FL_PROCESS | SIG_FL_FAULT);
+   /* Faults are thread-directed signals */
+   send_signal2(get_curr_pid(), get_curr_tid(), signum, SIG_FL_FAULT);
 }
 
 /* General protection fault handler */
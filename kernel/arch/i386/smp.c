@@ -0,0 +1,477 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck_gen_headers/config_sched.h>
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+#include <tilck/common/string_util.h>
+
+#include <tilck/kernel/smp.h>
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/paging.h>
+#include <tilck/kernel/paging_hw.h>
+#include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/sched.h>
+#include <tilck/kernel/spinlock.h>
+
+#include "gdt_int.h"
+#include "../generic_x86/lapic.h"
+#include "../generic_x86/pit.h"
+
+#if SMP_ENABLED
+
+/*
+ * SMP bring-up
+ * --------------
+ *
+ * The application processors (APs) listed in ACPI's MADT are started, one at
+ * a time, with the classic INIT-SIPI-SIPI sequence. They begin executing in
+ * real mode the code in ap_trampoline.S, copied at AP_TRAMPOLINE_PADDR, which
+ * switches to protected mode, enables paging and calls ap_entry() on a
+ * dedicated kernel stack.
+ *
+ * Before starting an AP, the BSP prepares its copy of the GDT with its TSS and
+ * its per-CPU data segment (see gdt_setup_ap()) and its idle task. The AP
+ * loads them, starts the periodic tick of its local APIC timer and waits for
+ * the big kernel lock (see sched.c), which the BSP holds until kmain() runs
+ * the scheduler for the first time. Then, it switches to its idle task and
+ * from that moment on it runs tasks like the BSP does: the ones in its own
+ * runqueue and the ones it steals from the other CPUs.
+ *
+ * The external IRQs still go only to the BSP, through the PIC. The APs get
+ * just their timer tick and the IPIs sent by the other CPUs: the reschedule
+ * one (see smp_send_resched()) and the one used for the cross-CPU calls (see
+ * smp_call()), like the TLB shootdown.
+ */
+
+#define AP_STARTUP_TIMEOUT_MS                   200
+
+/* Read by the trampoline: keep in sync with ap_trampoline.S */
+struct ap_trampoline_data {
+
+   u32 cr0;
+   u32 cr3;
+   u32 cr4;
+   u32 stack;
+   u32 entry;
+};
+
+struct desc_table_ptr {
+
+   u16 limit;
+   ulong base;
+
+} PACKED;
+
+extern char ap_trampoline[];
+extern char ap_trampoline_data[];
+extern char ap_trampoline_end[];
+
+/*
+ * The BSP is always the CPU 0: its preemption counter starts at 1, because it
+ * holds the big kernel lock since the boot (see sched.c).
+ */
+struct cpu __cpus[MAX_CPUS] = {
+   [0] = {
+      .self = &__cpus[0],
+      .disable_preempt = 1,
+   },
+};
+
+STATIC_ASSERT(OFFSET_OF(struct cpu, current) == CPU_CURRENT_OFF);
+STATIC_ASSERT(OFFSET_OF(struct cpu, disable_preempt) == CPU_PREEMPT_OFF);
+STATIC_ASSERT(MAX_CPUS <= 32); /* the CPU masks are u32 */
+
+static u32 cpus_count = 1;
+static bool bsp_in_madt;
+static struct task *ap_idle_tasks[MAX_CPUS];
+
+/* The IDT, loaded by the APs as well */
+static struct desc_table_ptr idt_ptr;
+
+/* Cross-CPU calls: see smp_call() */
+static struct spinlock call_lock;
+static smp_call_func call_func;
+static void *call_arg;
+static ATOMIC(u32) call_pending;
+static ATOMIC(int) stopping_cpu = -1;
+
+static ALWAYS_INLINE void cpu_relax(void)
+{
+   asmVolatile("pause");
+}
+
+static u32 get_bsp_apic_id(void)
+{
+   u32 a, b, c, d;
+   cpuid(1, &a, &b, &c, &d);
+   return b >> 24;
+}
+
+/* Called by the ACPI module, while parsing the MADT */
+void smp_register_cpu(u32 apic_id)
+{
+   struct cpu *c;
+
+   if (apic_id == get_bsp_apic_id()) {
+      __cpus[0].apic_id = apic_id;
+      bsp_in_madt = true;
+      return;
+   }
+
+   if (cpus_count == MAX_CPUS) {
+      printk("SMP: too many CPUs, ignoring APIC ID %u\n", apic_id);
+      return;
+   }
+
+   c = &__cpus[cpus_count];
+   c->self = c;
+   c->id = cpus_count++;
+   c->apic_id = apic_id;
+}
+
+static struct cpu *get_cpu_by_apic_id(u32 apic_id)
+{
+   for (u32 i = 0; i < cpus_count; i++) {
+      if (__cpus[i].apic_id == apic_id)
+         return &__cpus[i];
+   }
+
+   return NULL;
+}
+
+/*
+ * Run the pending cross-CPU call for this CPU, if any. Called by the IPI
+ * handler and by the spin loops with the interrupts disabled: otherwise, two
+ * CPUs calling each other (or one waiting for a spinlock held by the other)
+ * would deadlock.
+ */
+static void smp_poll_calls(void)
+{
+   const u32 id = get_cpu_id();
+   const u32 bit = 1u << id;
+   const int stopping = atomic_load_explicit(&stopping_cpu, mo_relaxed);
+   smp_call_func func;
+   void *arg;
+
+   if (UNLIKELY(stopping >= 0 && stopping != (int)id)) {
+
+      /* Another CPU panicked: see smp_stop_other_cpus() */
+      disable_interrupts_forced();
+
+      while (true)
+         halt();
+   }
+
+   if (!(atomic_load_explicit(&call_pending, mo_acquire) & bit))
+      return;
+
+   /*
+    * Read the call before clearing our bit: after that, the caller can
+    * return and another call can start.
+    */
+   func = call_func;
+   arg = call_arg;
+   func(arg);
+
+   atomic_fetch_and_explicit(&call_pending, ~bit, mo_release);
+}
+
+bool smp_handle_call_ipi(int int_num)
+{
+   if (int_num != 32 + LAPIC_CALL_IRQ)
+      return false;
+
+   lapic_eoi();
+   smp_poll_calls();
+   return true;
+}
+
+/*
+ * Run `func(arg)` on the CPUs in `cpu_mask` (the current one is excluded) and
+ * wait for all of them to complete it. The function runs in IRQ context,
+ * without the big kernel lock: it must not take it, nor any spinlock.
+ */
+void smp_call(u32 cpu_mask, smp_call_func func, void *arg)
+{
+   ulong var;
+   disable_interrupts(&var);
+   spin_lock(&call_lock);
+   {
+      cpu_mask &= ~(1u << get_cpu_id());
+
+      call_func = func;
+      call_arg = arg;
+      atomic_store_explicit(&call_pending, cpu_mask, mo_release);
+
+      for (u32 i = 0; i < cpus_count; i++) {
+         if (cpu_mask & (1u << i))
+            lapic_send_fixed_ipi(get_cpu(i)->apic_id, LAPIC_CALL_IRQ);
+      }
+
+      while (atomic_load_explicit(&call_pending, mo_acquire))
+         cpu_relax();
+   }
+   spin_unlock(&call_lock);
+   enable_interrupts(&var);
+}
+
+void spin_wait_unlocked(struct spinlock *l)
+{
+   while (atomic_load_explicit(&l->locked, mo_relaxed)) {
+
+      if (!are_interrupts_enabled())
+         smp_poll_calls();
+
+      cpu_relax();
+   }
+}
+
+void spin_lock(struct spinlock *l)
+{
+   while (!spin_trylock(l))
+      spin_wait_unlocked(l);
+}
+
+void smp_send_resched(u32 cpu)
+{
+   struct cpu *c = get_cpu(cpu);
+
+   if (is_cpu_online(c))
+      lapic_send_fixed_ipi(c->apic_id, LAPIC_RESCHED_IRQ);
+}
+
+/* Called by panic(): make all the other CPUs halt forever */
+void smp_stop_other_cpus(void)
+{
+   int expected = -1;
+
+   if (!atomic_compare_exchange_strong_explicit(&stopping_cpu,
+                                                &expected,
+                                                (int)get_cpu_id(),
+                                                mo_relaxed,
+                                                mo_relaxed))
+   {
+      return; /* Another CPU is already stopping us all */
+   }
+
+   for (u32 i = 0; i < cpus_count; i++) {
+      if (i != get_cpu_id() && is_cpu_online(get_cpu(i)))
+         lapic_send_fixed_ipi(get_cpu(i)->apic_id, LAPIC_CALL_IRQ);
+   }
+}
+
+/*
+ * The mask of the other online CPUs using `pdir` or, when `pdir` is NULL, of
+ * all the other online CPUs. Call with the interrupts disabled.
+ */
+u32 smp_get_pdir_users(void *pdir)
+{
+   u32 mask = 0;
+   ASSERT(!are_interrupts_enabled());
+
+   /* Order the page tables changes before reading the pdirs in use */
+   atomic_thread_fence(mo_seq_cst);
+
+   for (u32 i = 0; i < cpus_count; i++) {
+
+      struct cpu *c = get_cpu(i);
+
+      if (i == get_cpu_id() || !is_cpu_online(c))
+         continue;
+
+      if (!pdir || atomic_load_explicit(&c->pdir, mo_relaxed) == pdir)
+         mask |= (1u << i);
+   }
+
+   return mask;
+}
+
+static void smp_pdir_release_func(void *pdir)
+{
+   if (atomic_load_explicit(&get_this_cpu()->pdir, mo_relaxed) == pdir)
+      set_curr_pdir(get_kernel_pdir());
+}
+
+/*
+ * The kernel threads don't switch the page directory: make the other CPUs
+ * stop using `pdir`, which is about to be destroyed.
+ */
+void smp_pdir_release(void *pdir)
+{
+   ulong var;
+   u32 mask;
+
+   disable_interrupts(&var);
+   {
+      if ((mask = smp_get_pdir_users(pdir)))
+         smp_call(mask, &smp_pdir_release_func, pdir);
+   }
+   enable_interrupts(&var);
+}
+
+static NORETURN void ap_entry(void)
+{
+   struct cpu *c;
+
+   /* Switch from the temporary page directory to the kernel's one */
+   __set_curr_pdir(KERNEL_VA_TO_PA(get_kernel_pdir()));
+   invalidate_page(AP_TRAMPOLINE_PADDR);
+
+   /* Can't fail: the BSP started exactly this CPU */
+   c = get_cpu_by_apic_id(lapic_get_id());
+
+   /*
+    * Load the GDT of this CPU: from now on, the per-CPU data is accessible.
+    * The trampoline's GDT has the same kernel code and data segments: there's
+    * no need to reload the other segment registers.
+    */
+   gdt_load_ap(c->id);
+   asmVolatile("lidt %0" : : "m" (idt_ptr) : "memory");
+   atomic_store_explicit(&c->pdir, get_kernel_pdir(), mo_relaxed);
+
+   lapic_init_ap();
+   setup_sysenter_interface();
+   atomic_store_explicit(&c->online, true, mo_release);
+
+   /* Wait for the BKL: the BSP releases it at the end of kmain() */
+   disable_preemption();
+   lapic_start_ap_tick();
+   switch_to_task(ap_idle_tasks[c->id]);
+}
+
+static bool start_ap(struct cpu *c, struct ap_trampoline_data *data)
+{
+   if (!(c->stack = kzmalloc(KERNEL_STACK_SIZE)))
+      return false;
+
+   data->stack = (ulong)c->stack + KERNEL_STACK_SIZE;
+
+   lapic_send_init_ipi(c->apic_id);
+   pit_busy_wait_ms(10);
+
+   for (int i = 0; i < 2 && !is_cpu_online(c); i++) {
+      lapic_send_startup_ipi(c->apic_id, AP_TRAMPOLINE_PADDR);
+      pit_busy_wait_ms(1);
+   }
+
+   for (int i = 0; i < AP_STARTUP_TIMEOUT_MS && !is_cpu_online(c); i++)
+      pit_busy_wait_ms(1);
+
+   if (!is_cpu_online(c)) {
+
+      /*
+       * Put the AP back in the wait-for-SIPI state: it must not run the
+       * trampoline after we've released its page directory.
+       */
+      lapic_send_init_ipi(c->apic_id);
+      kfree2(c->stack, KERNEL_STACK_SIZE);
+      c->stack = NULL;
+      printk("SMP: the CPU with APIC ID %u did not start\n", c->apic_id);
+      return false;
+   }
+
+   return true;
+}
+
+/* Prepare everything the AP `c` needs to run tasks, then start it */
+static bool setup_and_start_ap(struct cpu *c, struct ap_trampoline_data *data)
+{
+   struct task *idle;
+
+   if (!(idle = sched_create_idle_task(c->id)))
+      return false;
+
+   if (!gdt_setup_ap(c->id) || !start_ap(c, data)) {
+
+      /*
+       * The idle task will never run: just keep it out of the runnable
+       * tasks. A kthread can't be killed from outside.
+       */
+      task_change_state(idle, TASK_STATE_SLEEPING);
+      return false;
+   }
+
+   return true;
+}
+
+void init_smp(void)
+{
+   const ulong tr_size = (ulong)(ap_trampoline_end - ap_trampoline);
+   void *const tr_va = KERNEL_PA_TO_VA(AP_TRAMPOLINE_PADDR);
+   struct ap_trampoline_data *data;
+   pdir_t *tmp_pdir;
+   u32 online = 1;
+   ulong var;
+   bool ok;
+
+   ASSERT(!is_preemption_enabled());
+
+   if (cpus_count <= 1)
+      return;
+
+   disable_interrupts(&var);
+   {
+      ok = lapic_init() && lapic_get_id() == __cpus[0].apic_id;
+
+      if (ok)
+         ok = lapic_setup_ap_tick();
+   }
+   enable_interrupts(&var);
+
+   if (!bsp_in_madt || !ok) {
+      printk("SMP: local APIC not usable, using only the boot CPU\n");
+      return;
+   }
+
+   atomic_store_explicit(&__cpus[0].pdir, get_curr_pdir(), mo_relaxed);
+   atomic_store_explicit(&__cpus[0].online, true, mo_release);
+
+   /*
+    * The APs enable paging while executing the trampoline at its physical
+    * address: they need a page directory identity-mapping it, other than the
+    * kernel. Use a temporary one, leaving the kernel's pdir untouched.
+    */
+   if (!(tmp_pdir = pdir_clone(get_kernel_pdir()))) {
+      printk("SMP: out of memory\n");
+      return;
+   }
+
+   if (map_page(tmp_pdir,
+                (void *)AP_TRAMPOLINE_PADDR,
+                AP_TRAMPOLINE_PADDR,
+                PAGING_FL_RW))
+   {
+      printk("SMP: out of memory\n");
+      pdir_destroy(tmp_pdir);
+      return;
+   }
+
+   ASSERT(tr_size <= PAGE_SIZE);
+   memcpy(tr_va, ap_trampoline, tr_size);
+   data = tr_va + (ap_trampoline_data - ap_trampoline);
+
+   asmVolatile("sidt %0" : "=m" (idt_ptr) : : "memory");
+
+   data->cr0 = (u32)read_cr0();
+   data->cr3 = (u32)KERNEL_VA_TO_PA(tmp_pdir);
+   data->cr4 = (u32)read_cr4();
+   data->entry = (u32)&ap_entry;
+
+   for (u32 i = 1; i < cpus_count; i++) {
+
+      struct cpu *c = get_cpu(i);
+
+      /* Until it switches to its idle task, the AP runs on behalf of pid 0 */
+      c->current = kernel_process;
+
+      if (setup_and_start_ap(c, data))
+         online++;
+   }
+
+   unmap_page(tmp_pdir, (void *)AP_TRAMPOLINE_PADDR, false);
+   pdir_destroy(tmp_pdir);
+
+   printk("SMP: %u/%u CPUs online\n", online, cpus_count);
+}
+
+#endif
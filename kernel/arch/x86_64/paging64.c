@@ -88,6 +88,22 @@ map_zero_page(pdir_t *pdir, void *vaddrp, u32 pg_flags)
    NOT_IMPLEMENTED();
 }
 
+NODISCARD int
+map_big_page(pdir_t *pdir, void *vaddrp, ulong paddr, u32 pg_flags)
+{
+   NOT_IMPLEMENTED();
+}
+
+bool is_zero_big_page_range(pdir_t *pdir, void *vaddr)
+{
+   NOT_IMPLEMENTED();
+}
+
+size_t get_user_big_pages_count(pdir_t *pdir)
+{
+   NOT_IMPLEMENTED();
+}
+
 static inline int
 __unmap_page(pdir_t *pdir, void *vaddrp, bool free_pageframe, bool permissive)
 {
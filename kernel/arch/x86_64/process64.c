@@ -48,6 +48,12 @@ arch_specific_free_proc(struct process *pi)
    NOT_IMPLEMENTED();
 }
 
+int
+arch_specific_clone_settls(struct task *ti, void *tls)
+{
+   NOT_IMPLEMENTED();
+}
+
 NODISCARD int
 kthread_create2(kthread_func_ptr func, const char *name, int fl, void *arg)
 {
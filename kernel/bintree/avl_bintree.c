@@ -30,12 +30,18 @@ bintree_node_to_obj(struct bintree_node *node, long offset)
 #define HEIGHT(obj) ((obj) ? OBJTN((obj))->height : -1)
 
 static inline void
-update_height(struct bintree_node *node, long bintree_offset)
+update_height(struct bintree_node *node,
+              long bintree_offset,
+              bintree_aug_cb aug)
 {
    node->height = (u16)MAX(HEIGHT(node->left_obj), HEIGHT(node->right_obj)) + 1;
+
+   /* The children of `node` might have changed: update its augmented data */
+   if (aug)
+      aug(NTOBJ(node));
 }
 
-#define UPDATE_HEIGHT(n) update_height((n), bintree_offset)
+#define UPDATE_HEIGHT(n) update_height((n), bintree_offset, aug)
 
 
 /*
@@ -48,7 +54,7 @@ update_height(struct bintree_node *node, long bintree_offset)
  *    (nll) (nlr)               (nlr) (nr)
  */
 
-void rotate_left_child(void **obj_ref, long bintree_offset)
+void rotate_left_child(void **obj_ref, long bintree_offset, bintree_aug_cb aug)
 {
    ASSERT(obj_ref != NULL);
    ASSERT(*obj_ref != NULL);
@@ -75,7 +81,7 @@ void rotate_left_child(void **obj_ref, long bintree_offset)
  *       (nrl) (nrr)         (nl) (nrl)
  */
 
-void rotate_right_child(void **obj_ref, long bintree_offset)
+void rotate_right_child(void **obj_ref, long bintree_offset, bintree_aug_cb aug)
 {
    ASSERT(obj_ref != NULL);
    ASSERT(*obj_ref != NULL);
@@ -92,11 +98,15 @@ void rotate_right_child(void **obj_ref, long bintree_offset)
    UPDATE_HEIGHT(orig_right_child);
 }
 
-#define ROTATE_CW_LEFT_CHILD(obj) (rotate_left_child((obj), bintree_offset))
-#define ROTATE_CCW_RIGHT_CHILD(obj) (rotate_right_child((obj), bintree_offset))
-#define BALANCE(obj) (balance((obj), bintree_offset))
+#define ROTATE_CW_LEFT_CHILD(obj) \
+   (rotate_left_child((obj), bintree_offset, aug))
+
+#define ROTATE_CCW_RIGHT_CHILD(obj) \
+   (rotate_right_child((obj), bintree_offset, aug))
+
+#define BALANCE(obj) (balance((obj), bintree_offset, aug))
 
-static void balance(void **obj_ref, long bintree_offset)
+static void balance(void **obj_ref, long bintree_offset, bintree_aug_cb aug)
 {
    ASSERT(obj_ref != NULL);
 
@@ -139,7 +149,8 @@ static void
 bintree_remove_internal_aux(void **root_obj_ref,
                             void ***stack,
                             int stack_size,
-                            long bintree_offset)
+                            long bintree_offset,
+                            bintree_aug_cb aug)
 {
    if (LEFT_OF(*root_obj_ref) && RIGHT_OF(*root_obj_ref)) {
 
@@ -286,6 +297,26 @@ bintree_find_ptr_cmp(const void *obj, const void *val, long field_off)
 #include "avl_remove.c.h"
 #undef BINTREE_PTR_FUNCS
 
+bool
+bintree_insert_internal(void **root_obj_ref,
+                        void *obj,
+                        cmpfun_ptr cmp,
+                        long bintree_offset)
+{
+   return bintree_insert_aug_internal(root_obj_ref, obj, cmp,
+                                      bintree_offset, NULL);
+}
+
+void *
+bintree_remove_internal(void **root_obj_ref,
+                        void *value_ptr,
+                        cmpfun_ptr objval_cmpfun,
+                        long bintree_offset)
+{
+   return bintree_remove_aug_internal(root_obj_ref, value_ptr, objval_cmpfun,
+                                      bintree_offset, NULL);
+}
+
 #include <tilck/common/norec.h>
 
 int
@@ -14,16 +14,26 @@ bintree_insert_ptr_internal(void **root_obj_ref,
                             long field_off)
 #else
 bool
-bintree_insert_internal(void **root_obj_ref,
-                        void *obj_or_value,
-                        cmpfun_ptr objval_cmpfun,
-                        long bintree_offset)
+bintree_insert_aug_internal(void **root_obj_ref,
+                            void *obj_or_value,
+                            cmpfun_ptr objval_cmpfun,
+                            long bintree_offset,
+                            bintree_aug_cb aug)
 #endif
 {
+#if BINTREE_PTR_FUNCS
+   const bintree_aug_cb aug = NULL;
+#endif
+
    ASSERT(root_obj_ref != NULL);
 
    if (!*root_obj_ref) {
+
       *root_obj_ref = obj_or_value;
+
+      if (aug)
+         aug(obj_or_value);
+
       return true;
    }
 
@@ -14,12 +14,17 @@ bintree_remove_ptr_internal(void **root_obj_ref,
                             long field_off)
 #else
 void *
-bintree_remove_internal(void **root_obj_ref,
-                        void *obj_or_value,
-                        cmpfun_ptr objval_cmpfun,
-                        long bintree_offset)
+bintree_remove_aug_internal(void **root_obj_ref,
+                            void *obj_or_value,
+                            cmpfun_ptr objval_cmpfun,
+                            long bintree_offset,
+                            bintree_aug_cb aug)
 #endif
 {
+#if BINTREE_PTR_FUNCS
+   const bintree_aug_cb aug = NULL;
+#endif
+
    void **stack[MAX_TREE_HEIGHT];
    int stack_size = 0;
    void *deleted_obj;
@@ -30,7 +35,8 @@ bintree_remove_internal(void **root_obj_ref,
    if (!deleted_obj)
       return NULL;   /* element not found */
 
-   bintree_remove_internal_aux(STACK_TOP(), stack, stack_size, bintree_offset);
+   bintree_remove_internal_aux(STACK_TOP(), stack, stack_size,
+                               bintree_offset, aug);
    return deleted_obj;
 }
 
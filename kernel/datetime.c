@@ -11,6 +11,9 @@
 #include <tilck/kernel/syscalls.h>
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/sched.h>
+#include <tilck/kernel/clocksource.h>
+#include <tilck/kernel/vdso.h>
+#include <tilck/kernel/spinlock.h>
 
 #define FULL_RESYNC_MAX_ATTEMPTS       10
 
@@ -58,11 +61,128 @@ u32 clock_drift_adj_loop_delay = 600 * TIMER_HZ;
 // Value suitable for the `time` selftest
 // u32 clock_drift_adj_loop_delay = 60 * TIMER_HZ;
 
+extern struct spinlock __time_lock;
 extern u64 __time_ns;
 extern u32 __tick_duration;
 extern int __tick_adj_val;
 extern int __tick_adj_ticks_rem;
 
+#define CS_SHIFT                       24
+
+static struct clocksource jiffies_clocksource = {
+   .name = "jiffies",
+   .read = NULL,
+   .freq = TIMER_HZ,
+};
+
+/* All the clocksource state is protected by `__time_lock` (see timer.c) */
+static struct clocksource *curr_cs = &jiffies_clocksource;
+static u32 cs_mult;              /* ns per cycle, << CS_SHIFT */
+static u32 cs_tick_mult;         /* cs_mult, adjusted for the drift comp. */
+static u32 cs_tick_ns;           /* duration of the current tick */
+static u64 cs_tick_cycles;       /* clocksource's value at the last tick */
+static u64 cs_last_time;         /* last value returned by get_sys_time() */
+
+/* Alone in its page, because it's mapped in userspace */
+union vvar_page vvar_page ALIGNED_AT(PAGE_SIZE);
+
+/* Publish the time base for the vDSO: see vdso.h */
+static void vdso_update_time(void)
+{
+   volatile struct vdso_data *vd = &vvar_page.data;
+   ASSERT(!are_interrupts_enabled());
+
+   vd->seq++;
+   vd->tick_mult = curr_cs->vdso ? cs_tick_mult : 0;
+   vd->time_ns = __time_ns;
+   vd->tick_cycles = cs_tick_cycles;
+   vd->tick_ns = cs_tick_ns;
+   vd->boot_ts = (u32)boot_timestamp;
+   vd->seq++;
+}
+
+const struct clocksource *get_clocksource(void)
+{
+   return curr_cs;
+}
+
+/*
+ * Prepare the interpolation for the tick that just started. Called by the
+ * timer with interrupts disabled, after updating __time_ns.
+ *
+ * The drift compensation makes the ticks slightly longer or shorter than
+ * __tick_duration: the interpolation follows it by scaling the clocksource's
+ * rate the same way. That keeps the system time continuous.
+ */
+void clocksource_tick(void)
+{
+   ASSERT(!are_interrupts_enabled());
+
+   if (curr_cs->read) {
+
+      cs_tick_cycles = curr_cs->read();
+
+      if (__tick_adj_ticks_rem) {
+
+         cs_tick_ns = (u32)((s32)__tick_duration + __tick_adj_val);
+         cs_tick_mult = (u32)((u64)cs_mult * cs_tick_ns / __tick_duration);
+
+      } else {
+
+         cs_tick_ns = __tick_duration;
+         cs_tick_mult = cs_mult;
+      }
+   }
+
+   vdso_update_time();
+}
+
+/*
+ * Select `cs` as clocksource, given that it counted `cycles` cycles in `ticks`
+ * timer ticks. Called by the timer, with interrupts disabled.
+ */
+void clocksource_select(struct clocksource *cs, u64 cycles, u32 ticks)
+{
+   const u64 ns = (u64)ticks * __tick_duration;
+   ASSERT(!are_interrupts_enabled());
+
+   /* With slower clocks, cs_mult would not fit in 32 bits */
+   if (cycles < ns / 100) {
+      printk("WARNING: clocksource %s too slow, ignored\n", cs->name);
+      return;
+   }
+
+   cs->freq = cycles * TS_SCALE / ns;
+   cs_mult = (u32)((ns << CS_SHIFT) / cycles);
+   curr_cs = cs;
+   clocksource_tick();
+}
+
+static ALWAYS_INLINE u64 cs_get_sys_time(void)
+{
+   u64 cycles, delta, ts;
+
+   if (!curr_cs->read)
+      return __time_ns;
+
+   /*
+    * Never go beyond the next tick, which will add exactly `cs_tick_ns` to
+    * __time_ns. That can happen only when the timer IRQ is late (or when it's
+    * not coming at all, with the tickless idle).
+    */
+   cycles = curr_cs->read() - cs_tick_cycles;
+   delta = MIN(mul_u64_u32_shr(cycles, cs_tick_mult, CS_SHIFT), cs_tick_ns - 1);
+   ts = __time_ns + delta;
+
+   /*
+    * Changing the drift compensation in the middle of a tick might make the
+    * next one shorter than expected: never go back in time, in that case.
+    */
+   ts = MAX(ts, cs_last_time);
+   cs_last_time = ts;
+   return ts;
+}
+
 bool clock_in_full_resync(void)
 {
    return in_full_resync;
@@ -76,11 +196,11 @@ bool clock_in_resync(void)
    if (in_full_resync)
       return true;
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&__time_lock, &var);
    {
       rem = __tick_adj_ticks_rem;
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&__time_lock, &var);
    return rem != 0;
 }
 
@@ -209,7 +329,7 @@ retry:
     * __tick_adj_ticks_rem accordingly to compensate it.
     */
 
-   disable_interrupts_forced();
+   spin_lock_irq(&__time_lock);
    {
       hw_time_ns = round_up_at64(__time_ns, TS_SCALE);
 
@@ -223,7 +343,7 @@ retry:
          __tick_adj_ticks_rem = abs_drift / __tick_adj_val;
       }
    }
-   enable_interrupts_forced();
+   spin_unlock_irq(&__time_lock);
    clock_rstats.full_resync_count++;
 
    /*
@@ -273,12 +393,12 @@ static void clock_multi_second_resync(int drift)
    const int adj_val = (TS_SCALE / TIMER_HZ) / (drift > 0 ? -10 : 10);
    const int adj_ticks = abs_drift * TIMER_HZ * 10;
 
-   disable_interrupts_forced();
+   spin_lock_irq(&__time_lock);
    {
       __tick_adj_val = adj_val;
       __tick_adj_ticks_rem = adj_ticks;
    }
-   enable_interrupts_forced();
+   spin_unlock_irq(&__time_lock);
    clock_rstats.multi_second_resync_count++;
 }
 
@@ -418,18 +538,24 @@ void init_system_time(void)
    if (boot_timestamp < 0)
       panic("Invalid boot-time UNIX timestamp: %d\n", boot_timestamp);
 
-   __time_ns = 0;
+   spin_lock_irq(&__time_lock);
+   {
+      __time_ns = 0;
+      cs_last_time = 0;
+      vdso_update_time();
+   }
+   spin_unlock_irq(&__time_lock);
 }
 
 u64 get_sys_time(void)
 {
    u64 ts;
    ulong var;
-   disable_interrupts(&var);
+   spin_lock_irqsave(&__time_lock, &var);
    {
-      ts = __time_ns;
+      ts = cs_get_sys_time();
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&__time_lock, &var);
    return ts;
 }
 
@@ -567,10 +693,19 @@ do_clock_getres(clockid_t clk_id, struct k_timespec64 *res)
    switch (clk_id) {
 
       case CLOCK_REALTIME:
-      case CLOCK_REALTIME_COARSE:
       case CLOCK_MONOTONIC:
-      case CLOCK_MONOTONIC_COARSE:
       case CLOCK_MONOTONIC_RAW:
+
+         /* The system time is interpolated using the clocksource */
+         if (curr_cs->read) {
+            *res = (struct k_timespec64) { .tv_sec = 0, .tv_nsec = 1 };
+            break;
+         }
+
+         /* fall-through */
+
+      case CLOCK_REALTIME_COARSE:
+      case CLOCK_MONOTONIC_COARSE:
       case CLOCK_PROCESS_CPUTIME_ID:
       case CLOCK_THREAD_CPUTIME_ID:
 
@@ -11,6 +11,7 @@
 #include <tilck/kernel/paging_hw.h>
 #include <tilck/kernel/process_mm.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/pageframes.h>
 #include <tilck/kernel/fs/vfs.h>
 #include <tilck/kernel/errno.h>
 #include <tilck/kernel/elf_utils.h>
@@ -64,11 +65,11 @@ load_segment_by_copy(fs_handle *elf_h,
 
       if (!is_mapped(pdir, vaddr)) {
 
-         if (!(p = kzmalloc(PAGE_SIZE)))
+         if (!(p = pf_zalloc()))
             return -ENOMEM;
 
          if ((rc = map_page(pdir, vaddr, KERNEL_VA_TO_PA(p), PAGING_FL_RWUS))) {
-            kfree2(p, PAGE_SIZE);
+            pf_free(p);
             return (int)rc;
          }
 
@@ -291,7 +292,7 @@ static int
 alloc_and_map_stack_page(pdir_t *pdir, void *stack_top, u32 i)
 {
    int rc;
-   void *p = kzmalloc(PAGE_SIZE);
+   void *p = pf_zalloc();
 
    if (!p)
       return -ENOMEM;
@@ -301,6 +302,9 @@ alloc_and_map_stack_page(pdir_t *pdir, void *stack_top, u32 i)
                  KERNEL_VA_TO_PA(p),
                  PAGING_FL_RW | PAGING_FL_US);
 
+   if (rc)
+      pf_free(p);
+
    return rc;
 }
 
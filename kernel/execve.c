@@ -149,6 +149,7 @@ execve_final_steps(struct task *ti,
    ti->nested_sig_handlers = 0;
    ti->in_sigsuspend = false;
    reset_all_custom_signal_handlers(ti);
+   ti->clear_child_tid = NULL;
 
    if (pi->debug_cmdline)
       save_cmdline(pi, argv);
@@ -403,12 +404,23 @@ int sys_execve(const char *user_filename,
    struct task *curr = get_curr_task();
    ASSERT(curr != NULL);
 
+   if (!is_main_thread(curr))
+      return -EINVAL; /* not supported from other threads (yet) */
+
    if ((rc = execve_get_path(user_filename, &path)))
       return rc;
 
    if ((rc = execve_get_args(user_argv, user_env, &argv, &env)))
       return rc;
 
+   /*
+    * The new image replaces the whole process: all the other threads must die
+    * first. NOTE: unlike Linux, that happens before loading the new program,
+    * so they are gone even if execve() fails.
+    */
+   if ((rc = terminate_other_threads()))
+      return rc;
+
    return do_execve(curr,
                     path,
                     (const char *const *)argv,
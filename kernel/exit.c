@@ -9,6 +9,9 @@
 #include <tilck/kernel/process_int.h>
 #include <tilck/kernel/tty.h>
 #include <tilck/kernel/errno.h>
+#include <tilck/kernel/user.h>
+#include <tilck/kernel/timer.h>
+#include <tilck/kernel/futex.h>
 #include <tilck/kernel/paging.h>
 #include <tilck/kernel/paging_hw.h>
 #include <tilck/kernel/process_mm.h>
@@ -202,71 +205,65 @@ switch_stack_free_mem_and_schedule(void)
 
 
 /*
- * NOTE: this code ASSUMES that user processes have a _single_ thread:
- *
- *    process = task = thread
- *
- * TODO: re-design this function when thread support is introduced.
- *
- * NOTE: the kernel "process" has multiple threads (kthreads), but they cannot
- * be signalled nor killed.
+ * Kill all the threads of the current process, except the current one. They
+ * will die as soon as they process the SIGKILL signal.
  */
-void terminate_process(int exit_code, int term_sig)
+static void kill_other_threads(struct task *curr)
 {
-   struct task *const ti = get_curr_task();
-   struct process *const pi = ti->pi;
-   struct task *parent;
-   const bool vforked = pi->vforked;
-
-   ASSERT(ti->state != TASK_STATE_ZOMBIE);
-   ASSERT(!is_kernel_thread(ti));
-   ASSERT(is_preemption_enabled());
-
-   if (term_sig)
-      trace_task_killed(term_sig);
-
-   disable_preemption();
-
-   if (ti->wobj.type != WOBJ_NONE) {
-
-      /*
-       * If the task has been waiting on something, we have to reset its wobj
-       * and remove its pointer from the target object's wait_list.
-       */
+   struct task *pos;
+   ASSERT(!is_preemption_enabled());
 
-      wait_obj_reset(&ti->wobj);
+   list_for_each_ro(pos, &curr->pi->threads, thread_node) {
+      if (pos != curr)
+         send_signal2(pos->pi->pid, pos->tid, SIGKILL, 0);
    }
+}
+
+static void clear_child_tid(struct task *ti)
+{
+   int zero = 0;
 
    /*
-    * Sleep-based wake-up timers work without the wait_obj mechanism: we have
-    * to cancel any potential wake-up timer as well.
+    * From set_tid_address(2):
+    *    When a thread whose clear_child_tid is not NULL terminates, then, if
+    *    the thread is sharing memory with other threads, then 0 is written at
+    *    the address specified in clear_child_tid and the kernel performs the
+    *    following operation:
+    *
+    *       futex(clear_child_tid, FUTEX_WAKE, 1, NULL, NULL, 0);
+    *
+    * Errors are ignored, as in Linux.
     */
-   task_cancel_wakeup_timer(ti);
+   if (ti->clear_child_tid) {
+      copy_to_user(ti->clear_child_tid, &zero, sizeof(zero));
+      futex_wake((u32 *)ti->clear_child_tid, 1);
+   }
+}
 
-   /* Here we can either be RUNNABLE (if ti->wobj was set) or RUNNING */
-   ASSERT(ti->state == TASK_STATE_RUNNING || ti->state == TASK_STATE_RUNNABLE);
+/*
+ * Release the resources of the process, when its last thread is dying. This
+ * is the second part of terminate_thread(): preemption is disabled and `ti`
+ * is already a zombie.
+ */
+static void terminate_process_int(struct task *ti, int term_sig)
+{
+   struct process *const pi = ti->pi;
+   struct task *const main_ti = get_process_task(pi);
+   const bool vforked = pi->vforked;
+   struct task *parent;
 
-   /* Drop the any pending signals and prevent new from being enqueued */
-   drop_all_pending_signals(ti);
-   ti->nested_sig_handlers = -1;
+   ASSERT(!is_preemption_enabled());
+   ASSERT(list_is_empty(&pi->threads));
 
-   /*
-    * Close all the handles, keeping the preemption enabled while doing so.
-    */
-   enable_preemption();
-   {
-      close_all_handles();
+   if (pi->exiting) {
+
+      /* exit_group() or a fatal signal: that's the status of the process */
+      main_ti->wstatus = pi->exit_status;
+      term_sig = pi->exit_status & 0x7f;
    }
-   disable_preemption();
 
-   /* OK, from now on the preemption won't be enabled until the end */
-   task_change_state(ti, TASK_STATE_ZOMBIE);
-   ti->wstatus = EXITCODE(exit_code, term_sig);
    parent = get_task(pi->parent_pid);
 
-   call_on_task_exit_callbacks();
-   task_free_all_kernel_allocs(ti);
-
    if (!vforked) {
 
       remove_all_user_zero_mem_mappings(pi);
@@ -275,7 +272,7 @@ void terminate_process(int exit_code, int term_sig)
          release_subsys_flock(pi->elf);
    }
 
-   if (LIKELY(ti->tid != 1)) {
+   if (LIKELY(pi->pid != 1)) {
 
       /*
        * What if the dying task has any children? We have to set their parent
@@ -288,11 +285,11 @@ void terminate_process(int exit_code, int term_sig)
    } else {
 
       /* The dying task is PID 1, init */
-      init_terminated(ti, exit_code, term_sig);
+      init_terminated(ti, main_ti->wstatus >> 8, term_sig);
    }
 
-   /* Wake-up all the tasks waiting on this specific task to exit */
-   wake_up_tasks_waiting_on(ti, task_died);
+   /* Wake-up all the tasks waiting on this specific process to exit */
+   wake_up_tasks_waiting_on(main_ti, task_died);
 
    if (term_sig) {
 
@@ -309,7 +306,7 @@ void terminate_process(int exit_code, int term_sig)
       handle_vforked_child_move_on(pi);
       pi->vforked = true; /* handle_vforked_child_move_on() unsets this */
 
-      if (!pi->inherited_mmap_heap) {
+      if (!pi->inherited_mappings_info) {
 
          /* We're in a vfork-ed child: the parent cannot die */
          ASSERT(parent != NULL);
@@ -335,5 +332,157 @@ void terminate_process(int exit_code, int term_sig)
    if (!vforked)
       pdir_destroy(pi->pdir);
 
+   process_free_mappings_info(pi);
+
+   if (main_ti != ti && pi->automatic_reaping) {
+
+      /*
+       * The main thread died before us, while other threads were alive: it
+       * could not be reaped at that time.
+       */
+      remove_task(main_ti);
+   }
+}
+
+/*
+ * Terminate the current thread. When it's the last thread of its process,
+ * terminate the whole process as well.
+ *
+ * NOTE: the kernel "process" has multiple threads (kthreads), but they cannot
+ * be signalled nor killed.
+ */
+void terminate_thread(int exit_code, int term_sig)
+{
+   struct task *const ti = get_curr_task();
+   struct process *const pi = ti->pi;
+   bool last_thread;
+
+   ASSERT(ti->state != TASK_STATE_ZOMBIE);
+   ASSERT(!is_kernel_thread(ti));
+   ASSERT(is_preemption_enabled());
+
+   if (term_sig)
+      trace_task_killed(term_sig);
+
+   disable_preemption();
+
+   if (ti->wobj.type != WOBJ_NONE) {
+
+      /*
+       * If the task has been waiting on something, we have to reset its wobj
+       * and remove its pointer from the target object's wait_list.
+       */
+
+      wait_obj_reset(&ti->wobj);
+   }
+
+   /*
+    * Sleep-based wake-up timers work without the wait_obj mechanism: we have
+    * to cancel any potential wake-up timer as well.
+    */
+   task_cancel_wakeup_timer(ti);
+
+   /* Here we can either be RUNNABLE (if ti->wobj was set) or RUNNING */
+   ASSERT(ti->state == TASK_STATE_RUNNING || ti->state == TASK_STATE_RUNNABLE);
+
+   /* Drop the any pending signals and prevent new from being enqueued */
+   drop_all_pending_signals(ti);
+   ti->nested_sig_handlers = -1;
+
+   /* Leave the thread group: the last thread terminates the process */
+   list_remove(&ti->thread_node);
+   last_thread = list_is_empty(&pi->threads);
+
+   if (!last_thread) {
+
+      clear_child_tid(ti);
+
+   } else {
+
+      /*
+       * Close all the handles, keeping the preemption enabled while doing so.
+       */
+      enable_preemption();
+      {
+         close_all_handles();
+      }
+      disable_preemption();
+   }
+
+   /* OK, from now on the preemption won't be enabled until the end */
+   task_change_state(ti, TASK_STATE_ZOMBIE);
+   ti->wstatus = EXITCODE(exit_code, term_sig);
+
+   call_on_task_exit_callbacks();
+   task_free_all_kernel_allocs(ti);
+
+   if (last_thread)
+      terminate_process_int(ti, term_sig);
+
    switch_stack_free_mem_and_schedule();
 }
+
+/*
+ * Terminate the whole process, as exit_group() or a fatal signal do: all the
+ * other threads get killed and the current one exits.
+ */
+void terminate_process(int exit_code, int term_sig)
+{
+   struct task *const ti = get_curr_task();
+   struct process *const pi = ti->pi;
+
+   disable_preemption();
+   {
+      /*
+       * Only the first thread terminating the process sets its exit status:
+       * the others are just dying because of that.
+       */
+      if (!pi->exiting) {
+         pi->exiting = true;
+         pi->exit_status = EXITCODE(exit_code, term_sig);
+         kill_other_threads(ti);
+      }
+   }
+   enable_preemption();
+   terminate_thread(exit_code, term_sig);
+}
+
+/*
+ * Kill all the other threads of the current process and wait for them to die,
+ * as execve() requires. Fails with -EINTR if the whole process is exiting.
+ */
+int terminate_other_threads(void)
+{
+   struct task *const ti = get_curr_task();
+   struct process *const pi = ti->pi;
+   int rc = 0;
+
+   disable_preemption();
+
+   if (pi->exiting) {
+      rc = -EINTR;         /* we're going to be killed as well */
+      goto out;
+   }
+
+   if (is_only_live_thread(ti))
+      goto out;
+
+   /* Behave like a group exit, but the current thread won't be killed */
+   pi->exiting = true;
+   pi->exit_status = EXITCODE(0, SIGKILL);
+   kill_other_threads(ti);
+
+   while (!is_only_live_thread(ti)) {
+      enable_preemption();
+      {
+         kernel_sleep(1);
+      }
+      disable_preemption();
+   }
+
+   pi->exiting = false;
+
+out:
+   enable_preemption();
+   return rc;
+}
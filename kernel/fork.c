@@ -9,6 +9,7 @@
 #include <tilck/kernel/paging.h>
 #include <tilck/kernel/paging_hw.h>
 #include <tilck/kernel/process_mm.h>
+#include <tilck/kernel/user.h>
 #include <tilck/kernel/test/fork.h>
 
 STATIC int fork_dup_all_handles(struct process *pi)
@@ -21,6 +22,7 @@ STATIC int fork_dup_all_handles(struct process *pi)
       fs_handle dup_h = NULL;
       fs_handle h = pi->handles[i];
       struct user_mapping *um;
+      struct bintree_walk_ctx ctx;
 
       if (!h)
          continue;
@@ -47,7 +49,13 @@ STATIC int fork_dup_all_handles(struct process *pi)
       if (!pi->mi)
          continue;
 
-      list_for_each_ro(um, &pi->mi->mappings, pi_node) {
+      bintree_in_order_visit_start(&ctx,
+                                   pi->mi->mappings,
+                                   struct user_mapping,
+                                   node,
+                                   false);
+
+      while ((um = bintree_in_order_visit_next(&ctx))) {
          if (um->h == h)
             um->h = dup_h;
       }
@@ -56,8 +64,8 @@ STATIC int fork_dup_all_handles(struct process *pi)
    return 0;
 }
 
-// Returns child's pid
-int do_fork(bool vfork)
+// Returns child's pid. With `newsp` != NULL, the child runs on that stack.
+int do_fork(bool vfork, void *newsp)
 {
    int pid;
    int rc = -EAGAIN;
@@ -105,12 +113,16 @@ int do_fork(bool vfork)
    *child->state_regs = *curr->state_regs; // copy parent's regs_t
    set_return_register(child->state_regs, 0);
 
+   if (newsp)
+      set_user_stack_ptr(child->state_regs, (ulong)newsp);
+
    // Make the parent to get child's pid as return value.
    set_return_register(curr->state_regs, (ulong) child->tid);
 
    if (fork_dup_all_handles(child->pi) < 0)
       goto oom_case;
 
+   process_join_groups_of(child->pi, curr_pi);
    add_task(child);
 
    if (vfork) {
@@ -164,9 +176,105 @@ oom_case:
    if (child) {
       child->state = TASK_STATE_ZOMBIE;
       free_common_task_allocs(child);
+      process_free_mappings_info(child->pi);
       free_task(child);
    }
 
+   release_pid(pid);
+
+out:
+   enable_preemption();
+   return rc;
+}
+
+/*
+ * Create a new thread in the current process, sharing with it the memory, the
+ * handles and the signal handlers: that's clone() with CLONE_THREAD. The flags
+ * have been already validated by sys_clone(). Returns the new thread's tid.
+ */
+int do_clone_thread(ulong flags,
+                    void *newsp,
+                    int *parent_tid,
+                    void *tls,
+                    int *child_tid)
+{
+   int tid;
+   int rc = -EAGAIN;
+   struct task *ti = NULL;
+   struct task *curr = get_curr_task();
+   struct process *pi = curr->pi;
+
+   if (pi->vforked)
+      return -EINVAL; /* we're borrowing our parent's memory */
+
+   disable_preemption();
+   ASSERT_TASK_STATE(curr->state, TASK_STATE_RUNNING);
+
+   if (pi->exiting)
+      goto out; /* all the threads are being killed */
+
+   if ((tid = create_new_pid()) < 0)
+      goto out; /* NOTE: rc is already set to -EAGAIN */
+
+   if (!(ti = allocate_new_thread(pi, tid, true))) {
+      rc = -ENOMEM;
+      goto err;
+   }
+
+   if (flags & CLONE_SETTLS) {
+      if ((rc = arch_specific_clone_settls(ti, tls)))
+         goto err;
+   }
+
+   rc = -EFAULT;
+
+   if (flags & CLONE_PARENT_SETTID) {
+      if (copy_to_user(parent_tid, &tid, sizeof(tid)))
+         goto err;
+   }
+
+   /* The memory is shared: the child would write exactly the same value */
+   if (flags & CLONE_CHILD_SETTID) {
+      if (copy_to_user(child_tid, &tid, sizeof(tid)))
+         goto err;
+   }
+
+   if (flags & CLONE_CHILD_CLEARTID)
+      ti->clear_child_tid = child_tid;
+
+   ti->state = TASK_STATE_RUNNABLE;
+   ti->running_in_kernel = false;
+   task_info_reset_kernel_stack(ti);
+
+   ti->state_regs--; // make room for a regs_t struct in the thread's stack
+   *ti->state_regs = *curr->state_regs; // copy the caller's regs_t
+   set_return_register(ti->state_regs, 0);
+
+   if (newsp)
+      set_user_stack_ptr(ti->state_regs, (ulong)newsp);
+
+   /* The signal mask and the scheduling params are per-thread: inherit them */
+   memcpy(ti->sa_mask, curr->sa_mask, sizeof(ti->sa_mask));
+   ti->sched_policy = curr->sched_policy;
+   ti->rt_prio = curr->base_rt_prio;
+   ti->base_rt_prio = curr->base_rt_prio;
+   ti->nice = curr->nice;
+
+   list_add_tail(&pi->threads, &ti->thread_node);
+   add_task(ti);
+   enable_preemption();
+   return tid;
+
+err:
+
+   if (ti) {
+      ti->state = TASK_STATE_ZOMBIE;
+      free_common_task_allocs(ti);
+      free_task(ti);
+   }
+
+   release_pid(tid);
+
 out:
    enable_preemption();
    return rc;
@@ -73,7 +73,13 @@ fat_read(fs_handle handle, char *buf, size_t bufsize, offt *pos)
 
       ASSERT(to_read >= 0);
 
-      memcpy(buf + written_to_buf, data + cluster_off, (size_t)to_read);
+      if (vfs_copy_to_buf(buf + written_to_buf,
+                          data + cluster_off,
+                          (size_t)to_read))
+      {
+         return written_to_buf > 0 ? (ssize_t)written_to_buf : -EFAULT;
+      }
+
       written_to_buf += to_read;
       *pos += to_read;
 
@@ -499,9 +505,10 @@ fat_open(struct vfs_path *p, fs_handle *out, int fl, mode_t mode)
    h->e = e;
    h->h_fpos = 0;
    h->curr_cluster = fat_get_first_cluster(e);
+   h->spec_flags = VFS_SPFL_USER_BUF;
 
    if (d->mmap_support)
-      h->spec_flags = VFS_SPFL_MMAP_SUPPORTED;
+      h->spec_flags |= VFS_SPFL_MMAP_SUPPORTED;
 
    *out = h;
    return 0;
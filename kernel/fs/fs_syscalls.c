@@ -14,6 +14,12 @@
 
 #include <fcntl.h>      // system header
 
+/*
+ * Max bytes transferred by a single read() or write(), like Linux's
+ * MAX_RW_COUNT: it fits in the `int` returned by the syscalls. See sys_read().
+ */
+#define MAX_RW_COUNT                  ((size_t)INT32_MAX & PAGE_MASK)
+
 static inline bool is_fd_in_valid_range(int fd)
 {
    return IN_RANGE(fd, 0, MAX_HANDLES);
@@ -191,15 +197,25 @@ int sys_read(int fd, void *u_buf, size_t count)
     *    actually transferred. (This is true on both 32-bit and 64-bit systems.)
     *
     * This means that it's perfectly fine to use `int` instead of ssize_t as
-    * return type of sys_read().
+    * return type of sys_read(). That holds for the file systems getting the
+    * user buffer directly (VFS_SPFL_USER_BUF) too, with no other size limit.
     */
 
-   count = MIN(count, (size_t)INT32_MAX);
+   count = MIN(count, MAX_RW_COUNT);
 
    if (h->spec_flags & VFS_SPFL_NO_USER_COPY) {
 
       ret = (int) vfs_read(h, u_buf, count);
 
+   } else if (h->spec_flags & VFS_SPFL_USER_BUF) {
+
+      if (user_out_of_range(u_buf, count))
+         return -EFAULT;
+
+      curr->io_user_buf = true;
+      ret = (int) vfs_read(h, u_buf, count);
+      curr->io_user_buf = false;
+
    } else {
 
       count = MIN(count, IO_COPYBUF_SIZE);
@@ -225,12 +241,21 @@ int sys_write(int fd, const void *u_buf, size_t count)
    if (!(h = get_fs_handle(fd)))
       return -EBADF;
 
-   count = MIN(count, (size_t)INT32_MAX);
+   count = MIN(count, MAX_RW_COUNT);
 
    if (h->spec_flags & VFS_SPFL_NO_USER_COPY) {
 
       ret = (int)vfs_write(h, (void *)u_buf, count);
 
+   } else if (h->spec_flags & VFS_SPFL_USER_BUF) {
+
+      if (user_out_of_range(u_buf, count))
+         return -EFAULT;
+
+      curr->io_user_buf = true;
+      ret = (int)vfs_write(h, (void *)u_buf, count);
+      curr->io_user_buf = false;
+
    } else {
 
       count = MIN(count, IO_COPYBUF_SIZE);
@@ -256,12 +281,21 @@ int sys_pread64(int fd, void *u_buf, size_t count, s64 off)
    if (!(h = get_fs_handle(fd)))
       return -EBADF;
 
-   count = MIN(count, (size_t)INT32_MAX);
+   count = MIN(count, MAX_RW_COUNT);
 
    if (h->spec_flags & VFS_SPFL_NO_USER_COPY) {
 
       ret = (int) vfs_pread(h, u_buf, count, (offt)off);
 
+   } else if (h->spec_flags & VFS_SPFL_USER_BUF) {
+
+      if (user_out_of_range(u_buf, count))
+         return -EFAULT;
+
+      curr->io_user_buf = true;
+      ret = (int) vfs_pread(h, u_buf, count, (offt)off);
+      curr->io_user_buf = false;
+
    } else {
 
       count = MIN(count, IO_COPYBUF_SIZE);
@@ -290,12 +324,21 @@ int sys_pwrite64(int fd, const void *u_buf, size_t count, s64 off)
    if (!(h = get_fs_handle(fd)))
       return -EBADF;
 
-   count = MIN(count, (size_t)INT32_MAX);
+   count = MIN(count, MAX_RW_COUNT);
 
    if (h->spec_flags & VFS_SPFL_NO_USER_COPY) {
 
       ret = (int)vfs_pwrite(h, (void *)u_buf, count, (offt)off);
 
+   } else if (h->spec_flags & VFS_SPFL_USER_BUF) {
+
+      if (user_out_of_range(u_buf, count))
+         return -EFAULT;
+
+      curr->io_user_buf = true;
+      ret = (int)vfs_pwrite(h, (void *)u_buf, count, (offt)off);
+      curr->io_user_buf = false;
+
    } else {
 
       count = MIN(count, IO_COPYBUF_SIZE);
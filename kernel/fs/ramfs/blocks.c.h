@@ -1,16 +1,18 @@
 /* SPDX-License-Identifier: BSD-2-Clause */
 
+DEF_KMEM_CACHE_FOR_TYPE(ramfs_block_cache, "ramfs_block", struct ramfs_block);
+
 static struct ramfs_block *ramfs_new_block(offt page)
 {
    struct ramfs_block *b;
 
    /* Allocate memory for the block object */
-   if (!(b = kalloc_obj(struct ramfs_block)))
+   if (!(b = kmem_cache_alloc(&ramfs_block_cache)))
       return NULL;
 
    /* Allocate block's data */
    if (!(b->vaddr = kzmalloc(PAGE_SIZE))) {
-      kfree_obj(b, struct ramfs_block);
+      kmem_cache_free(&ramfs_block_cache, b);
       return NULL;
    }
 
@@ -32,7 +34,7 @@ static void ramfs_destroy_block(struct ramfs_block *b)
    kfree2(b->vaddr, PAGE_SIZE);
 
    /* Free the memory used by the block object itself */
-   kfree_obj(b, struct ramfs_block);
+   kmem_cache_free(&ramfs_block_cache, b);
 }
 
 static void
@@ -1,5 +1,7 @@
 /* SPDX-License-Identifier: BSD-2-Clause */
 
+DEF_KMEM_CACHE_FOR_TYPE(ramfs_entry_cache, "ramfs_entry", struct ramfs_entry);
+
 static long ramfs_insert_remove_entry_cmp(const void *a, const void *b)
 {
    const struct ramfs_entry *e1 = a;
@@ -29,7 +31,7 @@ ramfs_dir_add_entry(struct ramfs_inode *idir,
    if (enl > sizeof(e->name))
       return -ENAMETOOLONG;
 
-   if (!(e = kalloc_obj(struct ramfs_entry)))
+   if (!(e = kmem_cache_alloc(&ramfs_entry_cache)))
       return -ENOSPC;
 
    ASSERT(ie->parent_dir != NULL);
@@ -90,7 +92,7 @@ ramfs_dir_remove_entry(struct ramfs_inode *idir, struct ramfs_entry *e)
    ASSERT(ie->nlink > 0);
    ie->nlink--;
    idir->num_entries--;
-   kfree_obj(e, struct ramfs_entry);
+   kmem_cache_free(&ramfs_entry_cache, e);
 }
 
 static struct ramfs_entry *
@@ -54,11 +54,10 @@ ramfs_mmap(struct user_mapping *um, pdir_t *pdir, int flags)
       if (rc) {
 
          /* mmap failed, we have to unmap the pages already mapped */
-         vaddr -= PAGE_SIZE;
-
-         for (; vaddr >= um->vaddr; vaddr -= PAGE_SIZE) {
-            unmap_page_permissive(pdir, (void *)vaddr, false);
-         }
+         unmap_pages_permissive(pdir,
+                                (void *)um->vaddr,
+                                (vaddr - um->vaddr) >> PAGE_SHIFT,
+                                false);
 
          return rc;
       }
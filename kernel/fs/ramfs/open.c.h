@@ -25,7 +25,7 @@ ramfs_open_int(struct mnt_fs *fs,
       return -ENOMEM;
 
    h->inode = inode;
-   h->spec_flags = VFS_SPFL_MMAP_SUPPORTED;
+   h->spec_flags = VFS_SPFL_MMAP_SUPPORTED | VFS_SPFL_USER_BUF;
    retain_obj(inode);
 
    if (inode->type == VFS_DIR) {
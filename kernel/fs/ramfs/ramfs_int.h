@@ -6,6 +6,7 @@
 #include <tilck/kernel/fs/vfs.h>
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/kmem_cache.h>
 #include <tilck/kernel/errno.h>
 #include <tilck/kernel/list.h>
 #include <tilck/kernel/user.h>
@@ -155,7 +155,6 @@ static void ramfs_unmap_past_eof_mappings(struct ramfs_inode *i, size_t len)
 {
    const size_t rlen = pow2_round_up_at(len, PAGE_SIZE);
    struct user_mapping *um;
-   ulong va;
    ASSERT(!is_preemption_enabled());
 
    list_for_each_ro(um, &i->mappings_list, inode_node) {
@@ -166,10 +165,10 @@ static void ramfs_unmap_past_eof_mappings(struct ramfs_inode *i, size_t len)
       const ulong voff = rlen >= um->off ? rlen - um->off : 0;
       const ulong vend = um->vaddr + um->len;
 
-      for (va = um->vaddr + voff; va < vend; va += PAGE_SIZE) {
-         unmap_page_permissive(um->pi->pdir, (void *)va, false);
-         invalidate_page(va);
-      }
+      unmap_pages_permissive(um->pi->pdir,
+                             (void *)(um->vaddr + voff),
+                             (vend - um->vaddr - voff) >> PAGE_SHIFT,
+                             false);
    }
 }
 
@@ -254,6 +253,7 @@ ramfs_read_nolock(struct ramfs_handle *rh, char *buf, size_t len, offt *pos)
    struct ramfs_inode *inode = rh->inode;
    offt tot_read = 0;
    offt buf_rem = (offt) len;
+   const char *src;
 
    if (inode->type == VFS_DIR)
       return -EISDIR;
@@ -283,13 +283,11 @@ ramfs_read_nolock(struct ramfs_handle *rh, char *buf, size_t len, offt *pos)
                                node,
                                offset);
 
-      if (block) {
-         /* reading a regular block */
-         memcpy(buf + tot_read, block->vaddr + page_off, (size_t)to_read);
-      } else {
-         /* reading a hole */
-         memset(buf + tot_read, 0, (size_t)to_read);
-      }
+      /* reading a regular block or a hole */
+      src = block ? block->vaddr + page_off : zero_page;
+
+      if (vfs_copy_to_buf(buf + tot_read, src, (size_t)to_read))
+         return tot_read > 0 ? (ssize_t)tot_read : -EFAULT;
 
       tot_read += to_read;
       *pos  += to_read;
@@ -352,7 +350,19 @@ ramfs_write_nolock(struct ramfs_handle *rh, char *buf, size_t len, offt *pos)
          ramfs_append_new_block(inode, block);
       }
 
-      memcpy(block->vaddr + page_off, buf + tot_written, (size_t)to_write);
+      if (vfs_copy_from_buf(block->vaddr + page_off,
+                            buf + tot_written,
+                            (size_t)to_write))
+      {
+         /* The data past the EOF must stay zeroed: see ramfs_inode_extend() */
+         if (*pos + to_write > inode->fsize) {
+            const offt z_off = MAX(*pos, inode->fsize) - page;
+            bzero(block->vaddr + z_off, (size_t)(page_off + to_write - z_off));
+         }
+
+         return tot_written > 0 ? (ssize_t)tot_written : -EFAULT;
+      }
+
       tot_written += to_write;
       buf_rem     -= to_write;
       *pos     += to_write;
@@ -386,21 +396,24 @@ ramfs_readv_nolock(struct ramfs_handle *rh, const struct iovec *iov, int iovcnt)
    struct task *curr = get_curr_task();
    ssize_t ret = 0;
    ssize_t rc;
-   size_t len;
 
    for (int i = 0; i < iovcnt; i++) {
 
-      len = MIN(iov[i].iov_len, IO_COPYBUF_SIZE);
-      rc = ramfs_read_nolock(rh, curr->io_copybuf, len, &rh->h_fpos);
+      if (user_out_of_range(iov[i].iov_base, iov[i].iov_len))
+         return -EFAULT;
+
+      curr->io_user_buf = true;
+      rc = ramfs_read_nolock(rh,
+                             iov[i].iov_base,
+                             iov[i].iov_len,
+                             &rh->h_fpos);
+      curr->io_user_buf = false;
 
       if (rc < 0) {
          ret = rc;
          break;
       }
 
-      if (copy_to_user(iov[i].iov_base, curr->io_copybuf, len))
-         return -EFAULT;
-
       ret += rc;
 
       if (rc < (ssize_t)iov[i].iov_len)
@@ -430,16 +443,18 @@ ramfs_writev_nolock(struct ramfs_handle *h, const struct iovec *iov, int iovcnt)
    struct task *curr = get_curr_task();
    ssize_t ret = 0;
    ssize_t rc;
-   size_t len;
 
    for (int i = 0; i < iovcnt; i++) {
 
-      len = MIN(iov[i].iov_len, IO_COPYBUF_SIZE);
-
-      if (copy_from_user(curr->io_copybuf, iov[i].iov_base, len))
+      if (user_out_of_range(iov[i].iov_base, iov[i].iov_len))
          return -EFAULT;
 
-      rc = ramfs_write_nolock(h, curr->io_copybuf, len, &h->h_fpos);
+      curr->io_user_buf = true;
+      rc = ramfs_write_nolock(h,
+                              iov[i].iov_base,
+                              iov[i].iov_len,
+                              &h->h_fpos);
+      curr->io_user_buf = false;
 
       if (rc < 0) {
          ret = rc;
@@ -5,6 +5,7 @@
 #include <tilck/kernel/fs/vfs.h>
 #include <tilck/kernel/fs/flock.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/kmem_cache.h>
 #include <tilck/kernel/errno.h>
 #include <tilck/kernel/process.h>
 #include <tilck/kernel/process_mm.h>
@@ -170,6 +171,29 @@ ssize_t vfs_pwrite(fs_handle h, void *buf, size_t buf_size, offt off)
    return hb->fops->write(h, buf, buf_size, &off);
 }
 
+/*
+ * Copy to/from the buffer passed to the read/write file_ops of the handles
+ * having VFS_SPFL_USER_BUF. It's an user buffer when the syscall passed it
+ * directly, a kernel one otherwise. Return 0 or -EFAULT.
+ */
+int vfs_copy_to_buf(void *buf, const void *src, size_t n)
+{
+   if (get_curr_task()->io_user_buf)
+      return copy_to_user(buf, src, n) ? -EFAULT : 0;
+
+   memcpy(buf, src, n);
+   return 0;
+}
+
+int vfs_copy_from_buf(void *dest, const void *buf, size_t n)
+{
+   if (get_curr_task()->io_user_buf)
+      return copy_from_user(dest, buf, n) ? -EFAULT : 0;
+
+   memcpy(dest, buf, n);
+   return 0;
+}
+
 offt vfs_seek(fs_handle h, offt off, int whence)
 {
    NO_TEST_ASSERT(is_preemption_enabled());
@@ -827,18 +851,33 @@ ssize_t vfs_readv(fs_handle h, const struct iovec *iov, int iovcnt)
 
    for (int i = 0; i < iovcnt; i++) {
 
-      len = MIN(iov[i].iov_len, IO_COPYBUF_SIZE);
+      if (hb->spec_flags & VFS_SPFL_USER_BUF) {
+
+         if (user_out_of_range(iov[i].iov_base, iov[i].iov_len))
+            return -EFAULT;
 
-      rc = vfs_read(h, curr->io_copybuf, len);
+         len = iov[i].iov_len;
+         curr->io_user_buf = true;
+         rc = vfs_read(h, iov[i].iov_base, len);
+         curr->io_user_buf = false;
+
+      } else {
+
+         len = MIN(iov[i].iov_len, IO_COPYBUF_SIZE);
+         rc = vfs_read(h, curr->io_copybuf, len);
+
+         if (rc > 0 &&
+             copy_to_user(iov[i].iov_base, curr->io_copybuf, (size_t)rc))
+         {
+            return -EFAULT;
+         }
+      }
 
       if (rc < 0) {
          ret = rc;
          break;
       }
 
-      if (copy_to_user(iov[i].iov_base, curr->io_copybuf, len))
-         return -EFAULT;
-
       ret += rc;
 
       if (rc < (ssize_t)iov[i].iov_len)
@@ -873,12 +912,25 @@ ssize_t vfs_writev(fs_handle h, const struct iovec *iov, int iovcnt)
 
    for (int i = 0; i < iovcnt; i++) {
 
-      len = MIN(iov[i].iov_len, IO_COPYBUF_SIZE);
+      if (hb->spec_flags & VFS_SPFL_USER_BUF) {
 
-      if (copy_from_user(curr->io_copybuf, iov[i].iov_base, len))
-         return -EFAULT;
+         if (user_out_of_range(iov[i].iov_base, iov[i].iov_len))
+            return -EFAULT;
 
-      rc = vfs_write(h, curr->io_copybuf, len);
+         len = iov[i].iov_len;
+         curr->io_user_buf = true;
+         rc = vfs_write(h, iov[i].iov_base, len);
+         curr->io_user_buf = false;
+
+      } else {
+
+         len = MIN(iov[i].iov_len, IO_COPYBUF_SIZE);
+
+         if (copy_from_user(curr->io_copybuf, iov[i].iov_base, len))
+            return -EFAULT;
+
+         rc = vfs_write(h, curr->io_copybuf, len);
+      }
 
       if (rc < 0) {
          ret = rc;
@@ -987,6 +1039,12 @@ int vfs_exunlock(struct mnt_fs *fs, vfs_inode_ptr_t i)
 
 #define PANIC_HANDLES      4
 
+DEF_KMEM_CACHE(fs_handle_cache,
+               "fs_handle",
+               MAX_FS_HANDLE_SIZE,
+               MAX_FS_HANDLE_SIZE,
+               NULL);
+
 static char
 panic_handles[PANIC_HANDLES][MAX_FS_HANDLE_SIZE] ALIGNED_AT(MAX_FS_HANDLE_SIZE);
 
@@ -1007,7 +1065,7 @@ fs_handle vfs_alloc_handle_raw(void)
       return NULL;
    }
 
-   return kmalloc(MAX_FS_HANDLE_SIZE);
+   return kmem_cache_alloc(&fs_handle_cache);
 }
 
 void vfs_free_handle(fs_handle h)
@@ -1024,7 +1082,7 @@ void vfs_free_handle(fs_handle h)
       return;
    }
 
-   kfree2(h, MAX_FS_HANDLE_SIZE);
+   kmem_cache_free(&fs_handle_cache, h);
 }
 
 fs_handle vfs_alloc_handle(void)
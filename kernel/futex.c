@@ -0,0 +1,382 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+
+#include <tilck/kernel/futex.h>
+#include <tilck/kernel/sync.h>
+#include <tilck/kernel/sched.h>
+#include <tilck/kernel/process.h>
+#include <tilck/kernel/signal.h>
+#include <tilck/kernel/user.h>
+#include <tilck/kernel/errno.h>
+#include <tilck/kernel/datetime.h>
+#include <tilck/kernel/syscalls.h>
+
+/*
+ * Futexes
+ * ---------
+ *
+ * A task waiting on a futex sleeps on a WOBJ_FUTEX wait object pointing to
+ * the futex's user address, with the FUTEX_WAIT_BITSET's bitset (never 0) as
+ * extra data. The wait object is linked in one of the FUTEX_BUCKETS wait lists,
+ * chosen by hashing the key (pdir, uaddr): that way, a wake-up visits only the
+ * few tasks hashed in the same bucket, instead of all the waiters.
+ *
+ * NOTE: Tilck cannot share anonymous memory between processes, so the shared
+ * futexes are handled like the private ones: the key is always (pdir, uaddr).
+ *
+ * All the state here is protected by disabling the preemption.
+ */
+
+#define FUTEX_HASH_BITS                                     6
+#define FUTEX_BUCKETS                  (1 << FUTEX_HASH_BITS)
+
+/* Beyond that, the timeout cannot be represented in ns: just wait forever */
+#define FUTEX_MAX_TIMEOUT_SEC           (1000 * 1000 * 1000)
+
+static struct list futex_buckets[FUTEX_BUCKETS];
+
+void init_futexes(void)
+{
+   for (int i = 0; i < FUTEX_BUCKETS; i++)
+      list_init(&futex_buckets[i]);
+}
+
+static struct list *
+get_futex_bucket(pdir_t *pdir, u32 *uaddr)
+{
+   u32 key = (u32)(ulong)pdir ^ ((u32)(ulong)uaddr >> 2);
+
+   /* Fibonacci hashing: the top bits of key * 2^32/phi */
+   return &futex_buckets[(key * 2654435769u) >> (32 - FUTEX_HASH_BITS)];
+}
+
+static ALWAYS_INLINE struct task *
+futex_waiter_task(struct wait_obj *wo)
+{
+   return CONTAINER_OF(wo, struct task, wobj);
+}
+
+static bool
+futex_waiter_match(struct wait_obj *wo, pdir_t *pdir, u32 *uaddr, u32 bitset)
+{
+   ASSERT(wo->type == WOBJ_FUTEX);
+
+   return wait_obj_get_ptr(wo) == uaddr &&
+          (wo->extra & bitset) &&
+          futex_waiter_task(wo)->pi->pdir == pdir;
+}
+
+static int
+futex_wake_int(pdir_t *pdir, u32 *uaddr, int count, u32 bitset)
+{
+   struct list *bucket = get_futex_bucket(pdir, uaddr);
+   struct wait_obj *pos, *temp;
+   struct task *ti;
+   int woken = 0;
+
+   ASSERT(!is_preemption_enabled());
+
+   list_for_each(pos, temp, bucket, wait_list_node) {
+
+      if (woken >= count)
+         break;
+
+      if (!futex_waiter_match(pos, pdir, uaddr, bitset))
+         continue;
+
+      /*
+       * Clear the bitset before waking up the task: that's how futex_wait()
+       * distinguishes a wake-up from a timeout or a signal, because both
+       * wake_up() and wait_obj_reset() leave the `extra` field untouched.
+       */
+      ti = futex_waiter_task(pos);
+      pos->extra = 0;
+      task_cancel_wakeup_timer(ti);
+      wake_up(ti);
+      woken++;
+   }
+
+   return woken;
+}
+
+/* Wake up to `count` tasks waiting on `uaddr`, in the current process */
+int futex_wake(u32 *uaddr, int count)
+{
+   int rc;
+   disable_preemption();
+   {
+      rc = futex_wake_int(get_curr_proc()->pdir,
+                          uaddr,
+                          count,
+                          FUTEX_BITSET_MATCH_ANY);
+   }
+   enable_preemption();
+   return rc;
+}
+
+/*
+ * Sleep on `uaddr` if it still contains `val`. `timeout_ns` is relative:
+ * when it's < 0, wait forever.
+ */
+static int
+futex_wait(u32 *uaddr, u32 val, u32 bitset, s64 timeout_ns)
+{
+   struct task *curr = get_curr_task();
+   struct list *bucket;
+   u32 curr_val;
+
+   if (!bitset)
+      return -EINVAL;
+
+   disable_preemption();
+
+   /* Reading the value and going to sleep must be atomic for futex_wake() */
+   if (copy_from_user(&curr_val, uaddr, sizeof(curr_val))) {
+      enable_preemption();
+      return -EFAULT;
+   }
+
+   if (curr_val != val) {
+      enable_preemption();
+      return -EAGAIN;
+   }
+
+   if (!timeout_ns) {
+      enable_preemption();
+      return -ETIMEDOUT;
+   }
+
+   bucket = get_futex_bucket(curr->pi->pdir, uaddr);
+   prepare_to_wait_on(WOBJ_FUTEX, uaddr, bitset, bucket);
+
+   if (timeout_ns > 0)
+      task_set_wakeup_timer_ns(curr, (u64)timeout_ns);
+
+   /* Go to sleep until a wake-up, a signal or the timeout */
+   enter_sleep_wait_state();
+
+   /* ------------------- We've been woken up ------------------- */
+
+   wait_obj_reset(&curr->wobj);
+
+   if (!curr->wobj.extra)
+      return 0;         /* futex_wake_int() cleared our bitset */
+
+   task_cancel_wakeup_timer(curr);
+   return pending_signals() ? -EINTR : -ETIMEDOUT;
+}
+
+/*
+ * Wake up to `nr_wake` tasks waiting on `uaddr` and move up to `nr_requeue`
+ * of the remaining ones to `uaddr2`, without waking them up. When `cmpval` is
+ * not NULL, do that only if `uaddr` still contains `*cmpval`.
+ */
+static int
+futex_requeue(u32 *uaddr,
+              u32 *uaddr2,
+              int nr_wake,
+              int nr_requeue,
+              const u32 *cmpval)
+{
+   pdir_t *pdir = get_curr_proc()->pdir;
+   struct list *bucket, *bucket2;
+   struct wait_obj *pos, *temp;
+   int woken, requeued = 0;
+   u32 curr_val;
+
+   if (nr_wake < 0 || nr_requeue < 0)
+      return -EINVAL;
+
+   disable_preemption();
+
+   if (cmpval) {
+
+      if (copy_from_user(&curr_val, uaddr, sizeof(curr_val))) {
+         enable_preemption();
+         return -EFAULT;
+      }
+
+      if (curr_val != *cmpval) {
+         enable_preemption();
+         return -EAGAIN;
+      }
+   }
+
+   woken = futex_wake_int(pdir, uaddr, nr_wake, FUTEX_BITSET_MATCH_ANY);
+   bucket = get_futex_bucket(pdir, uaddr);
+   bucket2 = get_futex_bucket(pdir, uaddr2);
+
+   list_for_each(pos, temp, bucket, wait_list_node) {
+
+      if (requeued >= nr_requeue)
+         break;
+
+      if (!futex_waiter_match(pos, pdir, uaddr, FUTEX_BITSET_MATCH_ANY))
+         continue;
+
+      /* Move the wait object in place, as wait_obj_set() would do */
+      list_remove(&pos->wait_list_node);
+      atomic_store_explicit(&pos->__ptr, (void *)uaddr2, mo_relaxed);
+      list_add_tail(bucket2, &pos->wait_list_node);
+      requeued++;
+   }
+
+   enable_preemption();
+   return woken + requeued;
+}
+
+/*
+ * Convert the user timeout in a relative one, in ns. FUTEX_WAIT_BITSET uses
+ * absolute timeouts, while FUTEX_WAIT uses relative ones.
+ */
+static int
+futex_get_timeout(int op, const struct k_timespec64 *tp, s64 *timeout_ref)
+{
+   const int cmd = op & FUTEX_CMD_MASK;
+   struct k_timespec64 now;
+   s64 ns;
+   int rc;
+
+   *timeout_ref = -1;
+
+   if (!tp)
+      return 0;
+
+   if (tp->tv_sec < 0 || !IN_RANGE(tp->tv_nsec, 0, BILLION))
+      return -EINVAL;
+
+   if (tp->tv_sec >= FUTEX_MAX_TIMEOUT_SEC)
+      return 0;
+
+   ns = tp->tv_sec * BILLION + tp->tv_nsec;
+
+   if (cmd == FUTEX_WAIT_BITSET) {
+
+      rc = do_clock_gettime(
+         (op & FUTEX_CLOCK_REALTIME) ? CLOCK_REALTIME : CLOCK_MONOTONIC,
+         &now
+      );
+
+      if (rc)
+         return rc;
+
+      ns = MAX(ns - (now.tv_sec * BILLION + now.tv_nsec), (s64)0);
+   }
+
+   *timeout_ref = ns;
+   return 0;
+}
+
+/* The number of tasks to wake up is an int: it cannot be negative */
+static ALWAYS_INLINE int futex_count(u32 val)
+{
+   return (int)MIN(val, (u32)0x7fffffff);
+}
+
+static bool futex_cmd_has_timeout(int cmd)
+{
+   return cmd == FUTEX_WAIT || cmd == FUTEX_WAIT_BITSET;
+}
+
+/*
+ * `tp` is the already copied timeout, for the commands having one. For the
+ * others, `val2` is the same argument, interpreted as an integer.
+ */
+static int
+do_futex(u32 *uaddr,
+         int op,
+         u32 val,
+         const struct k_timespec64 *tp,
+         ulong val2,
+         u32 *uaddr2,
+         u32 val3)
+{
+   const int cmd = op & FUTEX_CMD_MASK;
+   s64 timeout;
+   int rc;
+
+   if ((ulong)uaddr & (sizeof(u32) - 1))
+      return -EINVAL;
+
+   if ((rc = futex_get_timeout(op, tp, &timeout)))
+      return rc;
+
+   switch (cmd) {
+
+      case FUTEX_WAIT:
+         return futex_wait(uaddr, val, FUTEX_BITSET_MATCH_ANY, timeout);
+
+      case FUTEX_WAIT_BITSET:
+         return futex_wait(uaddr, val, val3, timeout);
+
+      case FUTEX_WAKE:
+         return futex_wake(uaddr, futex_count(val));
+
+      case FUTEX_WAKE_BITSET:
+
+         if (!val3)
+            return -EINVAL;
+
+         disable_preemption();
+         {
+            rc = futex_wake_int(get_curr_proc()->pdir,
+                                uaddr,
+                                futex_count(val),
+                                val3);
+         }
+         enable_preemption();
+         return rc;
+
+      case FUTEX_REQUEUE:
+         return futex_requeue(uaddr, uaddr2, (int)val, (int)val2, NULL);
+
+      case FUTEX_CMP_REQUEUE:
+         return futex_requeue(uaddr, uaddr2, (int)val, (int)val2, &val3);
+
+      default:
+         return -ENOSYS;
+   }
+}
+
+int sys_futex_time32(u32 *uaddr,
+                     int op,
+                     u32 val,
+                     const struct k_timespec32 *user_tp,
+                     u32 *uaddr2,
+                     u32 val3)
+{
+   struct k_timespec32 tp32;
+   struct k_timespec64 tp;
+
+   if (!futex_cmd_has_timeout(op & FUTEX_CMD_MASK) || !user_tp)
+      return do_futex(uaddr, op, val, NULL, (ulong)user_tp, uaddr2, val3);
+
+   if (copy_from_user(&tp32, user_tp, sizeof(tp32)))
+      return -EFAULT;
+
+   tp = (struct k_timespec64) {
+      .tv_sec = tp32.tv_sec,
+      .tv_nsec = tp32.tv_nsec,
+   };
+
+   return do_futex(uaddr, op, val, &tp, 0, uaddr2, val3);
+}
+
+int sys_futex(u32 *uaddr,
+              int op,
+              u32 val,
+              const struct k_timespec64 *user_tp,
+              u32 *uaddr2,
+              u32 val3)
+{
+   struct k_timespec64 tp;
+
+   if (!futex_cmd_has_timeout(op & FUTEX_CMD_MASK) || !user_tp)
+      return do_futex(uaddr, op, val, NULL, (ulong)user_tp, uaddr2, val3);
+
+   if (copy_from_user(&tp, user_tp, sizeof(tp)))
+      return -EFAULT;
+
+   return do_futex(uaddr, op, val, &tp, 0, uaddr2, val3);
+}
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck_gen_headers/config_sched.h>
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/hrtimer.h>
+#include <tilck/kernel/datetime.h>
+#include <tilck/kernel/spinlock.h>
+#include <tilck/kernel/smp.h>
+
+/* hrtimer_now() falls back to the system time */
+STATIC_ASSERT(TS_SCALE == BILLION);
+
+/*
+ * The armed timers are kept in an AVL tree sorted by expiration time (the
+ * address makes the keys unique), with the first one cached: it's the only
+ * timer the hardware needs to know about. With SMP, the tree is protected by
+ * `hrtimers_lock`, always taken with the interrupts disabled.
+ */
+static struct spinlock hrtimers_lock;
+static struct hrtimer *hrtimers_root;
+static struct hrtimer *hrtimers_first;
+static bool hrtimers_enabled;
+
+/*
+ * The timer whose callback is running, if any, and its CPU. With SMP, the
+ * callback runs holding `hrtimers_cb_lock` instead of `hrtimers_lock`: that's
+ * what hrtimer_cancel() waits for.
+ */
+static struct hrtimer *hrtimers_running;
+static u32 hrtimers_running_cpu;
+static struct spinlock hrtimers_cb_lock;
+
+static long hrtimer_cmp(const void *a, const void *b)
+{
+   const struct hrtimer *t1 = a;
+   const struct hrtimer *t2 = b;
+
+   if (t1->expire != t2->expire)
+      return t1->expire < t2->expire ? -1 : 1;
+
+   if (t1 != t2)
+      return t1 < t2 ? -1 : 1;
+
+   return 0;
+}
+
+bool hrtimers_available(void)
+{
+   return hrtimers_enabled;
+}
+
+u64 hrtimer_now(void)
+{
+   if (!hrtimers_enabled)
+      return get_sys_time();
+
+   return hw_hrtimer_now();
+}
+
+void hrtimer_init(struct hrtimer *t, hrtimer_func func)
+{
+   bintree_node_init(&t->node);
+   t->expire = 0;
+   t->func = func;
+   t->armed = false;
+}
+
+static void hrtimer_add(struct hrtimer *t)
+{
+   DEBUG_CHECKED_SUCCESS(
+      bintree_insert(&hrtimers_root, t, hrtimer_cmp, struct hrtimer, node)
+   );
+
+   t->armed = true;
+
+   if (!hrtimers_first || hrtimer_cmp(t, hrtimers_first) < 0) {
+      hrtimers_first = t;
+      hw_hrtimer_program(t->expire);
+   }
+}
+
+static void hrtimer_remove(struct hrtimer *t)
+{
+   DEBUG_CHECKED_SUCCESS(
+      bintree_remove(&hrtimers_root, t, hrtimer_cmp, struct hrtimer, node)
+   );
+
+   t->armed = false;
+
+   /*
+    * Don't reprogram the hardware when the first timer is removed: at worst,
+    * we'll get a spurious IRQ, which is cheaper than reprogramming the timer
+    * on every cancellation (the typical case, for sleeps interrupted by I/O).
+    */
+   if (t == hrtimers_first)
+      hrtimers_first = bintree_get_first_obj(hrtimers_root,
+                                             struct hrtimer,
+                                             node);
+}
+
+void hrtimer_start(struct hrtimer *t, u64 delay_ns)
+{
+   ulong var;
+   ASSERT(hrtimers_enabled);
+
+   spin_lock_irqsave(&hrtimers_lock, &var);
+   {
+      if (t->armed)
+         hrtimer_remove(t);
+
+      t->expire = hw_hrtimer_now() + delay_ns;
+      hrtimer_add(t);
+   }
+   spin_unlock_irqrestore(&hrtimers_lock, &var);
+}
+
+/*
+ * Cancel the timer, if armed. Returns the number of nanoseconds that were left
+ * before its expiration (0 if it wasn't armed). If its callback is running on
+ * another CPU, wait for it to complete: after that, the timer can be freed.
+ */
+u64 hrtimer_cancel(struct hrtimer *t)
+{
+   u64 now, rem = 0;
+   ulong var;
+
+   spin_lock_irqsave(&hrtimers_lock, &var);
+   {
+      if (t->armed) {
+
+         now = hw_hrtimer_now();
+         rem = t->expire > now ? t->expire - now : 0;
+         hrtimer_remove(t);
+      }
+
+#if SMP_ENABLED
+      while (hrtimers_running == t && hrtimers_running_cpu != get_cpu_id()) {
+         spin_unlock(&hrtimers_lock);
+         spin_wait_unlocked(&hrtimers_cb_lock);
+         spin_lock(&hrtimers_lock);
+      }
+#endif
+   }
+   spin_unlock_irqrestore(&hrtimers_lock, &var);
+   return rem;
+}
+
+/*
+ * Called by the arch code, with interrupts disabled, when the hardware timer
+ * fires: run the callbacks of all the expired timers and program the hardware
+ * for the next one. The callbacks run without `hrtimers_lock`, because they
+ * typically wake up tasks, taking the runqueue locks (see hrtimers_running).
+ */
+void hrtimer_irq_handler(void)
+{
+   struct hrtimer *t;
+   u64 now;
+
+   ASSERT(!are_interrupts_enabled());
+   now = hw_hrtimer_now();
+   spin_lock(&hrtimers_lock);
+
+   while ((t = hrtimers_first)) {
+
+      if (t->expire > now) {
+         hw_hrtimer_program(t->expire);
+         break;
+      }
+
+      hrtimer_remove(t);
+      hrtimers_running = t;
+      hrtimers_running_cpu = get_cpu_id();
+
+      spin_lock(&hrtimers_cb_lock);
+      spin_unlock(&hrtimers_lock);
+      {
+         t->func(t);
+      }
+      spin_unlock(&hrtimers_cb_lock);
+      spin_lock(&hrtimers_lock);
+
+      hrtimers_running = NULL;
+   }
+
+   spin_unlock(&hrtimers_lock);
+}
+
+void init_hrtimers(void)
+{
+   if (!KRN_HRTIMERS)
+      return;
+
+   if (!hw_hrtimer_init()) {
+      printk("hrtimers: not supported, using the regular timer\n");
+      return;
+   }
+
+   hrtimers_enabled = true;
+}
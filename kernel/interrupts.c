@@ -21,8 +21,24 @@ void arch_irq_handling(regs_t *r);
  *
  * Note: the `__in_irq_count` mechanism tracks only nested IRQs and has NOTHING
  * to do with `KRN_TRACK_NESTED_INTERR` which is a debug util that tracks all
- * the interrupt types, including: syscalls, faults and IRQs.
+ * the interrupt types, including: syscalls, faults and IRQs. With SMP, both
+ * of them are per-CPU (see struct cpu).
  */
+#if SMP_ENABLED
+
+static ALWAYS_INLINE void inc_irq_count(void)
+{
+   this_cpu_inc(in_irq_count);
+}
+
+static ALWAYS_INLINE void dec_irq_count(void)
+{
+   ASSERT(this_cpu_read(in_irq_count) > 0);
+   this_cpu_dec(in_irq_count);
+}
+
+#else
+
 ATOMIC(int) __in_irq_count;
 
 static ALWAYS_INLINE void inc_irq_count(void)
@@ -38,14 +54,25 @@ static ALWAYS_INLINE void dec_irq_count(void)
    ASSERT(oldval > 0);
 }
 
+#endif
+
 #if KRN_TRACK_NESTED_INTERR
 
+#if SMP_ENABLED
+
+#define nested_interrupts_count  (get_this_cpu()->nested_interrupts_count)
+#define nested_interrupts        (get_this_cpu()->nested_interrupts)
+
+#else
+
 static int nested_interrupts_count;
 static int nested_interrupts[MAX_NESTED_INTERRUPTS] =
 {
    [0 ... MAX_NESTED_INTERRUPTS-1] = -1,
 };
 
+#endif
+
 inline void push_nested_interrupt(int int_num)
 {
    ulong var;
@@ -199,6 +226,10 @@ void irq_entry(regs_t *r)
    /* We expect here that the CPU disabled the interrupts */
    ASSERT(!are_interrupts_enabled());
 
+   /* Cross-CPU calls don't need (nor should wait for) the big kernel lock */
+   if (smp_handle_call_ipi(regs_intnum(r)))
+      return;
+
    /* Disable the preemption */
    disable_preemption();
 
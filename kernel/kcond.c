@@ -4,6 +4,7 @@
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/interrupts.h>
+#include <tilck/kernel/datetime.h>
 
 void kcond_init(struct kcond *c)
 {
@@ -22,7 +23,7 @@ bool kcond_is_anyone_waiting(struct kcond *c)
    return ret;
 }
 
-bool kcond_wait(struct kcond *c, struct kmutex *m, u32 timeout_ticks)
+bool kcond_wait_ns(struct kcond *c, struct kmutex *m, u64 timeout_ns)
 {
    DEBUG_ONLY(check_not_in_irq_handler());
    ASSERT(!m || kmutex_is_curr_task_holding_lock(m));
@@ -34,8 +35,8 @@ panic_retry_hack:
    disable_preemption();
    prepare_to_wait_on(WOBJ_KCOND, c, NO_EXTRA, &c->wait_list);
 
-   if (timeout_ticks != KCOND_WAIT_FOREVER)
-      task_set_wakeup_timer(curr, timeout_ticks);
+   if (timeout_ns != KCOND_WAIT_FOREVER)
+      task_set_wakeup_timer_ns(curr, timeout_ns);
 
    if (m) {
       kmutex_unlock(m);
@@ -100,6 +101,11 @@ panic_retry_hack:
    return ret;
 }
 
+bool kcond_wait(struct kcond *c, struct kmutex *m, u32 timeout_ticks)
+{
+   return kcond_wait_ns(c, m, (u64)timeout_ticks * (TS_SCALE / TIMER_HZ));
+}
+
 static void
 kcond_signal_int(struct kcond *c, struct wait_obj *wo)
 {
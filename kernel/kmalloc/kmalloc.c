@@ -72,6 +72,126 @@ CONSTEXPR static ALWAYS_INLINE bool is_block_node_free(struct block_node n)
    return !(n.raw & (FL_NODE_FULL | FL_NODE_SPLIT));
 }
 
+/*
+ * Free nodes bitmap
+ * ------------------------
+ *
+ * Bit (n + 1) in h->free_bm is set when node `n` is a free "head" node: a node
+ * not split nor full, having a split parent (or being the root). Those are
+ * exactly the biggest free blocks in the heap, like the blocks in the free
+ * lists of a classic buddy allocator. Therefore, finding a free block for a
+ * given size means just finding the first set bit in the bitmap at that
+ * node's level or at the levels above it (bigger blocks), and then splitting
+ * the block found.
+ *
+ * The tree remains the source of truth for allocations and coalescing: the
+ * bitmap just gets updated via free_bm_update() every time the flags of a node
+ * (or of its parent) change.
+ */
+
+static ALWAYS_INLINE u32 node_level(int node)
+{
+   return get_last_set_bit_index32((u32)node + 1);
+}
+
+static ALWAYS_INLINE u32 level_first_bm_word(u32 level)
+{
+   return level >= 5 ? (1u << (level - 5)) : 0;
+}
+
+static ALWAYS_INLINE bool is_node_free_head(struct block_node *nodes, int n)
+{
+   return is_block_node_free(nodes[n]) && (!n || nodes[NODE_PARENT(n)].split);
+}
+
+static void free_bm_update(struct kmalloc_heap *h, int n)
+{
+   const u32 b = (u32)n + 1;
+   const u32 w = b >> 5;
+   const u32 bit = 1u << (b & 31);
+   const bool is_head = is_node_free_head(h->metadata_nodes, n);
+   u32 level;
+
+   if (is_head == !!(h->free_bm[w] & bit))
+      return; /* Nothing changed */
+
+   level = node_level(n);
+
+   if (is_head) {
+
+      h->free_bm[w] |= bit;
+      h->free_bm_count[level]++;
+
+      if (w < h->free_bm_hint[level])
+         h->free_bm_hint[level] = w;
+
+   } else {
+
+      ASSERT(h->free_bm_count[level] > 0);
+      h->free_bm[w] &= ~bit;
+      h->free_bm_count[level]--;
+   }
+}
+
+/* Called after the `split` flag of the non-leaf node `n` changed */
+static ALWAYS_INLINE void free_bm_update_split(struct kmalloc_heap *h, int n)
+{
+   free_bm_update(h, n);
+   free_bm_update(h, NODE_LEFT(n));
+   free_bm_update(h, NODE_RIGHT(n));
+}
+
+static int free_bm_find_first(struct kmalloc_heap *h, u32 level)
+{
+   u32 w, bits;
+
+   ASSERT(h->free_bm_count[level] > 0);
+
+   if (level < 5) {
+
+      /* The whole level fits in the first word: bits [2^L, 2^(L+1) - 1] */
+      bits = h->free_bm[0] & (make_bitmask(1u << level) << (1u << level));
+      return (int)get_first_set_bit_index32(bits) - 1;
+   }
+
+   /*
+    * Since free_bm_count[level] > 0, there must be a set bit at or after the
+    * hint, before the end of the level.
+    */
+   for (w = h->free_bm_hint[level]; !h->free_bm[w]; w++) {
+      ASSERT(w + 1 < level_first_bm_word(level + 1));
+   }
+
+   h->free_bm_hint[level] = w;
+   return (int)((w << 5) + get_first_set_bit_index32(h->free_bm[w])) - 1;
+}
+
+static void free_bm_reset(struct kmalloc_heap *h)
+{
+   const size_t nodes_size =
+      calculate_heap_nodes_size(h->size, h->min_block_size);
+
+   h->free_bm = h->metadata_nodes + nodes_size;
+   bzero(h->free_bm, calculate_heap_free_bm_size(h->size, h->min_block_size));
+   bzero(h->free_bm_count, sizeof(h->free_bm_count));
+
+   for (u32 i = 0; i < ARRAY_SIZE(h->free_bm_hint); i++)
+      h->free_bm_hint[i] = level_first_bm_word(i);
+}
+
+/*
+ * Re-build the free nodes bitmap from the tree of nodes. It requires walking
+ * all the nodes: use it only when there's no better option.
+ */
+static void free_bm_rebuild(struct kmalloc_heap *h)
+{
+   const int nodes_count = (1 << h->levels) - 1;
+   free_bm_reset(h);
+
+   for (int n = 0; n < nodes_count; n++)
+      free_bm_update(h, n);
+}
+
 static size_t set_free_uplevels(struct kmalloc_heap *h, int *node, size_t size)
 {
    struct block_node *nodes = h->metadata_nodes;
@@ -82,6 +202,7 @@ static size_t set_free_uplevels(struct kmalloc_heap *h, int *node, size_t size)
    ASSERT(!nodes[n].split);
 
    nodes[n].full = false;
+   free_bm_update(h, n);
    n = NODE_PARENT(n);
 
    while (!is_block_node_free(nodes[n])) {
@@ -102,6 +223,7 @@ static size_t set_free_uplevels(struct kmalloc_heap *h, int *node, size_t size)
 
       DEBUG_coaleshe;
       nodes[n].raw &= ~(FL_NODE_SPLIT | FL_NODE_FULL);
+      free_bm_update_split(h, n);
 
       if (n == 0)
          break; /* we processed the root node, cannot go further */
@@ -296,6 +418,23 @@ internal_kmalloc_coalesce_block(struct kmalloc_heap *h,
 
    nodes[block_node_num].full = 1;
    ASSERT(s < h->min_block_size);
+
+   /*
+    * Now the block is full and not split: none of the nodes in its subtree
+    * can be a free head node anymore.
+    */
+   n = block_node_num;
+   node_count = 1;
+
+   for (s = block_size; s >= h->min_block_size; s >>= 1) {
+
+      for (int j = n; j < n + node_count; j++)
+         free_bm_update(h, j);
+
+      node_count <<= 1;
+      n = NODE_LEFT(n);
+   }
+
    return already_free_size;
 }
 
@@ -352,6 +491,7 @@ internal_kmalloc(struct kmalloc_heap *h,
             success = actual_allocate_node(h, node_size,
                                            node, &vaddr, do_actual_alloc);
             ASSERT(vaddr != NULL); // 'vaddr' is not NULL even when !success
+            free_bm_update(h, node);
          } else {
             success = true;
             vaddr = node_to_ptr(h, node, node_size);
@@ -398,6 +538,7 @@ internal_kmalloc(struct kmalloc_heap *h,
       if (!n.split) {
          DEBUG_kmalloc_split;
          nodes[node].split = true;
+         free_bm_update_split(h, node);
       }
 
       if (!nodes[NODE_LEFT(node)].full) {
@@ -432,6 +573,79 @@ internal_kmalloc(struct kmalloc_heap *h,
    return NULL;
 }
 
+/*
+ * Allocate a block of exactly `size` bytes (power of 2) using the free nodes
+ * bitmap instead of walking the tree: get the smallest free head node big
+ * enough for `size` and split it (always going left) down to the right level.
+ */
+static void *
+internal_kmalloc_bm(struct kmalloc_heap *h,
+                    const size_t size,         /* power of 2 */
+                    bool do_actual_alloc)      /* ignored if linear_mapping */
+{
+   struct block_node *nodes = h->metadata_nodes;
+   const u32 target_level =
+      h->heap_data_size_log2 - log2_for_power_of_2(size);
+
+   void *vaddr = NULL;
+   u32 level = target_level;
+   bool success;
+   int node;
+
+   ASSERT(target_level < h->levels);
+
+   while (!h->free_bm_count[level]) {
+
+      if (!level)
+         return NULL; /* No free block big enough */
+
+      level--;
+   }
+
+   node = free_bm_find_first(h, level);
+   ASSERT(is_node_free_head(nodes, node));
+
+   for (; level < target_level; level++) {
+      DEBUG_kmalloc_split;
+      nodes[node].split = true;
+      free_bm_update_split(h, node);
+      node = NODE_LEFT(node);
+   }
+
+   success = actual_allocate_node(h, size, node, &vaddr, do_actual_alloc);
+   ASSERT(vaddr != NULL); // 'vaddr' is not NULL even when !success
+   free_bm_update(h, node);
+
+   // Mark the parent nodes as 'full', when necessary.
+
+   for (int n = node; n != 0; ) {
+
+      n = NODE_PARENT(n);
+
+      if (!nodes[NODE_LEFT(n)].full || !nodes[NODE_RIGHT(n)].full)
+         break;
+
+      ASSERT(!nodes[n].full);
+      nodes[n].full = true;
+   }
+
+   if (UNLIKELY(!success)) {
+
+      /* See the comment in internal_kmalloc() about this corner case */
+      DEBUG_kmalloc_bad_end;
+      size_t actual_size = size;
+      per_heap_kfree(h, vaddr, &actual_size, 0);
+      return NULL;
+   }
+
+   DEBUG_kmalloc_end;
+
+   if (do_actual_alloc)
+      h->mem_allocated += size;
+
+   return vaddr;
+}
+
 static void *
 per_heap_kmalloc_unsafe(struct kmalloc_heap *h, size_t *size, u32 flags)
 {
@@ -456,12 +670,7 @@ per_heap_kmalloc_unsafe(struct kmalloc_heap *h, size_t *size, u32 flags)
 
       *size = rounded_up_size;
 
-      addr = internal_kmalloc(h,          /* heap */
-                              *size,      /* block size */
-                              0,          /* start node */
-                              h->size,    /* start node size */
-                              true,       /* mark node as allocated */
-                              do_actual_alloc);
+      addr = internal_kmalloc_bm(h, *size, do_actual_alloc);
 
       if (sub_blocks_min_size && addr) {
          internal_kmalloc_split_block(h, addr, *size, sub_blocks_min_size);
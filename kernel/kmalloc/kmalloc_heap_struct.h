@@ -28,8 +28,22 @@ struct kmalloc_heap {
    size_t alloc_block_size_log2;
    size_t metadata_size;
    ulong heap_last_byte; /* addr + size - 1 */
+   u32 levels;           /* levels in the tree of nodes */
    /* -- */
 
+   /*
+    * Bitmap of the free "head" nodes: entirely free nodes having a split
+    * parent (or the root itself, when the whole heap is free). It lives in
+    * the metadata area, right after the nodes and it's indexed by node + 1,
+    * so that each level >= 5 starts at the beginning of a 32-bit word.
+    * The tree of nodes remains the source of truth: the bitmap is just an
+    * index on it, allowing per_heap_kmalloc() to find a free block of a given
+    * size without walking the tree.
+    */
+   u32 *free_bm;
+   u32 free_bm_count[KMALLOC_MAX_HEAP_LEVELS]; /* set bits per level */
+   u32 free_bm_hint[KMALLOC_MAX_HEAP_LEVELS];  /* no set bits before this */
+
    bool linear_mapping;
    bool dma;
 
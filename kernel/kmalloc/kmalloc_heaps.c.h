@@ -15,6 +15,7 @@
 
 #include <tilck/kernel/system_mmap.h>
 #include <tilck/kernel/list.h>
+#include <tilck/kernel/kmem_cache.h>
 #include <tilck/kernel/test/kmalloc.h>
 
 STATIC struct kmalloc_heap first_heap_struct;
@@ -42,6 +43,10 @@ kmalloc_heap_set_pre_calculated_values(struct kmalloc_heap *h)
    h->heap_data_size_log2 = log2_for_power_of_2(h->size);
    h->alloc_block_size_log2 = log2_for_power_of_2(h->alloc_block_size);
    h->metadata_size = calculate_heap_metadata_size(h->size, h->min_block_size);
+   h->levels = h->heap_data_size_log2 -
+               log2_for_power_of_2(h->min_block_size) + 1;
+
+   ASSERT(h->levels <= KMALLOC_MAX_HEAP_LEVELS);
 }
 
 bool
@@ -100,6 +105,8 @@ kmalloc_create_heap(struct kmalloc_heap *h,
    kmalloc_heap_set_pre_calculated_values(h);
 
    bzero(h->metadata_nodes, h->metadata_size);
+   free_bm_reset(h);
+   free_bm_update(h, 0); /* The root node is the only free head node */
    h->linear_mapping = linear_mapping;
    return true;
 }
@@ -170,7 +177,13 @@ kmalloc_heap_dup_expanded(struct kmalloc_heap *h, size_t new_size)
    }
 
    if (new_size == h->size) {
+
+      /* NOTE: the metadata includes the free nodes bitmap as well */
       memcpy(new_heap->metadata_nodes, h->metadata_nodes, h->metadata_size);
+
+      new_heap->free_bm = new_heap->metadata_nodes +
+         calculate_heap_nodes_size(new_size, new_heap->min_block_size);
+
       return new_heap;
    }
 
@@ -198,6 +211,7 @@ kmalloc_heap_dup_expanded(struct kmalloc_heap *h, size_t new_size)
       }
    }
 
+   free_bm_rebuild(new_heap);
    return new_heap;
 }
 
@@ -267,10 +281,18 @@ static int kmalloc_internal_add_heap(void *vaddr, size_t heap_size)
     * allocation using per_heap_kmalloc().
     */
 
-   size_t actual_metadata_size = metadata_size;
+   size_t actual_metadata_size =
+      pow2_round_up_at(metadata_size, min_block_size);
+
+   /*
+    * NOTE: because of the free nodes bitmap, the metadata size is not a power
+    * of 2: use a multi-step allocation to avoid wasting memory.
+    */
 
    void *md_allocated =
-      per_heap_kmalloc(heaps[used_heaps], &actual_metadata_size, 0);
+      per_heap_kmalloc(heaps[used_heaps],
+                       &actual_metadata_size,
+                       KMALLOC_FL_MULTI_STEP);
 
    if (KMALLOC_HEAVY_STATS)
       kmalloc_account_alloc(metadata_size);
@@ -341,6 +363,7 @@ void early_init_kmalloc(void)
    ASSERT(!kmalloc_initialized);
    list_init(&small_heaps_list);
    list_init(&avail_small_heaps_list);
+   init_kmem_caches();
 
    used_heaps = 0;
    bzero(heaps, sizeof(heaps));
@@ -163,8 +163,12 @@ alloc_new_small_heap_unsafe(void)
    actual_metadata_size = new_node->heap.metadata_size;
 
    DEBUG_ONLY_UNSAFE(void *actual_metadata =)
-      per_heap_kmalloc(&new_node->heap, &actual_metadata_size, 0);
+      per_heap_kmalloc(&new_node->heap,
+                       &actual_metadata_size,
+                       KMALLOC_FL_MULTI_STEP);
+
    ASSERT(actual_metadata == metadata);
+   ASSERT(actual_metadata_size == SMALL_HEAP_MD_SIZE);
 
    if (KMALLOC_HEAVY_STATS)
       kmalloc_account_alloc(actual_metadata_size);
@@ -0,0 +1,331 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/string_util.h>
+#include <tilck/common/utils.h>
+
+#include <tilck/kernel/kmem_cache.h>
+#include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/paging.h>
+#include <tilck/kernel/sched.h>
+
+#define KMEM_CACHE_MIN_OBJS_PER_SLAB             8
+
+static struct list kmem_caches = STATIC_LIST_INIT(kmem_caches);
+
+static ALWAYS_INLINE void **
+obj_free_link(struct kmem_cache *c, void *obj)
+{
+   return obj + c->free_link_off;
+}
+
+static ALWAYS_INLINE struct kmem_slab *
+obj_to_slab(struct kmem_cache *c, void *obj)
+{
+   return (void *)((ulong)obj & ~(c->slab_size - 1));
+}
+
+static void
+kmem_cache_reset(struct kmem_cache *c)
+{
+   list_init(&c->partial_slabs);
+   list_init(&c->full_slabs);
+   c->empty = NULL;
+   c->hits = 0;
+   c->misses = 0;
+   c->slabs = 0;
+   c->objs_in_use = 0;
+}
+
+void
+kmem_cache_init(struct kmem_cache *c,
+                const char *name,
+                size_t size,
+                size_t align,
+                kmem_cache_ctor ctor)
+{
+   size_t slab_size = PAGE_SIZE;
+
+   ASSERT(size > 0);
+   ASSERT(roundup_next_power_of_2(align) == align);
+
+   align = MAX(align, sizeof(void *));
+
+   *c = (struct kmem_cache) {
+      .name = name,
+      .size = size,
+      .align = align,
+      .ctor = ctor,
+   };
+
+   if (ctor) {
+
+      /*
+       * The objects must keep their constructed state while they are free:
+       * put the free-list link after the object, instead of over it.
+       */
+      c->free_link_off = pow2_round_up_at(size, sizeof(void *));
+      c->obj_size = pow2_round_up_at(c->free_link_off + sizeof(void *), align);
+
+   } else {
+
+      c->free_link_off = 0;
+      c->obj_size = pow2_round_up_at(MAX(size, sizeof(void *)), align);
+   }
+
+   c->objs_offset = pow2_round_up_at(sizeof(struct kmem_slab), align);
+
+   while (slab_size < KMALLOC_MAX_ALIGN &&
+          (slab_size - c->objs_offset) / c->obj_size <
+             KMEM_CACHE_MIN_OBJS_PER_SLAB)
+   {
+      slab_size <<= 1;
+   }
+
+   c->slab_size = slab_size;
+   c->objs_per_slab = (slab_size - c->objs_offset) / c->obj_size;
+   VERIFY(c->objs_per_slab > 0);
+
+   kmem_cache_reset(c);
+   list_add_tail(&kmem_caches, &c->node);
+}
+
+struct kmem_cache *
+kmem_cache_create(const char *name,
+                  size_t size,
+                  size_t align,
+                  kmem_cache_ctor ctor)
+{
+   struct kmem_cache *c;
+
+   if (!(c = kalloc_obj(struct kmem_cache)))
+      return NULL;
+
+   disable_preemption();
+   {
+      kmem_cache_init(c, name, size, align, ctor);
+      c->dynamic = true;
+   }
+   enable_preemption();
+   return c;
+}
+
+static struct kmem_slab *
+kmem_cache_alloc_slab(struct kmem_cache *c)
+{
+   struct kmem_slab *s;
+   void *obj, *prev = NULL;
+
+   if (!(s = kmalloc(c->slab_size)))
+      return NULL;
+
+   /* kmalloc's blocks are naturally aligned, up to KMALLOC_MAX_ALIGN */
+   ASSERT(((ulong)s & (c->slab_size - 1)) == 0);
+
+   *s = (struct kmem_slab) {
+      .cache = c,
+      .free_list = NULL,
+      .in_use = 0,
+   };
+
+   list_node_init(&s->node);
+
+   /* Build the free list in reverse, so that it follows the address order */
+   obj = (void *)s + c->objs_offset + (c->objs_per_slab - 1) * c->obj_size;
+
+   for (size_t i = 0; i < c->objs_per_slab; i++, obj -= c->obj_size) {
+
+      if (c->ctor)
+         c->ctor(obj);
+
+      *obj_free_link(c, obj) = prev;
+      prev = obj;
+   }
+
+   s->free_list = prev;
+   c->slabs++;
+   return s;
+}
+
+static void
+kmem_cache_free_slab(struct kmem_cache *c, struct kmem_slab *s)
+{
+   ASSERT(s->in_use == 0);
+   kfree2(s, c->slab_size);
+   c->slabs--;
+}
+
+void *
+kmem_cache_alloc(struct kmem_cache *c)
+{
+   struct kmem_slab *s;
+   void *obj;
+
+   disable_preemption();
+
+   if (!list_is_empty(&c->partial_slabs)) {
+
+      s = list_first_obj(&c->partial_slabs, struct kmem_slab, node);
+      c->hits++;
+
+   } else {
+
+      if (c->empty) {
+
+         s = c->empty;
+         c->empty = NULL;
+         c->hits++;
+
+      } else {
+
+         if (!(s = kmem_cache_alloc_slab(c))) {
+            enable_preemption();
+            return NULL;
+         }
+
+         c->misses++;
+      }
+
+      list_add_tail(&c->partial_slabs, &s->node);
+   }
+
+   obj = s->free_list;
+   ASSERT(obj != NULL);
+
+   s->free_list = *obj_free_link(c, obj);
+   s->in_use++;
+   c->objs_in_use++;
+
+   if (!s->free_list) {
+      list_remove(&s->node);
+      list_add_tail(&c->full_slabs, &s->node);
+   }
+
+   enable_preemption();
+   return obj;
+}
+
+void *
+kmem_cache_zalloc(struct kmem_cache *c)
+{
+   void *obj;
+
+   /* Zeroing a constructed object does not make sense */
+   ASSERT(!c->ctor);
+
+   if ((obj = kmem_cache_alloc(c)))
+      bzero(obj, c->size);
+
+   return obj;
+}
+
+void
+kmem_cache_free(struct kmem_cache *c, void *obj)
+{
+   struct kmem_slab *s;
+   bool was_full;
+
+   if (!obj)
+      return;
+
+   s = obj_to_slab(c, obj);
+
+   ASSERT(s->cache == c);
+   ASSERT(s->in_use > 0);
+   ASSERT(((ulong)obj - (ulong)s - c->objs_offset) % c->obj_size == 0);
+
+   disable_preemption();
+   {
+      was_full = !s->free_list;
+      *obj_free_link(c, obj) = s->free_list;
+      s->free_list = obj;
+      s->in_use--;
+      c->objs_in_use--;
+
+      if (!s->in_use) {
+
+         list_remove(&s->node);
+
+         /*
+          * Keep one empty slab around, in order to avoid alloc/free ping-pong
+          * of whole slabs when a single object is allocated and freed in a
+          * loop, at the edge of a slab.
+          */
+         if (!c->empty)
+            c->empty = s;
+         else
+            kmem_cache_free_slab(c, s);
+
+      } else if (was_full) {
+
+         list_remove(&s->node);
+         list_add_tail(&c->partial_slabs, &s->node);
+      }
+   }
+   enable_preemption();
+}
+
+void
+kmem_cache_destroy(struct kmem_cache *c)
+{
+   if (!c)
+      return;
+
+   disable_preemption();
+   {
+      VERIFY(c->objs_in_use == 0);
+      ASSERT(list_is_empty(&c->partial_slabs));
+      ASSERT(list_is_empty(&c->full_slabs));
+
+      if (c->empty) {
+         kmem_cache_free_slab(c, c->empty);
+         c->empty = NULL;
+      }
+
+      ASSERT(c->slabs == 0);
+      list_remove(&c->node);
+   }
+   enable_preemption();
+
+   if (c->dynamic)
+      kfree_obj(c, struct kmem_cache);
+}
+
+/*
+ * NOTE: the callback is called with preemption enabled: that's safe since
+ * the caches are expected to be created (and destroyed) during the kernel's
+ * initialization, while the list is iterated only later (e.g. by sysfs).
+ */
+int
+iterate_over_kmem_caches(int (*func)(struct kmem_cache *, void *), void *arg)
+{
+   struct kmem_cache *pos;
+   int rc;
+
+   list_for_each_ro(pos, &kmem_caches, node) {
+      if ((rc = func(pos, arg)))
+         return rc;
+   }
+
+   return 0;
+}
+
+/*
+ * Called by early_init_kmalloc(). In the kernel, nothing could have been
+ * allocated before that, so this is a no-op. In the unit tests instead,
+ * kmalloc is re-initialized multiple times: drop the slabs of the old heaps
+ * and the caches created dynamically there.
+ */
+void
+init_kmem_caches(void)
+{
+   struct kmem_cache *pos, *tmp;
+
+   list_for_each(pos, tmp, &kmem_caches, node) {
+
+      if (pos->dynamic)
+         list_remove(&pos->node);
+      else
+         kmem_cache_reset(pos);
+   }
+}
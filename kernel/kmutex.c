@@ -7,6 +7,108 @@
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/irq.h>
 
+/*
+ * Priority inheritance
+ * ----------------------
+ *
+ * A task holding a kmutex runs with the highest RT priority among its own and
+ * the ones of the tasks waiting for any of the kmutexes it holds. Otherwise,
+ * while a low priority owner is preempted by medium priority tasks, the high
+ * priority tasks waiting for the mutex would be stalled for an unbounded time
+ * (priority inversion). The inheritance is transitive: if the owner is waiting
+ * on another kmutex in turn, the boost is propagated to that one's owner and
+ * so on, following the `blocked_on` chain.
+ *
+ * Each task keeps a stack of the kmutexes it holds (`held_kmutexes`), so that
+ * its priority can be recomputed when it releases one of them. That's cheap,
+ * because tasks hold very few kmutexes at a time and most of them are
+ * released in LIFO order.
+ *
+ * NOTE: only the RT priority is inherited: the fair-class tasks cannot starve,
+ * so the inversion between them is bounded anyway.
+ */
+
+/* Guard against deadlock cycles in the `blocked_on` chain */
+#define KMUTEX_PI_MAX_CHAIN                                16
+
+static int kmutex_max_waiter_prio(struct kmutex *m)
+{
+   struct wait_obj *pos;
+   int prio = 0;
+
+   list_for_each_ro(pos, &m->wait_list, wait_list_node)
+      prio = MAX(prio, CONTAINER_OF(pos, struct task, wobj)->rt_prio);
+
+   return prio;
+}
+
+static int kmutex_pi_get_prio(struct task *ti)
+{
+   int prio = ti->base_rt_prio;
+
+   for (struct kmutex *m = ti->held_kmutexes; m; m = m->next_held)
+      prio = MAX(prio, kmutex_max_waiter_prio(m));
+
+   return prio;
+}
+
+/*
+ * Recompute the effective priority of `ti` and propagate the change, if any,
+ * to the owners of the chain of kmutexes it's waiting for.
+ */
+void kmutex_pi_update(struct task *ti)
+{
+   int prio;
+   ASSERT(!is_preemption_enabled());
+
+   for (int i = 0; ti && i < KMUTEX_PI_MAX_CHAIN; i++) {
+
+      if ((prio = kmutex_pi_get_prio(ti)) == ti->rt_prio)
+         break;
+
+      task_set_rt_prio(ti, prio);
+      ti = ti->blocked_on ? ti->blocked_on->owner_task : NULL;
+   }
+}
+
+static void kmutex_set_owner(struct kmutex *m, struct task *ti)
+{
+   m->owner_task = ti;
+   m->next_held = ti->held_kmutexes;
+   ti->held_kmutexes = m;
+}
+
+static void kmutex_clear_owner(struct kmutex *m)
+{
+   struct kmutex **ref = &m->owner_task->held_kmutexes;
+
+   while (*ref != m) {
+      ASSERT(*ref != NULL);
+      ref = &(*ref)->next_held;
+   }
+
+   *ref = m->next_held;
+   m->next_held = NULL;
+   m->owner_task = NULL;
+}
+
+/* The waiter with the highest priority or, among them, the first one */
+static struct task *kmutex_pick_waiter(struct kmutex *m)
+{
+   struct wait_obj *pos;
+   struct task *ti, *selected = NULL;
+
+   list_for_each_ro(pos, &m->wait_list, wait_list_node) {
+
+      ti = CONTAINER_OF(pos, struct task, wobj);
+
+      if (!selected || ti->rt_prio > selected->rt_prio)
+         selected = ti;
+   }
+
+   return selected;
+}
+
 bool kmutex_is_curr_task_holding_lock(struct kmutex *m)
 {
    return m->owner_task == get_curr_task();
@@ -44,7 +146,7 @@ void kmutex_lock(struct kmutex *m)
    if (!m->owner_task) {
 
       /* Nobody owns this mutex, just make this task own it */
-      m->owner_task = get_curr_task();
+      kmutex_set_owner(m, get_curr_task());
 
       if (m->flags & KMUTEX_FL_RECURSIVE) {
          ASSERT(m->lock_count == 0);
@@ -76,6 +178,11 @@ void kmutex_lock(struct kmutex *m)
 #endif
 
    prepare_to_wait_on(WOBJ_KMUTEX, m, NO_EXTRA, &m->wait_list);
+
+   /* Lend our priority to the owner, while we're waiting for it */
+   get_curr_task()->blocked_on = m;
+   kmutex_pi_update(m->owner_task);
+
    kmutex_lock_enable_preemption_wrapper(m);
 
    /*
@@ -92,6 +199,7 @@ void kmutex_lock(struct kmutex *m)
 
    /* Now for sure this task should hold the mutex */
    ASSERT(kmutex_is_curr_task_holding_lock(m));
+   ASSERT(get_curr_task()->blocked_on == NULL);
 
    /*
     * DEBUG check: in case we went to sleep with a recursive mutex, then the
@@ -112,7 +220,7 @@ bool kmutex_trylock(struct kmutex *m)
    if (!m->owner_task) {
 
       /* Nobody owns this mutex, just make this task own it */
-      m->owner_task = get_curr_task();
+      kmutex_set_owner(m, get_curr_task());
       success = true;
 
       if (m->flags & KMUTEX_FL_RECURSIVE)
@@ -157,17 +265,15 @@ void kmutex_unlock(struct kmutex *m)
       // m->lock_count == 0: we have to really unlock the mutex
    }
 
-   m->owner_task = NULL;
+   kmutex_clear_owner(m);
 
-   /* Unlock one task waiting to acquire the mutex 'm' (if any) */
+   /* Unlock the task waiting to acquire the mutex 'm' with the highest prio */
    if (!list_is_empty(&m->wait_list)) {
 
-      struct wait_obj *task_wo =
-         list_first_obj(&m->wait_list, struct wait_obj, wait_list_node);
+      struct task *ti = kmutex_pick_waiter(m);
 
-      struct task *ti = CONTAINER_OF(task_wo, struct task, wobj);
-
-      m->owner_task = ti;
+      kmutex_set_owner(m, ti);
+      ti->blocked_on = NULL;
 
       if (m->flags & KMUTEX_FL_RECURSIVE)
          m->lock_count++;
@@ -175,7 +281,12 @@ void kmutex_unlock(struct kmutex *m)
       ASSERT_TASK_STATE(ti->state, TASK_STATE_SLEEPING);
       wake_up(ti);
 
+      /* The new owner inherits the priority of the remaining waiters */
+      kmutex_pi_update(ti);
+
    } // if (!list_is_empty(&m->wait_list))
 
+   /* Drop the priority we might have inherited through `m` */
+   kmutex_pi_update(get_curr_task());
    enable_preemption();
 }
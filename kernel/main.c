@@ -16,13 +16,17 @@
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/irq.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/pageframes.h>
 #include <tilck/kernel/debug_utils.h>
 #include <tilck/kernel/sched.h>
+#include <tilck/kernel/futex.h>
+#include <tilck/kernel/smp.h>
 #include <tilck/kernel/elf_loader.h>
 #include <tilck/kernel/worker_thread.h>
 #include <tilck/kernel/fs/fat32.h>
 #include <tilck/kernel/fs/devfs.h>
 #include <tilck/kernel/timer.h>
+#include <tilck/kernel/hrtimer.h>
 #include <tilck/kernel/syscalls.h>
 #include <tilck/kernel/system_mmap.h>
 #include <tilck/kernel/elf_utils.h>
@@ -30,6 +34,7 @@
 #include <tilck/kernel/self_tests.h>
 #include <tilck/kernel/term.h>
 #include <tilck/kernel/process.h>
+#include <tilck/kernel/process_mm.h>
 #include <tilck/kernel/fs/kernelfs.h>
 #include <tilck/kernel/fs/vfs.h>
 
@@ -343,6 +348,11 @@ async_init(void)
 void
 kmain(u32 multiboot_magic, u32 mbi_addr)
 {
+#if SMP_ENABLED
+   /* The per-CPU data is needed as early as by the global constructors */
+   init_segmentation_early();
+#endif
+
    call_kernel_global_ctors();
    save_multiboot_info(multiboot_magic, mbi_addr);
 
@@ -357,7 +367,9 @@ kmain(u32 multiboot_magic, u32 mbi_addr)
    init_segmentation();
    init_fpu_memcpy();
    init_kmalloc();
+   init_pageframes();
    init_paging();
+   init_process_mm();
 
    acpi_mod_init_tables();
 
@@ -365,10 +377,13 @@ kmain(u32 multiboot_magic, u32 mbi_addr)
    init_self_tests();
    init_irq_handling();
    init_sched();
+   init_futexes();
    init_syscall_interfaces();
    init_worker_threads();
    init_timer();
+   init_hrtimers();
    init_system_time();
+   init_smp();
    init_kernelfs();
 
    async_init();
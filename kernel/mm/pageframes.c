@@ -0,0 +1,487 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck_gen_headers/config_mm.h>
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/string_util.h>
+#include <tilck/common/utils.h>
+
+#include <tilck/kernel/pageframes.h>
+#include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/paging.h>
+#include <tilck/kernel/sched.h>
+#include <tilck/kernel/system_mmap.h>
+#include <tilck/kernel/list.h>
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/spinlock.h>
+
+#define PF_CHUNK_SHIFT                                  16
+#define PF_PAGES_PER_CHUNK              (PF_CHUNK_SIZE / PAGE_SIZE)
+
+/*
+ * Completely free chunks are returned to kmalloc only when there are more
+ * than this number of free pages, in order to avoid alloc/free ping-pong
+ * of whole chunks.
+ */
+#define PF_MAX_KEPT_FREE_PAGES          (4 * PF_PAGES_PER_CHUNK)
+
+STATIC_ASSERT(PF_CHUNK_SIZE == (1 << PF_CHUNK_SHIFT));
+STATIC_ASSERT(PF_CHUNK_SIZE <= KMALLOC_MAX_ALIGN);
+STATIC_ASSERT(PF_PAGES_PER_CHUNK <= 255);
+
+/* Header stored in each free page, linking it in `free_list` */
+struct free_pageframe {
+   struct list_node node;
+};
+
+static struct list free_list;    /* all the free pages, LIFO */
+static ulong pf_mem_end;         /* end (paddr) of the memory covered */
+
+/*
+ * One bit per pageframe in [0, pf_mem_end): set when the pageframe is in
+ * the free list. Used for sanity checks and for removing the pages of a
+ * chunk from the free list, when the chunk is returned to kmalloc.
+ */
+static u32 *free_bm;
+
+/* One bit per chunk in [0, pf_mem_end): set when we own the chunk */
+static u32 *chunks_bm;
+
+/* Number of free pages in each chunk */
+static u8 *chunk_free_pages;
+
+/*
+ * Pool of pre-zeroed pages (a stack), refilled by the idle task. Its pages
+ * are not in the free list and they're not counted as used either.
+ */
+static void *zpool[ZERO_PAGE_POOL_SIZE > 0 ? ZERO_PAGE_POOL_SIZE : 1];
+static ulong zpool_count;
+
+static struct pf_stats stats;
+static pf_reclaim_cb reclaim_cb;
+
+/*
+ * Protects all the state above, instead of the preemption (and so, the big
+ * kernel lock): the allocator is used by the page fault handler and by the
+ * TLB shootdowns, on all the CPUs. Nothing calling kmalloc() or disabling the
+ * preemption is ever done while holding it.
+ */
+static struct spinlock pf_lock;
+
+static ALWAYS_INLINE bool bm_test(u32 *bm, ulong n)
+{
+   return !!(bm[n >> 5] & (1u << (n & 31)));
+}
+
+static ALWAYS_INLINE void bm_set(u32 *bm, ulong n)
+{
+   bm[n >> 5] |= (1u << (n & 31));
+}
+
+static ALWAYS_INLINE void bm_clear(u32 *bm, ulong n)
+{
+   bm[n >> 5] &= ~(1u << (n & 31));
+}
+
+static ALWAYS_INLINE void
+pf_add_free_page(void *va, bool tail)
+{
+   struct free_pageframe *f = va;
+   list_node_init(&f->node);
+
+   if (tail)
+      list_add_tail(&free_list, &f->node);
+   else
+      list_add_head(&free_list, &f->node);
+
+   bm_set(free_bm, KERNEL_VA_TO_PA(va) >> PAGE_SHIFT);
+}
+
+static ALWAYS_INLINE void
+pf_remove_free_page(void *va)
+{
+   struct free_pageframe *f = va;
+   list_remove(&f->node);
+   bm_clear(free_bm, KERNEL_VA_TO_PA(va) >> PAGE_SHIFT);
+}
+
+/* Called without `pf_lock`: kmalloc() disables the preemption */
+static bool pf_add_chunk(void)
+{
+   void *chunk;
+   ulong pa, ci, var;
+
+   if (!(chunk = kmalloc(PF_CHUNK_SIZE)))
+      return false;
+
+   pa = KERNEL_VA_TO_PA(chunk);
+   ci = pa >> PF_CHUNK_SHIFT;
+
+   /* kmalloc's blocks are naturally aligned, up to KMALLOC_MAX_ALIGN */
+   ASSERT((pa & (PF_CHUNK_SIZE - 1)) == 0);
+   VERIFY(pa + PF_CHUNK_SIZE <= pf_mem_end);
+
+   spin_lock_irqsave(&pf_lock, &var);
+   {
+      ASSERT(!bm_test(chunks_bm, ci));
+
+      for (ulong i = 0; i < PF_PAGES_PER_CHUNK; i++)
+         pf_add_free_page(chunk + (i << PAGE_SHIFT), true);
+
+      bm_set(chunks_bm, ci);
+      chunk_free_pages[ci] = PF_PAGES_PER_CHUNK;
+      stats.free_pages += PF_PAGES_PER_CHUNK;
+      stats.chunks++;
+   }
+   spin_unlock_irqrestore(&pf_lock, &var);
+   return true;
+}
+
+static void pf_kfree_chunk(void *chunk)
+{
+   size_t size = PF_CHUNK_SIZE;
+
+   /* The chunk might be a sub-block of a block split by pf_alloc_big() */
+   general_kfree(chunk, &size, KFREE_FL_ALLOW_SPLIT);
+}
+
+/*
+ * Called with `pf_lock` held: the caller has to return the chunk to kmalloc
+ * with pf_kfree_chunk(), after releasing the lock.
+ */
+static void *pf_release_chunk(ulong ci)
+{
+   void *chunk = KERNEL_PA_TO_VA(ci << PF_CHUNK_SHIFT);
+   ASSERT(chunk_free_pages[ci] == PF_PAGES_PER_CHUNK);
+
+   for (ulong i = 0; i < PF_PAGES_PER_CHUNK; i++)
+      pf_remove_free_page(chunk + (i << PAGE_SHIFT));
+
+   bm_clear(chunks_bm, ci);
+   chunk_free_pages[ci] = 0;
+   stats.free_pages -= PF_PAGES_PER_CHUNK;
+   stats.chunks--;
+   return chunk;
+}
+
+static ALWAYS_INLINE bool zpool_is_full(void)
+{
+#if ZERO_PAGE_POOL_SIZE > 0
+   return zpool_count >= ZERO_PAGE_POOL_SIZE;
+#else
+   return true;   /* The pool is disabled */
+#endif
+}
+
+static void *zpool_get(void)
+{
+   if (!zpool_count)
+      return NULL;
+
+   stats.zpool_pages--;
+   stats.used_pages++;
+   return zpool[--zpool_count];
+}
+
+/*
+ * Out of memory: let the reclaim callback free some pages, if any. It cannot
+ * allocate memory, but it can call pf_free(). Called without `pf_lock`.
+ */
+static bool pf_reclaim(void)
+{
+   size_t reclaimed;
+   ulong var;
+
+   if (!reclaim_cb)
+      return false;
+
+   disable_preemption();
+   {
+      reclaimed = reclaim_cb();
+   }
+   enable_preemption();
+
+   spin_lock_irqsave(&pf_lock, &var);
+   {
+      stats.reclaimed_pages += reclaimed;
+   }
+   spin_unlock_irqrestore(&pf_lock, &var);
+   return reclaimed > 0 || pf_add_chunk();
+}
+
+void *pf_alloc(void)
+{
+   struct free_pageframe *f;
+   ulong pa, var;
+
+   ASSERT(free_bm != NULL);
+   spin_lock_irqsave(&pf_lock, &var);
+
+   while (list_is_empty(&free_list)) {
+
+      /*
+       * Both kmalloc() and the reclaim callback need the lock to be released.
+       * Then, another CPU might get the new free pages before us: just retry.
+       */
+      spin_unlock_irqrestore(&pf_lock, &var);
+
+      if (!pf_add_chunk() && !pf_reclaim()) {
+
+         /* Out of memory: use the pre-zeroed pages as a last resort */
+         spin_lock_irqsave(&pf_lock, &var);
+         {
+            f = zpool_get();
+         }
+         spin_unlock_irqrestore(&pf_lock, &var);
+         return f;
+      }
+
+      spin_lock_irqsave(&pf_lock, &var);
+   }
+
+   f = list_first_obj(&free_list, struct free_pageframe, node);
+   pa = KERNEL_VA_TO_PA(f);
+
+   ASSERT(bm_test(free_bm, pa >> PAGE_SHIFT));
+   ASSERT(chunk_free_pages[pa >> PF_CHUNK_SHIFT] > 0);
+
+   pf_remove_free_page(f);
+   chunk_free_pages[pa >> PF_CHUNK_SHIFT]--;
+   stats.free_pages--;
+   stats.used_pages++;
+
+   spin_unlock_irqrestore(&pf_lock, &var);
+   return f;
+}
+
+static void pf_kfree_chunks(void *va, size_t size)
+{
+   for (size_t off = 0; off < size; off += PF_CHUNK_SIZE)
+      pf_kfree_chunk(va + off);
+}
+
+/*
+ * Allocate `size` bytes aligned at `size` in the physical memory. kmalloc's
+ * blocks are naturally aligned only relative to the beginning of their heap:
+ * when that's not enough, allocate twice the size and keep the aligned part.
+ * The blocks are split in chunks, in order to allow them to be freed one by
+ * one.
+ */
+static void *pf_kmalloc_aligned(size_t size)
+{
+   size_t actual_size = size;
+   void *va, *res;
+
+   if (!(va = general_kmalloc(&actual_size, PF_CHUNK_SIZE)))
+      return NULL;
+
+   if (!(KERNEL_VA_TO_PA(va) & (size - 1)))
+      return va;
+
+   pf_kfree_chunks(va, size);
+   actual_size = 2 * size;
+
+   if (!(va = general_kmalloc(&actual_size, PF_CHUNK_SIZE)))
+      return NULL;
+
+   res = KERNEL_PA_TO_VA(pow2_round_up_at(KERNEL_VA_TO_PA(va), size));
+   pf_kfree_chunks(va, (size_t)(res - va));
+   pf_kfree_chunks(res + size, (size_t)(va + 2 * size - (res + size)));
+   return res;
+}
+
+void *pf_alloc_big(size_t size)
+{
+   const ulong chunks = size >> PF_CHUNK_SHIFT;
+   ulong pa, ci, var;
+   void *va;
+
+   ASSERT(roundup_next_power_of_2(size) == size);
+   ASSERT(size >= PF_CHUNK_SIZE);
+
+   if (!(va = pf_kmalloc_aligned(size)))
+      return NULL;
+
+   pa = KERNEL_VA_TO_PA(va);
+   VERIFY(pa + size <= pf_mem_end);
+   ci = pa >> PF_CHUNK_SHIFT;
+
+   spin_lock_irqsave(&pf_lock, &var);
+   {
+      for (ulong i = 0; i < chunks; i++) {
+         ASSERT(!bm_test(chunks_bm, ci + i));
+         bm_set(chunks_bm, ci + i);
+         chunk_free_pages[ci + i] = 0;
+      }
+
+      stats.chunks += chunks;
+      stats.used_pages += size >> PAGE_SHIFT;
+   }
+   spin_unlock_irqrestore(&pf_lock, &var);
+   return va;
+}
+
+void *pf_zalloc(void)
+{
+   void *va;
+   ulong var;
+
+   spin_lock_irqsave(&pf_lock, &var);
+   {
+      if ((va = zpool_get()))
+         stats.zpool_hits++;
+      else
+         stats.zpool_misses++;
+   }
+   spin_unlock_irqrestore(&pf_lock, &var);
+
+   if (!va && (va = pf_alloc()))
+      bzero(va, PAGE_SIZE);
+
+   return va;
+}
+
+/*
+ * Called by the idle task: zero pages using non-temporal stores (so, without
+ * polluting the cache) and put them in the pool, until the pool is full or
+ * there's something else to do. fpu_memset256() ends with a store fence: the
+ * other CPUs see the zeroes before seeing the page in the pool.
+ */
+void pf_zpool_refill(void)
+{
+   u64 start;
+   ulong var;
+   void *va;
+
+   while (!zpool_is_full() && !need_reschedule()) {
+
+      start = RDTSC();
+
+      if (!(va = pf_alloc()))
+         break;
+
+      fpu_context_begin();
+      {
+         fpu_memset256(va, 0, PAGE_SIZE / 32);
+      }
+      fpu_context_end();
+
+      spin_lock_irqsave(&pf_lock, &var);
+      {
+         if (!zpool_is_full()) {
+
+            zpool[zpool_count++] = va;
+            stats.used_pages--;
+            stats.zpool_pages++;
+            stats.zpool_refills++;
+            stats.zpool_refill_cycles += RDTSC() - start;
+            va = NULL;
+         }
+      }
+      spin_unlock_irqrestore(&pf_lock, &var);
+
+      if (va) {
+         pf_free(va);
+         break;
+      }
+   }
+}
+
+void pf_free(void *va)
+{
+   const ulong pa = KERNEL_VA_TO_PA(va);
+   const ulong ci = pa >> PF_CHUNK_SHIFT;
+   void *chunk = NULL;
+   ulong var;
+
+   ASSERT(IS_PAGE_ALIGNED(va));
+   ASSERT(pa < pf_mem_end);
+
+   spin_lock_irqsave(&pf_lock, &var);
+   {
+      ASSERT(bm_test(chunks_bm, ci));        /* not a pageframe of ours */
+      ASSERT(!bm_test(free_bm, pa >> PAGE_SHIFT));   /* double free */
+
+      pf_add_free_page(va, false);
+      chunk_free_pages[ci]++;
+      stats.free_pages++;
+      stats.used_pages--;
+
+      if (chunk_free_pages[ci] == PF_PAGES_PER_CHUNK &&
+          stats.free_pages > PF_MAX_KEPT_FREE_PAGES)
+      {
+         chunk = pf_release_chunk(ci);
+      }
+   }
+   spin_unlock_irqrestore(&pf_lock, &var);
+
+   if (chunk)
+      pf_kfree_chunk(chunk);
+}
+
+void pf_get_stats(struct pf_stats *s)
+{
+   ulong var;
+
+   spin_lock_irqsave(&pf_lock, &var);
+   {
+      *s = stats;
+   }
+   spin_unlock_irqrestore(&pf_lock, &var);
+}
+
+const struct pf_stats *pf_get_live_stats(void)
+{
+   return &stats;
+}
+
+void pf_set_reclaim_cb(pf_reclaim_cb cb)
+{
+   reclaim_cb = cb;
+}
+
+static ulong pf_get_mem_end(void)
+{
+   struct mem_region r;
+   u64 end = 0;
+
+   for (int i = 0; i < get_mem_regions_count(); i++) {
+
+      get_mem_region(i, &r);
+
+      if (r.type != MULTIBOOT_MEMORY_AVAILABLE &&
+          !(r.extra & MEM_REG_EXTRA_KERNEL))
+      {
+         continue;
+      }
+
+      end = MAX(end, r.addr + r.len);
+   }
+
+   end = MIN(end, (u64)LINEAR_MAPPING_SIZE);
+   return pow2_round_up_at((ulong)end, PF_CHUNK_SIZE);
+}
+
+/*
+ * Called after init_kmalloc(), once the memory regions are known. The bitmaps
+ * cover all the memory that kmalloc could ever give us.
+ */
+void init_pageframes(void)
+{
+   ulong frames, chunks;
+
+   list_init(&free_list);
+   bzero(&stats, sizeof(stats));
+   zpool_count = 0;
+
+   pf_mem_end = pf_get_mem_end();
+   frames = pf_mem_end >> PAGE_SHIFT;
+   chunks = pf_mem_end >> PF_CHUNK_SHIFT;
+
+   free_bm = kzmalloc(round_up_at(frames, 32) / 8);
+   chunks_bm = kzmalloc(round_up_at(chunks, 32) / 8);
+   chunk_free_pages = kzmalloc(chunks);
+
+   if (!free_bm || !chunks_bm || !chunk_free_pages)
+      panic("Unable to allocate the pageframe allocator's bitmaps");
+}
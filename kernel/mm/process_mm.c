@@ -15,6 +15,10 @@
 
 #include <sys/mman.h>      // system header
 
+/* From <linux/mman.h>: <sys/mman.h> defines them only with _GNU_SOURCE */
+#define MREMAP_MAYMOVE           1
+#define MREMAP_FIXED             2
+
 char page_size_buf[PAGE_SIZE] ALIGNED_AT(PAGE_SIZE);
 
 static inline void sys_brk_internal(struct process *pi, void *new_brk)
@@ -23,11 +27,14 @@ static inline void sys_brk_internal(struct process *pi, void *new_brk)
 
    if (new_brk < pi->brk) {
 
-      /* we have to free pages */
+      const size_t page_count = (ulong)(pi->brk - new_brk) >> PAGE_SHIFT;
 
-      for (void *vaddr = new_brk; vaddr < pi->brk; vaddr += PAGE_SIZE) {
-         unmap_page(pi->pdir, vaddr, true);
-      }
+      /* Out of memory: keep the current brk, like Linux does */
+      if (prepare_to_unmap_user_pages(pi->pdir, new_brk, page_count))
+         return;
+
+      /* we have to free pages */
+      unmap_pages(pi->pdir, new_brk, page_count, true);
 
       pi->brk = new_brk;
       return;
@@ -43,29 +50,21 @@ static inline void sys_brk_internal(struct process *pi, void *new_brk)
       vaddr += PAGE_SIZE;
    }
 
-   /* OK, everything looks good here */
-
-   vaddr = pi->brk;
-
-   while (vaddr < new_brk) {
-
-      void *kernel_vaddr = kmalloc(PAGE_SIZE);
-
-      if (!kernel_vaddr)
-         break; /* we've allocated as much as possible */
-
-      const ulong paddr = KERNEL_VA_TO_PA(kernel_vaddr);
+   /*
+    * OK, everything looks good here. Map the whole range to the zero page:
+    * the actual pageframes will be allocated on the first write to each page,
+    * by the CoW logic in the page fault handler. While shrinking the heap,
+    * unmap_pages() frees only the pageframes actually allocated that way.
+    */
 
-      if (map_page(pi->pdir, vaddr, paddr, PAGING_FL_RWUS) != 0) {
-         kfree2(kernel_vaddr, PAGE_SIZE);
-         break;
-      }
+   const size_t page_count = (ulong)(new_brk - pi->brk) >> PAGE_SHIFT;
+   const size_t count = map_zero_pages(pi->pdir,
+                                       pi->brk,
+                                       page_count,
+                                       PAGING_FL_US | PAGING_FL_RW);
 
-      vaddr += PAGE_SIZE;
-   }
-
-   /* We're done. */
-   pi->brk = vaddr;
+   /* We're done (even if we might have mapped less pages than requested) */
+   pi->brk += count << PAGE_SHIFT;
 }
 
 void *sys_brk(void *new_brk)
@@ -103,98 +102,107 @@ void *sys_brk(void *new_brk)
    return pi->brk;
 }
 
-static int create_process_mmap_heap(struct process *pi)
+static int create_process_mappings_info(struct process *pi)
 {
-   struct kmalloc_heap *mmap_heap;
    ASSERT(!pi->mi);
 
    if (!(pi->mi = kalloc_obj(struct mappings_info)))
       return -ENOMEM;
 
-   if (!(mmap_heap = kzmalloc(kmalloc_get_heap_struct_size()))) {
-      kfree_obj(pi->mi, struct mappings_info);
-      return -ENOMEM;
+   pi->mi->mappings = NULL;
+   return 0;
+}
+
+static inline bool in_mmap_area(ulong vaddr, size_t len)
+{
+   return vaddr >= USER_MMAP_BEGIN &&
+          vaddr <= USER_MMAP_END &&
+          len <= USER_MMAP_END - vaddr;
+}
+
+/*
+ * Choose where to put a new mapping of `len` bytes: at `hint` if possible,
+ * otherwise in the lowest free range. Large anonymous mappings get aligned at
+ * BIG_PAGE_SIZE, in order to allow user_map_big_pages() to use big pages for
+ * as much as possible of them.
+ */
+static void *mmap_get_free_vaddr(void *hint, size_t len, bool anon)
+{
+   const ulong hint_va = pow2_round_up_at((ulong)hint, PAGE_SIZE);
+   struct user_mapping *um;
+   size_t aligned_len;
+   ulong vaddr;
+
+   ASSERT(!is_preemption_enabled());
+
+   if (hint && in_mmap_area(hint_va, len)) {
+
+      um = process_get_user_mapping_from((void *)hint_va);
+
+      if (!um || um->vaddr >= hint_va + len)
+         return (void *)hint_va;
    }
 
-   list_init(&pi->mi->mappings);
-   pi->mi->mmap_heap = mmap_heap;
-   pi->mi->mmap_heap_size = USER_MMAP_MIN_SZ;
-
-   bool success =
-      kmalloc_create_heap(mmap_heap,
-                          USER_MMAP_BEGIN,
-                          pi->mi->mmap_heap_size,
-                          PAGE_SIZE,
-                          KMALLOC_MAX_ALIGN,    /* alloc block size */
-                          false,                /* linear mapping */
-                          NULL,                 /* metadata_nodes */
-#if MMAP_NO_COW
-                          user_valloc_and_map,
-                          user_vfree_and_unmap);
-#else
-                          user_map_zero_page,
-                          user_unmap_zero_page);
-#endif
-
-   if (!success)
-      return -ENOMEM;
+   if (MMAP_BIG_PAGES && anon && len >= BIG_PAGE_SIZE) {
 
-   return 0;
+      /* Look for a range big enough to contain an aligned one */
+      aligned_len = len + BIG_PAGE_SIZE - PAGE_SIZE;
+      vaddr = (ulong)process_find_free_user_range(aligned_len);
+
+      if (vaddr)
+         return (void *)pow2_round_up_at(vaddr, BIG_PAGE_SIZE);
+   }
+
+   return process_find_free_user_range(len);
 }
 
-static inline void
-mmap_err_case_free(struct process *pi, void *ptr, size_t actual_len)
+static int munmap_int(struct process *pi, void *vaddrp, size_t len);
+
+/* Map the pages of an anonymous mapping (or of a part of it) */
+static bool map_anon_pages(ulong vaddr, size_t len)
 {
-   per_heap_kfree(pi->mi->mmap_heap,
-                  ptr,
-                  &actual_len,
-                  KFREE_FL_ALLOW_SPLIT |
-                  KFREE_FL_MULTI_STEP  |
-                  KFREE_FL_NO_ACTUAL_FREE);
+   if (MMAP_NO_COW)
+      return user_valloc_and_map(vaddr, len >> PAGE_SHIFT);
+
+   return user_map_zero_page(vaddr, len >> PAGE_SHIFT);
 }
 
 static struct user_mapping *
-mmap_on_user_heap(struct process *pi,
-                  size_t *actual_len_ref,
-                  fs_handle handle,
-                  u32 per_heap_kmalloc_flags,
-                  size_t off,
-                  int prot)
+mmap_int(struct process *pi,
+         void *addr,
+         size_t actual_len,
+         int flags,
+         fs_handle handle,
+         size_t off,
+         int prot)
 {
-   void *res;
    struct user_mapping *um;
+   void *vaddrp;
 
-   while (true) {
-
-      struct kmalloc_heap *new_heap;
-      struct kmalloc_heap *h = pi->mi->mmap_heap;
-      size_t heap_sz = pi->mi->mmap_heap_size;
-
-      res = per_heap_kmalloc(h,
-                             actual_len_ref,
-                             per_heap_kmalloc_flags);
+   ASSERT(!is_preemption_enabled());
 
-      if (LIKELY(res != NULL))
-         break;        /* great! */
+   if (flags & MAP_FIXED) {
 
-      if (heap_sz == USER_MMAP_MAX_SZ)
-         return NULL; /* cannot expand the heap more than that */
+      /* Like Linux, replace any existing mapping in the range */
+      if (munmap_int(pi, addr, actual_len))
+         return NULL;
 
-      new_heap = kmalloc_heap_dup_expanded(h, heap_sz * 2);
+      vaddrp = addr;
 
-      if (!new_heap)
-         return NULL; /* no enough memory */
+   } else {
 
-      pi->mi->mmap_heap_size = heap_sz * 2;
-      pi->mi->mmap_heap = new_heap;
-      kmalloc_destroy_heap(h);
+      if (!(vaddrp = mmap_get_free_vaddr(addr, actual_len, !handle)))
+         return NULL;
    }
 
    /* NOTE: here `handle` might be NULL (zero-map case) and that's OK */
-   um = process_add_user_mapping(handle, res, *actual_len_ref, off, prot);
+   um = process_add_user_mapping(handle, vaddrp, actual_len, off, prot);
 
-   if (!um) {
-      mmap_err_case_free(pi, res, *actual_len_ref);
+   if (!um || handle)
+      return um;
+
+   if (!map_anon_pages((ulong)vaddrp, actual_len)) {
+      process_remove_user_mapping(um);
       return NULL;
    }
 
@@ -205,7 +213,6 @@ long
 sys_mmap_pgoff(void *addr, size_t len, int prot,
                int flags, int fd, size_t pgoffset)
 {
-   u32 per_heap_kmalloc_flags = KMALLOC_FL_MULTI_STEP | PAGE_SIZE;
    struct task *curr = get_curr_task();
    struct process *pi = curr->pi;
    struct fs_handle_base *handle = NULL;
@@ -219,14 +226,20 @@ sys_mmap_pgoff(void *addr, size_t len, int prot,
    if (!len)
       return -EINVAL;
 
-   if (addr)
-      return -EINVAL; /* addr != NULL not supported */
-
    if (!(prot & PROT_READ))
       return -EINVAL;
 
    actual_len = pow2_round_up_at(len, PAGE_SIZE);
 
+   if (flags & MAP_FIXED) {
+
+      if (!IS_PAGE_ALIGNED(addr))
+         return -EINVAL;
+
+      if (!in_mmap_area((ulong)addr, actual_len))
+         return -EINVAL; /* fixed mappings outside the mmap area unsupported */
+   }
+
    if (fd == -1) {
 
       if (!(flags & MAP_ANONYMOUS))
@@ -266,30 +279,27 @@ sys_mmap_pgoff(void *addr, size_t len, int prot,
          if (!(fl & O_WRONLY) && (fl & O_RDWR) != O_RDWR)
             return -EACCES;
       }
-
-      per_heap_kmalloc_flags |= KMALLOC_FL_NO_ACTUAL_ALLOC;
    }
 
    if (!pi->mi)
-      if ((rc = create_process_mmap_heap(pi)))
+      if ((rc = create_process_mappings_info(pi)))
          return rc;
 
    disable_preemption();
    {
-      um = mmap_on_user_heap(pi,
-                             &actual_len,
-                             handle,
-                             per_heap_kmalloc_flags,
-                             pgoffset << PAGE_SHIFT,
-                             prot);
+      um = mmap_int(pi,
+                    addr,
+                    actual_len,
+                    flags,
+                    handle,
+                    pgoffset << PAGE_SHIFT,
+                    prot);
    }
    enable_preemption();
 
    if (!um)
       return -ENOMEM;
 
-   ASSERT(actual_len == pow2_round_up_at(len, PAGE_SIZE));
-
    if (handle) {
 
       if ((rc = vfs_mmap(um, pi->pdir, 0))) {
@@ -302,7 +312,6 @@ sys_mmap_pgoff(void *addr, size_t len, int prot,
 
          disable_preemption();
          {
-            mmap_err_case_free(pi, um->vaddrp, actual_len);
             process_remove_user_mapping(um);
          }
          enable_preemption();
@@ -319,105 +328,131 @@ sys_mmap_pgoff(void *addr, size_t len, int prot,
    return (long)um->vaddr;
 }
 
-static int munmap_int(struct process *pi, void *vaddrp, size_t len)
+/*
+ * Un-map the intersection [start, end) of the range being unmapped with the
+ * mapping `um`, shrinking, splitting or removing `um`.
+ */
+static int
+munmap_mapping(struct process *pi,
+               struct user_mapping *um,
+               ulong start,
+               ulong end)
 {
-   u32 kfree_flags = KFREE_FL_ALLOW_SPLIT | KFREE_FL_MULTI_STEP;
-   struct user_mapping *um = NULL, *um2 = NULL;
-   ulong vaddr = (ulong) vaddrp;
-   size_t actual_len;
+   const ulong um_vend = um->vaddr + um->len;
+   struct user_mapping *um2 = NULL;
    int rc;
 
-   ASSERT(!is_preemption_enabled());
+   ASSERT(um->vaddr <= start && end <= um_vend);
 
-   actual_len = pow2_round_up_at(len, PAGE_SIZE);
-   um = process_get_user_mapping(vaddrp);
+   /* That might require memory: do it before changing anything */
+   rc = prepare_to_unmap_user_pages(pi->pdir,
+                                    (void *)start,
+                                    (end - start) >> PAGE_SHIFT);
+   if (rc)
+      return rc;
 
-   if (!um) {
+   if (um->vaddr < start && end < um_vend) {
 
       /*
-       * We just don't have any user_mappings containing [vaddrp, vaddrp+len).
-       * Just ignore that and return 0 [linux behavior].
+       * Unmap something at the middle of the chunk: shrink the current
+       * struct user_mapping and create a new one for its 2nd part.
        */
 
-      printk("[%d] Un-map unknown chunk at [%p, %p)\n",
-             pi->pid, TO_PTR(vaddr), TO_PTR(vaddr + actual_len));
-      return 0;
+      process_set_user_mapping_range(um, um->vaddrp, start - um->vaddr);
+      um2 = process_add_user_mapping(um->h,
+                                     (void *)end,
+                                     um_vend - end,
+                                     um->off + (end - um->vaddr),
+                                     um->prot);
+
+      if (!um2) {
+
+         /*
+          * Oops, we're out-of-memory! No problem, revert the change and
+          * return -ENOMEM. Linux is allowed to do that.
+          */
+         process_set_user_mapping_range(um, um->vaddrp, um_vend - um->vaddr);
+         return -ENOMEM;
+      }
+
+      um2->lazy_free = um->lazy_free;
    }
 
-   const ulong um_vend = um->vaddr + um->len;
+   if (um->h) {
 
-   if (actual_len == um->len) {
+      rc = vfs_munmap(um, (void *)start, end - start);
 
-      process_remove_user_mapping(um);
+      /*
+       * If there's an actual user_mapping entry, it means um->h's fops MUST
+       * HAVE mmap() implemented. Therefore, we MUST REQUIRE munmap() to be
+       * present as well.
+       */
+
+      ASSERT(rc != -ENODEV);
+      (void) rc; /* prevent the "unused variable" Werror in release */
+
+      if (um2)
+         vfs_mmap(um2, pi->pdir, VFS_MM_DONT_MMAP);
 
    } else {
 
-      /* partial un-map */
+      unmap_pages_permissive(pi->pdir,
+                             (void *)start,
+                             (end - start) >> PAGE_SHIFT,
+                             true);
+   }
 
-      if (vaddr == um->vaddr) {
+   if (start == um->vaddr && end == um_vend) {
 
-         /* unmap the beginning of the chunk */
-         um->vaddr += actual_len;
-         um->off += actual_len;
-         um->len -= actual_len;
+      process_remove_user_mapping(um);
 
-      } else if (vaddr + actual_len == um_vend) {
+   } else if (start == um->vaddr) {
 
-         /* unmap the end of the chunk */
-         um->len -= actual_len;
+      /* unmap the beginning of the chunk */
+      um->off += end - start;
+      process_set_user_mapping_range(um, (void *)end, um_vend - end);
 
-      } else {
+   } else if (end == um_vend) {
+
+      /* unmap the end of the chunk */
+      process_set_user_mapping_range(um, um->vaddrp, start - um->vaddr);
+   }
 
-         /* Unmap something at the middle of the chunk */
+   return 0;
+}
 
-         /* Shrink the current struct user_mapping */
-         um->len = vaddr - um->vaddr;
+static int munmap_int(struct process *pi, void *vaddrp, size_t len)
+{
+   const ulong vaddr = (ulong)vaddrp;
+   const ulong end = vaddr + pow2_round_up_at(len, PAGE_SIZE);
+   struct user_mapping *um;
+   bool found = false;
+   int rc;
 
-         /* Create a new struct user_mapping for its 2nd part */
-         um2 = process_add_user_mapping(
-            um->h,
-            (void *)(vaddr + actual_len),
-            (um_vend - (vaddr + actual_len)),
-            um->off + um->len + actual_len,
-            um->prot
-         );
+   ASSERT(!is_preemption_enabled());
 
-         if (!um2) {
+   while ((um = process_get_user_mapping_from(vaddrp)) && um->vaddr < end) {
 
-            /*
-             * Oops, we're out-of-memory! No problem, revert um->page_count
-             * and return -ENOMEM. Linux is allowed to do that.
-             */
-            um->len = um_vend - um->vaddr;
-            return -ENOMEM;
-         }
-      }
+      found = true;
+      rc = munmap_mapping(pi,
+                          um,
+                          MAX(vaddr, um->vaddr),
+                          MIN(end, um->vaddr + um->len));
+      if (rc)
+         return rc;
    }
 
-   if (um->h) {
-
-      kfree_flags |= KFREE_FL_NO_ACTUAL_FREE;
-      rc = vfs_munmap(um, vaddrp, actual_len);
+   if (!found) {
 
       /*
-       * If there's an actual user_mapping entry, it means um->h's fops MUST
-       * HAVE mmap() implemented. Therefore, we MUST REQUIRE munmap() to be
-       * present as well.
+       * We just don't have any user_mappings in [vaddrp, vaddrp+len).
+       * Just ignore that and return 0 [linux behavior].
        */
 
-      ASSERT(rc != -ENODEV);
-      (void) rc; /* prevent the "unused variable" Werror in release */
-
-      if (um2)
-         vfs_mmap(um2, pi->pdir, VFS_MM_DONT_MMAP);
+      printk("[%d] Un-map unknown chunk at [%p, %p)\n",
+             pi->pid, TO_PTR(vaddr), TO_PTR(end));
    }
 
-   per_heap_kfree(pi->mi->mmap_heap,
-                  vaddrp,
-                  &actual_len,
-                  kfree_flags);
-
-   ASSERT(actual_len == pow2_round_up_at(len, PAGE_SIZE));
    return 0;
 }
 
@@ -428,19 +463,358 @@ int sys_munmap(void *vaddrp, size_t len)
    ulong vaddr = (ulong) vaddrp;
    int rc;
 
-   if (!len || !pi->mi->mmap_heap)
+   if (!len || !pi->mi || !IS_PAGE_ALIGNED(vaddr))
+      return -EINVAL;
+
+   if (!in_mmap_area(vaddr, pow2_round_up_at(len, PAGE_SIZE)))
       return -EINVAL;
 
-   if (!IN_RANGE(vaddr,
-                 USER_MMAP_BEGIN,
-                 USER_MMAP_BEGIN + pi->mi->mmap_heap_size))
+   disable_preemption();
    {
+      rc = munmap_int(pi, vaddrp, len);
+   }
+   enable_preemption();
+   return rc;
+}
+
+static bool is_user_range_free(ulong vaddr, size_t len)
+{
+   struct user_mapping *um = process_get_user_mapping_from((void *)vaddr);
+   return !um || um->vaddr >= vaddr + len;
+}
+
+/*
+ * Move [old_va, old_va + old_len) of the anonymous mapping `um` to a new
+ * mapping at `new_va`, by moving the page table entries, and grow it to
+ * `new_len` bytes (new_len >= old_len). On failure, everything is restored
+ * as it was.
+ */
+static long
+mremap_move(struct process *pi,
+            struct user_mapping *um,
+            ulong old_va,
+            size_t old_len,
+            ulong new_va,
+            size_t new_len)
+{
+   const size_t old_pages = old_len >> PAGE_SHIFT;
+   const size_t grow_len = new_len - old_len;
+   struct user_mapping *new_um;
+   size_t moved;
+   int rc = -ENOMEM;
+
+   ASSERT(new_len >= old_len);
+
+   new_um = process_add_user_mapping(NULL,
+                                     (void *)new_va,
+                                     new_len,
+                                     0,
+                                     um->prot);
+   if (!new_um)
+      return -ENOMEM;
+
+   /* The moved pages might still be lazily freeable (MADV_FREE) */
+   new_um->lazy_free = um->lazy_free;
+
+   if (grow_len && !map_anon_pages(new_va + old_len, grow_len)) {
+      process_remove_user_mapping(new_um);
+      return -ENOMEM;
+   }
+
+   moved = move_pages(pi->pdir, (void *)old_va, (void *)new_va, old_pages);
+
+   /*
+    * Now the old range has no pages mapped: munmap_int() will just update
+    * (or remove) the old mapping. It can fail only with -ENOMEM, when it
+    * has to split the mapping, before doing anything.
+    */
+   if (moved == old_pages)
+      rc = munmap_int(pi, (void *)old_va, old_len);
+
+   if (rc) {
+
+      VERIFY(move_pages(pi->pdir,
+                        (void *)new_va,
+                        (void *)old_va,
+                        moved) == moved);
+
+      if (grow_len)
+         unmap_pages_permissive(pi->pdir,
+                                (void *)(new_va + old_len),
+                                grow_len >> PAGE_SHIFT,
+                                true);
+
+      process_remove_user_mapping(new_um);
+      return rc;
+   }
+
+   return (long)new_va;
+}
+
+static long
+mremap_int(struct process *pi,
+           ulong old_va,
+           size_t old_len,
+           size_t new_len,
+           int flags,
+           ulong new_va)
+{
+   struct user_mapping *um;
+   ulong um_vend;
+   int rc;
+
+   ASSERT(!is_preemption_enabled());
+   um = process_get_user_mapping((void *)old_va);
+
+   if (!um || old_va + old_len > um->vaddr + um->len)
+      return -EFAULT;
+
+   if (um->h && (new_len > old_len || (flags & MREMAP_FIXED)))
+      return -EINVAL; /* file mappings can only shrink, at the moment */
+
+   if (flags & MREMAP_FIXED) {
+
+      /* The ranges don't overlap: this cannot touch `um` */
+      if ((rc = munmap_int(pi, (void *)new_va, new_len)))
+         return rc;
+
+      if (new_len < old_len) {
+
+         /* Drop the tail first: only new_len bytes have to be moved */
+         rc = munmap_int(pi, (void *)(old_va + new_len), old_len - new_len);
+
+         if (rc)
+            return rc;
+
+         old_len = new_len;
+         um = process_get_user_mapping((void *)old_va);
+      }
+
+      return mremap_move(pi, um, old_va, old_len, new_va, new_len);
+   }
+
+   if (new_len <= old_len) {
+
+      if (new_len < old_len) {
+
+         rc = munmap_int(pi, (void *)(old_va + new_len), old_len - new_len);
+
+         if (rc)
+            return rc;
+      }
+
+      return (long)old_va;
+   }
+
+   um_vend = um->vaddr + um->len;
+
+   if (old_va + old_len == um_vend &&
+       in_mmap_area(um_vend, new_len - old_len) &&
+       is_user_range_free(um_vend, new_len - old_len))
+   {
+      /* Grow in place */
+      if (!map_anon_pages(um_vend, new_len - old_len))
+         return -ENOMEM;
+
+      process_set_user_mapping_range(um,
+                                     um->vaddrp,
+                                     um->len + new_len - old_len);
+      return (long)old_va;
+   }
+
+   if (!(flags & MREMAP_MAYMOVE))
+      return -ENOMEM;
+
+   if (!(new_va = (ulong)mmap_get_free_vaddr(NULL, new_len, true)))
+      return -ENOMEM;
+
+   return mremap_move(pi, um, old_va, old_len, new_va, new_len);
+}
+
+long
+sys_mremap(void *old_addr,
+           size_t old_len,
+           size_t new_len,
+           int flags,
+           void *new_addr)
+{
+   struct process *pi = get_curr_proc();
+   const ulong old_va = (ulong)old_addr;
+   const ulong new_va = (ulong)new_addr;
+   long rc;
+
+   if (flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED))
+      return -EINVAL;
+
+   if ((flags & MREMAP_FIXED) && !(flags & MREMAP_MAYMOVE))
       return -EINVAL;
+
+   if (!IS_PAGE_ALIGNED(old_va) || !new_len || !pi->mi)
+      return -EINVAL;
+
+   old_len = pow2_round_up_at(old_len, PAGE_SIZE);
+   new_len = pow2_round_up_at(new_len, PAGE_SIZE);
+
+   if (!old_len)
+      return -EINVAL; /* duplicating shared mappings is not supported */
+
+   if (!in_mmap_area(old_va, old_len))
+      return -EFAULT;
+
+   if (flags & MREMAP_FIXED) {
+
+      if (!IS_PAGE_ALIGNED(new_va) || !in_mmap_area(new_va, new_len))
+         return -EINVAL;
+
+      if (new_va < old_va + old_len && old_va < new_va + new_len)
+         return -EINVAL; /* the ranges overlap */
    }
 
    disable_preemption();
    {
-      rc = munmap_int(pi, vaddrp, len);
+      rc = mremap_int(pi, old_va, old_len, new_len, flags, new_va);
+
+      if (MMAP_NO_COW && rc > 0 && new_len > old_len)
+         bzero((void *)rc + old_len, new_len - old_len);
+   }
+   enable_preemption();
+   return rc;
+}
+
+static int
+madvise_anon(struct process *pi,
+             struct user_mapping *um,
+             ulong start,
+             ulong end,
+             int advice)
+{
+   const size_t page_count = (end - start) >> PAGE_SHIFT;
+
+   switch (advice) {
+
+      case MADV_FREE:
+
+         if (um) {
+            lazy_free_user_pages(pi->pdir, (void *)start, page_count);
+            um->lazy_free = true;
+            return 0;
+         }
+
+         /*
+          * There's no mapping to track the brk heap's pages with: just free
+          * them right away, which is a valid implementation of MADV_FREE.
+          */
+         return discard_user_pages(pi->pdir, (void *)start, page_count);
+
+      case MADV_DONTNEED:
+         return discard_user_pages(pi->pdir, (void *)start, page_count);
+
+      default:
+         return 0;
+   }
+}
+
+static void
+madvise_file(struct process *pi,
+             struct user_mapping *um,
+             ulong start,
+             ulong end,
+             int advice)
+{
+   /*
+    * NOTE: MADV_DONTNEED and MADV_FREE have nothing to do here: file mappings
+    * are always shared and their pages belong to the file.
+    */
+
+   if (advice != MADV_WILLNEED)
+      return;
+
+   /* Pre-fault the pages not mapped yet, like reading them would do */
+   for (ulong va = start; va < end; va += PAGE_SIZE) {
+
+      if (is_mapped(pi->pdir, (void *)va))
+         continue;
+
+      if (!vfs_handle_fault(um, (void *)va, false, false))
+         break; /* past EOF or not supported by the filesystem */
+   }
+}
+
+static int madvise_int(struct process *pi, ulong start, ulong end, int advice)
+{
+   const ulong heap_start = (ulong)pi->initial_brk;
+   const ulong heap_end = (ulong)pi->brk;
+   struct user_mapping *um;
+   ulong va = start, seg_end;
+   int rc = 0;
+
+   ASSERT(!is_preemption_enabled());
+
+   while (va < end) {
+
+      if (heap_start <= va && va < heap_end) {
+
+         seg_end = MIN(end, heap_end);
+
+         if ((rc = madvise_anon(pi, NULL, va, seg_end, advice)))
+            return rc;
+
+         va = seg_end;
+         continue;
+      }
+
+      um = process_get_user_mapping_from((void *)va);
+
+      if (!um || um->vaddr >= end) {
+         rc = -ENOMEM; /* part of the range is not mapped [Linux behavior] */
+         break;
+      }
+
+      if (um->vaddr > va) {
+         rc = -ENOMEM;
+         va = um->vaddr;
+      }
+
+      seg_end = MIN(end, um->vaddr + um->len);
+
+      if (um->h) {
+
+         madvise_file(pi, um, va, seg_end, advice);
+
+      } else {
+
+         int rc2 = madvise_anon(pi, um, va, seg_end, advice);
+
+         if (rc2)
+            return rc2;
+      }
+
+      va = seg_end;
+   }
+
+   return rc;
+}
+
+int sys_madvise(void *addr, size_t len, int advice)
+{
+   struct process *pi = get_curr_proc();
+   const ulong start = (ulong)addr;
+   const ulong end = start + pow2_round_up_at(len, PAGE_SIZE);
+   int rc;
+
+   if (!IS_PAGE_ALIGNED(start) || end < start || end > USERMODE_VADDR_END)
+      return -EINVAL;
+
+   if (advice != MADV_DONTNEED &&
+       advice != MADV_FREE &&
+       advice != MADV_WILLNEED)
+   {
+      return 0; /* all the other advices are just ignored */
+   }
+
+   disable_preemption();
+   {
+      rc = madvise_int(pi, start, end, advice);
    }
    enable_preemption();
    return rc;
@@ -1,8 +1,154 @@
 /* SPDX-License-Identifier: BSD-2-Clause */
 
+#include <tilck_gen_headers/config_mm.h>
+
+#include <tilck/common/utils.h>
+
 #include <tilck/kernel/process_mm.h>
 #include <tilck/kernel/process.h>
 #include <tilck/kernel/paging_hw.h>
+#include <tilck/kernel/kmem_cache.h>
+#include <tilck/kernel/pageframes.h>
+
+DEF_KMEM_CACHE_FOR_TYPE(user_mapping_cache,
+                        "user_mapping",
+                        struct user_mapping);
+
+static long um_cmp(const void *a, const void *b)
+{
+   const struct user_mapping *um1 = a;
+   const struct user_mapping *um2 = b;
+
+   if (um1->vaddr < um2->vaddr)
+      return -1;
+
+   return um1->vaddr > um2->vaddr ? 1 : 0;
+}
+
+/* Compare a mapping with a vaddr: it's "equal" to all the vaddrs it contains */
+static long um_vaddr_cmp(const void *obj, const void *value)
+{
+   const struct user_mapping *um = obj;
+   const ulong vaddr = (ulong)value;
+
+   if (vaddr < um->vaddr)
+      return 1;
+
+   return vaddr >= um->vaddr + um->len ? -1 : 0;
+}
+
+static void um_aug(void *obj)
+{
+   struct user_mapping *um = obj;
+   struct user_mapping *l = um->node.left_obj;
+   struct user_mapping *r = um->node.right_obj;
+   const ulong um_end = um->vaddr + um->len;
+   ulong gap = 0;
+
+   um->sub_start = l ? l->sub_start : um->vaddr;
+   um->sub_end = r ? r->sub_end : um_end;
+
+   if (l)
+      gap = MAX(l->sub_max_gap, um->vaddr - l->sub_end);
+
+   if (r) {
+      gap = MAX(gap, r->sub_max_gap);
+      gap = MAX(gap, r->sub_start - um_end);
+   }
+
+   um->sub_max_gap = gap;
+}
+
+static void mi_insert(struct mappings_info *mi, struct user_mapping *um)
+{
+   DEBUG_CHECKED_SUCCESS(
+      bintree_insert_aug(&mi->mappings,
+                         um,
+                         um_cmp,
+                         um_aug,
+                         struct user_mapping,
+                         node)
+   );
+}
+
+static void mi_remove(struct mappings_info *mi, struct user_mapping *um)
+{
+   DEBUG_ONLY_UNSAFE(void *removed =)
+      bintree_remove_aug(&mi->mappings,
+                         um->vaddrp,
+                         um_vaddr_cmp,
+                         um_aug,
+                         struct user_mapping,
+                         node);
+
+   ASSERT(removed == um);
+}
+
+/* Returns the first mapping ending after `vaddr` (it might contain it) */
+static struct user_mapping *
+mi_get_mapping_from(struct mappings_info *mi, ulong vaddr)
+{
+   struct user_mapping *um = mi->mappings;
+   struct user_mapping *res = NULL;
+
+   while (um) {
+
+      if (um->vaddr + um->len > vaddr) {
+         res = um;
+         um = um->node.left_obj;
+      } else {
+         um = um->node.right_obj;
+      }
+   }
+
+   return res;
+}
+
+/*
+ * Find the lowest free range of `len` bytes in [USER_MMAP_BEGIN, USER_MMAP_END)
+ * in O(log n), by going down only into the subtrees having a big-enough gap.
+ * All the mappings are supposed to be in that range.
+ */
+static ulong
+mi_find_free_range(struct mappings_info *mi, size_t len)
+{
+   struct user_mapping *um = mi->mappings;
+   struct user_mapping *l, *r;
+
+   if (!um)
+      return len <= USER_MMAP_MAX_SZ ? USER_MMAP_BEGIN : 0;
+
+   if (um->sub_start - USER_MMAP_BEGIN >= len)
+      return USER_MMAP_BEGIN;
+
+   if (um->sub_max_gap < len) {
+
+      if (USER_MMAP_END - um->sub_end >= len)
+         return um->sub_end;
+
+      return 0;
+   }
+
+   while (true) {
+
+      l = um->node.left_obj;
+      r = um->node.right_obj;
+
+      if (l && l->sub_max_gap >= len) {
+         um = l;
+         continue;
+      }
+
+      if (l && um->vaddr - l->sub_end >= len)
+         return l->sub_end;
+
+      if (r && r->sub_start - (um->vaddr + um->len) >= len)
+         return um->vaddr + um->len;
+
+      ASSERT(r && r->sub_max_gap >= len);
+      um = r;
+   }
+}
 
 struct user_mapping *
 process_add_user_mapping(fs_handle h,
@@ -19,10 +165,10 @@ process_add_user_mapping(fs_handle h,
    ASSERT(!process_get_user_mapping(vaddr));
    ASSERT(pi->mi);
 
-   if (!(um = kzalloc_obj(struct user_mapping)))
+   if (!(um = kmem_cache_zalloc(&user_mapping_cache)))
       return NULL;
 
-   list_node_init(&um->pi_node);
+   bintree_node_init(&um->node);
    list_node_init(&um->inode_node);
 
    um->pi = pi;
@@ -32,7 +178,7 @@ process_add_user_mapping(fs_handle h,
    um->off = off;
    um->prot = prot;
 
-   list_add_tail(&pi->mi->mappings, &um->pi_node);
+   mi_insert(pi->mi, um);
    return um;
 }
 
@@ -40,99 +186,127 @@ void process_remove_user_mapping(struct user_mapping *um)
 {
    ASSERT(!is_preemption_enabled());
 
-   list_remove(&um->pi_node);
+   mi_remove(um->pi->mi, um);
    list_remove(&um->inode_node);
-   kfree_obj(um, struct user_mapping);
+   kmem_cache_free(&user_mapping_cache, um);
+}
+
+/*
+ * Change the range of an existing mapping (e.g. on partial munmap). The new
+ * range must not overlap with any other mapping.
+ */
+void process_set_user_mapping_range(struct user_mapping *um,
+                                    void *vaddr,
+                                    size_t len)
+{
+   struct mappings_info *mi = um->pi->mi;
+   ASSERT(!is_preemption_enabled());
+   ASSERT((len & OFFSET_IN_PAGE_MASK) == 0);
+
+   /* Re-insert the mapping, in order to update the augmented data */
+   mi_remove(mi, um);
+   um->vaddrp = vaddr;
+   um->len = len;
+   bintree_node_init(&um->node);
+   mi_insert(mi, um);
 }
 
 struct user_mapping *process_get_user_mapping(void *vaddrp)
 {
-   const ulong vaddr = (ulong)vaddrp;
    struct process *pi = get_curr_proc();
-   struct user_mapping *pos;
-
    ASSERT(!is_preemption_enabled());
 
-   if (pi->mi) {
+   /*
+    * NOTE: some small processes that don't use dynamic memory allocation will
+    * not even have this field (pi->mi == NULL).
+    */
 
-      /*
-       * Given that pi->mi->mappings contains at the moment only the memory
-       * mappings done with mmap(), some small processes that don't use dynamic
-       * memory allocation will not even have this field (pi->mi == NULL).
-       *
-       * For the rest, the list is supposed to be *short*, so a linear scan
-       * is acceptable for the moment. If in the future we start to put
-       * there also the mappings for program's text and data and expect to have
-       * more than a few elements, it will be necessary to use a BST to perform
-       * the lookup here below.
-       */
+   if (!pi->mi)
+      return NULL;
 
-      list_for_each_ro(pos, &pi->mi->mappings, pi_node) {
+   return bintree_find(pi->mi->mappings,
+                       vaddrp,
+                       um_vaddr_cmp,
+                       struct user_mapping,
+                       node);
+}
 
-         if (IN_RANGE(vaddr, pos->vaddr, pos->vaddr + pos->len))
-            return pos;
-      }
-   }
+struct user_mapping *process_get_user_mapping_from(void *vaddrp)
+{
+   struct process *pi = get_curr_proc();
+   ASSERT(!is_preemption_enabled());
+
+   if (!pi->mi)
+      return NULL;
+
+   return mi_get_mapping_from(pi->mi, (ulong)vaddrp);
+}
+
+/* Returns the lowest free range of `len` bytes in the mmap area or NULL */
+void *process_find_free_user_range(size_t len)
+{
+   struct process *pi = get_curr_proc();
+   ASSERT(!is_preemption_enabled());
+   ASSERT(pi->mi);
 
-   return NULL;
+   return (void *)mi_find_free_range(pi->mi, len);
 }
 
 void remove_all_user_zero_mem_mappings(struct process *pi)
 {
    struct user_mapping *um;
-   struct list *mappings_list_p;
+   ulong vaddr = 0;
 
    ASSERT(!is_preemption_enabled());
 
    if (!pi->mi)
       return;
 
-   mappings_list_p = &pi->mi->mappings;
+   while ((um = mi_get_mapping_from(pi->mi, vaddr))) {
 
-   list_for_each_ro(um, mappings_list_p, pi_node) {
+      vaddr = um->vaddr + um->len;
 
       if (!um->h)
          full_remove_user_mapping(pi, um);
    }
 
-   ASSERT(list_is_empty(mappings_list_p));
+   ASSERT(!pi->mi->mappings);
 }
 
 void remove_all_mappings_of_handle(struct process *pi, fs_handle h)
 {
-   struct user_mapping *pos, *temp;
    struct mappings_info *mi = pi->mi;
+   struct user_mapping *um;
+   ulong vaddr = 0;
 
    if (!mi)
       return;
 
    disable_preemption();
    {
-      list_for_each(pos, temp, &mi->mappings, pi_node) {
-         if (pos->h == h)
-            full_remove_user_mapping(pi, pos);
+      while ((um = mi_get_mapping_from(mi, vaddr))) {
+
+         vaddr = um->vaddr + um->len;
+
+         if (um->h == h)
+            full_remove_user_mapping(pi, um);
       }
    }
    enable_preemption();
 }
 
+/*
+ * Remove the mapping as a whole. Anonymous mappings are not unmapped here:
+ * this is called only when the whole address space is going away (exit or
+ * execve), in which case pdir_destroy() takes care of their pages.
+ */
 void full_remove_user_mapping(struct process *pi, struct user_mapping *um)
 {
-   struct mappings_info *mi = pi->mi;
-   size_t actual_len = um->len;
-
-   ASSERT(mi);
-   ASSERT(mi->mmap_heap);
+   ASSERT(pi->mi);
+   ASSERT(um->pi == pi);
 
    if (um->h)
-      vfs_munmap(um, um->vaddrp, actual_len);
-
-   per_heap_kfree(mi->mmap_heap,
-                  um->vaddrp,
-                  &actual_len,
-                  KFREE_FL_ALLOW_SPLIT |
-                  KFREE_FL_MULTI_STEP  |
-                  KFREE_FL_NO_ACTUAL_FREE);
+      vfs_munmap(um, um->vaddrp, um->len);
 
    process_remove_user_mapping(um);
 }
@@ -150,26 +324,50 @@ void remove_all_file_mappings(struct process *pi)
    }
 }
 
+/*
+ * Free the mappings info along with any mapping still in it, without touching
+ * the address space.
+ */
+void destroy_mappings_info(struct mappings_info *mi)
+{
+   struct user_mapping *um;
+
+   disable_preemption();
+   {
+      while ((um = mi->mappings)) {
+         mi_remove(mi, um);
+         list_remove(&um->inode_node);
+         kmem_cache_free(&user_mapping_cache, um);
+      }
+   }
+   enable_preemption();
+   kfree_obj(mi, struct mappings_info);
+}
+
 struct mappings_info *
 duplicate_mappings_info(struct process *new_pi, struct mappings_info *mi)
 {
    struct mappings_info *new_mi = NULL;
    struct user_mapping *um, *um2;
+   struct bintree_walk_ctx ctx;
 
    if (!(new_mi = kalloc_obj(struct mappings_info)))
-      goto oom_case;
-
-   list_init(&new_mi->mappings);
+      return NULL;
 
-   if (!(new_mi->mmap_heap = kmalloc_heap_dup(mi->mmap_heap)))
-      goto oom_case;
+   new_mi->mappings = NULL;
 
-   new_mi->mmap_heap_size = mi->mmap_heap_size;
+   bintree_in_order_visit_start(&ctx,
+                                mi->mappings,
+                                struct user_mapping,
+                                node,
+                                false);
 
-   list_for_each_ro(um, &mi->mappings, pi_node) {
+   while ((um = bintree_in_order_visit_next(&ctx))) {
 
-      if (!(um2 = kalloc_obj(struct user_mapping)))
-         goto oom_case;
+      if (!(um2 = kmem_cache_alloc(&user_mapping_cache))) {
+         destroy_mappings_info(new_mi);
+         return NULL;
+      }
 
       /* First just copy the mapping info */
       *um2 = *um;
@@ -178,11 +376,11 @@ duplicate_mappings_info(struct process *new_pi, struct mappings_info *mi)
       um2->pi = new_pi;
 
       /* Re-init the new nodes */
-      list_node_init(&um2->pi_node);
+      bintree_node_init(&um2->node);
       list_node_init(&um2->inode_node);
 
-      /* Add the pi_node to new process's mappings list */
-      list_add_tail(&new_mi->mappings, &um2->pi_node);
+      /* Add the mapping to the new process's tree */
+      mi_insert(new_mi, um2);
 
       /*
        * If the inode_node belongs to a list (mappings per inode)
@@ -193,42 +391,62 @@ duplicate_mappings_info(struct process *new_pi, struct mappings_info *mi)
    }
 
    return new_mi;
+}
 
-oom_case:
+static int reclaim_lazy_free_visit_cb(void *obj, void *arg)
+{
+   struct task *ti = obj;
+   struct process *pi = ti->pi;
+   size_t *freed = arg;
+   struct bintree_walk_ctx ctx;
+   struct user_mapping *um;
 
-   if (new_mi) {
+   if (!ti->is_main_thread || !pi->mi || pi->vforked)
+      return 0;
 
-      if (new_mi->mmap_heap) {
-         kmalloc_destroy_heap(new_mi->mmap_heap);
-         kfree2(new_mi->mmap_heap, kmalloc_get_heap_struct_size());
-      }
+   bintree_in_order_visit_start(&ctx,
+                                pi->mi->mappings,
+                                struct user_mapping,
+                                node,
+                                false);
 
-      list_for_each(um, um2, &new_mi->mappings, pi_node) {
-         list_remove(&um->pi_node);
-         kfree_obj(um, struct user_mapping);
-      }
+   while ((um = bintree_in_order_visit_next(&ctx))) {
+
+      if (!um->lazy_free)
+         continue;
 
-      kfree_obj(new_mi, struct mappings_info);
+      *freed += reclaim_lazy_free_pages(pi->pdir,
+                                        um->vaddrp,
+                                        um->len >> PAGE_SHIFT);
+      um->lazy_free = false;
    }
 
-   return NULL;
+   return 0;
 }
 
-void user_vfree_and_unmap(ulong user_vaddr, size_t page_count)
+/*
+ * Reclaim callback of the pageframe allocator: free the pages released with
+ * MADV_FREE by all the processes, unless they've been written since then.
+ */
+static size_t reclaim_lazy_free_mem(void)
 {
-   pdir_t *pdir = get_curr_pdir();
-   ulong va = user_vaddr;
-
-   for (size_t i = 0; i < page_count; i++, va += PAGE_SIZE) {
+   size_t freed = 0;
+   iterate_over_tasks(&reclaim_lazy_free_visit_cb, &freed);
+   return freed;
+}
 
-      if (!is_mapped(pdir, (void *)va))
-         continue;
+void init_process_mm(void)
+{
+   pf_set_reclaim_cb(&reclaim_lazy_free_mem);
+}
 
-      unmap_page(pdir, (void *)va, true);
-   }
+void user_vfree_and_unmap(ulong user_vaddr, size_t page_count)
+{
+   pdir_t *pdir = get_curr_pdir();
+   unmap_pages_permissive(pdir, (void *)user_vaddr, page_count, true);
 }
 
-bool user_valloc_and_map_slow(ulong user_vaddr, size_t page_count)
+bool user_valloc_and_map(ulong user_vaddr, size_t page_count)
 {
    pdir_t *pdir = get_curr_pdir();
    ulong pa, va = user_vaddr;
@@ -241,7 +459,7 @@ bool user_valloc_and_map_slow(ulong user_vaddr, size_t page_count)
          return false;
       }
 
-      if (!(kernel_vaddr = kmalloc(PAGE_SIZE))) {
+      if (!(kernel_vaddr = pf_alloc())) {
          user_vfree_and_unmap(user_vaddr, i);
          return false;
       }
@@ -249,7 +467,7 @@ bool user_valloc_and_map_slow(ulong user_vaddr, size_t page_count)
       pa = KERNEL_VA_TO_PA(kernel_vaddr);
 
       if (map_page(pdir, (void *)va, pa, PAGING_FL_RWUS) != 0) {
-         kfree2(kernel_vaddr, PAGE_SIZE);
+         pf_free(kernel_vaddr);
          user_vfree_and_unmap(user_vaddr, i);
          return false;
       }
@@ -258,52 +476,73 @@ bool user_valloc_and_map_slow(ulong user_vaddr, size_t page_count)
    return true;
 }
 
-bool user_valloc_and_map(ulong user_vaddr, size_t page_count)
+void user_unmap_zero_page(ulong user_vaddr, size_t page_count)
 {
    pdir_t *pdir = get_curr_pdir();
-   size_t size = (size_t)page_count << PAGE_SHIFT;
-   size_t count;
-
-   void *kernel_vaddr =
-      general_kmalloc(&size, KMALLOC_FL_MULTI_STEP | PAGE_SIZE);
 
-   if (!kernel_vaddr)
-      return user_valloc_and_map_slow(user_vaddr, page_count);
-
-   ASSERT(size == (size_t)page_count << PAGE_SHIFT);
+   /* The pages might have been already unmapped by munmap_int() */
+   unmap_pages_permissive(pdir, (void *)user_vaddr, page_count, true);
+}
 
-   count = map_pages(pdir,
-                     (void *)user_vaddr,
-                     KERNEL_VA_TO_PA(kernel_vaddr),
-                     page_count,
-                     PAGING_FL_US | PAGING_FL_RW);
+bool user_map_zero_page(ulong user_vaddr, size_t page_count)
+{
+   size_t count = map_zero_pages(get_curr_pdir(),
+                                 (void *)user_vaddr,
+                                 page_count,
+                                 PAGING_FL_US | PAGING_FL_RW);
 
    if (count != page_count) {
-      unmap_pages(pdir, (void *)user_vaddr, count, false);
-      general_kfree(kernel_vaddr,
-                    &size,
-                    KFREE_FL_ALLOW_SPLIT | KFREE_FL_MULTI_STEP);
+      user_unmap_zero_page(user_vaddr, count);
       return false;
    }
 
    return true;
 }
 
-void user_unmap_zero_page(ulong user_vaddr, size_t page_count)
+/*
+ * Called on the first write to a zero-page of an anonymous mapping, from the
+ * copy-on-write fault handler. When the aligned big page containing `vaddr`
+ * is entirely inside the mapping and none of its pages has been written yet,
+ * map it with a single, freshly zeroed, big page instead of copying just the
+ * 4 KB page. That way, big pages are allocated on demand, like the regular
+ * anonymous memory. Returns false when a 4 KB page has to be used instead.
+ */
+bool user_map_big_page_on_cow(ulong vaddr)
 {
+   const ulong va = vaddr & ~((ulong)BIG_PAGE_SIZE - 1);
    pdir_t *pdir = get_curr_pdir();
-   unmap_pages(pdir, (void *)user_vaddr, page_count, true);
-}
+   struct user_mapping *um;
+   void *kernel_vaddr;
 
-bool user_map_zero_page(ulong user_vaddr, size_t page_count)
-{
-   size_t count = map_zero_pages(get_curr_pdir(),
-                                 (void *)user_vaddr,
-                                 page_count,
-                                 PAGING_FL_US | PAGING_FL_RW);
+   ASSERT(!is_preemption_enabled());
+
+   if (!MMAP_BIG_PAGES)
+      return false;
+
+   um = process_get_user_mapping((void *)vaddr);
+
+   if (!um || um->h || va < um->vaddr)
+      return false;
+
+   if (va + BIG_PAGE_SIZE > um->vaddr + um->len)
+      return false;
+
+   if (!is_zero_big_page_range(pdir, (void *)va))
+      return false;
+
+   if (!(kernel_vaddr = pf_alloc_big(BIG_PAGE_SIZE)))
+      return false;
+
+   bzero(kernel_vaddr, BIG_PAGE_SIZE);
+
+   if (map_big_page(pdir,
+                    (void *)va,
+                    KERNEL_VA_TO_PA(kernel_vaddr),
+                    PAGING_FL_RWUS) != 0)
+   {
+      for (ulong off = 0; off < BIG_PAGE_SIZE; off += PAGE_SIZE)
+         pf_free(kernel_vaddr + off);
 
-   if (count != page_count) {
-      user_unmap_zero_page(user_vaddr, count);
       return false;
    }
 
@@ -314,13 +553,9 @@ int generic_fs_munmap(struct user_mapping *um, void *vaddrp, size_t len)
 {
    struct fs_handle_base *hb = um->h;
    struct process *pi = hb->pi;
-   ulong vaddr = (ulong)vaddrp;
-   ulong vend = vaddr + len;
    ASSERT(IS_PAGE_ALIGNED(len));
 
-   for (; vaddr < vend; vaddr += PAGE_SIZE) {
-      unmap_page_permissive(pi->pdir, (void *)vaddr, false);
-   }
-
+   /* NOTE: this unmaps the big pages entirely in the range as a whole */
+   unmap_pages_permissive(pi->pdir, vaddrp, len >> PAGE_SHIFT, false);
    return 0;
 }
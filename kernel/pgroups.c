@@ -0,0 +1,277 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+
+#include <tilck/kernel/process.h>
+#include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/errno.h>
+
+/*
+ * Process groups and sessions
+ * -----------------------------
+ *
+ * Each user process is in the `members` list of its process group and in the
+ * one of its session. The pgroup objects are kept in two trees indexed by ID,
+ * exist as long as they have any members and hold a reference on their ID (see
+ * pids.c), so that it cannot be reused by a new process meanwhile. That way,
+ * the operations on a group or a session cost O(log N + group size) instead of
+ * a walk of all the tasks in the system.
+ *
+ * The process_*_groups() functions must be called with preemption disabled.
+ */
+
+static struct pgroup *pgroups_root;
+static struct pgroup *sessions_root;
+
+static struct pgroup *
+pgroup_find(struct pgroup *root, int id)
+{
+   return bintree_find_ptr(root, id, struct pgroup, node, id);
+}
+
+static struct pgroup *
+pgroup_get_or_create(struct pgroup **root_ref, int id)
+{
+   struct pgroup *g = pgroup_find(*root_ref, id);
+
+   if (g)
+      return g;
+
+   if (!(g = kzalloc_obj(struct pgroup)))
+      return NULL;
+
+   bintree_node_init(&g->node);
+   list_init(&g->members);
+   g->id = id;
+
+   bintree_insert_ptr(root_ref, g, struct pgroup, node, id);
+   retain_pid(id);
+   return g;
+}
+
+static void
+pgroup_put_if_empty(struct pgroup **root_ref, struct pgroup *g)
+{
+   if (!list_is_empty(&g->members))
+      return;
+
+   bintree_remove_ptr(root_ref, g, struct pgroup, node, id);
+   release_pid((int)g->id);
+   kfree_obj(g, struct pgroup);
+}
+
+static void
+process_move_to_groups(struct process *pi,
+                       struct pgroup *pgrp,
+                       struct pgroup *session)
+{
+   struct pgroup *old_pgrp = pi->pgrp;
+   struct pgroup *old_session = pi->session;
+
+   if (old_pgrp != pgrp) {
+
+      if (old_pgrp)
+         list_remove(&pi->pgrp_node);
+
+      list_add_tail(&pgrp->members, &pi->pgrp_node);
+      pi->pgrp = pgrp;
+   }
+
+   if (old_session != session) {
+
+      if (old_session)
+         list_remove(&pi->session_node);
+
+      list_add_tail(&session->members, &pi->session_node);
+      pi->session = session;
+   }
+
+   pi->pgid = (int)pgrp->id;
+   pi->sid = (int)session->id;
+   pgrp->sid = pi->sid;
+
+   if (old_pgrp && old_pgrp != pgrp)
+      pgroup_put_if_empty(&pgroups_root, old_pgrp);
+
+   if (old_session && old_session != session)
+      pgroup_put_if_empty(&sessions_root, old_session);
+}
+
+/*
+ * Move `pi` in the process group `pgid` of the session `sid`, creating them
+ * if necessary. On failure, `pi` is left unchanged.
+ */
+int process_set_groups(struct process *pi, int pgid, int sid)
+{
+   struct pgroup *pgrp, *session;
+   ASSERT(!is_preemption_enabled());
+
+   if (!(pgrp = pgroup_get_or_create(&pgroups_root, pgid)))
+      return -ENOMEM;
+
+   if (!(session = pgroup_get_or_create(&sessions_root, sid))) {
+      pgroup_put_if_empty(&pgroups_root, pgrp);
+      return -ENOMEM;
+   }
+
+   process_move_to_groups(pi, pgrp, session);
+   return 0;
+}
+
+/* Put `pi` in the same process group and session as `other`. Cannot fail. */
+void process_join_groups_of(struct process *pi, struct process *other)
+{
+   ASSERT(!is_preemption_enabled());
+   ASSERT(other->pgrp && other->session);
+   process_move_to_groups(pi, other->pgrp, other->session);
+}
+
+void process_leave_groups(struct process *pi)
+{
+   ASSERT(!is_preemption_enabled());
+
+   if (!pi->pgrp)
+      return;
+
+   list_remove(&pi->pgrp_node);
+   list_remove(&pi->session_node);
+   pgroup_put_if_empty(&pgroups_root, pi->pgrp);
+   pgroup_put_if_empty(&sessions_root, pi->session);
+   pi->pgrp = NULL;
+   pi->session = NULL;
+}
+
+/* Call `func` on each process in the group `pgid`, until it returns != 0 */
+int iterate_over_group(int pgid, bintree_visit_cb func, void *arg)
+{
+   struct pgroup *g;
+   struct process *pos, *temp;
+   int rc;
+
+   ASSERT(!is_preemption_enabled());
+
+   if (!(g = pgroup_find(pgroups_root, pgid)))
+      return 0;
+
+   list_for_each(pos, temp, &g->members, pgrp_node) {
+      if ((rc = func(pos, arg)))
+         return rc;
+   }
+
+   return 0;
+}
+
+int sched_count_proc_in_group(int pgid)
+{
+   struct pgroup *g;
+   struct process *pos;
+   int count = 0;
+
+   disable_preemption();
+   {
+      if ((g = pgroup_find(pgroups_root, pgid))) {
+         list_for_each_ro(pos, &g->members, pgrp_node)
+            count++;
+      }
+   }
+   enable_preemption();
+   return count;
+}
+
+int sched_get_session_of_group(int pgid)
+{
+   struct pgroup *g;
+   int sid = -ESRCH;
+
+   disable_preemption();
+   {
+      if ((g = pgroup_find(pgroups_root, pgid)))
+         sid = g->sid;
+   }
+   enable_preemption();
+   return sid;
+}
+
+/*
+ * Signal all the members of a group or session, except the current process and
+ * init. The leader is signalled last by the callers, the current process as
+ * _very_ last.
+ */
+static ALWAYS_INLINE void
+signal_member(struct process *pi,
+              struct pgroup *g,
+              int sig,
+              struct process **leader_ref,
+              int *count)
+{
+   if (pi == get_curr_proc() || pi->pid == 1)
+      return;
+
+   if (pi->pid != g->id)
+      send_signal(pi->pid, sig, true);
+   else
+      *leader_ref = pi;
+
+   (*count)++;
+}
+
+int send_signal_to_group(int pgid, int sig)
+{
+   struct process *curr_pi = get_curr_proc();
+   struct process *leader = NULL;
+   struct process *pos, *temp;
+   struct pgroup *g;
+   int count = 0;
+
+   disable_preemption();
+
+   if ((g = pgroup_find(pgroups_root, pgid))) {
+
+      list_for_each(pos, temp, &g->members, pgrp_node)
+         signal_member(pos, g, sig, &leader, &count);
+   }
+
+   if (leader)
+      send_signal(leader->pid, sig, true); /* kill the leader last */
+
+   enable_preemption();
+
+   if (curr_pi->pgid == pgid) {
+
+      /* kill the current process, as _very_ last */
+      send_signal(curr_pi->pid, sig, true);
+      count++;
+   }
+
+   return count > 0 ? 0 : -ESRCH;
+}
+
+int send_signal_to_session(int sid, int sig)
+{
+   struct process *curr_pi = get_curr_proc();
+   struct process *leader = NULL;
+   struct process *pos, *temp;
+   struct pgroup *g;
+   int count = 0;
+
+   disable_preemption();
+
+   if ((g = pgroup_find(sessions_root, sid))) {
+
+      list_for_each(pos, temp, &g->members, session_node)
+         signal_member(pos, g, sig, &leader, &count);
+   }
+
+   if (leader)
+      send_signal(leader->pid, sig, true); /* kill the leader last */
+
+   enable_preemption();
+
+   /* kill the current process, as _very_ last */
+   if (curr_pi->sid == sid) {
+      send_signal(curr_pi->pid, sig, true);
+      count++;
+   }
+
+   return count > 0 ? 0 : -ESRCH;
+}
@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/utils.h>
+
+#include <tilck/kernel/sched.h>
+#include <tilck/kernel/hal.h>
+
+/*
+ * PID/TID allocator
+ * -------------------
+ *
+ * PIDs (and user TIDs, which share the same space) are reference-counted: a
+ * live task holds a reference on its TID and each process group and session
+ * holds one on its ID (see pgroups.c). That way, the ID of a dead group or
+ * session leader is not reused while the group or the session still exist, so
+ * a new process can never accidentally become their leader.
+ *
+ * A bitmap mirrors the non-zero ref-counts, so that free IDs can be found by
+ * skipping NBITS IDs at a time. As in the classic UNIX behavior, the IDs are
+ * allocated in increasing order, starting from the one after the last
+ * allocated (the `hint`), wrapping around when MAX_PID is reached: that makes
+ * the allocation O(1) amortized.
+ *
+ * Kernel TIDs use just a bitmap, as they cannot be pgid/sid values.
+ *
+ * All the functions here must be called with preemption disabled.
+ */
+
+#define BITMAP_WORDS(n)          (((n) + NBITS - 1) / NBITS)
+
+static u16 pid_refs[MAX_PID + 1];
+static ulong pid_bitmap[BITMAP_WORDS(MAX_PID + 1)];
+static int pid_hint;
+
+static ulong ktid_bitmap[BITMAP_WORDS(KERNEL_MAX_TID + 1)];
+static int ktid_hint;
+
+static ALWAYS_INLINE bool bitmap_test(ulong *bitmap, int id)
+{
+   return !!(bitmap[id / NBITS] & (1UL << (id % NBITS)));
+}
+
+static ALWAYS_INLINE void bitmap_set(ulong *bitmap, int id)
+{
+   bitmap[id / NBITS] |= (1UL << (id % NBITS));
+}
+
+static ALWAYS_INLINE void bitmap_clear(ulong *bitmap, int id)
+{
+   bitmap[id / NBITS] &= ~(1UL << (id % NBITS));
+}
+
+/* Find the first zero bit in [start, max_id], or return -1 */
+static int
+bitmap_find_zero(ulong *bitmap, int start, int max_id)
+{
+   int w = start / NBITS;
+   ulong word = bitmap[w] | ((1UL << (start % NBITS)) - 1); /* skip < start */
+   int id;
+
+   while (true) {
+
+      if (word != ~0UL) {
+         id = w * NBITS + (int)get_first_set_bit_index_l(~word);
+         return id <= max_id ? id : -1;
+      }
+
+      if (++w == BITMAP_WORDS(max_id + 1))
+         return -1;
+
+      word = bitmap[w];
+   }
+}
+
+static int
+bitmap_alloc_id(ulong *bitmap, int *hint, int max_id)
+{
+   int id = bitmap_find_zero(bitmap, *hint, max_id);
+
+   if (id < 0 && *hint > 0)
+      id = bitmap_find_zero(bitmap, 0, max_id);
+
+   if (id < 0)
+      return -1;
+
+   bitmap_set(bitmap, id);
+   *hint = id < max_id ? id + 1 : 0;
+   return id;
+}
+
+/*
+ * Allocate a new PID (or user TID). The caller owns the first reference to it,
+ * which has to be dropped with release_pid().
+ */
+int create_new_pid(void)
+{
+   int pid;
+   ASSERT(!is_preemption_enabled());
+
+   if ((pid = bitmap_alloc_id(pid_bitmap, &pid_hint, MAX_PID)) < 0)
+      return -1;
+
+   ASSERT(pid_refs[pid] == 0);
+   pid_refs[pid] = 1;
+   return pid;
+}
+
+/* Prevent `pid` from being reused: it's the pgid or the sid of a process */
+void retain_pid(int pid)
+{
+   ASSERT(!is_preemption_enabled());
+
+   if (pid < 0 || pid > MAX_PID)
+      return; /* Nothing to reserve: cannot be allocated anyway */
+
+   if (!pid_refs[pid]++)
+      bitmap_set(pid_bitmap, pid);
+
+   ASSERT(pid_refs[pid] != 0);
+}
+
+void release_pid(int pid)
+{
+   ASSERT(!is_preemption_enabled());
+
+   if (pid < 0 || pid > MAX_PID)
+      return;
+
+   ASSERT(pid_refs[pid] > 0);
+
+   if (!--pid_refs[pid])
+      bitmap_clear(pid_bitmap, pid);
+}
+
+int create_new_kernel_tid(void)
+{
+   int tid;
+   ASSERT(!is_preemption_enabled());
+
+   if ((tid = bitmap_alloc_id(ktid_bitmap, &ktid_hint, KERNEL_MAX_TID)) < 0)
+      return -1;
+
+   return tid + KERNEL_TID_START;
+}
+
+void release_kernel_tid(int tid)
+{
+   ASSERT(!is_preemption_enabled());
+
+   tid -= KERNEL_TID_START;
+   ASSERT(0 <= tid && tid <= KERNEL_MAX_TID);
+   ASSERT(bitmap_test(ktid_bitmap, tid));
+   bitmap_clear(ktid_bitmap, tid);
+}
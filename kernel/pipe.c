@@ -4,6 +4,7 @@
 #include <tilck/common/atomics.h>
 
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/paging.h>
 #include <tilck/kernel/fs/vfs.h>
 #include <tilck/kernel/errno.h>
 #include <tilck/kernel/pipe.h>
@@ -11,6 +12,7 @@
 #include <tilck/kernel/ringbuf.h>
 #include <tilck/kernel/sync.h>
 #include <tilck/kernel/sched.h>
+#include <tilck/kernel/fault_resumable.h>
 
 struct pipe {
 
@@ -27,6 +29,60 @@ struct pipe {
    ATOMIC(int) write_handles;
 };
 
+static size_t
+pipe_rb_io(struct ringbuf *rb, u8 *buf, size_t size, bool wr)
+{
+   return wr ? ringbuf_write_bytes(rb, buf, size)
+             : ringbuf_read_bytes(rb, buf, size);
+}
+
+/*
+ * Copy between the ringbuf and an user buffer one page at a time, updating
+ * `*res` after each chunk. Each chunk either faults on its first access or
+ * is copied entirely, and the ringbuf's state is updated only after a copy
+ * completes. Therefore, on a fault, `*res` holds exactly the bytes moved.
+ */
+static void
+pipe_rb_io_user(struct ringbuf *rb, u8 *buf, size_t size, bool wr, size_t *res)
+{
+   size_t chunk, done;
+
+   while (*res < size) {
+
+      chunk = PAGE_SIZE - ((ulong)(buf + *res) & OFFSET_IN_PAGE_MASK);
+      chunk = MIN(chunk, size - *res);
+      done = pipe_rb_io(rb, buf + *res, chunk, wr);
+      *res += done;
+
+      if (done < chunk)
+         break; /* The ringbuf is full (write) or empty (read) */
+   }
+}
+
+/*
+ * The pipe handles have VFS_SPFL_USER_BUF: when `buf` is an user buffer, the
+ * ringbuf copy must be fault-resumable. Like Linux, a fault after some bytes
+ * have been moved returns just their count: -EFAULT is returned only when
+ * nothing could be moved.
+ */
+static ssize_t
+pipe_rb_io_safe(struct ringbuf *rb, char *buf, size_t size, bool wr)
+{
+   size_t res = 0;
+
+   if (!get_curr_task()->io_user_buf)
+      return (ssize_t)pipe_rb_io(rb, (u8 *)buf, size, wr);
+
+   if (fault_resumable_call(PAGE_FAULT_MASK, &pipe_rb_io_user, 5,
+                            rb, buf, size, wr, &res))
+   {
+      if (!res)
+         return -EFAULT;
+   }
+
+   return (ssize_t)res;
+}
+
 static ssize_t pipe_read(fs_handle h, char *buf, size_t size, offt *pos)
 {
    struct kfs_handle *kh = h;
@@ -42,10 +98,10 @@ static ssize_t pipe_read(fs_handle h, char *buf, size_t size, offt *pos)
 
    while (true) {
 
-      rc = (ssize_t)ringbuf_read_bytes(&p->rb, (u8 *)buf, size);
+      rc = pipe_rb_io_safe(&p->rb, buf, size, false);
 
       if (rc)
-         break; /* Everything is alright, we read something */
+         break; /* We read something or got a fault */
 
       if (atomic_load_explicit(&p->write_handles, mo_relaxed) == 0) {
          /* No more writers, always return 0, no matter what. */
@@ -114,10 +170,10 @@ static ssize_t pipe_write(fs_handle h, char *buf, size_t size, offt *pos)
          break;
       }
 
-      rc = (ssize_t)ringbuf_write_bytes(&p->rb, (u8 *)buf, size);
+      rc = pipe_rb_io_safe(&p->rb, buf, size, true);
 
       if (rc)
-         break; /* Everything is alright, we wrote something */
+         break; /* We wrote something or got a fault */
 
       if (kh->fl_flags & O_NONBLOCK) {
          rc = -EAGAIN;
@@ -306,24 +362,28 @@ struct pipe *create_pipe(void)
 
 fs_handle pipe_create_read_handle(struct pipe *p)
 {
-   fs_handle res = NULL;
+   struct kfs_handle *res = NULL;
 
    res = kfs_create_new_handle(&static_ops_pipe_read_end, (void *)p, O_RDONLY);
 
-   if (res != NULL)
+   if (res != NULL) {
+      res->spec_flags = VFS_SPFL_USER_BUF;
       atomic_fetch_add_explicit(&p->read_handles, 1, mo_relaxed);
+   }
 
    return res;
 }
 
 fs_handle pipe_create_write_handle(struct pipe *p)
 {
-   fs_handle res = NULL;
+   struct kfs_handle *res = NULL;
 
    res = kfs_create_new_handle(&static_ops_pipe_write_end, (void*)p, O_WRONLY);
 
-   if (res != NULL)
+   if (res != NULL) {
+      res->spec_flags = VFS_SPFL_USER_BUF;
       atomic_fetch_add_explicit(&p->write_handles, 1, mo_relaxed);
+   }
 
    return res;
 }
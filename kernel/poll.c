@@ -9,6 +9,7 @@
 #include <tilck/kernel/paging.h>
 #include <tilck/kernel/fs/vfs.h>
 #include <tilck/kernel/timer.h>
+#include <tilck/kernel/datetime.h>
 
 static int
 poll_count_conds(struct pollfd *fds, nfds_t nfds)
@@ -173,10 +174,8 @@ poll_wait_on_cond(struct pollfd *fds, nfds_t nfds, int timeout, int cond_cnt)
       return ready_fds_cnt;
    }
 
-   if (timeout > 0) {
-      u32 ticks = MAX((u32)timeout / (1000 / TIMER_HZ), 1u);
-      task_set_wakeup_timer(curr, ticks);
-   }
+   if (timeout > 0)
+      task_set_wakeup_timer_ns(curr, (u64)timeout * MILLION);
 
    while (true) {
 
@@ -265,7 +264,7 @@ int sys_poll(struct pollfd *user_fds, nfds_t nfds, int timeout)
    } else {
 
       if (timeout > 0) {
-         kernel_sleep((u64)timeout / (1000 / TIMER_HZ));
+         kernel_sleep_ns((u64)timeout * MILLION);
 
          if (pending_signals())
             return -EINTR;
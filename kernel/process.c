@@ -11,6 +11,7 @@
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/list.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/kmem_cache.h>
 #include <tilck/kernel/errno.h>
 #include <tilck/kernel/user.h>
 #include <tilck/kernel/debug_utils.h>
@@ -24,6 +25,15 @@ STATIC_ASSERT(IS_PAGE_ALIGNED(ARGS_COPYBUF_SIZE));
 
 #define ISOLATED_STACK_HI_VMEM_SPACE   (KERNEL_STACK_SIZE + (2 * PAGE_SIZE))
 
+/* A process' main task and its process struct are allocated together */
+DEF_KMEM_CACHE(proc_cache,
+               "process",
+               TOT_PROC_AND_TASK_SIZE,
+               MAX(alignof(struct task), alignof(struct process)),
+               NULL);
+
+DEF_KMEM_CACHE_FOR_TYPE(thread_cache, "thread", struct task);
+
 static void *alloc_kernel_isolated_stack(struct process *pi)
 {
    void *vaddr_in_block;
@@ -135,19 +145,13 @@ void process_free_mappings_info(struct process *pi)
    struct mappings_info *mi = pi->mi;
 
    if (mi && !pi->vforked) {
-      ASSERT(mi->mmap_heap);
-      kmalloc_destroy_heap(mi->mmap_heap);
-      kfree2(mi->mmap_heap, kmalloc_get_heap_struct_size());
-      kfree_obj(mi, struct mappings_info);
+      destroy_mappings_info(mi);
       pi->mi = NULL;
    }
 }
 
 void free_common_task_allocs(struct task *ti)
 {
-   struct process *pi = ti->pi;
-   process_free_mappings_info(pi);
-
    free_kernel_stack(ti);
    kfree2(ti->io_copybuf, IO_COPYBUF_SIZE + ARGS_COPYBUF_SIZE);
 
@@ -170,7 +174,16 @@ void free_mem_for_zombie_task(struct task *ti)
 
    free_common_task_allocs(ti);
 
-   if (ti->pi->automatic_reaping) {
+   if (is_kernel_thread(ti))
+      return; /* kthread_exit() will remove the task */
+
+   if (!is_main_thread(ti)) {
+
+      /* Threads cannot be waited with waitpid(): nobody else will reap them */
+      remove_task(ti);
+
+   } else if (ti->pi->automatic_reaping && list_is_empty(&ti->pi->threads)) {
+
       /* The SIGCHLD signal has been EXPLICITLY ignored by the parent */
       remove_task(ti);
    }
@@ -179,18 +192,26 @@ void free_mem_for_zombie_task(struct task *ti)
 void init_task_lists(struct task *ti)
 {
    bintree_node_init(&ti->tree_by_tid_node);
-   list_node_init(&ti->runnable_node);
-   list_node_init(&ti->wakeup_timer_node);
+   bintree_node_init(&ti->runnable_node);
+   task_init_wakeup_timer(ti);
    list_node_init(&ti->siblings_node);
+   list_node_init(&ti->thread_node);
 
    list_init(&ti->tasks_waiting_list);
    list_init(&ti->on_exit);
    bzero(&ti->wobj, sizeof(struct wait_obj));
+   ti->blocked_on = NULL;
+   ti->held_kmutexes = NULL;
 }
 
 void init_process_lists(struct process *pi)
 {
    list_init(&pi->children);
+   list_init(&pi->threads);
+   list_node_init(&pi->pgrp_node);
+   list_node_init(&pi->session_node);
+   pi->pgrp = NULL;
+   pi->session = NULL;
    kmutex_init(&pi->fslock, KMUTEX_FL_RECURSIVE);
 }
 
@@ -202,7 +223,7 @@ allocate_new_process(struct task *parent, int pid, pdir_t *new_pdir)
    bool common_allocs = false;
    bool arch_fields = false;
 
-   if (UNLIKELY(!(ti = kmalloc(TOT_PROC_AND_TASK_SIZE))))
+   if (UNLIKELY(!(ti = kmem_cache_alloc(&proc_cache))))
       goto oom_case;
 
    pi = (struct process *)(ti + 1);
@@ -233,6 +254,8 @@ allocate_new_process(struct task *parent, int pid, pdir_t *new_pdir)
    pi->automatic_reaping = false;
    pi->cwd.fs = NULL;
    pi->vforked = false;
+   pi->exiting = false;
+   pi->exit_status = 0;
 
    if (new_pdir != parent_pi->pdir) {
 
@@ -248,11 +271,12 @@ allocate_new_process(struct task *parent, int pid, pdir_t *new_pdir)
       pi->vforked = true;
    }
 
-   pi->inherited_mmap_heap = !!pi->mi;
+   pi->inherited_mappings_info = !!pi->mi;
    ti->pi = pi;
    ti->tid = pid;
    ti->is_main_thread = true;
    ti->timer_ready = false;
+   ti->clear_child_tid = NULL;
 
    /*
     * From fork(2):
@@ -267,6 +291,9 @@ allocate_new_process(struct task *parent, int pid, pdir_t *new_pdir)
    /* Reset sched ticks in the new process */
    bzero(&ti->ticks, sizeof(ti->ticks));
 
+   /* Drop the priority the parent might inherit through its kmutexes */
+   ti->rt_prio = ti->base_rt_prio;
+
    /* Copy parent's `cwd` while retaining the `fs` and the inode obj */
    process_set_cwd2_nolock_raw(pi, &parent_pi->cwd);
 
@@ -280,6 +307,7 @@ allocate_new_process(struct task *parent, int pid, pdir_t *new_pdir)
    init_task_lists(ti);
    init_process_lists(pi);
    list_add_tail(&parent_pi->children, &ti->siblings_node);
+   list_add_tail(&pi->threads, &ti->thread_node);
 
    pi->proc_tty = parent_pi->proc_tty;
    return ti;
@@ -304,7 +332,7 @@ oom_case:
       if (MOD_debugpanel && pi->debug_cmdline)
          kfree2(pi->debug_cmdline, PROCESS_CMDLINE_BUF_SIZE);
 
-      kfree2(ti, TOT_PROC_AND_TASK_SIZE);
+      kmem_cache_free(&proc_cache, ti);
    }
 
    return NULL;
@@ -313,47 +341,68 @@ oom_case:
 struct task *allocate_new_thread(struct process *pi, int tid, bool alloc_bufs)
 {
    ASSERT(pi != NULL);
-   struct task *process_task = get_process_task(pi);
-   struct task *ti = kzalloc_obj(struct task);
+   struct task *parent = get_process_task(pi);
+   struct task *ti = kmem_cache_zalloc(&thread_cache);
 
    if (!ti || !(ti->pi = pi) || !do_common_task_allocs(ti, alloc_bufs)) {
 
       if (ti) /* do_common_task_allocs() failed */
          free_common_task_allocs(ti);
 
-      kfree_obj(ti, struct task);
+      kmem_cache_free(&thread_cache, ti);
       return NULL;
    }
 
    ti->tid = tid;
    ti->is_main_thread = false;
-
    init_task_lists(ti);
-   arch_specific_new_task_setup(ti, process_task);
+
+   if (!is_kernel_thread(ti)) {
+
+      /* User threads are created by clone(), called by a thread of `pi` */
+      parent = get_curr_task();
+      ASSERT(parent->pi == pi);
+   }
+
+   if (!arch_specific_new_task_setup(ti, parent)) {
+      free_common_task_allocs(ti);
+      kmem_cache_free(&thread_cache, ti);
+      return NULL;
+   }
+
+   /* User threads keep their process alive, see free_task() */
+   if (!is_kernel_thread(ti))
+      retain_obj(pi);
+
    return ti;
 }
 
+/*
+ * Drop a reference to `pi`: one is held by its main thread and one by each of
+ * its other user threads. The main thread's struct task is allocated together
+ * with `pi`: it's freed only when the last reference is dropped.
+ */
 static void free_process_int(struct process *pi)
 {
    ASSERT(get_ref_count(pi) > 0);
 
-   if (LIKELY(pi->cwd.fs != NULL)) {
+   if (release_obj(pi) == 0) {
 
-      /*
-       * When we change the current directory or when we fork a process, we
-       * set a new value for the struct vfs_path pi->cwd which has its inode
-       * retained as well as its owning fs. Here we have to release those
-       * ref-counts.
-       */
-
-      vfs_release_inode_at(&pi->cwd);
-      release_obj(pi->cwd.fs);
-   }
+      if (LIKELY(pi->cwd.fs != NULL)) {
 
-   if (release_obj(pi) == 0) {
+         /*
+          * When we change the current directory or when we fork a process, we
+          * set a new value for the struct vfs_path pi->cwd which has its inode
+          * retained as well as its owning fs. Here we have to release those
+          * ref-counts.
+          */
+
+         vfs_release_inode_at(&pi->cwd);
+         release_obj(pi->cwd.fs);
+      }
 
       arch_specific_free_proc(pi);
-      kfree2(get_process_task(pi), TOT_PROC_AND_TASK_SIZE);
+      kmem_cache_free(&proc_cache, get_process_task(pi));
 
       if (MOD_debugpanel)
          kfree2(pi->debug_cmdline, PROCESS_CMDLINE_BUF_SIZE);
@@ -362,6 +411,8 @@ static void free_process_int(struct process *pi)
 
 void free_task(struct task *ti)
 {
+   struct process *pi = ti->pi;
+
    ASSERT_TASK_STATE(ti->state, TASK_STATE_ZOMBIE);
    arch_specific_free_task(ti);
 
@@ -371,10 +422,18 @@ void free_task(struct task *ti)
 
    list_remove(&ti->siblings_node);
 
-   if (is_main_thread(ti))
-      free_process_int(ti->pi);
-   else
-      kfree_obj(ti, struct task);
+   if (is_main_thread(ti)) {
+
+      free_process_int(pi);
+
+   } else {
+
+      const bool kthread = is_kernel_thread(ti);
+      kmem_cache_free(&thread_cache, ti);
+
+      if (!kthread)
+         free_process_int(pi);
+   }
 }
 
 void *task_temp_kernel_alloc(size_t size)
@@ -559,10 +618,11 @@ int sys_setsid(void)
    disable_preemption();
 
    if (!sched_count_proc_in_group(pi->pid)) {
-      pi->pgid = pi->pid;
-      pi->sid = pi->pid;
-      pi->proc_tty = NULL;
-      rc = pi->sid;
+
+      if (!(rc = process_set_groups(pi, pi->pid, pi->pid))) {
+         pi->proc_tty = NULL;
+         rc = pi->sid;
+      }
    }
 
    enable_preemption();
@@ -625,15 +685,15 @@ int sys_setpgid(int pid, int pgid)
          goto out;
       }
 
-      /* Set process' pgid to `pgid` */
-      pi->pgid = pgid;
-
    } else {
 
       /* pgid is 0: make the process a group leader */
-      pi->pgid = pi->pid;
+      pgid = pi->pid;
    }
 
+   /* Set process' pgid to `pgid` */
+   rc = process_set_groups(pi, pgid, pi->sid);
+
 out:
    enable_preemption();
    return rc;
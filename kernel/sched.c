@@ -6,29 +6,48 @@
 #include <tilck/kernel/process_int.h>
 #include <tilck/kernel/list.h>
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/pageframes.h>
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/worker_thread.h>
 #include <tilck/kernel/timer.h>
 #include <tilck/kernel/errno.h>
+#include <tilck/kernel/spinlock.h>
 
 /* Shared global variables */
+#if !SMP_ENABLED
 struct task *__current;
 ATOMIC(int) __disable_preempt = 1;        /* see docs/atomics.md */
 ATOMIC(int) __need_resched;               /* see docs/atomics.md */
+#endif
 
 struct task *kernel_process;
 struct process *kernel_process_pi;
 
-/* Task lists */
-struct list runnable_tasks_list;
+/*
+ * Each CPU has its own runqueue, with the runnable tasks it will pick in
+ * do_schedule() and its idle task. A task stays in the runqueue of the CPU it
+ * ran last (`ti->cpu`), unless another CPU with nothing to do steals it: see
+ * sched_steal_task(). Without SMP, there's just one runqueue.
+ *
+ * The runqueues are protected by their spinlock, because tasks are woken up
+ * also with the interrupts disabled, but not necessarily with the preemption
+ * disabled. To lock the runqueue of a task, use task_rq_lock().
+ */
+struct runqueue {
+
+   struct spinlock lock;
+   struct task *root;                     /* tree of the runnable tasks */
+   struct task *leftmost;                 /* the first task in the tree */
+   ATOMIC(int) nr;                        /* number of tasks in the tree */
+   struct task *idle;                     /* the idle task of the CPU */
+   u64 idle_ticks;
+};
 
 /* Static variables */
 static struct task *tree_by_tid_root;
-static u64 idle_ticks;
-static volatile int runnable_tasks_count;
-static int current_max_pid = -1;
-static int current_max_kernel_tid = -1;
-struct task *idle_task;
+static struct runqueue runqueues[MAX_CPUS];
+static ATOMIC(u64) rt_seq_counter;
+static ATOMIC(int) runnable_tasks_count;
 
 const char *const task_state_str[5] = {
    [TASK_STATE_INVALID]  = "invalid",
@@ -38,10 +57,113 @@ const char *const task_state_str[5] = {
    [TASK_STATE_ZOMBIE]   = "zombie",
 };
 
+#if SMP_ENABLED
+
+/*
+ * The big kernel lock (BKL)
+ * ---------------------------
+ *
+ * Tilck has been designed for a single CPU, where disabling the preemption is
+ * enough to get exclusive access to almost all of the kernel's data
+ * structures. With SMP, the same guarantee is given by the BKL: a CPU takes it
+ * when its preemption counter goes from 0 to 1 and releases it when the counter
+ * goes back to 0. Therefore, only one CPU at a time can run the kernel code
+ * with the preemption disabled (syscalls, IRQ handlers, the scheduler etc.),
+ * while the user code and the preemptible kernel code run in parallel.
+ *
+ * The interrupts are disabled while the counter and the BKL are updated: an IRQ
+ * handler seeing the counter at 0 while its CPU still holds the BKL (or the
+ * other way around) would spin forever.
+ *
+ * switch_to_task() does not release the BKL with the counter: that happens in
+ * context_switch_unlock_bkl(), after leaving the stack of the previous task.
+ * Until then, no other CPU can resume that task or use the initial kernel stack
+ * (see kthread_exit()). The BSP holds the BKL since the boot, as its counter
+ * starts at 1, like `__disable_preempt` without SMP.
+ *
+ * The data structures used the most often by all the CPUs at the same time
+ * have their own spinlocks instead: the runqueues, the timer wheel and the
+ * hrtimers, the clocksource, the PIC, the GDT and the pageframe allocator. The
+ * preemption must not be disabled while holding any of them (see spinlock.h).
+ */
+static struct spinlock big_kernel_lock = { .locked = true };
+
+void disable_preemption(void)
+{
+   ulong var;
+
+   while (true) {
+
+      disable_interrupts(&var);
+
+      if (this_cpu_read(disable_preempt) || spin_trylock(&big_kernel_lock)) {
+         this_cpu_inc(disable_preempt);
+         enable_interrupts(&var);
+         return;
+      }
+
+      enable_interrupts(&var);
+      spin_wait_unlocked(&big_kernel_lock);
+   }
+}
+
+void enable_preemption_nosched(void)
+{
+   ulong var;
+   disable_interrupts(&var);
+   {
+      ASSERT(this_cpu_read(disable_preempt) > 0);
+      this_cpu_dec(disable_preempt);
+
+      if (!this_cpu_read(disable_preempt))
+         spin_unlock(&big_kernel_lock);
+   }
+   enable_interrupts(&var);
+}
+
+/*
+ * Called by fault_resumable_call() when a fault occurred, to restore the
+ * preemption counter it had before the call.
+ */
+void sched_restore_preempt_count(int count)
+{
+   ulong var;
+   disable_interrupts(&var);
+   {
+      ASSERT(this_cpu_read(disable_preempt) > 0);
+      this_cpu_write(disable_preempt, count);
+
+      if (!count)
+         spin_unlock(&big_kernel_lock);
+   }
+   enable_interrupts(&var);
+}
+
+void force_enable_preemption(void)
+{
+   if (get_preempt_disable_count())
+      sched_restore_preempt_count(0);
+}
+
+/* Called by context_switch_unlock_bkl(), see the comment above */
+void sched_release_bkl(void)
+{
+   ASSERT(!are_interrupts_enabled());
+   ASSERT(is_preemption_enabled());
+   spin_unlock(&big_kernel_lock);
+}
+
+#endif
+
 void enable_preemption(void)
 {
+#if SMP_ENABLED
+   const int oldval = get_preempt_disable_count();
+   enable_preemption_nosched();
+#else
    int oldval =
       atomic_fetch_sub_explicit(&__disable_preempt, 1, mo_relaxed);
+#endif
 
    ASSERT(oldval > 0);
 
@@ -99,56 +221,6 @@ get_traced_tasks_count(void)
    return count;
 }
 
-int sched_count_proc_in_group(int pgid)
-{
-   struct bintree_walk_ctx ctx;
-   struct task *ti;
-   int count = 0;
-
-   disable_preemption();
-   {
-      bintree_in_order_visit_start(&ctx,
-                                   tree_by_tid_root,
-                                   struct task,
-                                   tree_by_tid_node,
-                                   false);
-
-      while ((ti = bintree_in_order_visit_next(&ctx))) {
-
-         if (ti->pi->pgid == pgid)
-            count++;
-      }
-   }
-   enable_preemption();
-   return count;
-}
-
-int sched_get_session_of_group(int pgid)
-{
-   struct bintree_walk_ctx ctx;
-   struct task *ti;
-   int sid = -ESRCH;
-
-   disable_preemption();
-   {
-      bintree_in_order_visit_start(&ctx,
-                                   tree_by_tid_root,
-                                   struct task,
-                                   tree_by_tid_node,
-                                   false);
-
-      while ((ti = bintree_in_order_visit_next(&ctx))) {
-
-         if (ti->pi->pgid == pgid) {
-            sid = ti->pi->sid;
-            break;
-         }
-      }
-   }
-   enable_preemption();
-   return sid;
-}
-
 int get_curr_tid(void)
 {
    struct task *c = get_curr_task();
@@ -161,223 +233,57 @@ int get_curr_pid(void)
    return c ? c->pi->pid : 0;
 }
 
-struct create_pid_visit_ctx {
-
-   bool kernel_tid;
-   bool lowest_avail_invalid;
-   int id_off;
-   int lowest_available;
-   int lowest_after_current_max;
-};
-
-static inline int inc_candicate_if_matches(int *cand, int id, int val)
-{
-   if (*cand != val)
-      return 0; /* Everything is OK */
-
-   /* The lowest_<something> candicate cannot be > id */
-   ASSERT(*cand <= val);
-
-   /*
-    * We've found a case where the candicate is equal to current task's pgid/sid
-    * and that might be a problem.
-    *
-    * Two cases:
-    *
-    *    1) Candidate == id. This means: candidate == pgid/sid == id.
-    *       That's fine: we just hit a group/session leader. By default we'll
-    *       skip this candiate (see the impl. below).
-    *
-    *    2) Candidate < id. This means that the pgid/sid is < id and we didn't
-    *       hit it before (note: we're doing an in-order visit). For example:
-    *
-    *    pid | sid | what
-    *    ----+-----+-----------
-    *     1  |  1  | init
-    *     2  |  1  | ash
-    *     8  |  3  | prog1
-    *
-    *    lowest_available = 3   [our candidate]
-    *
-    *    We don't want this to happen because 3 is the ID of a session, with
-    *    a dead leader. In order to handle this case, we have to increment
-    *    lowest_available and restart the whole iteration. We must end up with
-    *    lowest_available = 4. Actually, if lowest_after_current_max is a good
-    *    value, we're going to use it without restarting the iteration.
-    */
-
-   if (*cand == id)
-      return 0; /* We just hit a group/session leader. That's fine */
-
-   (*cand)++;
-   return 1;
-}
-
-static int create_new_pid_visit_cb(void *obj, void *arg)
-{
-   struct task *ti = obj;
-   struct create_pid_visit_ctx *ctx = arg;
-   const int tid = ti->tid - ctx->id_off;
-
-   if (ctx->kernel_tid) {
-
-      if (!is_kernel_thread(ti))
-         return 0; /* skip non-kernel tasks */
-
-      ASSERT(tid >= 0);
-
-
-   } else {
-
-      if (!is_main_thread(ti))
-         return 0; /* skip threads */
-
-      ASSERT(tid >= 0);
-
-      if (tid < ctx->lowest_available)
-         return 0;
-
-      /*
-       * Both ctx->lowest_available and ctx->lowest_after_current_max are
-       * candidates for the next tid. If one of them gets equal to a sid
-       * without a session leader process or to a pgid without a group leader,
-       * the new process could accidentally become leader of a group/session:
-       * we have to ensure that could never happen.
-       */
-
-      const int pgid = ti->pi->pgid;
-      const int sid = ti->pi->sid;
-      const int should_restart =
-         inc_candicate_if_matches(&ctx->lowest_available, tid, pgid) +
-         inc_candicate_if_matches(&ctx->lowest_available, tid, sid) +
-         inc_candicate_if_matches(&ctx->lowest_after_current_max, tid, pgid) +
-         inc_candicate_if_matches(&ctx->lowest_after_current_max, tid, sid);
-
-      if (should_restart) {
-         ctx->lowest_avail_invalid = true;
-      }
-   }
-
-
-   /*
-    * Algorithm: we start with lowest_available (L) == 0. When we hit
-    * tid == L, that means L is not really the lowest, therefore, we guess
-    * the right value of L is L + 1. The first time tid skips one, for example
-    * jumping from 3 to 5, the value of L set by the iteration with tid == 3,
-    * will stuck. That value will be clearly 4.
-    */
-
-   if (ctx->lowest_available == tid)
-      ctx->lowest_available++;
-
-   /*
-    * For lowest_after_current_max (A) the logic is similar.
-    * We start with A = current_max_pid + 1. The first time A is == tid, will
-    * be when tid is current_max_pid + 1. We continue to update A, until the
-    * first hole is found. In case tid never reaches current_max_pid + 1, `A`
-    * will be just be current_max_pid + 1, as expected.
-    */
-
-   if (ctx->lowest_after_current_max == tid)
-      ctx->lowest_after_current_max++;
-
-   return 0;
-}
-
-static int
-create_id_common(struct create_pid_visit_ctx *ctx, int max_id)
-{
-   int r;
-
-   do {
-
-      ctx->lowest_avail_invalid = false;
-      iterate_over_tasks(&create_new_pid_visit_cb, ctx);
-
-      r = ctx->lowest_after_current_max <= max_id
-            ? ctx->lowest_after_current_max
-            : ctx->lowest_available <= max_id
-               ? ctx->lowest_available
-               : -1;
-
-      /*
-       * Typically, ctx->lowest_avail_invalid is not a problem because the new
-       * id will be ctx->lowest_after_current_max. But, in the case we've
-       * finished the IDs, we have to pick the absolutely lowest ID available,
-       * which might be invalid we it matched with a process' pgid/sid. This
-       * can happen only in case of orphaned sessions/process groups.
-       *
-       * NOTE: in case we're going to repeat the loop, lowest_avail_invalid is
-       * reset, but all the rest of the context is unchanged: that's because
-       * ctx->lowest_available has actually a meaningful value: the lowest ID
-       * after pgid/sid we hit. It doesn't mean we can use this value, but it
-       * means we cannot pick consider IDs smaller than it.
-       */
-
-   } while (r == ctx->lowest_available && ctx->lowest_avail_invalid);
-
-   return r;
-}
-
-int create_new_pid(void)
+int iterate_over_tasks(bintree_visit_cb func, void *arg)
 {
    ASSERT(!is_preemption_enabled());
 
-   struct create_pid_visit_ctx ctx = {
-      .kernel_tid = false,
-      .id_off = 0,
-      .lowest_available = 0,
-      .lowest_after_current_max = current_max_pid + 1,
-   };
-
-   int r = create_id_common(&ctx, MAX_PID);
-
-   if (r >= 0)
-      current_max_pid = r;
-
-   return r;
+   return bintree_in_order_visit(tree_by_tid_root,
+                                 func,
+                                 arg,
+                                 struct task,
+                                 tree_by_tid_node);
 }
 
-int create_new_kernel_tid(void)
-{
-   ASSERT(!is_preemption_enabled());
+static bool sched_any_runnable_task(struct runqueue *rq);
 
-   struct create_pid_visit_ctx ctx = {
-      .kernel_tid = true,
-      .id_off = KERNEL_TID_START,
-      .lowest_available = 0,
-      .lowest_after_current_max = current_max_kernel_tid + 1,
-   };
+static void idle_nohz_halt(struct runqueue *rq)
+{
+   bool any_runnable;
 
-   int r = create_id_common(&ctx, KERNEL_MAX_TID);
+   disable_interrupts_forced();
 
-   if (r >= 0) {
-      current_max_kernel_tid = r;
-      return r + KERNEL_TID_START;
+   spin_lock(&rq->lock);
+   {
+      any_runnable = sched_any_runnable_task(rq);
    }
+   spin_unlock(&rq->lock);
 
-   return -1;
-}
-
-int iterate_over_tasks(bintree_visit_cb func, void *arg)
-{
-   ASSERT(!is_preemption_enabled());
+   if (!need_reschedule() && !any_runnable)
+      timer_nohz_enter();
 
-   return bintree_in_order_visit(tree_by_tid_root,
-                                 func,
-                                 arg,
-                                 struct task,
-                                 tree_by_tid_node);
+   enable_interrupts_and_halt();
+   timer_nohz_exit();
 }
 
 static void idle(void)
 {
+   struct runqueue *rq = &runqueues[get_cpu_id()];
+
    while (true) {
 
       ASSERT(is_preemption_enabled());
 
-      idle_ticks++;
-      halt();
+      rq->idle_ticks++;
+      pf_zpool_refill();
+
+      /*
+       * The tickless mode stops the PIT, which is the BSP's tick: the APs have
+       * a periodic tick from their local APIC timer, always running.
+       */
+      if (KRN_NO_HZ_IDLE && !get_cpu_id())
+         idle_nohz_halt(rq);
+      else
+         halt();
 
       if (need_reschedule() || runnable_tasks_count > 1)
          schedule();
@@ -402,7 +308,6 @@ static void create_kernel_process(void)
    struct task *s_kernel_ti = (struct task *)kernel_proc_buf;
    struct process *s_kernel_pi = (struct process *)(s_kernel_ti + 1);
 
-   list_init(&runnable_tasks_list);
    s_kernel_pi->pid = create_new_pid();
    s_kernel_ti->tid = create_new_kernel_tid();
    s_kernel_pi->ref_count = 1;
@@ -443,20 +348,327 @@ void process_set_tty(struct process *pi, void *t)
    pi->proc_tty = t;
 }
 
-void init_sched(void)
+/*
+ * Nice levels are mapped to weights like in Linux: each level is worth ~10% of
+ * CPU time, because the ratio between the weights of two consecutive levels is
+ * ~1.25, while nice 0 has weight 1024. This table contains 2^32 / weight, see
+ * sched_account_ticks().
+ */
+static const u32 nice_to_wmult[MAX_NICE - MIN_NICE + 1] = {
+   /* -20 */     48388,     59856,     76040,     92818,    118348,
+   /* -15 */    147320,    184698,    229616,    287308,    360437,
+   /* -10 */    449829,    563644,    704093,    875809,   1099582,
+   /*  -5 */   1376151,   1717300,   2157191,   2708050,   3363326,
+   /*   0 */   4194304,   5237765,   6557202,   8165337,  10153587,
+   /*   5 */  12820798,  15790321,  19976592,  24970740,  31350126,
+   /*  10 */  39045157,  49367440,  61356676,  76695844,  95443717,
+   /*  15 */ 119304647, 148102320, 186737708, 238609294, 286331153,
+};
+
+/*
+ * The runnable tasks are kept in an AVL tree ordered by the scheduler's
+ * priority: first the RT tasks (SCHED_FIFO and SCHED_RR), by decreasing
+ * priority and then in FIFO order. After them, the tasks of the fair class:
+ * first the ones just woken up by their timer, then the ones with the lowest
+ * vruntime. The tid makes the keys unique. The leftmost node is cached, so that
+ * picking the next task is O(1) in the common case.
+ *
+ * Because the key is part of the tree's invariant, `rt_prio`, `rt_seq`,
+ * `vruntime` and `timer_ready` must never change while a task is in the tree:
+ * see sched_account_ticks(), task_set_timer_ready(), task_set_rt_prio() and
+ * task_requeue().
+ */
+static long runnable_task_cmp(const void *a, const void *b)
+{
+   const struct task *t1 = a;
+   const struct task *t2 = b;
+
+   if (t1->rt_prio != t2->rt_prio)
+      return t1->rt_prio > t2->rt_prio ? -1 : 1;
+
+   if (t1->rt_prio) {
+
+      if (t1->ticks.rt_seq != t2->ticks.rt_seq)
+         return t1->ticks.rt_seq < t2->ticks.rt_seq ? -1 : 1;
+
+      return t1->tid - t2->tid;
+   }
+
+   if (t1->timer_ready != t2->timer_ready)
+      return t1->timer_ready ? -1 : 1;
+
+   if (t1->ticks.vruntime != t2->ticks.vruntime)
+      return t1->ticks.vruntime < t2->ticks.vruntime ? -1 : 1;
+
+   return t1->tid - t2->tid;
+}
+
+static ALWAYS_INLINE bool is_idle_task(struct task *ti)
+{
+   return ti == runqueues[ti->cpu].idle;
+}
+
+static inline bool is_in_runnable_tree(struct task *ti)
+{
+   return atomic_load_explicit(&ti->state, mo_relaxed) == TASK_STATE_RUNNABLE &&
+          !is_worker_thread(ti) &&
+          !is_idle_task(ti);
+}
+
+/*
+ * Lock the runqueue of `ti`, with the interrupts disabled. The loop handles
+ * the case where another CPU moves the task to its runqueue meanwhile.
+ */
+static struct runqueue *task_rq_lock(struct task *ti, ulong *var)
+{
+   struct runqueue *rq;
+
+   while (true) {
+
+      rq = &runqueues[ti->cpu];
+      spin_lock_irqsave(&rq->lock, var);
+
+      if (rq == &runqueues[ti->cpu])
+         return rq;
+
+      spin_unlock_irqrestore(&rq->lock, var);
+   }
+}
+
+static ALWAYS_INLINE void task_rq_unlock(struct runqueue *rq, ulong *var)
+{
+   spin_unlock_irqrestore(&rq->lock, var);
+}
+
+static ALWAYS_INLINE u64 next_rt_seq(void)
+{
+   return atomic_fetch_add_explicit(&rt_seq_counter, 1, mo_relaxed) + 1;
+}
+
+static void runnable_tree_add(struct runqueue *rq, struct task *ti)
+{
+   DEBUG_CHECKED_SUCCESS(
+      bintree_insert(&rq->root,
+                     ti,
+                     runnable_task_cmp,
+                     struct task,
+                     runnable_node)
+   );
+
+   if (!rq->leftmost || runnable_task_cmp(ti, rq->leftmost) < 0)
+      rq->leftmost = ti;
+
+   atomic_fetch_add_explicit(&rq->nr, 1, mo_relaxed);
+}
+
+static void runnable_tree_remove(struct runqueue *rq, struct task *ti)
+{
+   DEBUG_CHECKED_SUCCESS(
+      bintree_remove(&rq->root,
+                     ti,
+                     runnable_task_cmp,
+                     struct task,
+                     runnable_node)
+   );
+
+   if (ti == rq->leftmost) {
+      rq->leftmost = bintree_get_first_obj(rq->root,
+                                           struct task,
+                                           runnable_node);
+   }
+
+   atomic_fetch_sub_explicit(&rq->nr, 1, mo_relaxed);
+}
+
+/* Make `cpu` run the scheduler as soon as possible */
+static void sched_resched_cpu(u32 cpu)
+{
+   if (cpu == get_cpu_id()) {
+      sched_set_need_resched();
+      return;
+   }
+
+#if SMP_ENABLED
+   atomic_store_explicit(&get_cpu(cpu)->need_resched, 1, mo_relaxed);
+   smp_send_resched(cpu);
+#endif
+}
+
+#if SMP_ENABLED
+
+/*
+ * A task became runnable on a busy CPU: if there's an idle CPU, wake it up, so
+ * that it can steal the task (see sched_steal_task()).
+ */
+static void sched_kick_idle_cpu(void)
+{
+   for (u32 i = 0; i < MAX_CPUS; i++) {
+
+      struct cpu *c = get_cpu(i);
+
+      if (i != get_cpu_id() && is_cpu_online(c))
+         if (c->current == runqueues[i].idle) {
+            sched_resched_cpu(i);
+            return;
+         }
+   }
+}
+
+#endif
+
+/*
+ * Called when `ti`, in the runqueue of its CPU, has just become runnable or got
+ * a higher priority: RT tasks preempt the lower priority ones immediately. With
+ * SMP, `ti` preempts also the idle task of its CPU or, at least, wakes up an
+ * idle CPU.
+ */
+static void sched_check_preempt(struct task *ti)
+{
+#if SMP_ENABLED
+   struct task *curr = get_cpu(ti->cpu)->current;
+
+   if (ti->rt_prio > curr->rt_prio || is_idle_task(curr))
+      sched_resched_cpu(ti->cpu);
+   else
+      sched_kick_idle_cpu();
+#else
+   if (ti->rt_prio > get_curr_task()->rt_prio)
+      sched_set_need_resched();
+#endif
+}
+
+void task_set_timer_ready(struct task *ti, bool value)
+{
+   struct runqueue *rq;
+   ulong var;
+
+   rq = task_rq_lock(ti, &var);
+   {
+      if (is_in_runnable_tree(ti)) {
+         runnable_tree_remove(rq, ti);
+         ti->timer_ready = value;
+         runnable_tree_add(rq, ti);
+      } else {
+         ti->timer_ready = value;
+      }
+   }
+   task_rq_unlock(rq, &var);
+}
+
+/*
+ * Set the effective RT priority of `ti`, the one used by the scheduler. It
+ * differs from `base_rt_prio` only while `ti` inherits the priority of the
+ * tasks waiting for its kmutexes: see kmutex_pi_update().
+ */
+void task_set_rt_prio(struct task *ti, int rt_prio)
+{
+   struct runqueue *rq;
+   ulong var;
+   ASSERT(0 <= rt_prio && rt_prio <= MAX_RT_PRIO);
+
+   rq = task_rq_lock(ti, &var);
+   {
+      const bool in_tree = is_in_runnable_tree(ti);
+
+      if (in_tree)
+         runnable_tree_remove(rq, ti);
+
+      ti->rt_prio = (u8)rt_prio;
+
+      if (in_tree)
+         runnable_tree_add(rq, ti);
+
+      /* Let the scheduler re-evaluate which task should run now */
+      if (is_task_on_cpu(ti))
+         sched_resched_cpu(ti->cpu);
+      else if (in_tree)
+         sched_check_preempt(ti);
+   }
+   task_rq_unlock(rq, &var);
+}
+
+void task_set_sched_policy(struct task *ti, int policy, int rt_prio)
+{
+   ASSERT(!is_preemption_enabled());
+   ASSERT(0 <= rt_prio && rt_prio <= MAX_RT_PRIO);
+   ASSERT(!rt_prio == (policy != SCHED_FIFO && policy != SCHED_RR));
+
+   ti->sched_policy = (u8)policy;
+   ti->base_rt_prio = (u8)rt_prio;
+
+   /* Keep the inherited priority, if any, and propagate the change */
+   kmutex_pi_update(ti);
+
+   if (ti == get_curr_task())
+      sched_set_need_resched();
+}
+
+/*
+ * Put `ti` after all the other runnable RT tasks with its same priority, as
+ * sched_yield() and the expiration of a SCHED_RR time slice require. It has no
+ * effect on the tasks of the fair class.
+ */
+void task_requeue(struct task *ti)
+{
+   struct runqueue *rq;
+   ulong var;
+
+   rq = task_rq_lock(ti, &var);
+   {
+      if (is_in_runnable_tree(ti)) {
+         runnable_tree_remove(rq, ti);
+         ti->ticks.rt_seq = next_rt_seq();
+         runnable_tree_add(rq, ti);
+      } else {
+         ti->ticks.rt_seq = next_rt_seq();
+      }
+   }
+   task_rq_unlock(rq, &var);
+}
+
+/*
+ * Create the idle task of `cpu`: init_sched() does that for the BSP, the SMP
+ * code for the APs, before starting them.
+ */
+struct task *sched_create_idle_task(u32 cpu)
 {
+   struct runqueue *rq = &runqueues[cpu];
+   struct task *ti;
+   ulong var;
    int tid;
 
+   ASSERT(!is_preemption_enabled());
+
+   if ((tid = kthread_create(&idle, 0, NULL)) < 0)
+      return NULL;
+
+   /*
+    * The idle task is never picked from the runnable tree: take it out from
+    * there, now that we know which task it is.
+    */
+   ti = get_task(tid);
+   rq = task_rq_lock(ti, &var);
+   {
+      if (is_in_runnable_tree(ti))
+         runnable_tree_remove(rq, ti);
+   }
+   task_rq_unlock(rq, &var);
+
+   /* No need for locks: the idle task cannot be picked by any CPU until now */
+   ti->cpu = (u8)cpu;
+   runqueues[cpu].idle = ti;
+   return ti;
+}
+
+void init_sched(void)
+{
    ASSERT(kernel_process_pi->pid == 0);
    ASSERT(kernel_process_pi->parent_pid == 0);
 
    kernel_process->pi->pdir = get_kernel_pdir();
-   tid = kthread_create(&idle, 0, NULL);
 
-   if (tid < 0)
+   if (!sched_create_idle_task(0))
       panic("Unable to create the idle_task!");
-
-   idle_task = get_task(tid);
 }
 
 void set_current_task_in_kernel(void)
@@ -465,7 +677,7 @@ void set_current_task_in_kernel(void)
    get_curr_task()->running_in_kernel = true;
 }
 
-static void task_add_to_state_list(struct task *ti)
+static void task_add_to_state_list(struct runqueue *rq, struct task *ti)
 {
    if (is_worker_thread(ti))
       return;
@@ -473,7 +685,21 @@ static void task_add_to_state_list(struct task *ti)
    switch (atomic_load_explicit(&ti->state, mo_relaxed)) {
 
       case TASK_STATE_RUNNABLE:
-         list_add_tail(&runnable_tasks_list, &ti->runnable_node);
+
+         if (!is_idle_task(ti)) {
+
+            /*
+             * A task becoming runnable goes at the end of the queue of its
+             * priority, unless it's the current task being preempted: that
+             * one keeps its place, as POSIX requires for SCHED_FIFO.
+             */
+            if (!is_task_on_cpu(ti))
+               ti->ticks.rt_seq = next_rt_seq();
+
+            runnable_tree_add(rq, ti);
+            sched_check_preempt(ti);
+         }
+
          runnable_tasks_count++;
          break;
 
@@ -482,7 +708,7 @@ static void task_add_to_state_list(struct task *ti)
          break;
 
       case TASK_STATE_RUNNING:
-         /* no dedicated list: without SMP there's only one 'running' task */
+         /* no dedicated list: see get_cpu(ti->cpu)->current */
          break;
 
       case TASK_STATE_ZOMBIE:
@@ -494,7 +720,7 @@ static void task_add_to_state_list(struct task *ti)
    }
 }
 
-static void task_remove_from_state_list(struct task *ti)
+static void task_remove_from_state_list(struct runqueue *rq, struct task *ti)
 {
    if (is_worker_thread(ti))
       return;
@@ -502,7 +728,10 @@ static void task_remove_from_state_list(struct task *ti)
    switch (atomic_load_explicit(&ti->state, mo_relaxed)) {
 
       case TASK_STATE_RUNNABLE:
-         list_remove(&ti->runnable_node);
+
+         if (!is_idle_task(ti))
+            runnable_tree_remove(rq, ti);
+
          runnable_tasks_count--;
          ASSERT(runnable_tasks_count >= 0);
          break;
@@ -524,38 +753,55 @@ static void task_remove_from_state_list(struct task *ti)
    }
 }
 
-void task_change_state(struct task *ti, enum task_state new_state)
+static void
+task_change_state_locked(struct runqueue *rq,
+                         struct task *ti,
+                         enum task_state new_state)
 {
-   ulong var;
    ASSERT(ti->state != new_state);
    ASSERT(ti->state != TASK_STATE_ZOMBIE);
 
-   disable_interrupts(&var);
+   task_remove_from_state_list(rq, ti);
+   atomic_store_explicit(&ti->state, new_state, mo_relaxed);
+   task_add_to_state_list(rq, ti);
+}
+
+void task_change_state(struct task *ti, enum task_state new_state)
+{
+   struct runqueue *rq;
+   ulong var;
+
+   rq = task_rq_lock(ti, &var);
    {
-      task_remove_from_state_list(ti);
-      atomic_store_explicit(&ti->state, new_state, mo_relaxed);
-      task_add_to_state_list(ti);
+      task_change_state_locked(rq, ti, new_state);
    }
-   enable_interrupts(&var);
+   task_rq_unlock(rq, &var);
 }
 
 void task_change_state_idempotent(struct task *ti, enum task_state new_state)
 {
+   struct runqueue *rq;
    ulong var;
-   disable_interrupts(&var);
+
+   rq = task_rq_lock(ti, &var);
    {
       if (atomic_load_explicit(&ti->state, mo_relaxed) != new_state) {
-         task_change_state(ti, new_state);
+         task_change_state_locked(rq, ti, new_state);
       }
    }
-   enable_interrupts(&var);
+   task_rq_unlock(rq, &var);
 }
 
 void add_task(struct task *ti)
 {
+   struct runqueue *rq;
+   ulong var;
+
    disable_preemption();
    {
-      task_add_to_state_list(ti);
+      rq = task_rq_lock(ti, &var);
+      task_add_to_state_list(rq, ti);
+      task_rq_unlock(rq, &var);
 
       bintree_insert_ptr(&tree_by_tid_root,
                          ti,
@@ -568,11 +814,16 @@ void add_task(struct task *ti)
 
 void remove_task(struct task *ti)
 {
+   struct runqueue *rq;
+   ulong var;
+
    disable_preemption();
    {
       ASSERT_TASK_STATE(ti->state, TASK_STATE_ZOMBIE);
 
-      task_remove_from_state_list(ti);
+      rq = task_rq_lock(ti, &var);
+      task_remove_from_state_list(rq, ti);
+      task_rq_unlock(rq, &var);
 
       bintree_remove_ptr(&tree_by_tid_root,
                          ti,
@@ -580,6 +831,18 @@ void remove_task(struct task *ti)
                          tree_by_tid_node,
                          tid);
 
+      if (is_kernel_thread(ti)) {
+
+         release_kernel_tid(ti->tid);
+
+      } else {
+
+         if (is_main_thread(ti))
+            process_leave_groups(ti->pi);
+
+         release_pid(ti->tid);
+      }
+
       free_task(ti);
    }
    enable_preemption();
@@ -602,7 +865,7 @@ void sched_account_ticks(void)
    if (curr->running_in_kernel)
       t->total_kernel++;
 
-   if (curr != idle_task) {
+   if (!is_idle_task(curr)) {
 
       /*
        * The more currently runnable tasks are, the higher vruntime has to
@@ -618,16 +881,48 @@ void sched_account_ticks(void)
        * picking the task with the lowest `total` number of ticks, because
        * tasks that that consumed 100% of the CPU when no other task was
        * runnable won't be so much penalized.
+       *
+       * Finally, the increment is scaled by the weight of the task's nice
+       * level: vruntime grows by delta * 2^20 / weight, that is delta * 1024
+       * for nice 0. That way, a nice -5 task gets ~3 times the CPU time of a
+       * nice 0 task. RT tasks are accounted the same way, even if their
+       * vruntime matters only if they go back to the fair class.
+       *
+       * The current task is usually not in the runnable tree, but it might be
+       * if it has been woken up before it could switch away: in that case,
+       * its position in the tree has to be updated as well.
        */
-      t->vruntime += (u64)(runnable_tasks_count - 1);
+      const u32 wmult = nice_to_wmult[curr->nice - MIN_NICE];
+      const u64 delta = ((u64)(runnable_tasks_count - 1) * wmult) >> 12;
+      struct runqueue *rq;
+      ulong var;
+
+      rq = task_rq_lock(curr, &var);
+
+      if (delta && is_in_runnable_tree(curr)) {
+         runnable_tree_remove(rq, curr);
+         t->vruntime += delta;
+         runnable_tree_add(rq, curr);
+      } else {
+         t->vruntime += delta;
+      }
+
+      task_rq_unlock(rq, &var);
    }
 
    /*
     * need_resched is never set for worker threads when they used too much
     * CPU time: their timeslice is unlimited and can preempted only be another
-    * worker thread.
+    * worker thread. The same applies to SCHED_FIFO tasks, which run until they
+    * block, yield or get preempted by a higher priority task. SCHED_RR tasks,
+    * instead, go after the others of their priority when their slice expires.
     */
-   const bool timeout = !is_worker && t->timeslice >= TIME_SLICE_TICKS;
+   const bool timeout = !is_worker &&
+                        curr->sched_policy != SCHED_FIFO &&
+                        t->timeslice >= TIME_SLICE_TICKS;
+
+   if (timeout && curr->sched_policy == SCHED_RR)
+      task_requeue(curr);
 
    if (curr->stopped || !is_running || timeout)
       sched_set_need_resched();
@@ -666,27 +961,51 @@ sched_should_return_immediately(struct task *curr, enum task_state curr_state)
 }
 
 static struct task *
-sched_do_select_runnable_task(enum task_state curr_state, bool resched)
+sched_first_runnable_non_stopped_task(struct runqueue *rq)
 {
-   struct task *curr = get_curr_task();
-   struct task *selected = NULL;
+   struct bintree_walk_ctx ctx;
    struct task *pos;
 
-   list_for_each_ro(pos, &runnable_tasks_list, runnable_node) {
+   bintree_in_order_visit_start(&ctx,
+                                rq->root,
+                                struct task,
+                                runnable_node,
+                                false);
 
-      ASSERT_TASK_STATE(pos->state, TASK_STATE_RUNNABLE);
+   while ((pos = bintree_in_order_visit_next(&ctx))) {
+      if (!pos->stopped)
+         return pos;
+   }
 
-      if (pos->stopped || pos == idle_task)
-         continue;
+   return NULL;
+}
 
-      if (pos->timer_ready) {
-         selected = pos;
-         break;
-      }
+static bool sched_any_runnable_task(struct runqueue *rq)
+{
+   struct task *ti = rq->leftmost;
 
-      if (!selected || pos->ticks.vruntime < selected->ticks.vruntime)
-         selected = pos;
-   }
+   if (ti && ti->stopped)
+      ti = sched_first_runnable_non_stopped_task(rq);
+
+   return ti != NULL;
+}
+
+static struct task *
+sched_do_select_runnable_task(struct runqueue *rq,
+                              enum task_state curr_state,
+                              bool resched)
+{
+   struct task *curr = get_curr_task();
+   struct task *selected = rq->leftmost;
+
+   /*
+    * Stopped tasks stay in the runnable tree: skip them by walking the tree
+    * in order. That's uncommon, so the typical cost here is O(1).
+    */
+   if (selected && selected->stopped)
+      selected = sched_first_runnable_non_stopped_task(rq);
+
+   ASSERT(!selected || selected->state == TASK_STATE_RUNNABLE);
 
    /* If there is still no selected task, check for current task */
    if (!selected) {
@@ -695,29 +1014,117 @@ sched_do_select_runnable_task(enum task_state curr_state, bool resched)
          selected = curr;
    }
 
-   if (!resched && selected) {
+   if ((!resched || curr->rt_prio) && selected) {
 
       /*
        * If need_resched is not set, the caller didn't want necessarily to
        * yield, but just give the scheduler an opportunity to switch the current
-       * task. In the loop avoid, the current task was not included because its
-       * state is typically RUNNING, so it's not present in the runnable_list.
+       * task. The current task was not considered above because its state is
+       * typically RUNNING, so it's not present in the runnable tree.
+       *
+       * RT tasks, instead, never yield the CPU to lower priority tasks, not
+       * even when need_resched is set: see task_requeue().
        */
 
       if (curr_state == TASK_STATE_RUNNING && !curr->stopped)
-         if (curr->ticks.vruntime < selected->ticks.vruntime)
+         if (runnable_task_cmp(curr, selected) < 0)
             selected = curr;
    }
 
    return selected;
 }
 
+#if SMP_ENABLED
+
+/* Lock two runqueues always in the same order, to avoid ABBA deadlocks */
+static void double_rq_lock(struct runqueue *rq1, struct runqueue *rq2)
+{
+   if (rq1 < rq2) {
+      spin_lock(&rq1->lock);
+      spin_lock(&rq2->lock);
+   } else {
+      spin_lock(&rq2->lock);
+      spin_lock(&rq1->lock);
+   }
+}
+
+static void double_rq_unlock(struct runqueue *rq1, struct runqueue *rq2)
+{
+   spin_unlock(&rq1->lock);
+   spin_unlock(&rq2->lock);
+}
+
+/*
+ * Work stealing: called by a CPU which has nothing to run, it moves to its
+ * own runqueue the first runnable task of the busiest other runqueue, skipping
+ * the tasks still running on their CPU (see sched_account_ticks()).
+ */
+static struct task *sched_steal_task(struct runqueue *this_rq)
+{
+   struct runqueue *busiest = NULL;
+   struct task *stolen = NULL;
+   struct bintree_walk_ctx ctx;
+   struct task *pos;
+   int max_nr = 0;
+   ulong var;
+
+   for (u32 i = 0; i < MAX_CPUS; i++) {
+
+      const int nr = atomic_load_explicit(&runqueues[i].nr, mo_relaxed);
+
+      if (&runqueues[i] != this_rq && nr > max_nr) {
+         busiest = &runqueues[i];
+         max_nr = nr;
+      }
+   }
+
+   if (!busiest)
+      return NULL;
+
+   disable_interrupts(&var);
+   double_rq_lock(this_rq, busiest);
+   {
+      bintree_in_order_visit_start(&ctx,
+                                   busiest->root,
+                                   struct task,
+                                   runnable_node,
+                                   false);
+
+      while ((pos = bintree_in_order_visit_next(&ctx))) {
+         if (!pos->stopped && !is_task_on_cpu(pos)) {
+            stolen = pos;
+            break;
+         }
+      }
+
+      if (stolen) {
+         runnable_tree_remove(busiest, stolen);
+         stolen->cpu = (u8)get_cpu_id();
+         runnable_tree_add(this_rq, stolen);
+      }
+   }
+   double_rq_unlock(this_rq, busiest);
+   enable_interrupts(&var);
+   return stolen;
+}
+
+#else
+
+static ALWAYS_INLINE struct task *sched_steal_task(struct runqueue *this_rq)
+{
+   return NULL;
+}
+
+#endif
+
 void do_schedule(void)
 {
    enum task_state curr_state = get_curr_task_state();
    const bool resched = need_reschedule();
+   struct runqueue *rq = &runqueues[get_cpu_id()];
    struct task *curr = get_curr_task();
    struct task *selected = NULL;
+   ulong var;
 
    ASSERT(!is_preemption_enabled());
 
@@ -729,15 +1136,23 @@ void do_schedule(void)
       return;
 
    /* Check for worker threads ready to run */
-   selected = wth_get_runnable_thread();
+   if ((selected = wth_get_runnable_thread()))
+      selected->cpu = (u8)get_cpu_id();
 
    /* Check for regular runnable tasks */
    if (!selected) {
 
-      selected = sched_do_select_runnable_task(curr_state, resched);
+      spin_lock_irqsave(&rq->lock, &var);
+      {
+         selected = sched_do_select_runnable_task(rq, curr_state, resched);
+      }
+      spin_unlock_irqrestore(&rq->lock, &var);
 
       if (!selected)
-         selected = idle_task; /* fall-back to the idle task */
+         selected = sched_steal_task(rq);
+
+      if (!selected)
+         selected = rq->idle; /* fall-back to the idle task */
    }
 
    if (selected != curr) {
@@ -800,93 +1215,3 @@ bool in_currently_dying_task(void)
    return get_curr_task_state() == TASK_STATE_ZOMBIE;
 }
 
-int send_signal_to_group(int pgid, int sig)
-{
-   struct process *curr_pi = get_curr_proc();
-   struct process *leader = NULL;
-   struct bintree_walk_ctx ctx;
-   struct task *ti;
-   int count = 0;
-
-   disable_preemption();
-
-   bintree_in_order_visit_start(&ctx,
-                                tree_by_tid_root,
-                                struct task,
-                                tree_by_tid_node,
-                                false);
-
-   while ((ti = bintree_in_order_visit_next(&ctx))) {
-
-      struct process *pi = ti->pi;
-
-      if (pi->pgid == pgid && pi != curr_pi && pi->pid != 1) {
-
-         if (pi->pid != pgid)
-            send_signal(pi->pid, sig, true);
-         else
-            leader = pi;
-
-         count++;
-      }
-   }
-
-   if (leader)
-      send_signal(leader->pid, sig, true); /* kill the leader last */
-
-   enable_preemption();
-
-   if (curr_pi->pgid == pgid) {
-
-      /* kill the current process, as _very_ last */
-      send_signal(curr_pi->pid, sig, true);
-      count++;
-   }
-
-   return count > 0 ? 0 : -ESRCH;
-}
-
-int send_signal_to_session(int sid, int sig)
-{
-   struct process *curr_pi = get_curr_proc();
-   struct process *leader = NULL;
-   struct bintree_walk_ctx ctx;
-   struct task *ti;
-   int count = 0;
-
-   disable_preemption();
-
-   bintree_in_order_visit_start(&ctx,
-                                tree_by_tid_root,
-                                struct task,
-                                tree_by_tid_node,
-                                false);
-
-   while ((ti = bintree_in_order_visit_next(&ctx))) {
-
-      struct process *pi = ti->pi;
-
-      if (pi->pgid == sid && pi != curr_pi && pi->pid != 1) {
-
-         if (pi->pid != sid)
-            send_signal(pi->pid, sig, true);
-         else
-            leader = pi;
-
-         count++;
-      }
-   }
-
-   if (leader)
-      send_signal(leader->pid, sig, true); /* kill the leader last */
-
-   enable_preemption();
-
-   /* kill the current process, as _very_ last */
-   if (curr_pi->pgid == sid) {
-      send_signal(curr_pi->pid, sig, true);
-      count++;
-   }
-
-   return count > 0 ? 0 : -ESRCH;
-}
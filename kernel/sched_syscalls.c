@@ -0,0 +1,335 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+
+#include <tilck/kernel/syscalls.h>
+#include <tilck/kernel/process.h>
+#include <tilck/kernel/user.h>
+#include <tilck/kernel/errno.h>
+#include <tilck/kernel/datetime.h>
+
+#ifndef PRIO_PROCESS
+   #define PRIO_PROCESS                0
+   #define PRIO_PGRP                   1
+   #define PRIO_USER                   2
+#endif
+
+struct prio_visit_ctx {
+
+   bool set;
+   int nice;
+   int count;
+};
+
+static bool is_valid_policy(int policy)
+{
+   switch (policy) {
+
+      case SCHED_OTHER:
+      case SCHED_FIFO:
+      case SCHED_RR:
+      case SCHED_BATCH:
+      case SCHED_IDLE:
+         return true;
+
+      default:
+         return false;
+   }
+}
+
+static ALWAYS_INLINE bool is_rt_policy(int policy)
+{
+   return policy == SCHED_FIFO || policy == SCHED_RR;
+}
+
+/* Get the task `tid` or the current one if `tid` is 0. No kernel threads. */
+static struct task *get_sched_target(int tid)
+{
+   struct task *ti;
+   ASSERT(!is_preemption_enabled());
+
+   if (!tid)
+      return get_curr_task();
+
+   ti = get_task(tid);
+   return ti && !is_kernel_thread(ti) ? ti : NULL;
+}
+
+static int
+do_sched_setscheduler(int tid,
+                      int policy,
+                      const struct k_sched_param *u_param,
+                      bool keep_policy)
+{
+   struct k_sched_param param;
+   struct task *ti;
+   int rc = 0;
+
+   if (tid < 0 || !u_param)
+      return -EINVAL;
+
+   if (copy_from_user(&param, u_param, sizeof(param)))
+      return -EFAULT;
+
+   disable_preemption();
+
+   if (!(ti = get_sched_target(tid))) {
+      rc = -ESRCH;
+      goto out;
+   }
+
+   if (keep_policy)
+      policy = ti->sched_policy;
+
+   if (!is_valid_policy(policy)) {
+      rc = -EINVAL;
+      goto out;
+   }
+
+   if (param.sched_priority < sys_sched_get_priority_min(policy) ||
+       param.sched_priority > sys_sched_get_priority_max(policy))
+   {
+      rc = -EINVAL;
+      goto out;
+   }
+
+   task_set_sched_policy(ti, policy, param.sched_priority);
+
+out:
+   enable_preemption();
+   return rc;
+}
+
+int sys_sched_setscheduler(int pid,
+                           int policy,
+                           const struct k_sched_param *u_param)
+{
+   return do_sched_setscheduler(pid, policy, u_param, false);
+}
+
+int sys_sched_setparam(int pid, const struct k_sched_param *u_param)
+{
+   return do_sched_setscheduler(pid, 0, u_param, true);
+}
+
+int sys_sched_getscheduler(int pid)
+{
+   struct task *ti;
+   int rc;
+
+   if (pid < 0)
+      return -EINVAL;
+
+   disable_preemption();
+   {
+      ti = get_sched_target(pid);
+      rc = ti ? ti->sched_policy : -ESRCH;
+   }
+   enable_preemption();
+   return rc;
+}
+
+int sys_sched_getparam(int pid, struct k_sched_param *u_param)
+{
+   struct k_sched_param param;
+   struct task *ti;
+
+   if (pid < 0 || !u_param)
+      return -EINVAL;
+
+   disable_preemption();
+   {
+      if ((ti = get_sched_target(pid)))
+         param.sched_priority = ti->base_rt_prio;
+   }
+   enable_preemption();
+
+   if (!ti)
+      return -ESRCH;
+
+   if (copy_to_user(u_param, &param, sizeof(param)))
+      return -EFAULT;
+
+   return 0;
+}
+
+int sys_sched_get_priority_max(int policy)
+{
+   if (!is_valid_policy(policy))
+      return -EINVAL;
+
+   return is_rt_policy(policy) ? MAX_RT_PRIO : 0;
+}
+
+int sys_sched_get_priority_min(int policy)
+{
+   if (!is_valid_policy(policy))
+      return -EINVAL;
+
+   return is_rt_policy(policy) ? 1 : 0;
+}
+
+static int
+do_sched_rr_get_interval(int pid, struct k_timespec64 *tp)
+{
+   struct task *ti;
+   u64 ticks = 0;
+
+   if (pid < 0)
+      return -EINVAL;
+
+   disable_preemption();
+   {
+      /* SCHED_FIFO tasks have no time slice */
+      if ((ti = get_sched_target(pid)) && ti->sched_policy != SCHED_FIFO)
+         ticks = TIME_SLICE_TICKS;
+   }
+   enable_preemption();
+
+   if (!ti)
+      return -ESRCH;
+
+   ticks_to_timespec(ticks, tp);
+   return 0;
+}
+
+int sys_sched_rr_get_interval_time32(int pid, struct k_timespec32 *u_tp)
+{
+   struct k_timespec64 tp;
+   struct k_timespec32 tp32;
+   int rc;
+
+   if ((rc = do_sched_rr_get_interval(pid, &tp)))
+      return rc;
+
+   tp32 = to_k_timespec32(tp);
+
+   if (copy_to_user(u_tp, &tp32, sizeof(tp32)))
+      return -EFAULT;
+
+   return 0;
+}
+
+int sys_sched_rr_get_interval(int pid, struct k_timespec64 *u_tp)
+{
+   struct k_timespec64 tp;
+   int rc;
+
+   if ((rc = do_sched_rr_get_interval(pid, &tp)))
+      return rc;
+
+   if (copy_to_user(u_tp, &tp, sizeof(tp)))
+      return -EFAULT;
+
+   return 0;
+}
+
+int sys_sched_yield(void)
+{
+   /* Go after the other RT tasks with the same priority, if any */
+   task_requeue(get_curr_task());
+   kernel_yield();
+   return 0;
+}
+
+static int prio_visit_task(struct task *ti, struct prio_visit_ctx *ctx)
+{
+   if (ctx->set)
+      ti->nice = (s8)ctx->nice;
+   else
+      ctx->nice = MIN(ctx->nice, ti->nice);
+
+   ctx->count++;
+   return 0;
+}
+
+static int prio_visit_user_task(void *obj, void *arg)
+{
+   struct task *ti = obj;
+
+   if (!is_kernel_thread(ti))
+      prio_visit_task(ti, arg);
+
+   return 0;
+}
+
+static int prio_visit_process(void *obj, void *arg)
+{
+   return prio_visit_task(get_process_task(obj), arg);
+}
+
+/*
+ * Visit all the tasks matching `which` and `who`, as defined by getpriority(2).
+ * NOTE: with PRIO_PGRP, only the main threads of the processes are visited.
+ */
+static int
+prio_visit(int which, int who, struct prio_visit_ctx *ctx)
+{
+   struct task *ti;
+
+   if (who < 0)
+      return -EINVAL;
+
+   disable_preemption();
+
+   switch (which) {
+
+      case PRIO_PROCESS:
+         if ((ti = get_sched_target(who)))
+            prio_visit_task(ti, ctx);
+         break;
+
+      case PRIO_PGRP:
+         iterate_over_group(who ? who : get_curr_proc()->pgid,
+                            &prio_visit_process,
+                            ctx);
+         break;
+
+      case PRIO_USER:
+         /* All the processes run as root (uid 0) */
+         if (!who)
+            iterate_over_tasks(&prio_visit_user_task, ctx);
+         break;
+
+      default:
+         enable_preemption();
+         return -EINVAL;
+   }
+
+   enable_preemption();
+   return ctx->count > 0 ? 0 : -ESRCH;
+}
+
+/*
+ * NOTE: like the Linux syscall, this returns 20 - nice (1..40), in order to
+ * avoid negative values. The libc converts it back to the nice value.
+ */
+int sys_getpriority(int which, int who)
+{
+   struct prio_visit_ctx ctx = { .set = false, .nice = MAX_NICE };
+   int rc;
+
+   if ((rc = prio_visit(which, who, &ctx)))
+      return rc;
+
+   return 20 - ctx.nice;
+}
+
+int sys_setpriority(int which, int who, int prio)
+{
+   struct prio_visit_ctx ctx = {
+      .set = true,
+      .nice = CLAMP(prio, MIN_NICE, MAX_NICE),
+   };
+
+   return prio_visit(which, who, &ctx);
+}
+
+int sys_nice(int inc)
+{
+   struct task *curr = get_curr_task();
+
+   inc = CLAMP(inc, -40, 40);
+   curr->nice = (s8)CLAMP(curr->nice + inc, MIN_NICE, MAX_NICE);
+   return 0;
+}
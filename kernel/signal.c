@@ -395,6 +395,30 @@ static void do_send_signal(struct task *ti, int signum, int fl)
    }
 }
 
+/*
+ * Choose the thread that will handle a process-directed signal: the main
+ * thread, unless it's dead or it blocks the signal. In that case, any other
+ * thread not blocking it, like Linux does.
+ */
+static struct task *
+get_process_signal_target(struct task *main_ti, int signum)
+{
+   struct task *pos;
+
+   if (main_ti->state != TASK_STATE_ZOMBIE && !is_sig_masked(main_ti, signum))
+      return main_ti;
+
+   list_for_each_ro(pos, &main_ti->pi->threads, thread_node) {
+      if (!is_sig_masked(pos, signum))
+         return pos;
+   }
+
+   /* All the threads block the signal: leave it pending on the first one */
+   return list_is_empty(&main_ti->pi->threads)
+      ? main_ti
+      : list_first_obj(&main_ti->pi->threads, struct task, thread_node);
+}
+
 int send_signal2(int pid, int tid, int signum, int flags)
 {
    struct task *ti;
@@ -418,10 +442,12 @@ int send_signal2(int pid, int tid, int signum, int flags)
    if (signum == 0)
       goto end; /* the user app is just checking permissions */
 
+   if ((flags & SIG_FL_PROCESS) && !(flags & SIG_FL_FAULT))
+      ti = get_process_signal_target(ti, signum);
+
    if (ti->state == TASK_STATE_ZOMBIE)
       goto end; /* do nothing */
 
-   /* TODO: update this code when thread support is added */
    do_send_signal(ti, signum, flags);
 
 end:
@@ -470,19 +496,27 @@ bool pending_signals(void)
 /* NOTE: deprecated syscall */
 int sys_tkill(int tid, int sig)
 {
+   struct task *ti;
+   int pid = -1;
+
    if (!IN_RANGE(sig, 0, _NSIG) || tid <= 0)
       return -EINVAL;
 
-   return send_signal(tid, sig, false);
+   disable_preemption();
+   {
+      if ((ti = get_task(tid)) && !is_kernel_thread(ti))
+         pid = ti->pi->pid;
+   }
+   enable_preemption();
+
+   if (pid < 0)
+      return -ESRCH;
+
+   return send_signal2(pid, tid, sig, 0);
 }
 
 int sys_tgkill(int pid /* linux: tgid */, int tid, int sig)
 {
-   if (pid != tid) {
-      printk("sys_tgkill: pid != tid NOT SUPPORTED yet.\n");
-      return -EINVAL;
-   }
-
    if (!IN_RANGE(sig, 0, _NSIG) || pid <= 0 || tid <= 0)
       return -EINVAL;
 
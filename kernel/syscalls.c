@@ -11,6 +11,8 @@
 #include <tilck/kernel/process.h>
 #include <tilck/kernel/signal.h>
 #include <tilck/kernel/timer.h>
+#include <tilck/kernel/hrtimer.h>
+#include <tilck/kernel/datetime.h>
 #include <tilck/kernel/fs/vfs.h>
 
 #define LINUX_REBOOT_MAGIC1         0xfee1dead
@@ -24,32 +26,40 @@
 #define LINUX_REBOOT_CMD_HALT       0xcdef0123
 #define LINUX_REBOOT_CMD_POWER_OFF  0x4321fedc
 
-int sys_madvise(void *addr, size_t len, int advice)
+#ifndef TIMER_ABSTIME
+   #define TIMER_ABSTIME                     1
+#endif
+
+static inline bool is_timespec_valid(const struct k_timespec64 *tp)
 {
-   // TODO (future): consider implementing at least part of sys_madvice().
-   return 0;
+   return tp->tv_sec >= 0 && IN_RANGE(tp->tv_nsec, 0, BILLION);
 }
 
 int
 do_nanosleep(const struct k_timespec64 *req, struct k_timespec64 *rem)
 {
-   u64 ticks_to_sleep;
-   u64 exp_wake_up_ticks;
-
-   ticks_to_sleep = timespec_to_ticks(req);
-   exp_wake_up_ticks = get_ticks() + ticks_to_sleep;
-   kernel_sleep(ticks_to_sleep);
+   u64 ns, start, elapsed;
 
-   /* After wake-up */
    rem->tv_sec = 0;
    rem->tv_nsec = 0;
 
+   if (!is_timespec_valid(req))
+      return -EINVAL;
+
+   ns = (u64)req->tv_sec * BILLION + (u64)req->tv_nsec;
+   start = hrtimer_now();
+   kernel_sleep_ns(ns);
+
+   /* After wake-up */
    if (pending_signals()) {
 
-      u64 ticks = get_ticks();
+      elapsed = hrtimer_now() - start;
 
-      if (ticks < exp_wake_up_ticks)
-         ticks_to_timespec(exp_wake_up_ticks - ticks, rem);
+      if (elapsed < ns) {
+         ns -= elapsed;
+         rem->tv_sec = (s64)(ns / BILLION);
+         rem->tv_nsec = (long)(ns % BILLION);
+      }
 
       return -EINTR;
    }
@@ -57,6 +67,42 @@ do_nanosleep(const struct k_timespec64 *req, struct k_timespec64 *rem)
    return 0;
 }
 
+static int
+do_clock_nanosleep(clockid_t clk_id,
+                   int flags,
+                   const struct k_timespec64 *req,
+                   struct k_timespec64 *rem)
+{
+   struct k_timespec64 now, rel, unused;
+   int rc;
+
+   if (clk_id != CLOCK_REALTIME && clk_id != CLOCK_MONOTONIC)
+      return -EINVAL;
+
+   if (!(flags & TIMER_ABSTIME))
+      return do_nanosleep(req, rem);
+
+   if (!is_timespec_valid(req))
+      return -EINVAL;
+
+   if ((rc = do_clock_gettime(clk_id, &now)))
+      return rc;
+
+   /* Absolute time: compute the relative one. `rem` is not used, here. */
+   rel.tv_sec = req->tv_sec - now.tv_sec;
+   rel.tv_nsec = req->tv_nsec - now.tv_nsec;
+
+   if (rel.tv_nsec < 0) {
+      rel.tv_sec--;
+      rel.tv_nsec += BILLION;
+   }
+
+   if (rel.tv_sec < 0)
+      return 0; /* Already expired */
+
+   return do_nanosleep(&rel, &unused);
+}
+
 int
 sys_nanosleep_time32(const struct k_timespec32 *user_req,
                      struct k_timespec32 *user_rem)
@@ -67,7 +113,7 @@ sys_nanosleep_time32(const struct k_timespec32 *user_req,
    struct k_timespec64 rem;
    int rc;
 
-   if (copy_from_user(&req32, user_req, sizeof(req)))
+   if (copy_from_user(&req32, user_req, sizeof(req32)))
       return -EFAULT;
 
    req = (struct k_timespec64) {
@@ -91,6 +137,65 @@ sys_nanosleep_time32(const struct k_timespec32 *user_req,
    return rc;
 }
 
+int
+sys_clock_nanosleep_time32(clockid_t clk_id,
+                           int flags,
+                           const struct k_timespec32 *user_req,
+                           struct k_timespec32 *user_rem)
+{
+   struct k_timespec32 req32;
+   struct k_timespec64 req;
+   struct k_timespec32 rem32;
+   struct k_timespec64 rem = {0};
+   int rc;
+
+   if (copy_from_user(&req32, user_req, sizeof(req32)))
+      return -EFAULT;
+
+   req = (struct k_timespec64) {
+      .tv_sec = req32.tv_sec,
+      .tv_nsec = req32.tv_nsec,
+   };
+
+   rc = do_clock_nanosleep(clk_id, flags, &req, &rem);
+
+   if (rc == -EINTR && user_rem && !(flags & TIMER_ABSTIME)) {
+
+      rem32 = (struct k_timespec32) {
+         .tv_sec = (s32) rem.tv_sec,
+         .tv_nsec = rem.tv_nsec,
+      };
+
+      if (copy_to_user(user_rem, &rem32, sizeof(rem32)))
+         return -EFAULT;
+   }
+
+   return rc;
+}
+
+int
+sys_clock_nanosleep(clockid_t clk_id,
+                    int flags,
+                    const struct k_timespec64 *user_req,
+                    struct k_timespec64 *user_rem)
+{
+   struct k_timespec64 req;
+   struct k_timespec64 rem = {0};
+   int rc;
+
+   if (copy_from_user(&req, user_req, sizeof(req)))
+      return -EFAULT;
+
+   rc = do_clock_nanosleep(clk_id, flags, &req, &rem);
+
+   if (rc == -EINTR && user_rem && !(flags & TIMER_ABSTIME)) {
+      if (copy_to_user(user_rem, &rem, sizeof(rem)))
+         return -EFAULT;
+   }
+
+   return rc;
+}
+
 int sys_newuname(struct utsname *user_buf)
 {
    struct commit_hash_and_date comm;
@@ -110,9 +215,10 @@ int sys_newuname(struct utsname *user_buf)
    return 0;
 }
 
+/* Terminate the current thread: the process ends with its last thread */
 NORETURN int sys_exit(int exit_status)
 {
-   terminate_process(exit_status, 0 /* term_sig */);
+   terminate_thread(exit_status, 0 /* term_sig */);
 
    /* Necessary to guarantee to the compiler that we won't return. */
    NOT_REACHED();
@@ -120,8 +226,8 @@ NORETURN int sys_exit(int exit_status)
 
 NORETURN int sys_exit_group(int status)
 {
-   // TODO: update when user threads are supported
-   sys_exit(status);
+   terminate_process(status, 0 /* term_sig */);
+   NOT_REACHED();
 }
 
 ulong sys_times(struct tms *user_buf)
@@ -153,12 +259,59 @@ ulong sys_times(struct tms *user_buf)
 
 int sys_fork(void)
 {
-   return do_fork(false);
+   return do_fork(false, NULL);
 }
 
 int sys_vfork(void)
 {
-   return do_fork(true);
+   return do_fork(true, NULL);
+}
+
+#define CLONE_THREAD_REQ_FLAGS                                         \
+   (CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND | CLONE_THREAD)
+
+#define CLONE_THREAD_OPT_FLAGS                                         \
+   (CLONE_SYSVSEM | CLONE_SETTLS | CLONE_PARENT_SETTID |               \
+    CLONE_CHILD_CLEARTID | CLONE_DETACHED | CLONE_CHILD_SETTID)
+
+/*
+ * Supported cases:
+ *
+ *    - threads: all the CLONE_THREAD_REQ_FLAGS set, because the memory, the
+ *      handles, the cwd and the signal handlers belong to the process in Tilck
+ *
+ *    - fork() and vfork(), as the libc might implement them, optionally with
+ *      a new stack (e.g. posix_spawn() in libmusl)
+ */
+int sys_clone(ulong flags,
+              void *newsp,
+              int *parent_tid,
+              void *tls,
+              int *child_tid)
+{
+   const ulong fl = flags & ~(ulong)CSIGNAL;
+
+   if (fl & CLONE_THREAD) {
+
+      if ((fl & CLONE_THREAD_REQ_FLAGS) != CLONE_THREAD_REQ_FLAGS)
+         return -EINVAL;
+
+      if (fl & ~(CLONE_THREAD_REQ_FLAGS | CLONE_THREAD_OPT_FLAGS))
+         return -EINVAL;
+
+      return do_clone_thread(flags, newsp, parent_tid, tls, child_tid);
+   }
+
+   if ((flags & CSIGNAL) != SIGCHLD)
+      return -EINVAL;
+
+   if (fl == 0)
+      return do_fork(false, newsp);
+
+   if (fl == (CLONE_VM | CLONE_VFORK))
+      return do_fork(true, newsp);
+
+   return -EINVAL;
 }
 
 static int
@@ -235,12 +388,6 @@ int sys_reboot(u32 magic, u32 magic2, u32 cmd, void *arg)
    return 0;
 }
 
-int sys_sched_yield(void)
-{
-   kernel_yield();
-   return 0;
-}
-
 int sys_utimes(const char *u_path, const struct k_timeval u_times[2])
 {
    struct k_timeval ts[2];
@@ -5,14 +5,18 @@
 #include <tilck/common/basic_defs.h>
 #include <tilck/common/printk.h>
 #include <tilck/common/atomics.h>
+#include <tilck/common/utils.h>
 
 #include <tilck/kernel/sched.h>
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/irq.h>
 #include <tilck/kernel/timer.h>
+#include <tilck/kernel/hrtimer.h>
 #include <tilck/kernel/elf_utils.h>
 #include <tilck/kernel/worker_thread.h>
 #include <tilck/kernel/datetime.h>
+#include <tilck/kernel/clocksource.h>
+#include <tilck/kernel/spinlock.h>
 
 FASTCALL void asm_nop_loop(u32 iters);
 
@@ -20,6 +24,7 @@ FASTCALL void asm_nop_loop(u32 iters);
 static u64 __ticks;        /* ticks since the timer started */
 
 /* System time */
+struct spinlock __time_lock;  /* protects the ticks and the system time */
 u64 __time_ns;             /* nanoseconds since the timer started */
 u32 __tick_duration;       /* the real duration of a tick, ~TS_SCALE/TIMER_HZ */
 int __tick_adj_val;
@@ -32,7 +37,6 @@ u32 slow_timer_irq_handler_count;
 volatile ATOMIC(u32) __bogo_loops;
 
 /* Static variables */
-static struct list timer_wakeup_list = STATIC_LIST_INIT(timer_wakeup_list);
 static u32 loops_per_tick;         /* Tilck bogoMips as loops/tick    */
 static u32 loops_per_ms = 5000000; /* loops/millisecond (initial val)  */
 static u32 loops_per_us = 5000;    /* loops/microsecond (initial val) */
@@ -42,31 +46,107 @@ u64 get_ticks(void)
    u64 curr_ticks;
    ulong var;
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&__time_lock, &var);
    {
       curr_ticks = __ticks;
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&__time_lock, &var);
    return curr_ticks;
 }
 
+/*
+ * Sleep timers: a hierarchical timing wheel
+ * -------------------------------------------
+ *
+ * Each armed timer lives in exactly one slot of the wheel, depending on how
+ * far in the future it expires. The first level has TW_L0_SLOTS slots of one
+ * tick each. The next TW_LEVELS - 1 levels have TW_LN_SLOTS slots each, and
+ * every slot covers TW_LN_SLOTS times more ticks than a slot of the level
+ * below. Together, the levels cover the whole 32-bit range of a timer.
+ *
+ * On every tick, only the expiring level-0 slot is visited. Once every
+ * TW_L0_SLOTS ticks, the current slot of the next level is "cascaded": its
+ * timers are moved to the lower levels, now that they're closer. That way,
+ * the per-tick work depends only on the timers actually expiring (plus the
+ * amortized cascade), not on the total number of sleeping tasks. Arming and
+ * cancelling a timer are O(1), because they're just list operations.
+ *
+ * `tw_now` counts the ticks processed by the wheel: timers store their
+ * expiration time as an absolute (wrapping) value of it.
+ */
+
+#define TW_L0_BITS                8
+#define TW_LN_BITS                6
+#define TW_LEVELS                 5
+#define TW_L0_SLOTS               (1u << TW_L0_BITS)
+#define TW_LN_SLOTS               (1u << TW_LN_BITS)
+
+STATIC_ASSERT(TW_L0_BITS + (TW_LEVELS - 1) * TW_LN_BITS == 32);
+
+static struct spinlock tw_lock;
+static struct list tw_l0[TW_L0_SLOTS];
+static struct list tw_ln[TW_LEVELS - 1][TW_LN_SLOTS];
+static u32 tw_now;
+
+static inline u32 tw_ln_index(u32 expire, int level)
+{
+   return (expire >> (TW_L0_BITS + level * TW_LN_BITS)) & (TW_LN_SLOTS - 1);
+}
+
+static inline bool is_timer_armed(struct task *ti)
+{
+   return !list_node_is_empty(&ti->wakeup_timer_node);
+}
+
+static void tw_add(struct task *ti)
+{
+   const u32 expire = ti->wakeup_timer_expire;
+   const u32 delta = expire - tw_now;
+   struct list *slot;
+
+   if (delta < TW_L0_SLOTS) {
+
+      slot = &tw_l0[expire & (TW_L0_SLOTS - 1)];
+
+   } else {
+
+      int level = 0;
+
+      while (level < TW_LEVELS - 2 &&
+             delta >= (1u << (TW_L0_BITS + (level + 1) * TW_LN_BITS)))
+      {
+         level++;
+      }
+
+      slot = &tw_ln[level][tw_ln_index(expire, level)];
+   }
+
+   list_add_tail(slot, &ti->wakeup_timer_node);
+}
+
+static void tw_remove(struct task *ti)
+{
+   list_remove(&ti->wakeup_timer_node);
+   list_node_init(&ti->wakeup_timer_node);
+}
+
 void task_set_wakeup_timer(struct task *ti, u32 ticks)
 {
    ulong var;
    ASSERT(ticks > 0);
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&tw_lock, &var);
    {
-      if (ti->ticks_before_wake_up == 0) {
-         ASSERT(!list_is_node_in_list(&ti->wakeup_timer_node));
-         list_add_tail(&timer_wakeup_list, &ti->wakeup_timer_node);
-      } else {
-         ASSERT(list_is_node_in_list(&ti->wakeup_timer_node));
-      }
+      if (is_timer_armed(ti))
+         tw_remove(ti);
 
-      ti->ticks_before_wake_up = ticks;
+      if (hrtimer_is_armed(&ti->wakeup_hrtimer))
+         hrtimer_cancel(&ti->wakeup_hrtimer);
+
+      ti->wakeup_timer_expire = tw_now + ticks;
+      tw_add(ti);
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&tw_lock, &var);
 }
 
 void task_update_wakeup_timer_if_any(struct task *ti, u32 new_ticks)
@@ -74,106 +154,182 @@ void task_update_wakeup_timer_if_any(struct task *ti, u32 new_ticks)
    ulong var;
    ASSERT(new_ticks > 0);
 
-   disable_interrupts(&var);
+   spin_lock_irqsave(&tw_lock, &var);
    {
-      if (ti->ticks_before_wake_up > 0) {
+      if (is_timer_armed(ti)) {
          ASSERT(list_is_node_in_list(&ti->wakeup_timer_node));
-         ti->ticks_before_wake_up = new_ticks;
+         tw_remove(ti);
+         ti->wakeup_timer_expire = tw_now + new_ticks;
+         tw_add(ti);
       }
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&tw_lock, &var);
+}
+
+static u32 ns_to_timer_ticks(u64 ns)
+{
+   return (u32)CLAMP(div_round_up64(ns, __tick_duration), 1u, UINT32_MAX);
 }
 
 u32 task_cancel_wakeup_timer(struct task *ti)
 {
    ulong var;
-   u32 old;
-   disable_interrupts(&var);
+   u32 old = 0;
+   spin_lock_irqsave(&tw_lock, &var);
    {
-      old = ti->ticks_before_wake_up;
+      if (is_timer_armed(ti)) {
+         old = ti->wakeup_timer_expire - tw_now;
+         task_set_timer_ready(ti, false);
+         tw_remove(ti);
+      } else if (hrtimer_is_armed(&ti->wakeup_hrtimer)) {
+         old = ns_to_timer_ticks(hrtimer_cancel(&ti->wakeup_hrtimer));
+         task_set_timer_ready(ti, false);
+      } else if (hrtimers_available()) {
+         /* Its callback might be still running on another CPU: wait for it */
+         hrtimer_cancel(&ti->wakeup_hrtimer);
+      }
+   }
+   spin_unlock_irqrestore(&tw_lock, &var);
+   return old;
+}
 
-      if (old > 0) {
-         ti->timer_ready = false;
-         ti->ticks_before_wake_up = 0;
-         list_remove(&ti->wakeup_timer_node);
+/*
+ * Wake-up timers with nanosecond resolution
+ * -------------------------------------------
+ *
+ * When the high-resolution timers are available, task_set_wakeup_timer_ns()
+ * uses the task's hrtimer instead of the timing wheel. Otherwise, it just
+ * rounds up the time to the next tick. A task has at most one wake-up timer
+ * armed at a time, of either kind: task_cancel_wakeup_timer*() cancel both.
+ */
+static void task_wakeup_hrtimer_func(struct hrtimer *t)
+{
+   struct task *ti = CONTAINER_OF(t, struct task, wakeup_hrtimer);
+
+   task_set_timer_ready(ti, true);
+
+   if (ti->state == TASK_STATE_SLEEPING) {
+      task_change_state(ti, TASK_STATE_RUNNABLE);
+      sched_set_need_resched();
+   }
+}
+
+void task_init_wakeup_timer(struct task *ti)
+{
+   list_node_init(&ti->wakeup_timer_node);
+   hrtimer_init(&ti->wakeup_hrtimer, &task_wakeup_hrtimer_func);
+}
+
+void task_set_wakeup_timer_ns(struct task *ti, u64 ns)
+{
+   ulong var;
+   ASSERT(ns > 0);
+
+   if (!hrtimers_available()) {
+      task_set_wakeup_timer(ti, ns_to_timer_ticks(ns));
+      return;
+   }
+
+   spin_lock_irqsave(&tw_lock, &var);
+   {
+      if (is_timer_armed(ti))
+         tw_remove(ti);
+
+      hrtimer_start(&ti->wakeup_hrtimer, ns);
+   }
+   spin_unlock_irqrestore(&tw_lock, &var);
+}
+
+/* Like task_cancel_wakeup_timer(), but returns the nanoseconds left */
+u64 task_cancel_wakeup_timer_ns(struct task *ti)
+{
+   ulong var;
+   u64 old = 0;
+   spin_lock_irqsave(&tw_lock, &var);
+   {
+      if (is_timer_armed(ti)) {
+         old = (u64)(ti->wakeup_timer_expire - tw_now) * __tick_duration;
+         task_set_timer_ready(ti, false);
+         tw_remove(ti);
+      } else if (hrtimer_is_armed(&ti->wakeup_hrtimer)) {
+         old = hrtimer_cancel(&ti->wakeup_hrtimer);
+         task_set_timer_ready(ti, false);
+      } else if (hrtimers_available()) {
+         /* See task_cancel_wakeup_timer() */
+         hrtimer_cancel(&ti->wakeup_hrtimer);
       }
    }
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&tw_lock, &var);
    return old;
 }
 
+/*
+ * Move all the timers in the current slot of `level` to the lower levels.
+ * Returns true when the slot index is 0, meaning that the next level has to be
+ * cascaded as well.
+ */
+static bool tw_cascade(int level)
+{
+   const u32 idx = tw_ln_index(tw_now, level);
+   struct list *slot = &tw_ln[level][idx];
+   struct task *pos, *temp;
+
+   list_for_each(pos, temp, slot, wakeup_timer_node) {
+      tw_remove(pos);
+      tw_add(pos);
+   }
+
+   return idx == 0;
+}
+
 static void tick_all_timers(void)
 {
    struct task *pos, *temp;
    bool any_woken_up_task = false;
+   struct list *slot;
    ulong var;
 
-   /*
-    * This is *NOT* the best we can do. In particular, it's terrible to keep
-    * the interrupts disabled while iterating the _whole_ timer_wakeup_list.
-    *
-    * Possible better solutions
-    * -----------------------------
-    * 1. Keep the tasks to wake-up in a sort of ordered list and then use
-    * relative timers. This way, at each tick we'll have to decrement just one
-    * single counter. We'll start decrement the next counter only when the first
-    * counter reaches 0 and its list node is removed. Of course, if we cannot
-    * use kmalloc() in case of sleep, it gets much harder to create such an
-    * ordered list and make it live inside a member of struct task. Maybe a BST
-    * will do the job, but that would require paying O(logN) per tick for
-    * finding the earliest timer. Not sure how better would be now for N < 50
-    * (typical), given the huge added constant for the BST functions. Also, the
-    * cancellation of a timer would require some extra effort in order to
-    * re-calculate the relative timer values, while we want the cancellation to
-    * be light-fast because it's run by IRQ handlers.
-    *
-    * 2. Use a fixed number of wakeup lists like: short-term, mid-term and
-    * long-term. Current task's wakeup list node will be placed in one those
-    * lists, depending on far in the future the task is supposted to be woke up.
-    * On every tick, here in tick_all_timers(), ONLY the short-term list will be
-    * iterated. That's a considerable improvement. In a system, there might be
-    * even 1,000 active timers, but how many of them will expire in the next
-    * second? Only a small percentage of them. To further improve the
-    * scalability, it's possible to have even more than 3 lists, or to further
-    * reduce the time-horizon of the short-term list. Periodically, but NOT on
-    * every tick, the `ticks_before_wake_up` field belonging to tasks in the
-    * other wakeup lists will adjusted with bigger decrements and tasks will be
-    * moved from one list to another. That will also happen in case the wakeup
-    * timer is changed for task with an already active timer. This solution
-    * looks much better than solution 1.
-    *
-    * Conclusion
-    * ---------------------
-    * For the moment, given the very limited scale of Tilck (tens of tasks at
-    * most running on the whole system), the current solution is safe and
-    * good-enough but, at some point, a smarter ad-hoc solution should be
-    * devised. Probably solution 2 is the right candidate.
-    */
-   disable_interrupts(&var);
+   spin_lock_irqsave(&tw_lock, &var);
 
-   list_for_each(pos, temp, &timer_wakeup_list, wakeup_timer_node) {
+   tw_now++;
+   slot = &tw_l0[tw_now & (TW_L0_SLOTS - 1)];
 
-      /* If task is part of this list, it's counter must be > 0 */
-      ASSERT(pos->ticks_before_wake_up > 0);
+   if ((tw_now & (TW_L0_SLOTS - 1)) == 0) {
+      for (int level = 0; level < TW_LEVELS - 1; level++)
+         if (!tw_cascade(level))
+            break;
+   }
 
-      if (UNLIKELY(--pos->ticks_before_wake_up == 0)) {
+   list_for_each(pos, temp, slot, wakeup_timer_node) {
 
-         pos->timer_ready = true;
-         list_remove(&pos->wakeup_timer_node);
+      ASSERT(pos->wakeup_timer_expire == tw_now);
 
-         if (pos->state == TASK_STATE_SLEEPING) {
-            task_change_state(pos, TASK_STATE_RUNNABLE);
-            any_woken_up_task = true;
-         }
+      task_set_timer_ready(pos, true);
+      tw_remove(pos);
+
+      if (pos->state == TASK_STATE_SLEEPING) {
+         task_change_state(pos, TASK_STATE_RUNNABLE);
+         any_woken_up_task = true;
       }
    }
 
-   enable_interrupts(&var);
+   spin_unlock_irqrestore(&tw_lock, &var);
 
    if (any_woken_up_task)
       sched_set_need_resched();
 }
 
+__attribute__((constructor))
+static void init_timer_wheel(void)
+{
+   for (u32 i = 0; i < TW_L0_SLOTS; i++)
+      list_init(&tw_l0[i]);
+
+   for (int level = 0; level < TW_LEVELS - 1; level++)
+      for (u32 i = 0; i < TW_LN_SLOTS; i++)
+         list_init(&tw_ln[level][i]);
+}
+
 static void do_sleep_internal(u32 ticks)
 {
    ASSERT(are_interrupts_enabled());
@@ -213,14 +369,14 @@ void kernel_sleep(u64 ticks)
     *    }
     *    kernel_yield();
     *
-    * But that would require task->ticks_before_wake_up to be actually 64-bit,
+    * But that would require task->wakeup_timer_expire to be actually 64-bit,
     * wide and that's bad on 32-bit systems because:
     *
     *    - it would require using the soft 64-bit integers (slow)
     *    - it would make impossible, in the case we wanted that, the counter
     *      to be atomic.
     *
-    * Therefore, in order to use a 32-bit value for 'ticks_before_wake_up' and,
+    * Therefore, in order to use a 32-bit value for 'wakeup_timer_expire' and,
     * at the same time being able to sleep for more than 2^32-1 ticks, we need
     * a more tricky implementation (below), and the little extra runtime price
     * for it is totally fine, since we're going to sleep anyways!
@@ -229,7 +385,7 @@ void kernel_sleep(u64 ticks)
     * ----------------------
     *
     * The simpler way to explain the algorithm is to just assume everything
-    * is in base 10 and that ticks_before_wake_up has 2 digits, while we want
+    * is in base 10 and that wakeup_timer_expire has 2 digits, while we want
     * to support 4 digits sleep time. For example, we want to sleep for 234
     * ticks. The algorithm first computes 534 % 100 = 34 and then 534 / 100 = 5.
     * After that, it sleeps q (= 5) times for 99 ticks (max allowed). Clearly,
@@ -274,6 +430,26 @@ void kernel_sleep_ms(u64 ms)
    kernel_sleep(MAX(1u, ms_to_ticks(ms)));
 }
 
+void kernel_sleep_ns(u64 ns)
+{
+   if (!hrtimers_available() || !ns) {
+      kernel_sleep(div_round_up64(ns, __tick_duration));
+      return;
+   }
+
+   if (in_panic())
+      return; /* See the comments in kernel_sleep() */
+
+   DEBUG_ONLY(check_not_in_irq_handler());
+   ASSERT(are_interrupts_enabled());
+
+   /* No need for the tricks in kernel_sleep(): hrtimers are 64-bit */
+   disable_preemption();
+   task_change_state(get_curr_task(), TASK_STATE_SLEEPING);
+   task_set_wakeup_timer_ns(get_curr_task(), ns);
+   kernel_yield_preempt_disabled();
+}
+
 static ALWAYS_INLINE bool timer_nested_irq(void)
 {
    bool res = false;
@@ -294,48 +470,152 @@ static ALWAYS_INLINE bool timer_nested_irq(void)
    return res;
 }
 
-static enum irq_action timer_irq_handler(void *ctx)
+static void timer_do_tick(void)
 {
    u32 ns_delta;
-   ASSERT(are_interrupts_enabled());
-
-   if (KRN_TRACK_NESTED_INTERR)
-      if (timer_nested_irq())
-         return IRQ_HANDLED;
-
-   /*
-    * Compute `ns_delta` by reading `__tick_duration` and `__tick_adj_val` here
-    * without disabling interrupts, because it's safe to do so. Also, decrement
-    * `__tick_adj_ticks_rem` too. Why it's safe:
-    *
-    *    1. `__tick_duration` is immutable
-    *    2. `__tick_adj_val` is changed only by datetime.c while keeping
-    *       interrupts disabled and it's read only here. Nested timer IRQs
-    *       will be ignored (see above). No other IRQ handler should read it.
-    */
-
-   if (__tick_adj_ticks_rem) {
-      ns_delta = (u32)((s32)__tick_duration + __tick_adj_val);
-      __tick_adj_ticks_rem--;
-   } else {
-      ns_delta = __tick_duration;
-   }
 
-   disable_interrupts_forced();
+   spin_lock_irq(&__time_lock);
    {
       /*
-       * Alter __ticks and __time_ns here, while keeping the interrupts disabled
-       * because other IRQ handlers might need to use them. While, as explained
-       * above, `__tick_adj_val` and `__tick_adj_ticks_rem` will never need to
-       * be read or written by IRQ handlers.
+       * Compute `ns_delta` and alter __ticks and __time_ns here, while keeping
+       * the interrupts disabled because other IRQ handlers might need to use
+       * them. `__tick_adj_val` and `__tick_adj_ticks_rem` are changed by
+       * datetime.c, while holding `__time_lock` as well. Because of
+       * the tickless idle, this function is not always called by the timer
+       * IRQ handler: that's why everything here has to be protected.
        */
+      if (__tick_adj_ticks_rem) {
+         ns_delta = (u32)((s32)__tick_duration + __tick_adj_val);
+         __tick_adj_ticks_rem--;
+      } else {
+         ns_delta = __tick_duration;
+      }
+
       __ticks++;
       __time_ns += ns_delta;
+      clocksource_tick();
    }
-   enable_interrupts_forced();
+   spin_unlock_irq(&__time_lock);
 
    sched_account_ticks();
    tick_all_timers();
+}
+
+/*
+ * Tickless idle (KRN_NO_HZ_IDLE)
+ * --------------------------------
+ *
+ * When the idle task is about to halt the CPU and nothing else is runnable,
+ * timer_nohz_enter() switches the timer to one-shot mode, programmed to fire
+ * on the next expiring timer in the wheel or as late as the hardware allows.
+ * The ticks skipped meanwhile are accounted all together later, exactly as if
+ * the timer IRQ fired regularly: by the timer IRQ handler when the one-shot
+ * timer fires, or by timer_nohz_exit() when another IRQ woke up the CPU
+ * earlier. In the latter case, only the whole ticks elapsed are accounted and
+ * the one-shot timer is re-armed to fire on the next tick boundary, where the
+ * periodic mode is restored: that way, the partial tick is not lost and the
+ * clock doesn't drift, no matter how often the CPU is woken up early.
+ */
+static bool nohz_active;         /* the one-shot timer is programmed */
+static u32 nohz_ticks;           /* ticks covered by the one-shot timer */
+u64 nohz_skipped_ticks;          /* timer IRQs avoided by the tickless idle */
+
+static u32 tw_ticks_to_next_expiry(u32 max_ticks)
+{
+   /* Don't skip a cascade: it might bring timers expiring soon to level 0 */
+   max_ticks = MIN(max_ticks, TW_L0_SLOTS - (tw_now & (TW_L0_SLOTS - 1)));
+
+   for (u32 i = 1; i < max_ticks; i++) {
+      if (!list_is_empty(&tw_l0[(tw_now + i) & (TW_L0_SLOTS - 1)]))
+         return i;
+   }
+
+   return max_ticks;
+}
+
+void timer_nohz_enter(void)
+{
+   u32 ticks;
+   ASSERT(!are_interrupts_enabled());
+
+   if (nohz_active)
+      return;
+
+   /* The bogoMips measurement needs all the ticks */
+   if (atomic_load_explicit(&__bogo_loops, mo_relaxed) != (u32)-1)
+      return;
+
+   spin_lock(&tw_lock);
+   {
+      ticks = tw_ticks_to_next_expiry(hw_timer_oneshot_max_ticks());
+   }
+   spin_unlock(&tw_lock);
+
+   if (ticks <= 1)
+      return; /* Nothing to skip */
+
+   nohz_ticks = hw_timer_setup_oneshot(ticks);
+   nohz_active = true;
+}
+
+void timer_nohz_exit(void)
+{
+   u32 ticks;
+   ulong var;
+
+   disable_interrupts(&var);
+   {
+      /*
+       * If the one-shot timer has already fired (or it's just about to), its
+       * IRQ is coming: let the IRQ handler account the ticks.
+       */
+      if (!nohz_active || !hw_timer_oneshot_rearm(&ticks)) {
+         enable_interrupts(&var);
+         return;
+      }
+
+      /* The one-shot timer will fire for the current (partial) tick */
+      nohz_ticks = 1;
+      nohz_skipped_ticks += ticks;
+   }
+   enable_interrupts(&var);
+
+   disable_preemption();
+   {
+      for (u32 i = 0; i < ticks; i++)
+         timer_do_tick();
+   }
+   enable_preemption();
+}
+
+static enum irq_action timer_irq_handler(void *ctx)
+{
+   u32 ticks = 1;
+   ASSERT(are_interrupts_enabled());
+
+   if (KRN_TRACK_NESTED_INTERR)
+      if (timer_nested_irq())
+         return IRQ_HANDLED;
+
+   if (KRN_NO_HZ_IDLE) {
+
+      disable_interrupts_forced();
+
+      if (nohz_active) {
+
+         /* The one-shot timer fired: go back to the periodic mode */
+         hw_timer_setup(TS_SCALE / TIMER_HZ);
+         nohz_active = false;
+         ticks = nohz_ticks;
+         nohz_skipped_ticks += ticks - 1;
+      }
+
+      enable_interrupts_forced();
+   }
+
+   for (u32 i = 0; i < ticks; i++)
+      timer_do_tick();
+
    return IRQ_HANDLED;
 }
 
@@ -348,6 +628,8 @@ struct bogo_measure_ctx {
    bool started;
    bool pass_start;
    u32 ticks;
+   struct clocksource *cs;    /* clocksource to calibrate, if any */
+   u64 cs_start;
 };
 
 static enum irq_action measure_bogomips_irq_handler(void *arg)
@@ -370,6 +652,10 @@ static enum irq_action measure_bogomips_irq_handler(void *arg)
        */
       __bogo_loops = 0;
       ctx->pass_start = true;
+
+      if (ctx->cs)
+         ctx->cs_start = ctx->cs->read();
+
       return IRQ_NOT_HANDLED;
    }
 
@@ -379,14 +665,21 @@ static enum irq_action measure_bogomips_irq_handler(void *arg)
       /* We're done */
       irq_uninstall_handler(X86_PC_TIMER_IRQ, &measure_bogomips);
 
-      disable_interrupts_forced();
+      spin_lock_irq(&__time_lock);
       {
          loops_per_tick = __bogo_loops * BOGOMIPS_CONST/MEASURE_BOGOMIPS_TICKS;
          loops_per_ms = loops_per_tick / (1000 / TIMER_HZ);
          loops_per_us = loops_per_ms / 1000;
          __bogo_loops = -1;
+
+         /* Calibrate the clocksource the same way, against the same ticks */
+         if (ctx->cs) {
+            clocksource_select(ctx->cs,
+                               ctx->cs->read() - ctx->cs_start,
+                               MEASURE_BOGOMIPS_TICKS);
+         }
       }
-      enable_interrupts_forced();
+      spin_unlock_irq(&__time_lock);
    }
 
    return IRQ_NOT_HANDLED;   /* always allow the real IRQ handler to go */
@@ -425,6 +718,7 @@ void init_timer(void)
 {
    static struct bogo_measure_ctx ctx;
    measure_bogomips.context = &ctx;
+   ctx.cs = hw_get_clocksource();
 
    __tick_duration = hw_timer_setup(TS_SCALE / TIMER_HZ);
 
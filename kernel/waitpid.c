@@ -62,7 +62,8 @@ get_task_if_changed(struct task *ti, int opts)
 {
    enum task_state s = atomic_load_explicit(&ti->state, mo_relaxed);
 
-   if (s == TASK_STATE_ZOMBIE)
+   /* The main thread might die before the others: wait for all of them */
+   if (s == TASK_STATE_ZOMBIE && list_is_empty(&ti->pi->threads))
       return ti;
 
    if (ti->stopped && !ti->was_stopped && (opts & WUNTRACED)) {
@@ -156,14 +157,19 @@ void wake_up_tasks_waiting_on(struct task *ti, enum wakeup_reason r)
 
    if (LIKELY(pi->parent_pid > 0)) {
 
-      struct task *parent_task = get_task(pi->parent_pid);
+      struct process *parent_pi = get_task(pi->parent_pid)->pi;
+      struct task *pos;
       int tid;
 
-      if (is_waiting_on_multiple_children(parent_task, &tid)      &&
-          !waitpid_should_skip_child(parent_task, ti, tid)        &&
-          is_good_reason_to_wake_up_task(&parent_task->wobj, r))
-      {
-         wake_up(parent_task);
+      /* Any thread of the parent might be waiting on its children */
+      list_for_each_ro(pos, &parent_pi->threads, thread_node) {
+
+         if (is_waiting_on_multiple_children(pos, &tid)           &&
+             !waitpid_should_skip_child(pos, ti, tid)             &&
+             is_good_reason_to_wake_up_task(&pos->wobj, r))
+         {
+            wake_up(pos);
+         }
       }
 
       send_signal(pi->parent_pid, SIGCHLD, true);
@@ -204,7 +210,10 @@ int sys_wait4(int tid, int *user_wstatus, int options, void *user_rusage)
 
          struct task *waited_task = get_task(tid);
 
-         if (!waited_task || !task_is_parent(curr, waited_task)) {
+         if (!waited_task                          ||
+             !is_main_thread(waited_task)          ||
+             !task_is_parent(curr, waited_task))
+         {
             enable_preemption();
             return -ECHILD;
          }
@@ -170,6 +170,12 @@ void wth_run(void *arg)
 
       } while (job_run);
 
+      /*
+       * Disable the preemption as well, not just the interrupts: with SMP, the
+       * other CPUs can call wth_enqueue_on() and only the preemption (the big
+       * kernel lock) excludes them.
+       */
+      disable_preemption();
       disable_interrupts_forced();
       {
          if (safe_ringbuf_is_empty(&t->rb)) {
@@ -178,6 +184,7 @@ void wth_run(void *arg)
          }
       }
       enable_interrupts_forced();
+      enable_preemption_nosched();
 
       if (t->waiting_for_jobs) {
          kcond_signal_all(&t->completion);
@@ -195,6 +202,10 @@ struct task *wth_get_runnable_thread(void)
 
       struct worker_thread *t = worker_threads[i];
 
+      /* With SMP, a runnable worker thread might be still running elsewhere */
+      if (t->task != get_curr_task() && is_task_on_cpu(t->task))
+         continue;
+
       if (t->task->state == TASK_STATE_RUNNABLE)
          if (!selected || t->priority < selected->priority)
             selected = t;
@@ -10,6 +10,7 @@
 #include <tilck/kernel/hal.h>
 #include <tilck/kernel/debug_utils.h>
 #include <tilck/kernel/cmdline.h>
+#include <tilck/kernel/smp.h>
 
 #include <tilck/mods/pci.h>
 #include <tilck/mods/acpi.h>
@@ -150,6 +151,48 @@ acpi_read_acpi_hw_flags(void)
    AcpiPutTable((struct acpi_table_header *)fadt);
 }
 
+/* Register the enabled CPUs listed in the MADT, for the SMP bring-up */
+static void
+acpi_read_madt(void)
+{
+   struct acpi_table_madt *madt;
+   ACPI_SUBTABLE_HEADER *sub;
+   ACPI_MADT_LOCAL_APIC *lapic;
+   ACPI_STATUS rc;
+   char *p, *end;
+
+   rc = AcpiGetTable(ACPI_SIG_MADT, 1, (struct acpi_table_header **)&madt);
+
+   if (rc == AE_NOT_FOUND)
+      return;
+
+   if (ACPI_FAILURE(rc)) {
+      print_acpi_failure("AcpiGetTable", "MADT", rc);
+      return;
+   }
+
+   p = (char *)(madt + 1);
+   end = (char *)madt + madt->Header.Length;
+
+   for (; p + sizeof(*sub) <= end; p += sub->Length) {
+
+      sub = (void *)p;
+
+      if (sub->Length < sizeof(*sub))
+         break; /* Corrupted table */
+
+      if (sub->Type != ACPI_MADT_TYPE_LOCAL_APIC)
+         continue;
+
+      lapic = (void *)sub;
+
+      if (lapic->LapicFlags & ACPI_MADT_ENABLED)
+         smp_register_cpu(lapic->Id);
+   }
+
+   AcpiPutTable((struct acpi_table_header *)madt);
+}
+
 void
 acpi_reboot(void)
 {
@@ -254,6 +297,9 @@ acpi_mod_init_tables(void)
 
    acpi_init_status = ais_tables_initialized;
    acpi_read_acpi_hw_flags();
+
+   if (KRN_SMP)
+      acpi_read_madt();
 }
 
 void
@@ -8,6 +8,7 @@
 #include <tilck/kernel/kmalloc.h>
 #include <tilck/kernel/errno.h>
 #include <tilck/kernel/timer.h>
+#include <tilck/kernel/spinlock.h>
 
 #include <limits.h>           // system header
 
@@ -30,12 +31,22 @@ AcpiOsCreateLock(ACPI_SPINLOCK *OutHandle)
    if (!OutHandle)
       return_ACPI_STATUS(AE_BAD_PARAMETER);
 
+#if SMP_ENABLED
+
+   if (!(*OutHandle = kzalloc_obj(struct spinlock)))
+      return_ACPI_STATUS(AE_NO_MEMORY);
+
+#else
+
    /*
-    * Tilck does not support SMP, therefore there's no need for real spinlocks:
-    * disabling the interrupts is enough. Hopefully, ACPI will accept a NULL
+    * On a single CPU there's no need for real spinlocks: disabling the
+    * interrupts is enough (see spinlock.h). Hopefully, ACPI will accept a NULL
     * value, by treating the handle as completely opaque value.
     */
    *OutHandle = NULL;
+
+#endif
+
    return_ACPI_STATUS(AE_OK);
 }
 
@@ -43,6 +54,9 @@ void
 AcpiOsDeleteLock(ACPI_SPINLOCK Handle)
 {
    ACPI_FUNCTION_TRACE(__FUNC__);
+
+   if (Handle)
+      kfree_obj(Handle, struct spinlock);
 }
 
 ACPI_CPU_FLAGS
@@ -50,7 +64,7 @@ AcpiOsAcquireLock(ACPI_SPINLOCK Handle)
 {
    ulong flags;
    ACPI_FUNCTION_TRACE(__FUNC__);
-   disable_interrupts(&flags);
+   spin_lock_irqsave(Handle, &flags);
    return_VALUE(flags);
 }
 
@@ -60,7 +74,7 @@ AcpiOsReleaseLock(
     ACPI_CPU_FLAGS          Flags)
 {
    ulong flags = (ulong) Flags;
-   enable_interrupts(&flags);
+   spin_unlock_irqrestore(Handle, &flags);
    ACPI_FUNCTION_TRACE(__FUNC__);
    return_VOID;
 }
@@ -4,6 +4,7 @@
 #include <tilck/common/printk.h>
 
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/pageframes.h>
 #include <tilck/kernel/kmalloc_debug.h>
 
 #include "termutil.h"
@@ -12,6 +13,7 @@
 static size_t heaps_alloc[KMALLOC_HEAPS_COUNT];
 static struct debug_kmalloc_heap_info hi;
 static struct debug_kmalloc_stats stats;
+static struct pf_stats pf_stats;
 static size_t tot_usable_mem_kb;
 static size_t tot_used_mem_kb;
 static long tot_diff;
@@ -40,12 +42,14 @@ static void dp_heaps_on_enter(void)
    ASSERT(tot_usable_mem_kb > 0);
 
    debug_kmalloc_get_stats(&stats);
+   pf_get_stats(&pf_stats);
 }
 
 static void dp_show_kmalloc_heaps(void)
 {
    int row = dp_screen_start_row;
    const int col = dp_start_col + 40;
+   const ulong zpool_tot = pf_stats.zpool_hits + pf_stats.zpool_misses;
 
    dp_writeln2("[      Small heaps      ]");
    dp_writeln2("count:    %3d [peak: %3d]",
@@ -65,6 +69,14 @@ static void dp_show_kmalloc_heaps(void)
               tot_diff > 0 ? "+" : " ",
               tot_diff / (long)KB,
               tot_diff);
+   dp_writeln("Pages:   %6u used, %u free",
+              pf_stats.used_pages, pf_stats.free_pages);
+   dp_writeln("Zpool:   %6u pages, hits: %u%%, %llu cycles/page",
+              pf_stats.zpool_pages,
+              zpool_tot ? pf_stats.zpool_hits * 100 / zpool_tot : 0,
+              pf_stats.zpool_refills
+                 ? pf_stats.zpool_refill_cycles / pf_stats.zpool_refills
+                 : 0);
 
    dp_writeln("");
 
@@ -24,6 +24,16 @@ static void debug_dump_slow_irq_handler_count(void)
    }
 }
 
+static void debug_dump_nohz_skipped_ticks(void)
+{
+   extern u64 nohz_skipped_ticks;
+
+   if (KRN_NO_HZ_IDLE) {
+      dp_writeln("   Ticks skipped by the tickless idle: %llu",
+                 nohz_skipped_ticks);
+   }
+}
+
 static void debug_dump_spur_irq_count(void)
 {
    extern u32 spur_irq_count;
@@ -78,6 +88,7 @@ static void dp_show_irq_stats(void)
 
    dp_writeln("Kernel IRQ-related counters");
    debug_dump_slow_irq_handler_count();
+   debug_dump_nohz_skipped_ticks();
    debug_dump_spur_irq_count();
    debug_dump_unhandled_irq_count();
    debug_dump_masked_irqs();
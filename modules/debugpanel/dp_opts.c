@@ -54,6 +54,7 @@ static void dp_show_opts(void)
    DUMP_INT_OPT(TIMER_HZ);
    DUMP_INT_OPT(KERNEL_STACK_PAGES);
    DUMP_INT_OPT(USER_STACK_PAGES);
+   DUMP_INT_OPT(ZERO_PAGE_POOL_SIZE);
 
    DUMP_LABEL("Kernel modules");
    DUMP_BOOL_OPT(MOD_acpi);
@@ -86,6 +87,7 @@ static void dp_show_opts(void)
    DUMP_BOOL_OPT(BOOT_INTERACTIVE);
    DUMP_BOOL_OPT(KERNEL_64BIT_OFFT);
    DUMP_BOOL_OPT(KRN_CLOCK_DRIFT_COMP);
+   DUMP_BOOL_OPT(KRN_HRTIMERS);
 
    DUMP_LABEL("Disabled by default");
    DUMP_BOOL_OPT(KRN_NO_SYS_WARN);
@@ -93,12 +95,15 @@ static void dp_show_opts(void)
    DUMP_BOOL_OPT(KERNEL_UBSAN);
    DUMP_BOOL_OPT(TERM_BIG_SCROLL_BUF);
    DUMP_BOOL_OPT(KRN_RESCHED_ENABLE_PREEMPT);
+   DUMP_BOOL_OPT(KRN_NO_HZ_IDLE);
+   DUMP_BOOL_OPT(KRN_SMP);
    DUMP_BOOL_OPT(KERNEL_BIG_IO_BUF);
    DUMP_BOOL_OPT(PS2_DO_SELFTEST);
    DUMP_BOOL_OPT(PS2_VERBOSE_DEBUG_LOG);
    DUMP_BOOL_OPT(KERNEL_GCOV);
    DUMP_BOOL_OPT(FORK_NO_COW);
    DUMP_BOOL_OPT(MMAP_NO_COW);
+   DUMP_BOOL_OPT(MMAP_BIG_PAGES);
    DUMP_BOOL_OPT(PANIC_SHOW_REGS);
    DUMP_BOOL_OPT(KMALLOC_HEAVY_STATS);
    DUMP_BOOL_OPT(KMALLOC_FREE_MEM_POISONING);
@@ -15,7 +15,7 @@
 #include <tilck/mods/tracing.h>
 
 #include "termutil.h"
-#define MAX_EXEC_PATH_LEN     34
+#define MAX_EXEC_PATH_LEN     27
 
 void init_dp_tracing(void);
 
@@ -90,7 +90,7 @@ debug_get_task_dump_util_str(enum task_dump_util_str t)
    static char fmt[120];
    static char hfmt[120];
    static char header[120];
-   static char hline_sep[120] = "qqqqqqqnqqqqqqnqqqqqqnqqqqqqnqqqqqnqqqqqn";
+   static char hline_sep[120] = "qqqqqqqnqqqqqqnqqqqqqnqqqqqqnqqqqqnqqqqqnqqqqqqn";
 
    static char *hline_sep_end = &hline_sep[sizeof(hline_sep)];
 
@@ -105,6 +105,7 @@ debug_get_task_dump_util_str(enum task_dump_util_str t)
                TERM_VLINE " %%-4d "
                TERM_VLINE " %%-3s "
                TERM_VLINE "  %%-2d "
+               TERM_VLINE " %%-4d "
                TERM_VLINE " %%-%ds",
                dp_start_col+1, path_field_len);
 
@@ -115,6 +116,7 @@ debug_get_task_dump_util_str(enum task_dump_util_str t)
                TERM_VLINE " %%-4s "
                TERM_VLINE " %%-3s "
                TERM_VLINE " %%-3s "
+               TERM_VLINE " %%-4s "
                TERM_VLINE " %%-%ds",
                path_field_len);
 
@@ -127,6 +129,7 @@ debug_get_task_dump_util_str(enum task_dump_util_str t)
                "ppid",
                "S",
                "tty",
+               "bigp",
                "cmdline");
 
       char *p = hline_sep + strlen(hline_sep);
@@ -187,6 +190,11 @@ static int debug_per_task_cb(void *obj, void *arg)
 
    debug_get_state_name(state_str, ti->state, ti->stopped, ti->traced);
    int ttynum = tty_get_num(ti->pi->proc_tty);
+   int big_pages = 0;
+
+   /* Zombie processes don't have a page directory anymore */
+   if (ti->state != TASK_STATE_ZOMBIE && !is_kernel_thread(ti))
+      big_pages = (int)get_user_big_pages_count(pi->pdir);
 
    if (is_kernel_thread(ti)) {
 
@@ -237,6 +245,7 @@ static int debug_per_task_cb(void *obj, void *arg)
                  pi->parent_pid,
                  state_str,
                  ttynum,
+                 big_pages,
                  buf);
 
       if (sel)
@@ -251,6 +260,7 @@ static int debug_per_task_cb(void *obj, void *arg)
                    pi->parent_pid,
                    state_str,
                    ttynum,
+                   big_pages,
                    buf);
 
       dp_write_raw("\r\n");
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+
+#include <tilck/kernel/clocksource.h>
+#include <tilck/kernel/errno.h>
+
+#include <tilck/mods/sysfs.h>
+#include <tilck/mods/sysfs_utils.h>
+
+/*
+ * The clocksource is selected after the sysfs init (its calibration takes a
+ * few ticks): read the current one every time.
+ */
+
+static offt
+cs_name_load(struct sysobj *obj, void *data, void *buf, offt buf_sz, offt off)
+{
+   ASSERT(off == 0);
+   return snprintk(buf, (size_t)buf_sz, "%s\n", get_clocksource()->name);
+}
+
+static offt
+cs_freq_load(struct sysobj *obj, void *data, void *buf, offt buf_sz, offt off)
+{
+   ASSERT(off == 0);
+   return snprintk(buf, (size_t)buf_sz, "%" PRIu64 "\n",
+                   get_clocksource()->freq);
+}
+
+static const struct sysobj_prop_type cs_name_ptype = {
+   .load = &cs_name_load
+};
+
+static const struct sysobj_prop_type cs_freq_ptype = {
+   .load = &cs_freq_load
+};
+
+DEF_STATIC_SYSOBJ_PROP(name, &cs_name_ptype);
+DEF_STATIC_SYSOBJ_PROP(freq, &cs_freq_ptype);
+
+DEF_STATIC_SYSOBJ_TYPE(clocksource_sysobj_type,
+                       &prop_name,
+                       &prop_freq,
+                       NULL);
+
+void sysfs_create_clocksource_obj(void)
+{
+   struct sysobj *obj;
+
+   obj = sysfs_create_obj(&clocksource_sysobj_type,
+                          NULL,                          /* hooks */
+                          NULL,                          /* name */
+                          NULL);                         /* freq */
+
+   if (!obj || sysfs_register_obj(NULL, &sysfs_root_obj, "clocksource", obj))
+      panic("Unable to create the sysfs clocksource obj");
+}
@@ -34,6 +34,7 @@ DEF_STATIC_CONF_RO(BOOL,   debugchecks,            DEBUG_CHECKS);
 DEF_STATIC_CONF_RO(ULONG, timer_hz,                TIMER_HZ);
 DEF_STATIC_CONF_RO(ULONG, stack_pages,             KERNEL_STACK_PAGES);
 DEF_STATIC_CONF_RO(ULONG, user_stack_pages,        USER_STACK_PAGES);
+DEF_STATIC_CONF_RO(ULONG, zero_page_pool_size,     ZERO_PAGE_POOL_SIZE);
 DEF_STATIC_CONF_RO(BOOL,  track_nested_int,        KRN_TRACK_NESTED_INTERR);
 DEF_STATIC_CONF_RO(BOOL,  panic_backtrace,         PANIC_SHOW_STACKTRACE);
 DEF_STATIC_CONF_RO(BOOL,  panic_regs,              PANIC_SHOW_REGS);
@@ -42,13 +43,17 @@ DEF_STATIC_CONF_RO(BOOL,  stack_isolation,         KERNEL_STACK_ISOLATION);
 DEF_STATIC_CONF_RO(BOOL,  symbols,                 KERNEL_SYMBOLS);
 DEF_STATIC_CONF_RO(BOOL,  printk_on_curr_tty,      KRN_PRINTK_ON_CURR_TTY);
 DEF_STATIC_CONF_RO(BOOL,  resched_enable_preempt,  KRN_RESCHED_ENABLE_PREEMPT);
+DEF_STATIC_CONF_RO(BOOL,  no_hz_idle,              KRN_NO_HZ_IDLE);
+DEF_STATIC_CONF_RO(BOOL,  smp,                     KRN_SMP);
 DEF_STATIC_CONF_RO(BOOL,  big_io_buf,              KERNEL_BIG_IO_BUF);
 DEF_STATIC_CONF_RO(BOOL,  gcov,                    KERNEL_GCOV);
 DEF_STATIC_CONF_RO(BOOL,  fork_no_cow,             FORK_NO_COW);
 DEF_STATIC_CONF_RO(BOOL,  mmap_no_cow,             MMAP_NO_COW);
+DEF_STATIC_CONF_RO(BOOL,  mmap_big_pages,          MMAP_BIG_PAGES);
 DEF_STATIC_CONF_RO(BOOL,  ubsan,                   KERNEL_UBSAN);
 DEF_STATIC_CONF_RO(BOOL,  kernel_64bit_offt,       KERNEL_64BIT_OFFT);
 DEF_STATIC_CONF_RO(BOOL,  clock_drift_comp,        KRN_CLOCK_DRIFT_COMP);
+DEF_STATIC_CONF_RO(BOOL,  hrtimers,                KRN_HRTIMERS);
 
 /* config/console */
 DEF_STATIC_CONF_RO(ULONG, big_font_threshold,      FBCON_BIGFONT_THR);
@@ -97,6 +102,7 @@ void sysfs_create_config_obj(void)
       SYSOBJ_CONF_PROP_PAIR(timer_hz),
       SYSOBJ_CONF_PROP_PAIR(stack_pages),
       SYSOBJ_CONF_PROP_PAIR(user_stack_pages),
+      SYSOBJ_CONF_PROP_PAIR(zero_page_pool_size),
       SYSOBJ_CONF_PROP_PAIR(track_nested_int),
       SYSOBJ_CONF_PROP_PAIR(panic_backtrace),
       SYSOBJ_CONF_PROP_PAIR(panic_regs),
@@ -105,13 +111,17 @@ void sysfs_create_config_obj(void)
       SYSOBJ_CONF_PROP_PAIR(symbols),
       SYSOBJ_CONF_PROP_PAIR(printk_on_curr_tty),
       SYSOBJ_CONF_PROP_PAIR(resched_enable_preempt),
+      SYSOBJ_CONF_PROP_PAIR(no_hz_idle),
+      SYSOBJ_CONF_PROP_PAIR(smp),
       SYSOBJ_CONF_PROP_PAIR(big_io_buf),
       SYSOBJ_CONF_PROP_PAIR(gcov),
       SYSOBJ_CONF_PROP_PAIR(fork_no_cow),
       SYSOBJ_CONF_PROP_PAIR(mmap_no_cow),
+      SYSOBJ_CONF_PROP_PAIR(mmap_big_pages),
       SYSOBJ_CONF_PROP_PAIR(ubsan),
       SYSOBJ_CONF_PROP_PAIR(kernel_64bit_offt),
       SYSOBJ_CONF_PROP_PAIR(clock_drift_comp),
+      SYSOBJ_CONF_PROP_PAIR(hrtimers),
       NULL
    );
 
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+
+#include <tilck/kernel/hrtimer.h>
+#include <tilck/kernel/errno.h>
+
+#include <tilck/mods/sysfs.h>
+#include <tilck/mods/sysfs_utils.h>
+
+/*
+ * Unlike /syst/config/hrtimers, this tells whether the high-resolution timers
+ * are actually in use: the hardware might not support them.
+ */
+
+static offt
+hrt_avail_load(struct sysobj *obj, void *data, void *buf, offt buf_sz, offt off)
+{
+   ASSERT(off == 0);
+   return snprintk(buf, (size_t)buf_sz, "%d\n", hrtimers_available());
+}
+
+static const struct sysobj_prop_type hrt_avail_ptype = {
+   .load = &hrt_avail_load
+};
+
+DEF_STATIC_SYSOBJ_PROP(available, &hrt_avail_ptype);
+
+DEF_STATIC_SYSOBJ_TYPE(hrtimers_sysobj_type,
+                       &prop_available,
+                       NULL);
+
+void sysfs_create_hrtimers_obj(void)
+{
+   struct sysobj *obj;
+
+   obj = sysfs_create_obj(&hrtimers_sysobj_type,
+                          NULL,                          /* hooks */
+                          NULL);                         /* available */
+
+   if (!obj || sysfs_register_obj(NULL, &sysfs_root_obj, "hrtimers", obj))
+      panic("Unable to create the sysfs hrtimers obj");
+}
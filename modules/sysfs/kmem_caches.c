@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+
+#include <tilck/kernel/kmem_cache.h>
+#include <tilck/kernel/errno.h>
+
+#include <tilck/mods/sysfs.h>
+#include <tilck/mods/sysfs_utils.h>
+
+DEF_STATIC_SYSOBJ_PROP(obj_size, &sysobj_ptype_ro_ulong_literal);
+DEF_STATIC_SYSOBJ_PROP(slab_size, &sysobj_ptype_ro_ulong_literal);
+DEF_STATIC_SYSOBJ_PROP(objs_per_slab, &sysobj_ptype_ro_ulong_literal);
+DEF_STATIC_SYSOBJ_PROP(slabs, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(objs_in_use, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(hits, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(misses, &sysobj_ptype_ro_ulong);
+
+DEF_STATIC_SYSOBJ_TYPE(kmem_cache_sysobj_type,
+                       &prop_obj_size,
+                       &prop_slab_size,
+                       &prop_objs_per_slab,
+                       &prop_slabs,
+                       &prop_objs_in_use,
+                       &prop_hits,
+                       &prop_misses,
+                       NULL);
+
+static int
+create_kmem_cache_sysobj(struct kmem_cache *c, void *arg)
+{
+   struct sysobj *parent = arg;
+   struct sysobj *obj;
+
+   obj = sysfs_create_obj(&kmem_cache_sysobj_type,
+                          NULL,                          /* hooks */
+                          TO_PTR(c->obj_size),           /* obj_size */
+                          TO_PTR(c->slab_size),          /* slab_size */
+                          TO_PTR(c->objs_per_slab),      /* objs_per_slab */
+                          &c->slabs,                     /* slabs */
+                          &c->objs_in_use,               /* objs_in_use */
+                          &c->hits,                      /* hits */
+                          &c->misses);                   /* misses */
+
+   if (!obj)
+      return -ENOMEM;
+
+   return sysfs_register_obj(NULL, parent, c->name, obj);
+}
+
+void sysfs_create_kmem_caches_obj(void)
+{
+   struct sysobj *caches;
+
+   if (!(caches = sysfs_create_empty_obj()))
+      goto fail;
+
+   if (sysfs_register_obj(NULL, &sysfs_root_obj, "kmem_caches", caches))
+      goto fail;
+
+   if (iterate_over_kmem_caches(&create_kmem_cache_sysobj, caches))
+      goto fail;
+
+   /* Success */
+   return;
+
+fail:
+   panic("Unable to create the sysfs kmem_caches obj");
+}
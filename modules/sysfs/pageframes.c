@@ -0,0 +1,41 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+
+#include <tilck/kernel/pageframes.h>
+#include <tilck/kernel/errno.h>
+
+#include <tilck/mods/sysfs.h>
+#include <tilck/mods/sysfs_utils.h>
+
+DEF_STATIC_SYSOBJ_PROP(chunks, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(free_pages, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(used_pages, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(zpool_pages, &sysobj_ptype_ro_ulong);
+DEF_STATIC_SYSOBJ_PROP(reclaimed_pages, &sysobj_ptype_ro_ulong);
+
+DEF_STATIC_SYSOBJ_TYPE(pageframes_sysobj_type,
+                       &prop_chunks,
+                       &prop_free_pages,
+                       &prop_used_pages,
+                       &prop_zpool_pages,
+                       &prop_reclaimed_pages,
+                       NULL);
+
+void sysfs_create_pageframes_obj(void)
+{
+   struct pf_stats *s = (struct pf_stats *)pf_get_live_stats();
+   struct sysobj *obj;
+
+   obj = sysfs_create_obj(&pageframes_sysobj_type,
+                          NULL,                          /* hooks */
+                          &s->chunks,                    /* chunks */
+                          &s->free_pages,                /* free_pages */
+                          &s->used_pages,                /* used_pages */
+                          &s->zpool_pages,               /* zpool_pages */
+                          &s->reclaimed_pages);          /* reclaimed_pages */
+
+   if (!obj || sysfs_register_obj(NULL, &sysfs_root_obj, "pageframes", obj))
+      panic("Unable to create the sysfs pageframes obj");
+}
@@ -25,6 +25,10 @@
 #include "lock_and_retain.c.h"
 
 void sysfs_create_config_obj(void);
+void sysfs_create_kmem_caches_obj(void);
+void sysfs_create_pageframes_obj(void);
+void sysfs_create_clocksource_obj(void);
+void sysfs_create_hrtimers_obj(void);
 static struct mnt_fs *sysfs;
 
 static int
@@ -756,6 +760,10 @@ init_sysfs(void)
       panic("Unable to create default objects");
 
    sysfs_create_config_obj();
+   sysfs_create_kmem_caches_obj();
+   sysfs_create_pageframes_obj();
+   sysfs_create_clocksource_obj();
+   sysfs_create_hrtimers_obj();
 }
 
 static struct module sysfs_module = {
@@ -32,6 +32,13 @@ static const struct syscall_info __tracing_metadata[] =
    SYSCALL_TYPE_1(SYS_dup, "dup"),
    SYSCALL_TYPE_1(SYS_getpgid, "pid"),
    SYSCALL_TYPE_1(SYS_getsid, "pid"),
+   SYSCALL_TYPE_1(SYS_sched_getscheduler, "pid"),
+   SYSCALL_TYPE_1(SYS_sched_get_priority_max, "policy"),
+   SYSCALL_TYPE_1(SYS_sched_get_priority_min, "policy"),
+
+#if defined(__i386__)
+   SYSCALL_TYPE_1(SYS_nice, "inc"),
+#endif
 
    SYSCALL_TYPE_2(SYS_creat, "path", "mode"),
    SYSCALL_TYPE_2(SYS_chmod, "path", "mode"),
@@ -48,6 +55,7 @@ static const struct syscall_info __tracing_metadata[] =
 
    SYSCALL_TYPE_5(SYS_setpgid, "pid", "pgid"),
    SYSCALL_TYPE_5(SYS_dup2, "oldfd", "newfd"),
+   SYSCALL_TYPE_5(SYS_getpriority, "which", "who"),
 
 #if defined(__i386__)
    SYSCALL_TYPE_6(SYS_chown16, "path", "owner", "group"),
@@ -116,6 +124,35 @@ static const struct syscall_info __tracing_metadata[] =
       .params = { }
    },
 
+   {
+      .sys_n = SYS_clone,
+      .n_params = 5,
+      .exp_block = false,
+      .ret_type = &ptype_errno_or_val,
+      .params = {
+         SIMPLE_PARAM("flags", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("newsp", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("parent_tid", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("tls", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("child_tid", &ptype_voidp, sys_param_in),
+      },
+   },
+
+   {
+      .sys_n = SYS_futex,
+      .n_params = 6,
+      .exp_block = true,
+      .ret_type = &ptype_errno_or_val,
+      .params = {
+         SIMPLE_PARAM("uaddr", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("op", &ptype_int, sys_param_in),
+         SIMPLE_PARAM("val", &ptype_int, sys_param_in),
+         SIMPLE_PARAM("timeout", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("uaddr2", &ptype_voidp, sys_param_in),
+         SIMPLE_PARAM("val3", &ptype_int, sys_param_in),
+      },
+   },
+
    {
       .sys_n = SYS_getcwd,
       .n_params = 2,
@@ -41,7 +41,7 @@ class printer_struct_task:
          ("timeslice_ticks     ", task['ticks']['timeslice']),
          ("total_ticks         ", task['ticks']['total']),
          ("total_kernel_ticks  ", task['ticks']['total_kernel']),
-         ("ticks_before_wake_up", task['ticks_before_wake_up']),
+         ("wakeup_timer_expire ", task['wakeup_timer_expire']),
          ("timer_ready         ", task['timer_ready']),
          ("wobj                ", task['wobj']),
          ("state_regs          ", state_regs),
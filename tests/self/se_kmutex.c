@@ -427,3 +427,163 @@ end:
 }
 
 REGISTER_SELF_TEST(kmutex_ord, se_med, &selftest_kmutex_ord)
+
+/* -------------------------------------------------- */
+/*             Priority inheritance test              */
+/* -------------------------------------------------- */
+
+/*
+ * HOW IT WORKS
+ * --------------
+ *
+ * The classic priority inversion, with a chain of two mutexes: the `low` task
+ * (RT prio 10) holds pi_mutex2 while doing PI_HOLD_MS of CPU work; the `mid`
+ * task (prio 15) holds pi_mutex1 and waits for pi_mutex2; the `high` task
+ * (prio 30) waits for pi_mutex1. Meanwhile, the `hog` task (prio 20) burns the
+ * CPU for PI_HOG_MS.
+ *
+ * Without priority inheritance, `hog` preempts `low` and `high` waits for at
+ * least PI_HOG_MS. With it, `low` runs with the priority of `high` (through
+ * `mid`) until it releases pi_mutex2: the wait of `high` is bounded by the
+ * critical sections of `low` and `mid`, not by the unrelated `hog` task.
+ *
+ * The test thread itself runs at the highest priority, in order to create the
+ * other threads in the right order while they're busy.
+ */
+
+#define PI_HOLD_MS                100
+#define PI_HOG_MS                1000
+
+#define PI_LOW_PRIO                10
+#define PI_MID_PRIO                15
+#define PI_HOG_PRIO                20
+#define PI_HIGH_PRIO               30
+#define PI_TEST_PRIO               40
+
+static struct kmutex pi_mutex1;
+static struct kmutex pi_mutex2;
+static volatile int pi_stage;
+static volatile int pi_low_max_prio;
+static volatile int pi_mid_max_prio;
+static volatile u64 pi_high_wait_ticks;
+
+static void pi_set_curr_prio(int prio)
+{
+   disable_preemption();
+   {
+      task_set_sched_policy(get_curr_task(),
+                            prio ? SCHED_FIFO : SCHED_OTHER,
+                            prio);
+   }
+   enable_preemption();
+}
+
+static void pi_wait_for_stage(int stage)
+{
+   while (pi_stage < stage)
+      kernel_sleep(1);
+}
+
+static void pi_low_thread(void *unused)
+{
+   u64 end;
+
+   pi_set_curr_prio(PI_LOW_PRIO);
+   kmutex_lock(&pi_mutex2);
+   {
+      pi_stage = 1;
+      end = get_ticks() + ms_to_ticks(PI_HOLD_MS);
+
+      while (get_ticks() < end) {
+         pi_low_max_prio = MAX(pi_low_max_prio, get_curr_task()->rt_prio);
+      }
+   }
+   kmutex_unlock(&pi_mutex2);
+
+   /* The inherited priority must be dropped on unlock */
+   VERIFY(get_curr_task()->rt_prio == PI_LOW_PRIO);
+}
+
+static void pi_mid_thread(void *unused)
+{
+   pi_set_curr_prio(PI_MID_PRIO);
+   kmutex_lock(&pi_mutex1);
+   {
+      pi_stage = 2;
+      kmutex_lock(&pi_mutex2);
+      {
+         pi_mid_max_prio = get_curr_task()->rt_prio;
+      }
+      kmutex_unlock(&pi_mutex2);
+   }
+   kmutex_unlock(&pi_mutex1);
+   VERIFY(get_curr_task()->rt_prio == PI_MID_PRIO);
+}
+
+static void pi_high_thread(void *unused)
+{
+   u64 start;
+
+   pi_set_curr_prio(PI_HIGH_PRIO);
+   pi_stage = 3;
+   start = get_ticks();
+
+   kmutex_lock(&pi_mutex1);
+   {
+      pi_high_wait_ticks = get_ticks() - start;
+   }
+   kmutex_unlock(&pi_mutex1);
+}
+
+static void pi_hog_thread(void *unused)
+{
+   u64 end;
+
+   pi_set_curr_prio(PI_HOG_PRIO);
+   end = get_ticks() + ms_to_ticks(PI_HOG_MS);
+
+   while (get_ticks() < end) { }
+}
+
+void selftest_kmutex_pi()
+{
+   int local_tids[4];
+
+   pi_stage = 0;
+   pi_low_max_prio = pi_mid_max_prio = 0;
+   pi_high_wait_ticks = 0;
+   kmutex_init(&pi_mutex1, 0);
+   kmutex_init(&pi_mutex2, 0);
+   pi_set_curr_prio(PI_TEST_PRIO);
+
+   local_tids[0] = kthread_create(&pi_low_thread, 0, NULL);
+   VERIFY(local_tids[0] > 0);
+   pi_wait_for_stage(1);
+
+   local_tids[1] = kthread_create(&pi_mid_thread, 0, NULL);
+   VERIFY(local_tids[1] > 0);
+   pi_wait_for_stage(2);
+
+   local_tids[2] = kthread_create(&pi_high_thread, 0, NULL);
+   VERIFY(local_tids[2] > 0);
+   pi_wait_for_stage(3);
+
+   local_tids[3] = kthread_create(&pi_hog_thread, 0, NULL);
+   VERIFY(local_tids[3] > 0);
+
+   pi_set_curr_prio(0);
+   kthread_join_all(local_tids, ARRAY_SIZE(local_tids), true);
+
+   printk("high prio task waited: %u ms (hog: %u ms)\n",
+          (u32)(pi_high_wait_ticks * 1000 / TIMER_HZ), PI_HOG_MS);
+
+   VERIFY(pi_low_max_prio == PI_HIGH_PRIO);
+   VERIFY(pi_mid_max_prio == PI_HIGH_PRIO);
+   VERIFY(pi_high_wait_ticks < ms_to_ticks(PI_HOG_MS / 2));
+
+   kmutex_destroy(&pi_mutex2);
+   kmutex_destroy(&pi_mutex1);
+   se_regular_end();
+}
+
+REGISTER_SELF_TEST(kmutex_pi, se_med, &selftest_kmutex_pi)
@@ -0,0 +1,80 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <tilck/common/basic_defs.h>
+#include <tilck/common/printk.h>
+
+#include <tilck/kernel/hal.h>
+#include <tilck/kernel/sched.h>
+#include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/timer.h>
+#include <tilck/kernel/self_tests.h>
+
+static volatile bool sched_perf_stop;
+static volatile u64 sched_perf_switches;
+
+static void sched_perf_thread(void *unused)
+{
+   while (!sched_perf_stop) {
+      kernel_yield();
+      sched_perf_switches++;
+   }
+}
+
+static void sched_perf_run(int count)
+{
+   u64 start, duration, switches;
+   int *tids;
+   int n;
+
+   tids = kalloc_array_obj(int, count);
+   VERIFY(tids != NULL);
+
+   sched_perf_stop = false;
+
+   for (n = 0; n < count; n++) {
+
+      tids[n] = kthread_create(sched_perf_thread, 0, NULL);
+
+      if (tids[n] < 0) {
+         printk("Unable to create more than %d threads\n", n);
+         break;
+      }
+   }
+
+   /* Let all the threads start, before measuring */
+   kernel_sleep(TIMER_HZ / 10);
+
+   /* While we're sleeping, only the test threads are runnable */
+   switches = sched_perf_switches;
+   start = RDTSC();
+   kernel_sleep(TIMER_HZ / 2);
+   duration = RDTSC() - start;
+   switches = sched_perf_switches - switches;
+
+   sched_perf_stop = true;
+   kthread_join_all(tids, (size_t)n, true);
+   kfree_array_obj(tids, int, count);
+
+   printk("Runnable tasks: %4d, cycles per yield: %" PRIu64 "\n",
+          n, switches ? duration / switches : 0);
+}
+
+void selftest_sched_perf(void)
+{
+   static const int counts[] = { 10, 100, 1000 };
+
+   for (int i = 0; i < ARRAY_SIZE(counts); i++) {
+
+      if (se_is_stop_requested())
+         break;
+
+      sched_perf_run(counts[i]);
+   }
+
+   if (se_is_stop_requested())
+      se_interrupted_end();
+   else
+      se_regular_end();
+}
+
+REGISTER_SELF_TEST(sched_perf, se_long, &selftest_sched_perf)
@@ -22,11 +22,21 @@ CMD_ENTRY(bad_read,     TT_SHORT,  true)
 CMD_ENTRY(bad_write,    TT_SHORT,  true)
 CMD_ENTRY(fork_perf,    TT_LONG,   true)
 CMD_ENTRY(vfork_perf,   TT_LONG,   true)
+CMD_ENTRY(fork_perf2,   TT_LONG,   true)
+CMD_ENTRY(thread_perf,  TT_LONG,   true)
+CMD_ENTRY(mutex_perf,   TT_LONG,   true)
+CMD_ENTRY(threads0,     TT_SHORT,  true)
+CMD_ENTRY(futex0,       TT_SHORT,  true)
 CMD_ENTRY(syscall_perf, TT_MED,    true)
+CMD_ENTRY(nanosleep,    TT_SHORT,  true)
 CMD_ENTRY(fpu,          TT_SHORT,  true)
 CMD_ENTRY(brk,          TT_SHORT,  true)
 CMD_ENTRY(mmap,         TT_MED,    true)
 CMD_ENTRY(mmap2,        TT_SHORT,  true)
+CMD_ENTRY(mmap_big,     TT_SHORT,  true)
+CMD_ENTRY(mmap_fixed,   TT_SHORT,  true)
+CMD_ENTRY(mremap,       TT_MED,    true)
+CMD_ENTRY(madvise,      TT_SHORT,  true)
 CMD_ENTRY(kcow,         TT_SHORT,  true)
 CMD_ENTRY(wpid1,        TT_SHORT,  true)
 CMD_ENTRY(wpid2,        TT_SHORT,  true)
@@ -52,6 +62,7 @@ CMD_ENTRY(fs6,          TT_SHORT,  true)
 CMD_ENTRY(fs7,          TT_SHORT,  true)
 CMD_ENTRY(fs_perf1,     TT_SHORT,  true)
 CMD_ENTRY(fs_perf2,     TT_SHORT,  true)
+CMD_ENTRY(fs_perf3,     TT_SHORT,  true)
 CMD_ENTRY(fmmap1,       TT_SHORT,  true)
 CMD_ENTRY(fmmap2,       TT_SHORT,  true)
 CMD_ENTRY(fmmap3,       TT_SHORT,  true)
@@ -96,3 +107,4 @@ CMD_ENTRY(sigsegv3,     TT_SHORT,  true)
 CMD_ENTRY(sigsegv4,     TT_SHORT,  true)
 CMD_ENTRY(sigsegv5,     TT_SHORT,  true)
 CMD_ENTRY(getuids,      TT_SHORT,  true)
+CMD_ENTRY(sched,        TT_SHORT,  true)
@@ -13,6 +13,9 @@
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/mman.h>
+#include <pthread.h>
+#include <time.h>
+#include <linux/futex.h>
 
 #include "devshell.h"
 #include "sysenter.h"
@@ -83,9 +86,8 @@ int cmd_fork0(int argc, char **argv)
    return fork_test(&fork);
 }
 
-static int do_fork_perf(int (*fork_func)(void))
+static int do_fork_perf(int (*fork_func)(void), int iters)
 {
-   const int iters = 150000;
    int rc, wstatus, child_pid;
    ull_t start, duration;
 
@@ -128,12 +130,148 @@ int cmd_fork_se(int argc, char **argv)
 
 int cmd_fork_perf(int argc, char **argv)
 {
-   return do_fork_perf(&fork);
+   return do_fork_perf(&fork, 150000);
 }
 
 int cmd_vfork_perf(int argc, char **argv)
 {
-   return do_fork_perf(&vfork);
+   return do_fork_perf(&vfork, 150000);
+}
+
+/* Like fork_perf, but with a parent having a lot of memory mapped */
+int cmd_fork_perf2(int argc, char **argv)
+{
+   const size_t alloc_size = 1 * MB;    /* small enough to avoid big pages */
+   const int count = 16;
+   char *arr[16];
+   int rc;
+
+   for (int i = 0; i < count; i++) {
+
+      arr[i] = mmap(NULL,
+                    alloc_size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE,
+                    -1,
+                    0);
+
+      if (arr[i] == (void *)-1) {
+         perror("mmap() failed");
+         return 1;
+      }
+
+      /* Touch all the pages, in order to make them to be really allocated */
+      for (size_t off = 0; off < alloc_size; off += 4 * KB)
+         arr[i][off] = 1;
+   }
+
+   rc = do_fork_perf(&fork, 15000);
+
+   for (int i = 0; i < count; i++)
+      munmap(arr[i], alloc_size);
+
+   return rc;
+}
+
+/*
+ * NOTE: Tilck does not support PROT_NONE mappings, so the threads cannot have
+ * a guard page below their stack.
+ */
+static void thread_attr_init(pthread_attr_t *attr)
+{
+   pthread_attr_init(attr);
+   pthread_attr_setguardsize(attr, 0);
+   pthread_attr_setstacksize(attr, 64 * KB);
+}
+
+static void *thread_nop(void *arg)
+{
+   return arg;
+}
+
+/* Like fork_perf, but creating and joining threads instead of processes */
+int cmd_thread_perf(int argc, char **argv)
+{
+   const int iters = 20000;
+   pthread_attr_t attr;
+   pthread_t th;
+   ull_t start, duration;
+   int rc;
+
+   thread_attr_init(&attr);
+   start = RDTSC();
+
+   for (int i = 0; i < iters; i++) {
+
+      if ((rc = pthread_create(&th, &attr, &thread_nop, NULL))) {
+         printf("pthread_create() failed: %s\n", strerror(rc));
+         return 1;
+      }
+
+      if ((rc = pthread_join(th, NULL))) {
+         printf("pthread_join() failed: %s\n", strerror(rc));
+         return 1;
+      }
+   }
+
+   duration = RDTSC() - start;
+   printf("duration: %llu\n", duration/iters);
+   pthread_attr_destroy(&attr);
+   return 0;
+}
+
+#define MUTEX_PERF_THREADS          4
+#define MUTEX_PERF_ITERS        50000
+
+static pthread_mutex_t perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile int perf_counter;
+
+static void *mutex_perf_func(void *arg)
+{
+   for (int i = 0; i < MUTEX_PERF_ITERS; i++) {
+
+      pthread_mutex_lock(&perf_mutex);
+      {
+         perf_counter++;
+
+         /* Make the critical section long enough to get preempted in it */
+         for (volatile int j = 0; j < 50; j++) { }
+      }
+      pthread_mutex_unlock(&perf_mutex);
+   }
+
+   return NULL;
+}
+
+/* Measure the cost of lock + unlock on a mutex contended by a few threads */
+int cmd_mutex_perf(int argc, char **argv)
+{
+   const int tot = MUTEX_PERF_THREADS * MUTEX_PERF_ITERS;
+   pthread_t th[MUTEX_PERF_THREADS];
+   pthread_attr_t attr;
+   ull_t start, duration;
+   int rc;
+
+   thread_attr_init(&attr);
+   perf_counter = 0;
+   start = RDTSC();
+
+   for (int i = 0; i < MUTEX_PERF_THREADS; i++) {
+      rc = pthread_create(&th[i], &attr, &mutex_perf_func, NULL);
+      DEVSHELL_CMD_ASSERT(rc == 0);
+   }
+
+   for (int i = 0; i < MUTEX_PERF_THREADS; i++) {
+      rc = pthread_join(th[i], NULL);
+      DEVSHELL_CMD_ASSERT(rc == 0);
+   }
+
+   duration = RDTSC() - start;
+   DEVSHELL_CMD_ASSERT(perf_counter == tot);
+
+   printf("duration: %llu\n", duration/tot);
+   pthread_attr_destroy(&attr);
+   return 0;
 }
 
 int cmd_execve0(int argc, char **argv)
@@ -295,3 +433,126 @@ int cmd_vfork0(int argc, char **argv)
    print_waitpid_change(pid, wstatus);
    return failed;
 }
+
+static volatile int threads0_counter;
+
+static void *threads0_func(void *arg)
+{
+   __atomic_fetch_add(&threads0_counter, 1, __ATOMIC_SEQ_CST);
+   *(int *)arg = (int)syscall(SYS_gettid);
+   return arg;
+}
+
+static void *threads0_exit_func(void *arg)
+{
+   exit(42);   /* exit_group(): kills the whole process */
+}
+
+int cmd_threads0(int argc, char **argv)
+{
+   const int count = 4;
+   int tids[4];
+   pthread_t th[4];
+   pthread_attr_t attr;
+   void *ret;
+   int rc, pid, wstatus;
+
+   thread_attr_init(&attr);
+
+   for (int i = 0; i < count; i++) {
+      rc = pthread_create(&th[i], &attr, &threads0_func, &tids[i]);
+      DEVSHELL_CMD_ASSERT(rc == 0);
+   }
+
+   for (int i = 0; i < count; i++) {
+      rc = pthread_join(th[i], &ret);
+      DEVSHELL_CMD_ASSERT(rc == 0);
+      DEVSHELL_CMD_ASSERT(ret == &tids[i]);
+   }
+
+   DEVSHELL_CMD_ASSERT(threads0_counter == count);
+
+   /* Each thread has its own TID, different from the PID */
+   for (int i = 0; i < count; i++) {
+
+      DEVSHELL_CMD_ASSERT(tids[i] > 0 && tids[i] != getpid());
+
+      for (int j = 0; j < i; j++)
+         DEVSHELL_CMD_ASSERT(tids[i] != tids[j]);
+   }
+
+   printf(STR_PARENT "Threads joined, now test exit() from a thread\n");
+   pid = fork();
+   DEVSHELL_CMD_ASSERT(pid >= 0);
+
+   if (!pid) {
+
+      if (pthread_create(&th[0], &attr, &threads0_exit_func, NULL))
+         exit(1);
+
+      /* The main thread should be killed while sleeping here */
+      sleep(10);
+      exit(2);
+   }
+
+   rc = waitpid(pid, &wstatus, 0);
+   DEVSHELL_CMD_ASSERT(rc == pid);
+   print_waitpid_change(pid, wstatus);
+
+   DEVSHELL_CMD_ASSERT(WIFEXITED(wstatus));
+   DEVSHELL_CMD_ASSERT(WEXITSTATUS(wstatus) == 42);
+
+   pthread_attr_destroy(&attr);
+   return 0;
+}
+
+static int futex0_var;
+
+static long sys_futex(int *uaddr, int op, int val, struct timespec *tp)
+{
+   return syscall(SYS_futex, uaddr, op, val, tp, NULL, 0);
+}
+
+static void *futex0_waker(void *arg)
+{
+   usleep(50 * 1000);
+   __atomic_store_n(&futex0_var, 1, __ATOMIC_SEQ_CST);
+   return (void *)sys_futex(&futex0_var, FUTEX_WAKE_PRIVATE, 1, NULL);
+}
+
+int cmd_futex0(int argc, char **argv)
+{
+   struct timespec ts = { .tv_sec = 0, .tv_nsec = 10 * 1000 * 1000 };
+   pthread_attr_t attr;
+   pthread_t th;
+   void *ret;
+   long rc;
+
+   /* The value does not match: FUTEX_WAIT must not sleep */
+   rc = sys_futex(&futex0_var, FUTEX_WAIT_PRIVATE, 1, NULL);
+   DEVSHELL_CMD_ASSERT(rc < 0 && errno == EAGAIN);
+
+   /* Nobody wakes us up: the timeout has to expire */
+   rc = sys_futex(&futex0_var, FUTEX_WAIT_PRIVATE, 0, &ts);
+   DEVSHELL_CMD_ASSERT(rc < 0 && errno == ETIMEDOUT);
+
+   /* No waiters: nobody to wake up */
+   rc = sys_futex(&futex0_var, FUTEX_WAKE_PRIVATE, 1, NULL);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+
+   thread_attr_init(&attr);
+   rc = pthread_create(&th, &attr, &futex0_waker, NULL);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+
+   while (!__atomic_load_n(&futex0_var, __ATOMIC_SEQ_CST)) {
+      rc = sys_futex(&futex0_var, FUTEX_WAIT_PRIVATE, 0, NULL);
+      DEVSHELL_CMD_ASSERT(rc == 0 || errno == EAGAIN);
+   }
+
+   rc = pthread_join(th, &ret);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+   DEVSHELL_CMD_ASSERT(ret == (void *)1 || ret == (void *)0);
+
+   pthread_attr_destroy(&attr);
+   return 0;
+}
@@ -109,3 +109,66 @@ int cmd_fs_perf2(int argc, char **argv)
    DEVSHELL_CMD_ASSERT(rc == 0);
    return 0;
 }
+
+/*
+ * Like fs_perf2, but with a 1 MB buffer: each write() and read() must move the
+ * whole buffer in a single call, with no bounce through a kernel buffer.
+ */
+int cmd_fs_perf3(int argc, char **argv)
+{
+   const int n = 4;
+   const size_t buf_size = 1 * MB;
+   char path[256];
+   char *buf;
+   int fd, rc;
+   u64 start, end, w_elapsed, r_elapsed;
+   const char *dest_dir = argc > 0 ? argv[0] : "/tmp";
+
+   printf("Using '%s' as test dir\n", dest_dir);
+
+   buf = malloc(buf_size);
+   DEVSHELL_CMD_ASSERT(buf != NULL);
+   memset(buf, 'a', buf_size);
+
+   sprintf(path, "%s/test_file", dest_dir);
+   fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+   DEVSHELL_CMD_ASSERT(fd > 0);
+
+   start = RDTSC();
+
+   for (int i = 0; i < n; i++) {
+      rc = write(fd, buf, buf_size);
+      DEVSHELL_CMD_ASSERT(rc == (int)buf_size);
+   }
+
+   end = RDTSC();
+   w_elapsed = end - start;
+
+   rc = (int)lseek(fd, 0, SEEK_SET);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+   memset(buf, 0, buf_size);
+
+   start = RDTSC();
+
+   for (int i = 0; i < n; i++) {
+      rc = read(fd, buf, buf_size);
+      DEVSHELL_CMD_ASSERT(rc == (int)buf_size);
+   }
+
+   end = RDTSC();
+   r_elapsed = end - start;
+   close(fd);
+
+   DEVSHELL_CMD_ASSERT(buf[0] == 'a' && buf[buf_size - 1] == 'a');
+
+   printf("Tot written and read: %d MB, buffer: 1 MB\n", n);
+   printf("Avg. write() cost per KB: %4" PRIu64 " cycles\n",
+          w_elapsed / (n * KB));
+   printf("Avg. read() cost per KB:  %4" PRIu64 " cycles\n",
+          r_elapsed / (n * KB));
+
+   free(buf);
+   rc = unlink(path);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+   return 0;
+}
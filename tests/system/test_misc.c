@@ -14,6 +14,8 @@
 #include <sys/syscall.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sched.h>
 
 #include "devshell.h"
 #include "sysenter.h"
@@ -113,6 +115,7 @@ int cmd_syscall_perf(int argc, char **argv)
    const int iters = 1000;
    ull_t start, duration;
    ull_t best = (ull_t) -1;
+   struct timespec ts, ts2;
 
    for (int j = 0; j < major_iters; j++) {
 
@@ -144,6 +147,190 @@ int cmd_syscall_perf(int argc, char **argv)
    }
 
    printf("sysenter getuid(): %llu cycles\n", best/iters);
+   best = (ull_t) -1;
+
+   for (int j = 0; j < major_iters; j++) {
+
+      start = RDTSC();
+
+      for (int i = 0; i < iters; i++)
+         syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+
+      duration = RDTSC() - start;
+
+      if (duration < best)
+         best = duration;
+   }
+
+   printf("int 0x80 clock_gettime(): %llu cycles\n", best/iters);
+   best = (ull_t) -1;
+
+   for (int j = 0; j < major_iters; j++) {
+
+      start = RDTSC();
+
+      for (int i = 0; i < iters; i++)
+         clock_gettime(CLOCK_MONOTONIC, &ts);
+
+      duration = RDTSC() - start;
+
+      if (duration < best)
+         best = duration;
+   }
+
+   printf("vDSO clock_gettime(): %llu cycles\n", best/iters);
+
+   /* The vDSO and the syscall must agree: the time never goes back */
+   for (int i = 0; i < iters; i++) {
+
+      syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+      clock_gettime(CLOCK_MONOTONIC, &ts2);
+
+      if (ts2.tv_sec < ts.tv_sec ||
+          (ts2.tv_sec == ts.tv_sec && ts2.tv_nsec < ts.tv_nsec))
+      {
+         printf("vDSO time: %ld.%09ld < syscall time: %ld.%09ld\n",
+                (long)ts2.tv_sec, ts2.tv_nsec, (long)ts.tv_sec, ts.tv_nsec);
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+static ull_t ts_diff_us(struct timespec *a, struct timespec *b)
+{
+   return (ull_t)(b->tv_sec - a->tv_sec) * 1000000 +
+          (b->tv_nsec - a->tv_nsec) / 1000;
+}
+
+/* Returns true if the kernel actually uses the high-resolution timers */
+static bool hrtimers_in_use(void)
+{
+   char buf[8] = {0};
+   int fd, rc;
+
+   if ((fd = open("/syst/hrtimers/available", O_RDONLY)) < 0)
+      return false;
+
+   rc = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   return rc > 0 && buf[0] == '1';
+}
+
+int cmd_nanosleep(int argc, char **argv)
+{
+   struct timespec req, start, end;
+   ull_t elapsed, best = (ull_t) -1;
+   int rc;
+
+   /* Short relative sleeps */
+   for (int i = 0; i < 20; i++) {
+
+      req = (struct timespec) { .tv_sec = 0, .tv_nsec = 200 * 1000 };
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      rc = clock_nanosleep(CLOCK_MONOTONIC, 0, &req, NULL);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      DEVSHELL_CMD_ASSERT(rc == 0);
+      elapsed = ts_diff_us(&start, &end);
+
+      if (elapsed < best)
+         best = elapsed;
+   }
+
+   printf("clock_nanosleep(200 us): best: %llu us\n", best);
+
+   /* Without the hrtimers, the sleeps have the resolution of a tick */
+   if (hrtimers_in_use())
+      DEVSHELL_CMD_ASSERT(best < 1000);
+
+   /* Absolute sleep, 50 ms in the future */
+   clock_gettime(CLOCK_MONOTONIC, &start);
+   req = start;
+   req.tv_nsec += 50 * 1000 * 1000;
+
+   if (req.tv_nsec >= 1000 * 1000 * 1000) {
+      req.tv_sec++;
+      req.tv_nsec -= 1000 * 1000 * 1000;
+   }
+
+   rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &req, NULL);
+   clock_gettime(CLOCK_MONOTONIC, &end);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+
+   elapsed = ts_diff_us(&start, &end);
+   printf("clock_nanosleep(TIMER_ABSTIME, +50 ms): %llu us\n", elapsed);
+   /* The clock has the resolution of a tick: allow some slack */
+   DEVSHELL_CMD_ASSERT(elapsed >= 40 * 1000);
+
+   /* Absolute time in the past: return immediately */
+   rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start, NULL);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+
+   /* Invalid requests */
+   req = (struct timespec) { .tv_sec = 0, .tv_nsec = 1000 * 1000 * 1000 };
+   rc = clock_nanosleep(CLOCK_MONOTONIC, 0, &req, NULL);
+   DEVSHELL_CMD_ASSERT(rc == EINVAL);
+
+   rc = nanosleep(&req, NULL);
+   DEVSHELL_CMD_ASSERT(rc < 0 && errno == EINVAL);
+   return 0;
+}
+
+int cmd_sched(int argc, char **argv)
+{
+   struct sched_param param = { .sched_priority = 10 };
+   int child_pid, wstatus, rc;
+
+   /* Nice levels */
+   DEVSHELL_CMD_ASSERT(getpriority(PRIO_PROCESS, 0) == 0);
+   DEVSHELL_CMD_ASSERT(setpriority(PRIO_PROCESS, 0, 5) == 0);
+   DEVSHELL_CMD_ASSERT(getpriority(PRIO_PROCESS, 0) == 5);
+   DEVSHELL_CMD_ASSERT(nice(2) == 7);
+   DEVSHELL_CMD_ASSERT(setpriority(PRIO_PROCESS, 0, 100) == 0);
+   DEVSHELL_CMD_ASSERT(getpriority(PRIO_PROCESS, 0) == 19);
+   DEVSHELL_CMD_ASSERT(setpriority(PRIO_PROCESS, 0, 0) == 0);
+
+   /*
+    * RT scheduling classes. NOTE: libmusl's sched_setscheduler() & co. always
+    * fail with ENOSYS, so we have to use the syscalls directly.
+    */
+   DEVSHELL_CMD_ASSERT(sched_get_priority_min(SCHED_FIFO) == 1);
+   DEVSHELL_CMD_ASSERT(sched_get_priority_max(SCHED_RR) == 99);
+   DEVSHELL_CMD_ASSERT(sched_get_priority_max(SCHED_OTHER) == 0);
+   DEVSHELL_CMD_ASSERT(syscall(SYS_sched_getscheduler, 0) == SCHED_OTHER);
+
+   rc = syscall(SYS_sched_setscheduler, 0, SCHED_OTHER, &param);
+   DEVSHELL_CMD_ASSERT(rc < 0 && errno == EINVAL);
+
+   rc = syscall(SYS_sched_setscheduler, 0, SCHED_FIFO, &param);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+   DEVSHELL_CMD_ASSERT(syscall(SYS_sched_getscheduler, 0) == SCHED_FIFO);
+
+   param.sched_priority = 20;
+   DEVSHELL_CMD_ASSERT(syscall(SYS_sched_setparam, 0, &param) == 0);
+
+   param.sched_priority = 0;
+   DEVSHELL_CMD_ASSERT(syscall(SYS_sched_getparam, 0, &param) == 0);
+   DEVSHELL_CMD_ASSERT(param.sched_priority == 20);
+   DEVSHELL_CMD_ASSERT(sched_yield() == 0);
+
+   /* The scheduling policy is inherited on fork */
+   child_pid = fork();
+   DEVSHELL_CMD_ASSERT(child_pid >= 0);
+
+   if (!child_pid)
+      exit(syscall(SYS_sched_getscheduler, 0) == SCHED_FIFO ? 0 : 1);
+
+   DEVSHELL_CMD_ASSERT(waitpid(child_pid, &wstatus, 0) == child_pid);
+   DEVSHELL_CMD_ASSERT(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0);
+
+   param.sched_priority = 0;
+   rc = syscall(SYS_sched_setscheduler, 0, SCHED_OTHER, &param);
+   DEVSHELL_CMD_ASSERT(rc == 0);
+   DEVSHELL_CMD_ASSERT(syscall(SYS_sched_getscheduler, 0) == SCHED_OTHER);
    return 0;
 }
 
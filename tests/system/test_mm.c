@@ -391,3 +391,440 @@ int cmd_fork_oom(int argc, char **argv)
    free(buf);
    return rc;
 }
+
+int cmd_mmap_big(int argc, char **argv)
+{
+   const size_t alloc_size = 8 * MB;
+   int child, wstatus;
+   char *res;
+
+   res = mmap(NULL,
+              alloc_size,
+              PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE,
+              -1,
+              0);
+
+   if (res == (void*) -1) {
+      printf("mmap %zu MB failed: %s\n", alloc_size / MB, strerror(errno));
+      return 1;
+   }
+
+   for (size_t i = 0; i < alloc_size; i += 4 * KB) {
+
+      if (res[i] != 0) {
+         printf("Non-zero byte at offset %zu\n", i);
+         return 1;
+      }
+
+      res[i] = (char)(i >> 12);
+   }
+
+   child = fork();
+
+   if (!child) {
+
+      /* Trigger the copy-on-write of the (big) pages */
+      for (size_t i = 0; i < alloc_size; i += 4 * KB) {
+
+         if (res[i] != (char)(i >> 12)) {
+            printf(STR_CHILD "Unexpected byte at offset %zu\n", i);
+            exit(1);
+         }
+
+         res[i] = 'x';
+      }
+
+      exit(0);
+   }
+
+   waitpid(child, &wstatus, 0);
+
+   if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+      printf("The child process failed\n");
+      return 1;
+   }
+
+   for (size_t i = 0; i < alloc_size; i += 4 * KB) {
+      if (res[i] != (char)(i >> 12)) {
+         printf("Unexpected byte at offset %zu, after fork\n", i);
+         return 1;
+      }
+   }
+
+   /* Unmap a range in the middle: big pages have to be split */
+   if (munmap(res + 1 * MB, 2 * MB) != 0) {
+      printf("Partial munmap failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   if (res[0] != 0 || res[3 * MB] != (char)((3 * MB) >> 12)) {
+      printf("Unexpected data after the partial munmap\n");
+      return 1;
+   }
+
+   munmap(res, 1 * MB);
+   munmap(res + 3 * MB, alloc_size - 3 * MB);
+   return 0;
+}
+
+int cmd_mmap_fixed(int argc, char **argv)
+{
+   const size_t pg = 4 * KB;
+   char *r, *res;
+
+   r = mmap(NULL,
+            16 * pg,
+            PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE,
+            -1,
+            0);
+
+   if (r == (void*) -1) {
+      printf("mmap failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   memset(r, 0x11, 16 * pg);
+
+   /* Make a hole at [r + 8 pg, r + 16 pg) and use it as a hint */
+   munmap(r + 8 * pg, 8 * pg);
+
+   res = mmap(r + 8 * pg,
+              8 * pg,
+              PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE,
+              -1,
+              0);
+
+   if (res != r + 8 * pg) {
+      printf("The address hint was not used: %p vs %p\n", res, r + 8 * pg);
+      return 1;
+   }
+
+   memset(res, 0x22, 8 * pg);
+
+   /* Replace a range overlapping both the mappings */
+   res = mmap(r + 4 * pg,
+              8 * pg,
+              PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+              -1,
+              0);
+
+   if (res != r + 4 * pg) {
+      printf("MAP_FIXED mmap failed: %p, %s\n", res, strerror(errno));
+      return 1;
+   }
+
+   for (size_t i = 0; i < 16; i++) {
+
+      const char exp = i < 4 ? 0x11 : (i < 12 ? 0 : 0x22);
+
+      if (r[i * pg] != exp || r[i * pg + pg - 1] != exp) {
+         printf("Unexpected data in page %zu after MAP_FIXED\n", i);
+         return 1;
+      }
+   }
+
+   /* Unmap all the three mappings at once */
+   if (munmap(r, 16 * pg) != 0) {
+      printf("munmap failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   res = mmap(r,
+              16 * pg,
+              PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED,
+              -1,
+              0);
+
+   if (res != r || res[0] != 0 || res[15 * pg] != 0) {
+      printf("MAP_FIXED mmap after munmap failed\n");
+      return 1;
+   }
+
+   munmap(r, 16 * pg);
+   return 0;
+}
+
+#ifndef MREMAP_MAYMOVE
+   #define MREMAP_MAYMOVE 1
+#endif
+
+#ifndef MREMAP_FIXED
+   #define MREMAP_FIXED 2
+#endif
+
+/* Write a different value in each page of [buf + from, buf + to) */
+static void mremap_fill(char *buf, size_t from, size_t to)
+{
+   for (size_t off = from; off < to; off += 4 * KB)
+      buf[off] = (char)(off >> 12);
+}
+
+static bool mremap_check(char *buf, size_t size)
+{
+   for (size_t off = 0; off < size; off += 4 * KB) {
+      if (buf[off] != (char)(off >> 12)) {
+         printf("Unexpected byte at offset %zu\n", off);
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/* Move a buffer to a fixed address, shrinking it at the same time */
+static int mremap_fixed_shrink(void)
+{
+   const size_t size = 256 * KB;
+   char *buf, *dst, *res;
+
+   buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+   dst = mmap(NULL, size, PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+
+   if (buf == (void*) -1 || dst == (void*) -1) {
+      printf("mmap failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   mremap_fill(buf, 0, size);
+   dst[size / 2] = 'x';
+
+   res = (void *)syscall(SYS_mremap, buf, size, size / 4,
+                         MREMAP_MAYMOVE | MREMAP_FIXED, dst);
+
+   if (res != dst) {
+      printf("mremap (fixed, shrink) failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   if (!mremap_check(dst, size / 4))
+      return 1;
+
+   /* Only [dst, dst + size / 4) must have been replaced */
+   if (dst[size / 2] != 'x') {
+      printf("mremap (fixed, shrink) overwrote past the new length\n");
+      return 1;
+   }
+
+   munmap(dst, size);
+   return 0;
+}
+
+/*
+ * Grow a buffer from 1 MB to 64 MB, doubling its size each time, with
+ * mremap() and then with mmap() + memcpy() + munmap(), like a realloc()
+ * implementation would do without mremap().
+ */
+int cmd_mremap(int argc, char **argv)
+{
+   const size_t init_size = 1 * MB;
+   const size_t max_size = 64 * MB;
+   ull_t mremap_cycles = 0, copy_cycles = 0, start;
+   char *buf, *res, *guard;
+   size_t size;
+
+   buf = mmap(NULL,
+              init_size,
+              PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE,
+              -1,
+              0);
+
+   if (buf == (void*) -1) {
+      printf("mmap failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   mremap_fill(buf, 0, init_size);
+
+   for (size = init_size; size < max_size; size *= 2) {
+
+      /* Map a page right after the buffer, to prevent growing in place */
+      guard = mmap(buf + size,
+                   4 * KB,
+                   PROT_READ | PROT_WRITE,
+                   MAP_ANONYMOUS | MAP_PRIVATE,
+                   -1,
+                   0);
+
+      if (guard == (void*) -1) {
+         printf("mmap guard failed: %s\n", strerror(errno));
+         return 1;
+      }
+
+      start = RDTSC();
+      res = (void *)syscall(SYS_mremap, buf, size, 2 * size, MREMAP_MAYMOVE);
+      mremap_cycles += RDTSC() - start;
+
+      if (res == (void*) -1) {
+         printf("mremap to %zu MB failed: %s\n",
+                2 * size / MB, strerror(errno));
+         return 1;
+      }
+
+      if (guard == buf + size && res == buf) {
+         printf("mremap grew the buffer over the guard page\n");
+         return 1;
+      }
+
+      munmap(guard, 4 * KB);
+      buf = res;
+
+      if (!mremap_check(buf, size))
+         return 1;
+
+      if (buf[size] != 0) {
+         printf("The new part of the buffer is not zeroed\n");
+         return 1;
+      }
+
+      mremap_fill(buf, size, 2 * size);
+   }
+
+   /* Shrink it back */
+   res = (void *)syscall(SYS_mremap, buf, max_size, init_size, 0);
+
+   if (res != buf || !mremap_check(buf, init_size)) {
+      printf("mremap (shrink) failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   if (mremap_fixed_shrink())
+      return 1;
+
+   for (size = init_size; size < max_size; size *= 2) {
+
+      start = RDTSC();
+      {
+         res = mmap(NULL,
+                    2 * size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_ANONYMOUS | MAP_PRIVATE,
+                    -1,
+                    0);
+
+         if (res == (void*) -1) {
+            printf("mmap %zu MB failed: %s\n", 2 * size / MB, strerror(errno));
+            return 1;
+         }
+
+         memcpy(res, buf, size);
+         munmap(buf, size);
+      }
+      copy_cycles += RDTSC() - start;
+
+      buf = res;
+      mremap_fill(buf, size, 2 * size);
+   }
+
+   munmap(buf, max_size);
+
+   printf("Growing a buffer from %zu MB to %zu MB:\n",
+          init_size / MB, max_size / MB);
+   printf("    mremap():                     %llu K cycles\n",
+          mremap_cycles / 1000);
+   printf("    mmap() + memcpy() + munmap(): %llu K cycles\n",
+          copy_cycles / 1000);
+   return 0;
+}
+
+/* Returns the number of used pageframes, as reported by sysfs, or -1 */
+static long get_used_pageframes(void)
+{
+   char buf[32] = {0};
+   int fd, rc;
+
+   if ((fd = open("/syst/pageframes/used_pages", O_RDONLY)) < 0)
+      return -1;
+
+   rc = read(fd, buf, sizeof(buf) - 1);
+   close(fd);
+   return rc > 0 ? strtol(buf, NULL, 10) : -1;
+}
+
+int cmd_madvise(int argc, char **argv)
+{
+   const size_t size = 2 * MB;
+   long used_before, used_after;
+   char *res;
+   int rc;
+
+   res = mmap(NULL,
+              size,
+              PROT_READ | PROT_WRITE,
+              MAP_ANONYMOUS | MAP_PRIVATE,
+              -1,
+              0);
+
+   if (res == (void*) -1) {
+      printf("mmap failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   memset(res, 0xaa, size);
+   used_before = get_used_pageframes();
+
+   if ((rc = madvise(res, size, MADV_DONTNEED))) {
+      printf("madvise(MADV_DONTNEED) failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   used_after = get_used_pageframes();
+
+   if (used_before >= 0) {
+
+      printf("Used pageframes: %ld -> %ld\n", used_before, used_after);
+
+      /* Allow some slack for the allocations done meanwhile by the kernel */
+      if (used_before - used_after < (long)(size / (4 * KB)) - 16) {
+         printf("The pageframes have not been freed\n");
+         return 1;
+      }
+   }
+
+   for (size_t i = 0; i < size; i += 4 * KB) {
+      if (res[i] != 0 || res[i + 4 * KB - 1] != 0) {
+         printf("Non-zero byte in page %zu after MADV_DONTNEED\n", i >> 12);
+         return 1;
+      }
+   }
+
+   /* The pages must be usable again */
+   memset(res, 0xbb, size);
+
+   if ((rc = madvise(res, size, MADV_FREE))) {
+      printf("madvise(MADV_FREE) failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   /* Pages written after MADV_FREE can't be reclaimed anymore */
+   memset(res, 0xcc, size / 2);
+
+   for (size_t i = 0; i < size / 2; i += 4 * KB) {
+      if (res[i] != (char)0xcc) {
+         printf("Unexpected byte in page %zu after MADV_FREE\n", i >> 12);
+         return 1;
+      }
+   }
+
+   if (madvise(res, size, MADV_WILLNEED)) {
+      printf("madvise(MADV_WILLNEED) failed: %s\n", strerror(errno));
+      return 1;
+   }
+
+   munmap(res, size);
+
+   /* The range is not mapped anymore */
+   if (madvise(res, size, MADV_DONTNEED) != -1 || errno != ENOMEM) {
+      printf("madvise() on an unmapped range did not fail with ENOMEM\n");
+      return 1;
+   }
+
+   return 0;
+}
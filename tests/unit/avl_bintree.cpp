@@ -5,6 +5,8 @@
 #include <memory>
 #include <set>
 #include <unordered_set>
+#include <vector>
+#include <algorithm>
 #include <inttypes.h>
 #include <gtest/gtest.h>
 
@@ -564,6 +566,99 @@ TEST(avl_bintree, remove_quick_test)
    remove_rand_data(100, 1000);
 }
 
+struct aug_struct {
+
+   int val;
+   int sub_count;    /* number of objects in the subtree */
+   int sub_max;      /* max val in the subtree */
+   struct bintree_node node;
+};
+
+static long aug_cmpfun(const void *a, const void *b)
+{
+   return ((aug_struct *)a)->val - ((aug_struct *)b)->val;
+}
+
+static long aug_cmpfun_objval(const void *obj, const void *valptr)
+{
+   return ((aug_struct *)obj)->val - *(int *)valptr;
+}
+
+static void aug_cb(void *obj)
+{
+   aug_struct *s = (aug_struct *)obj;
+   aug_struct *l = (aug_struct *)s->node.left_obj;
+   aug_struct *r = (aug_struct *)s->node.right_obj;
+
+   s->sub_count = 1 + (l ? l->sub_count : 0) + (r ? r->sub_count : 0);
+   s->sub_max = r ? r->sub_max : s->val;
+}
+
+/* Returns the number of objects in the subtree, checking the aug data */
+static int check_aug_data(aug_struct *s, bool *failed)
+{
+   aug_struct *l, *r;
+   int count;
+
+   if (!s)
+      return 0;
+
+   l = (aug_struct *)s->node.left_obj;
+   r = (aug_struct *)s->node.right_obj;
+   count = 1 + check_aug_data(l, failed) + check_aug_data(r, failed);
+
+   if (s->sub_count != count || s->sub_max != (r ? r->sub_max : s->val))
+      *failed = true;
+
+   return count;
+}
+
+TEST(avl_bintree, augmented_tree)
+{
+   const int elems = 500;
+   random_device rdev;
+   const auto seed = rdev();
+   default_random_engine e(seed);
+   vector<aug_struct> nodes(elems);
+   vector<int> vals(elems);
+   aug_struct *root = NULL;
+   bool failed = false;
+
+   cout << "[ INFO     ] random seed: " << seed << endl;
+
+   for (int i = 0; i < elems; i++)
+      vals[i] = i;
+
+   shuffle(vals.begin(), vals.end(), e);
+
+   for (int i = 0; i < elems; i++) {
+
+      nodes[i].val = vals[i];
+      bintree_node_init(&nodes[i].node);
+
+      ASSERT_TRUE(bintree_insert_aug(&root, &nodes[i], aug_cmpfun,
+                                     aug_cb, aug_struct, node));
+
+      ASSERT_EQ(check_aug_data(root, &failed), i + 1);
+      ASSERT_FALSE(failed);
+   }
+
+   shuffle(vals.begin(), vals.end(), e);
+
+   for (int i = 0; i < elems; i++) {
+
+      void *removed = bintree_remove_aug(&root, &vals[i], aug_cmpfun_objval,
+                                         aug_cb, aug_struct, node);
+
+      ASSERT_TRUE(removed != NULL);
+      ASSERT_EQ(((aug_struct *)removed)->val, vals[i]);
+      ASSERT_EQ(check_aug_data(root, &failed), elems - i - 1);
+      ASSERT_FALSE(failed);
+   }
+
+   ASSERT_TRUE(root == NULL);
+}
+
 TEST(avl_bintree, DISABLED_remove_1000_elems_100_iters)
 {
    remove_rand_data(1000, 100);
@@ -13,6 +13,11 @@ void hw_read_clock(struct datetime *out)
    memset(out, 0, sizeof(*out));
 }
 
+void fpu_memset256(void *dest, u32 val32, u32 n)
+{
+   memset(dest, (int)val32, n << 5);
+}
+
 bool hi_vmem_avail(void) { return false; }
 int kthread_create2() { return -12; /* ENOMEM */}
 
@@ -32,6 +37,13 @@ void gdt_install() { }
 void idt_install() { }
 void irq_install() { }
 void hw_timer_setup() { }
+void hw_timer_oneshot_max_ticks() { NOT_REACHED(); }
+void hw_timer_setup_oneshot() { NOT_REACHED(); }
+void hw_timer_oneshot_rearm() { NOT_REACHED(); }
+void hw_get_clocksource() { NOT_REACHED(); }
+void hw_hrtimer_init() { NOT_REACHED(); }
+void hw_hrtimer_now() { NOT_REACHED(); }
+void hw_hrtimer_program() { NOT_REACHED(); }
 void irq_install_handler() { }
 void irq_uninstall_handler() { }
 void setup_sysenter_interface() { }
@@ -46,9 +58,13 @@ void arch_specific_new_task_setup() { NOT_REACHED(); }
 void arch_specific_free_task() { NOT_REACHED(); }
 void arch_specific_new_proc_setup() { NOT_REACHED(); }
 void arch_specific_free_proc() { NOT_REACHED(); }
+void arch_specific_clone_settls() { NOT_REACHED(); }
 void fpu_context_begin() { }
 void fpu_context_end() { }
 void map_zero_pages() { NOT_REACHED(); }
+void map_big_page() { NOT_REACHED(); }
+void is_zero_big_page_range() { NOT_REACHED(); }
+void reclaim_lazy_free_pages() { NOT_REACHED(); }
 void dump_var_mtrrs() { }
 void set_page_rw() { }
 void poweroff() { NOT_REACHED(); }
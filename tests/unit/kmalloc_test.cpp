@@ -7,6 +7,7 @@
 #include <vector>
 #include <unordered_map>
 #include <random>
+#include <algorithm>
 #include <memory>
 
 #include <gtest/gtest.h>
@@ -21,6 +22,7 @@ extern "C" {
    #include <tilck/common/utils.h>
 
    #include <tilck/kernel/kmalloc.h>
+   #include <tilck/kernel/kmem_cache.h>
    #include <tilck/kernel/paging.h>
    #include <tilck/kernel/self_tests.h>
 
@@ -183,6 +185,84 @@ TEST_F(kmalloc_test, chaos_test)
    }
 }
 
+static void check_heap_free_bm(struct kmalloc_heap *h)
+{
+   struct block_node *nodes = (struct block_node *)h->metadata_nodes;
+   u32 counts[KMALLOC_MAX_HEAP_LEVELS] = {0};
+   const int nodes_count = (1 << h->levels) - 1;
+
+   for (int n = 0; n < nodes_count; n++) {
+
+      const u32 b = (u32)n + 1;
+      const u32 level = 31u - (u32)__builtin_clz(b);
+      const bool in_bm = !!(h->free_bm[b >> 5] & (1u << (b & 31)));
+
+      const bool is_head =
+         !(nodes[n].raw & (FL_NODE_SPLIT | FL_NODE_FULL)) &&
+         (n == 0 || nodes[NODE_PARENT(n)].split);
+
+      ASSERT_EQ(is_head, in_bm) << "node: " << n;
+
+      if (is_head)
+         counts[level]++;
+   }
+
+   for (u32 i = 0; i < h->levels; i++)
+      ASSERT_EQ(counts[i], h->free_bm_count[i]) << "level: " << i;
+}
+
+static void check_all_heaps_free_bm(void)
+{
+   for (int h = 0; h < KMALLOC_HEAPS_COUNT && heaps[h]; h++)
+      ASSERT_NO_FATAL_FAILURE({ check_heap_free_bm(heaps[h]); }) << "h: " << h;
+}
+
+TEST_F(kmalloc_test, free_bm_consistency)
+{
+   random_device rdev;
+   const auto seed = rdev();
+   default_random_engine e(seed);
+   cout << "[ INFO     ] random seed: " << seed << endl;
+
+   lognormal_distribution<> dist(5.0, 3);
+   vector<pair<void *, size_t>> allocations;
+
+   check_all_heaps_free_bm();
+
+   for (int i = 0; i < 50; i++) {
+
+      for (int j = 0; j < 200; j++) {
+
+         size_t s = round(dist(e));
+
+         if (s == 0)
+            continue;
+
+         void *r = kmalloc(s);
+
+         if (r != NULL)
+            allocations.push_back(make_pair(r, s));
+      }
+
+      ASSERT_NO_FATAL_FAILURE({ check_all_heaps_free_bm(); }) << "i: " << i;
+
+      /* Free half of the allocations, in random order */
+      shuffle(allocations.begin(), allocations.end(), e);
+
+      for (size_t k = allocations.size() / 2; k > 0; k--) {
+         kfree2(allocations.back().first, allocations.back().second);
+         allocations.pop_back();
+      }
+
+      ASSERT_NO_FATAL_FAILURE({ check_all_heaps_free_bm(); }) << "i: " << i;
+   }
+
+   for (const auto& a : allocations)
+      kfree2(a.first, a.second);
+
+   check_all_heaps_free_bm();
+}
+
 #define COLOR_RED           "\033[31m"
 #define COLOR_YELLOW        "\033[93m"
 #define COLOR_BRIGHT_GREEN  "\033[92m"
@@ -810,3 +890,70 @@ TEST_F(kmalloc_test, partial_free)
 
    kmalloc_destroy_heap(&h);
 }
+
+static void kmem_cache_test_ctor(void *obj)
+{
+   memset(obj, 0xaa, 40);
+}
+
+TEST_F(kmalloc_test, kmem_cache)
+{
+   struct kmem_cache *c = kmem_cache_create("test", 40, 8, NULL);
+   vector<void *> objs;
+
+   ASSERT_TRUE(c != NULL);
+   ASSERT_GE(c->objs_per_slab, 8u);
+   ASSERT_EQ(c->obj_size % 8, 0u);
+
+   for (size_t i = 0; i < 3 * c->objs_per_slab + 1; i++) {
+
+      void *obj = kmem_cache_zalloc(c);
+      ASSERT_TRUE(obj != NULL);
+      ASSERT_EQ((ulong)obj % 8, 0u);
+      objs.push_back(obj);
+   }
+
+   EXPECT_EQ(c->slabs, 4u);
+   EXPECT_EQ(c->misses, 4u);
+   EXPECT_EQ(c->objs_in_use, objs.size());
+
+   /* All the objects must be distinct */
+   sort(objs.begin(), objs.end());
+   EXPECT_TRUE(adjacent_find(objs.begin(), objs.end()) == objs.end());
+
+   for (void *obj : objs)
+      kmem_cache_free(c, obj);
+
+   /* Only one empty slab is kept */
+   EXPECT_EQ(c->objs_in_use, 0u);
+   EXPECT_EQ(c->slabs, 1u);
+
+   /* Now, alloc/free must not require new slabs */
+   for (int i = 0; i < 100; i++)
+      kmem_cache_free(c, kmem_cache_alloc(c));
+
+   EXPECT_EQ(c->misses, 4u);
+   EXPECT_EQ(c->slabs, 1u);
+   kmem_cache_destroy(c);
+
+   /* Objects of caches with a ctor are constructed only once, per slab */
+   c = kmem_cache_create("test_ctor", 40, 8, &kmem_cache_test_ctor);
+   ASSERT_TRUE(c != NULL);
+   ASSERT_GE(c->free_link_off, 40u);
+
+   u8 *obj = (u8 *)kmem_cache_alloc(c);
+   ASSERT_TRUE(obj != NULL);
+   EXPECT_EQ(obj[0], 0xaa);
+
+   obj[0] = 0x11;
+   kmem_cache_free(c, obj);
+
+   /* The constructed state survives the free (the link is after the obj) */
+   for (int i = 1; i < 40; i++)
+      EXPECT_EQ(obj[i], 0xaa);
+
+   EXPECT_EQ(kmem_cache_alloc(c), (void *)obj);
+   EXPECT_EQ(obj[0], 0x11);
+   kmem_cache_free(c, obj);
+   kmem_cache_destroy(c);
+}
@@ -13,6 +13,7 @@
 #include <tilck_gen_headers/config_kmalloc.h>
 
 #include <tilck/kernel/kmalloc.h>
+#include <tilck/kernel/test/mem_regions.h>
 #include <kernel/kmalloc/kmalloc_heap_struct.h> // kmalloc private header
 #include <kernel/kmalloc/kmalloc_block_node.h>  // kmalloc private header
 
@@ -100,7 +101,7 @@ void *__wrap_general_kmalloc(size_t *size, u32 flags)
    if (mock_kmalloc)
       return malloc(*size);
 
-   return __real_general_kmalloc(size, 0);
+   return __real_general_kmalloc(size, flags);
 }
 
 void __wrap_general_kfree(void *ptr, size_t *size, u32 flags)
@@ -108,18 +109,18 @@ void __wrap_general_kfree(void *ptr, size_t *size, u32 flags)
    if (mock_kmalloc)
       return free(ptr);
 
-   return __real_general_kfree(ptr, size, 0);
+   return __real_general_kfree(ptr, size, flags);
 }
 
 void *__wrap_kmalloc_get_first_heap(size_t *size)
 {
-   static void *buf;
+   /* See initialize_test_kernel_heap() */
+   void *buf = kernel_va;
 
-   if (!buf) {
-      buf = aligned_alloc(KMALLOC_MAX_ALIGN, KMALLOC_FIRST_HEAP_SIZE);
-      VERIFY(buf);
-      VERIFY( ((ulong)buf & (KMALLOC_MAX_ALIGN - 1)) == 0 );
-   }
+   STATIC_ASSERT(KMALLOC_FIRST_HEAP_SIZE <= TEST_KERNEL_IMG_SIZE);
+
+   VERIFY(kernel_va != NULL);
+   VERIFY( ((ulong)buf & (KMALLOC_MAX_ALIGN - 1)) == 0 );
 
    if (size)
       *size = KMALLOC_FIRST_HEAP_SIZE;
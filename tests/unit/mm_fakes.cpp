@@ -24,6 +24,7 @@ extern "C" {
 #include <kernel/kmalloc/kmalloc_block_node.h>  // kmalloc private header
 #include <tilck/kernel/test/mem_regions.h>
 #include <tilck/kernel/test/kmalloc.h>
+#include <tilck/kernel/pageframes.h>
 
 extern bool suppress_printk;
 
@@ -32,21 +33,32 @@ static unordered_map<ulong, ulong> mappings;
 
 void initialize_test_kernel_heap()
 {
-   const ulong test_mem_size = 256 * MB;
-
    if (kernel_va != nullptr) {
-      bzero(kernel_va, test_mem_size);
+      bzero((char *)kernel_va + TEST_KERNEL_IMG_SIZE,
+            TEST_MEM_SIZE - TEST_KERNEL_IMG_SIZE);
       mappings.clear();
       return;
    }
 
-   kernel_va = aligned_alloc(MB, test_mem_size);
-   bzero(kernel_va, test_mem_size);
+   /*
+    * Like in the real kernel, the first heap is part of the physical memory,
+    * in a reserved region (the kernel's image) before the usable one.
+    * See __wrap_kmalloc_get_first_heap().
+    */
+   kernel_va = aligned_alloc(MB, TEST_MEM_SIZE);
+   bzero(kernel_va, TEST_MEM_SIZE);
 
-   mem_regions_count = 1;
+   mem_regions_count = 2;
    mem_regions[0] = (struct mem_region) {
       .addr = 0,
-      .len = test_mem_size,
+      .len = TEST_KERNEL_IMG_SIZE,
+      .type = MULTIBOOT_MEMORY_RESERVED,
+      .extra = MEM_REG_EXTRA_KERNEL,
+   };
+
+   mem_regions[1] = (struct mem_region) {
+      .addr = TEST_KERNEL_IMG_SIZE,
+      .len = TEST_MEM_SIZE - TEST_KERNEL_IMG_SIZE,
       .type = MULTIBOOT_MEMORY_AVAILABLE,
       .extra = 0,
    };
@@ -64,6 +76,7 @@ void init_kmalloc_for_tests()
    suppress_printk = true;
    early_init_kmalloc();
    init_kmalloc();
+   init_pageframes();
    suppress_printk = false;
 }
 
@@ -0,0 +1,182 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <vector>
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+#include "kernel_init_funcs.h"
+
+extern "C" {
+   #include <tilck_gen_headers/config_mm.h>
+   #include <tilck/kernel/pageframes.h>
+   #include <tilck/kernel/paging.h>
+}
+
+using namespace std;
+using namespace testing;
+
+class pageframes_test : public Test {
+public:
+
+   void SetUp() override {
+      init_kmalloc_for_tests();
+   }
+
+   void TearDown() override {
+      /* do nothing, for the moment */
+   }
+};
+
+TEST_F(pageframes_test, alloc_and_free)
+{
+   const size_t pages_per_chunk = PF_CHUNK_SIZE / PAGE_SIZE;
+   const size_t count = 20 * pages_per_chunk + 3;
+   struct pf_stats s;
+   vector<void *> pages;
+
+   for (size_t i = 0; i < count; i++) {
+
+      void *va = pf_alloc();
+      ASSERT_TRUE(va != nullptr);
+      ASSERT_TRUE(IS_PAGE_ALIGNED(va));
+      pages.push_back(va);
+   }
+
+   pf_get_stats(&s);
+   EXPECT_EQ(s.used_pages, count);
+   EXPECT_EQ(s.chunks, 21u);
+   EXPECT_EQ(s.free_pages, s.chunks * pages_per_chunk - count);
+
+   /* All the pages must be distinct */
+   sort(pages.begin(), pages.end());
+   EXPECT_TRUE(adjacent_find(pages.begin(), pages.end()) == pages.end());
+
+   for (void *va : pages)
+      pf_free(va);
+
+   /* Most of the completely free chunks are returned to kmalloc */
+   pf_get_stats(&s);
+   EXPECT_EQ(s.used_pages, 0u);
+   EXPECT_LT(s.chunks, 21u);
+   EXPECT_EQ(s.free_pages, s.chunks * pages_per_chunk);
+
+   /* The last freed page is the first to be reused */
+   void *va = pf_alloc();
+   pf_free(va);
+   EXPECT_EQ(pf_alloc(), va);
+   pf_free(va);
+}
+
+TEST_F(pageframes_test, zero_pages_pool)
+{
+   struct pf_stats s;
+   void *va;
+
+   /* Dirty a page and free it: the pool refill must zero it */
+   va = pf_alloc();
+   ASSERT_TRUE(va != nullptr);
+   memset(va, 0xaa, PAGE_SIZE);
+   pf_free(va);
+
+   pf_zpool_refill();
+   pf_get_stats(&s);
+   EXPECT_EQ(s.zpool_pages, (ulong)ZERO_PAGE_POOL_SIZE);
+   EXPECT_EQ(s.zpool_refills, (ulong)ZERO_PAGE_POOL_SIZE);
+   EXPECT_EQ(s.used_pages, 0u);
+
+   for (int i = 0; i < ZERO_PAGE_POOL_SIZE + 1; i++) {
+
+      va = pf_zalloc();
+      ASSERT_TRUE(va != nullptr);
+
+      for (ulong j = 0; j < PAGE_SIZE; j++)
+         ASSERT_EQ(((u8 *)va)[j], 0) << "i: " << i << ", j: " << j;
+
+      /* Dirty the page again before freeing it */
+      memset(va, 0xaa, PAGE_SIZE);
+      pf_free(va);
+   }
+
+   /* Only the last call had to zero the page by itself */
+   pf_get_stats(&s);
+   EXPECT_EQ(s.zpool_pages, 0u);
+   EXPECT_EQ(s.zpool_hits, (ulong)ZERO_PAGE_POOL_SIZE);
+   EXPECT_EQ(s.zpool_misses, 1u);
+   EXPECT_EQ(s.used_pages, 0u);
+}
+
+TEST_F(pageframes_test, alloc_big)
+{
+   const size_t pages = BIG_PAGE_SIZE / PAGE_SIZE;
+   struct pf_stats s;
+   char *va;
+
+   va = (char *)pf_alloc_big(BIG_PAGE_SIZE);
+   ASSERT_TRUE(va != nullptr);
+   EXPECT_EQ(KERNEL_VA_TO_PA(va) & (BIG_PAGE_SIZE - 1), 0u);
+
+   pf_get_stats(&s);
+   EXPECT_EQ(s.used_pages, pages);
+   EXPECT_EQ(s.chunks, BIG_PAGE_SIZE / PF_CHUNK_SIZE);
+
+   /* Big pages can be split: their pages are freed one by one */
+   for (size_t i = 0; i < pages; i++)
+      pf_free(va + i * PAGE_SIZE);
+
+   pf_get_stats(&s);
+   EXPECT_EQ(s.used_pages, 0u);
+   EXPECT_EQ(s.free_pages, s.chunks * (PF_CHUNK_SIZE / PAGE_SIZE));
+}
+
+static vector<void *> reclaimable_pages;
+
+static size_t test_reclaim_cb(void)
+{
+   size_t count = reclaimable_pages.size();
+
+   for (void *va : reclaimable_pages)
+      pf_free(va);
+
+   reclaimable_pages.clear();
+   return count;
+}
+
+TEST_F(pageframes_test, reclaim_when_out_of_memory)
+{
+   struct pf_stats s;
+   vector<void *> pages;
+   void *va;
+
+   /* Keep a few pages that the reclaim callback can give back */
+   for (int i = 0; i < 3; i++) {
+      va = pf_alloc();
+      ASSERT_TRUE(va != nullptr);
+      reclaimable_pages.push_back(va);
+   }
+
+   /* Use all the memory */
+   while ((va = pf_alloc()))
+      pages.push_back(va);
+
+   pf_set_reclaim_cb(&test_reclaim_cb);
+
+   /* Now the allocations succeed by using the reclaimed pages */
+   for (int i = 0; i < 3; i++) {
+      va = pf_alloc();
+      ASSERT_TRUE(va != nullptr);
+      pages.push_back(va);
+   }
+
+   EXPECT_TRUE(pf_alloc() == nullptr);
+   pf_set_reclaim_cb(nullptr);
+
+   pf_get_stats(&s);
+   EXPECT_EQ(s.reclaimed_pages, 3u);
+
+   for (void *p : pages)
+      pf_free(p);
+
+   pf_get_stats(&s);
+   EXPECT_EQ(s.used_pages, 0u);
+}
@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+#include <vector>
+#include <gtest/gtest.h>
+
+extern "C" {
+   #include <tilck/kernel/sched.h>
+}
+
+using namespace std;
+
+TEST(pids, increasing_order)
+{
+   int a = create_new_pid();
+   int b = create_new_pid();
+
+   ASSERT_GE(a, 0);
+   ASSERT_GE(b, 0);
+   EXPECT_EQ(b, a < MAX_PID ? a + 1 : 0);
+
+   /* Freed IDs are not reused immediately */
+   release_pid(a);
+   release_pid(b);
+
+   int c = create_new_pid();
+   EXPECT_NE(c, a);
+   EXPECT_NE(c, b);
+   release_pid(c);
+}
+
+TEST(pids, reserved_ids_are_not_reused)
+{
+   vector<int> pids;
+   int pid, x;
+
+   /* Use all the PIDs */
+   while ((pid = create_new_pid()) >= 0)
+      pids.push_back(pid);
+
+   ASSERT_GT(pids.size(), 10u);
+   x = pids[10];
+
+   /* The task `x` dies, but `x` is still the pgid of some process */
+   retain_pid(x);
+   release_pid(x);
+   EXPECT_EQ(create_new_pid(), -1);
+
+   /* The process group is gone: `x` is the only free PID */
+   release_pid(x);
+   EXPECT_EQ(create_new_pid(), x);
+
+   for (int p : pids)
+      release_pid(p);
+}
+
+TEST(pids, kernel_tids)
+{
+   vector<int> tids;
+   int tid;
+
+   while ((tid = create_new_kernel_tid()) >= 0) {
+      ASSERT_GT(tid, KERNEL_TID_START);
+      ASSERT_LE(tid, KERNEL_TID_START + KERNEL_MAX_TID);
+      tids.push_back(tid);
+   }
+
+   /* The kernel process already has KERNEL_TID_START */
+   EXPECT_EQ(tids.size(), (size_t)KERNEL_MAX_TID);
+
+   release_kernel_tid(tids[5]);
+   EXPECT_EQ(create_new_kernel_tid(), tids[5]);
+
+   for (int t : tids)
+      release_kernel_tid(t);
+}